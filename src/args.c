@@ -0,0 +1,213 @@
+/**
+ * @file args.c
+ * @brief Table-driven command argument parser implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "args.h"
+
+/**
+ * Get the name of a table entry.
+ * @param entries the table entries (in program memory)
+ * @param stride the size of an entry
+ * @param index the entry index
+ * @return the name (in program memory)
+ */
+static PGM_P args_name(const void *entries, uint8_t stride, uint8_t index);
+
+/**
+ * Parse a single argument.
+ * @param type the argument type
+ * @param table the keyword table (in program memory)
+ * @param token the token
+ * @param length the length of the token
+ * @param value a pointer to storage for the value
+ * @return false, if the token is not valid for the type
+ */
+static bool args_parse_one(uint8_t type, const args_table_t *table, const char *token, size_t length, args_value_t *value);
+
+PGM_P args_name(const void *entries, uint8_t stride, uint8_t index) {
+	return (PGM_P) pgm_read_ptr((const char *) entries + (size_t) index * stride);
+}
+
+int16_t args_prefix(const void *entries, uint8_t count, uint8_t stride, const char *token, size_t length) {
+	if (length == 0) {
+		return -1;
+	}
+	// Lower bound: names that start with the token compare equal and are contiguous in a sorted table
+	uint8_t low = 0;
+	uint8_t high = count;
+	while (low < high) {
+		uint8_t middle = low + (high - low) / 2;
+		if (strncasecmp_P(token, args_name(entries, stride, middle), length) > 0) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	if (low < count && strncasecmp_P(token, args_name(entries, stride, low), length) == 0) {
+		return low;
+	}
+	return -1;
+}
+
+int16_t args_search(const void *entries, uint8_t count, uint8_t stride, const char *token, size_t length) {
+	int16_t index = args_prefix(entries, count, stride, token, length);
+	if (index < 0 || strlen_P(args_name(entries, stride, index)) == length) {
+		// No match, or an exact match (which sorts before the longer names it is a prefix of)
+		return index;
+	}
+	if (index + 1 < count && strncasecmp_P(token, args_name(entries, stride, index + 1), length) == 0) {
+		// Ambiguous
+		return -1;
+	}
+	return index;
+}
+
+int16_t args_lookup(const args_table_t *table, const char *token, size_t length) {
+	const void *entries = pgm_read_ptr(&table->entries);
+	uint8_t count = pgm_read_byte(&table->count);
+	uint8_t stride = pgm_read_byte(&table->stride);
+	return args_search(entries, count, stride, token, length);
+}
+
+bool args_decimal(const char *buf, size_t length, int16_t *left, uint8_t *right) {
+	size_t i = 0;
+	bool negative = false;
+	if (i < length && (buf[i] == '-' || buf[i] == '+')) {
+		negative = buf[i] == '-';
+		i++;
+	}
+	// Accumulate the magnitude in hundredths, saturating one step beyond the range
+	const uint32_t limit = negative ? 3276899UL : 3276799UL;
+	uint32_t value = 0;
+	uint8_t digits = 0;
+	while (i < length && buf[i] >= '0' && buf[i] <= '9') {
+		if (value <= limit) {
+			value = value * 10 + (buf[i] - '0') * 100;
+		}
+		digits++;
+		i++;
+	}
+	if (i < length && buf[i] == '.') {
+		i++;
+		uint8_t scale = 10;
+		while (i < length && buf[i] >= '0' && buf[i] <= '9') {
+			// Digits beyond the hundredths are truncated
+			value += (buf[i] - '0') * scale;
+			scale /= 10;
+			digits++;
+			i++;
+		}
+	}
+	if (digits == 0 || i != length) {
+		return false;
+	}
+	if (value > limit) {
+		value = limit;
+	}
+	*left = negative ? (int16_t) -(int32_t) (value / 100) : (int16_t) (value / 100);
+	*right = value % 100;
+	return true;
+}
+
+bool args_parse_one(uint8_t type, const args_table_t *table, const char *token, size_t length, args_value_t *value) {
+	switch (type) {
+		case ARGS_KEYWORD: {
+			int16_t index = args_lookup(table, token, length);
+			if (index >= 0) {
+				value->index = index;
+				return true;
+			}
+			break;
+		}
+		case ARGS_PORT:
+			if (length == 1) {
+				char port = token[0] & ~0x20;
+				if (port >= 'A' && port <= 'G') {
+					value->port = port;
+					return true;
+				}
+			}
+			break;
+		case ARGS_PIN:
+			if (length == 1 && token[0] >= '0' && token[0] <= '7') {
+				value->pin = token[0] - '0';
+				return true;
+			}
+			break;
+		case ARGS_PORTS: {
+			uint8_t ports = 0;
+			size_t i;
+			for (i = 0; i < length; i++) {
+				char port = token[i] & ~0x20;
+				if (port < 'A' || port > 'G' || (ports & (1 << (port - 'A')))) {
+					return false;
+				}
+				ports |= 1 << (port - 'A');
+			}
+			value->ports = ports;
+			return ports != 0;
+		}
+		case ARGS_NUMBER: {
+			uint32_t number = 0;
+			size_t i;
+			for (i = 0; i < length; i++) {
+				if (token[i] < '0' || token[i] > '9') {
+					return false;
+				}
+				number = number * 10 + (token[i] - '0');
+				if (number > UINT16_MAX) {
+					return false;
+				}
+			}
+			value->number = number;
+			return length > 0;
+		}
+		case ARGS_DECIMAL:
+			return args_decimal(token, length, &value->decimal.left, &value->decimal.right);
+		case ARGS_WORD:
+			if (length > 0 && length <= UINT8_MAX) {
+				value->word.buf = token;
+				value->word.length = length;
+				return true;
+			}
+			break;
+	}
+	return false;
+}
+
+int8_t args_parse(const args_spec_t *spec, uint8_t count, uint8_t required, const char *const *tokens, const size_t *lengths, uint8_t ntokens, args_value_t *values) {
+	if (ntokens < required) {
+		return -1 - ntokens;
+	}
+	if (ntokens > count) {
+		return -1 - count;
+	}
+	uint8_t i;
+	for (i = 0; i < ntokens; i++) {
+		uint8_t type = pgm_read_byte(&spec[i].type);
+		const args_table_t *table = (const args_table_t *) pgm_read_ptr(&spec[i].table);
+		if (!args_parse_one(type, table, tokens[i], lengths[i], &values[i])) {
+			return -1 - i;
+		}
+	}
+	return ntokens;
+}
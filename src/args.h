@@ -0,0 +1,188 @@
+/**
+ * @file args.h
+ * @brief Table-driven command argument parser
+ * 
+ * Commands declare their arguments as an array of specifications in program
+ * memory. args_parse() checks the tokens of a command line against it and
+ * converts them into values, so command handlers do not parse text.
+ * 
+ * Keywords and commands are looked up in tables in program memory, sorted
+ * lexicographically by name, with a binary search. Each table entry starts
+ * with a pointer to its name (in program memory), so the same search serves
+ * keyword lists and command tables with additional fields. Names must be
+ * lowercase. Lookups are case insensitive and accept a full name or any
+ * prefix that matches only one name; an ambiguous prefix matches nothing.
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ARGS_H
+#define _ARGS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Maximum number of arguments of a command */
+#define ARGS_MAX 4
+
+/** Number of elements of an array */
+#define ARGS_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+/**
+ * Initialiser for a lookup table descriptor.
+ * @param entries an array whose elements start with a name pointer
+ */
+#define ARGS_TABLE(entries) { (entries), ARGS_COUNT(entries), sizeof((entries)[0]) }
+
+/**
+ * Argument types
+ */
+typedef enum {
+	/** Keyword from a table, value: index */
+	ARGS_KEYWORD,
+	/** GPIO port letter A-G (case insensitive), value: port ('A'..'G') */
+	ARGS_PORT,
+	/** Pin number 0-7, value: pin */
+	ARGS_PIN,
+	/** One or more distinct GPIO port letters A-G (case insensitive), value: ports (bit 0 is port A) */
+	ARGS_PORTS,
+	/** Unsigned decimal integer 0-65535, value: number */
+	ARGS_NUMBER,
+	/** Signed decimal amount with up to two fraction digits, value: decimal */
+	ARGS_DECIMAL,
+	/** Any word, value: word */
+	ARGS_WORD,
+} args_type_e;
+
+/**
+ * Lookup table descriptor (in program memory)
+ */
+typedef struct {
+	/** Table entries (in program memory), each one starts with a PGM_P name */
+	const void *entries;
+	/** Number of entries */
+	uint8_t count;
+	/** Size of an entry */
+	uint8_t stride;
+} args_table_t;
+
+/**
+ * Argument specification (in program memory)
+ */
+typedef struct {
+	/** Type (args_type_e) */
+	uint8_t type;
+	/** Keyword table for ARGS_KEYWORD (in program memory) */
+	const args_table_t *table;
+} args_spec_t;
+
+/**
+ * Parsed argument value
+ */
+typedef union {
+	/** Keyword table index */
+	uint8_t index;
+	/** Port letter */
+	char port;
+	/** Pin number */
+	uint8_t pin;
+	/** Port set */
+	uint8_t ports;
+	/** Unsigned integer */
+	uint16_t number;
+	/** Decimal amount */
+	struct {
+		/** Integer part */
+		int16_t left;
+		/** Fraction in hundredths (the sign is only carried by left, as in currency_t) */
+		uint8_t right;
+	} decimal;
+	/** Word */
+	struct {
+		/** Start of the word (not terminated) */
+		const char *buf;
+		/** Length of the word */
+		uint8_t length;
+	} word;
+} args_value_t;
+
+/**
+ * Find the first table entry whose name starts with a token, ignoring case.
+ * The matching entries follow it, e.g. for completion.
+ * @param entries the table entries (in program memory, sorted by name)
+ * @param count the number of entries
+ * @param stride the size of an entry
+ * @param token the token (not terminated)
+ * @param length the length of the token
+ * @return the index of the entry, or -1 if no name starts with the token
+ */
+int16_t args_prefix(const void *entries, uint8_t count, uint8_t stride, const char *token, size_t length);
+
+/**
+ * Find the table entry that a token names, ignoring case: the entry whose
+ * name is the token, or else the only entry whose name starts with it.
+ * @param entries the table entries (in program memory, sorted by name)
+ * @param count the number of entries
+ * @param stride the size of an entry
+ * @param token the token (not terminated)
+ * @param length the length of the token
+ * @return the index of the entry, or -1 if no name or several names start
+ * with the token
+ */
+int16_t args_search(const void *entries, uint8_t count, uint8_t stride, const char *token, size_t length);
+
+/**
+ * Find the keyword in a table that a token names, see args_search().
+ * @param table the table descriptor (in program memory)
+ * @param token the token (not terminated)
+ * @param length the length of the token
+ * @return the index of the keyword, or -1 if no keyword or several keywords
+ * start with the token
+ */
+int16_t args_lookup(const args_table_t *table, const char *token, size_t length);
+
+/**
+ * Parse a decimal amount.
+ * 
+ * Saturates at 32767.99 and -32768.99.
+ * @param buf a string (not terminated)
+ * @param length the length of the string
+ * @param left a pointer to storage for the integer part
+ * @param right a pointer to storage for the fraction (hundredths)
+ * @return false, if the string is not a decimal amount
+ */
+bool args_decimal(const char *buf, size_t length, int16_t *left, uint8_t *right);
+
+/**
+ * Parse command arguments according to their specification.
+ * 
+ * The first required arguments must be present, the following ones are
+ * optional. Surplus arguments are rejected.
+ * @param spec the argument specification (in program memory)
+ * @param count the number of specified arguments
+ * @param required the number of required arguments
+ * @param tokens the argument tokens
+ * @param lengths the lengths of the argument tokens
+ * @param ntokens the number of argument tokens
+ * @param values an array of at least count elements for the parsed values
+ * @return the number of parsed values, or -1 - the index of the first invalid
+ * token (which is ntokens if there are too few)
+ */
+int8_t args_parse(const args_spec_t *spec, uint8_t count, uint8_t required, const char *const *tokens, const size_t *lengths, uint8_t ntokens, args_value_t *values);
+
+#endif /*_ARGS_H*/
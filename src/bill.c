@@ -59,22 +59,31 @@
  *   ACCEPT [label="{ACCEPT | K:L}"];
  *   REJECT [label="{REJECT* | R:L}"];
  *   ERROR [label="{ERROR | }"];
- *   END [label="{END | K:H R:H}"];
- *   UNINITIALIZED->SELFTEST [label="V:H S:L A:L B:H E:H"];
+ *   END [label="{END | }"];
+ *   UNINITIALIZED->SELFTEST [label=""];
  *   SELFTEST->IDLE [label="B:L"];
  *   IDLE->VALIDATION [label="B:H"];
  *   VALIDATION->ERROR [label="A:H"];
  *   VALIDATION->SCANNED [label="V:L"];
  *   SCANNED->ACCEPT [label=""];
  *   SCANNED->REJECT [label=""];
+ *   ACCEPT->ERROR [label="A:H"];
+ *   ACCEPT->END [label="S:H"];
  *   ACCEPT->END [label=""];
  *   REJECT->END [label=""];
- *   ACCEPT->ERROR [label="A:H"];
  *   ERROR->END [label="A:L"];
  *   END->IDLE [label="V:H B:L"];
  * }
  * @enddot
  * 
+ * Edge labels are the pin levels that enable a transition, node labels the
+ * outputs that are set on entry. The edges of a state are tried in the order
+ * given here, the first that matches is taken. The ACK and REJ pulses end on
+ * their own after BILL_ACK_TIME. The graph is implemented by the
+ * BILL_TRANSITIONS table, and the host test checks that both agree.
+ * 
+ * REJECT* is only reachable in escrow mode, which is not implemented yet.
+ * 
  * @copyright Matemat controller firmware
  * Copyright © 2015 Chaostreff Basel
  * 
@@ -92,11 +101,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <stdio.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/pgmspace.h>
-#include "memory.h"
+#include <aversive/irq_lock.h>
 #include "bill.h"
+#include "eventlog.h"
+#include "telemetry.h"
+#include "main.h"
+#include "rate.h"
+#include "util.h"
 
 /**
  * Capture the input pin state of the scanner.
@@ -117,22 +131,6 @@
  * @param vend3 the bit value of vend3 (0 = L, 1 = H)
  */
 #define BILL_BITS_VEND(vend1, vend2, vend3) ((vend1 << 7) | (vend2 << 6) | (vend3 << 5))
-/**
- * Mask the BUSY bit of an input state (but do not shift)
- */
-#define BILL_PINS_BUSY(pins) (pins & _BV(4))
-/**
- * Mask the ABN bit of an input state (but do not shift)
- */
-#define BILL_PINS_ABN(pins) (pins & _BV(3))
-/**
- * Mask the VALID bit of an input state (but do not shift)
- */
-#define BILL_PINS_VALID(pins) (pins & _BV(2))
-/**
- * Mask the STKF bit of an input state (but do not shift)
- */
-#define BILL_PINS_STKF(pins) (pins & _BV(1))
 /**
  * Set the state of the INH output port.
  * @param value 0 = L, 1 = H, 2 = toggle
@@ -154,11 +152,37 @@
  */
 #define BILL_INIT() do { DDRB &= ~(_BV(PB6) | _BV(PB7)); PORTB |= _BV(PB6) | _BV(PB7); DDRC = _BV(PC0) | _BV(PC1) | _BV(PC2); PORTC = _BV(PC0) | _BV(PC1) | _BV(PC3) | _BV(PC4) | _BV(PC5) | _BV(PC6) | _BV(PC7); } while(0);
 
-#ifndef BILL_POLL_TIME
-/** Polling period (~100ms) */
-#define BILL_POLL_TIME 1600
+#ifndef BILL_ACK_TIME
+/** Length of the ACK and REJ pulses (~10ms) */
+#define BILL_ACK_TIME 160
+#endif
+
+#ifndef BILL_SAMPLE_PERIOD
+/** Pin sampling period while a banknote is processed (~1ms) */
+#define BILL_SAMPLE_PERIOD 16
+#endif
+
+#ifndef BILL_SAMPLE_IDLE
+/** Pin sampling period while idle (~50ms) */
+#define BILL_SAMPLE_IDLE 800
 #endif
 
+#ifndef BILL_LINGER
+/** Quiet time before returning to the idle sampling period (~2s) */
+#define BILL_LINGER 31250
+#endif
+
+#ifndef BILL_EDGES
+/** Size of the edge queue (power of 2) */
+#define BILL_EDGES 8
+#endif
+
+static_assert((BILL_EDGES & (BILL_EDGES - 1)) == 0, "BILL_EDGES must be a power of 2");
+static_assert(BILL_EDGES <= 128, "BILL_EDGES must fit into the 8 bit ring indexes");
+
+/** A pin state that BILL_PINS() never returns (bit 0 is unused), forces the first sample into the queue */
+#define BILL_PINS_NONE 0x01
+
 /**
  * Descriptor for a single banknote denomination
  */
@@ -181,12 +205,73 @@ static const bill_denomination_t BILL_DENOMINATIONS[] PROGMEM = {
 	{ BILL_BITS_VEND(0, 1, 0), 200 },
 };
 
+/**
+ * Generate a transition table entry.
+ * @param from the state name
+ * @param mask the pins to check (bill_pin_t)
+ * @param value the pin levels that enable the transition
+ * @param output the output name (bill_output_t)
+ * @param to the next state name
+ * @param notify the callback name (bill_notify_t)
+ */
+#define BILL_TRANSITION(from, mask, value, output, to, notify) { BILL_STATE_##from, mask, value, BILL_OUTPUT_##output, BILL_STATE_##to, BILL_NOTIFY_##notify }
+
+/**
+ * State transitions, sorted by state, in the order of the edges in the state diagram
+ */
+static const bill_transition_t BILL_TRANSITIONS[] PROGMEM = {
+	BILL_TRANSITION(UNINITIALIZED, 0, 0, NONE, SELFTEST, NONE),
+	BILL_TRANSITION(SELFTEST, BILL_PIN_BUSY, 0, READY, IDLE, NONE),
+	BILL_TRANSITION(IDLE, BILL_PIN_BUSY, BILL_PIN_BUSY, NONE, VALIDATION, NONE),
+	BILL_TRANSITION(VALIDATION, BILL_PIN_ABN, BILL_PIN_ABN, NONE, ERROR, SCAN),
+	BILL_TRANSITION(VALIDATION, BILL_PIN_VALID, 0, NONE, SCANNED, NONE),
+	BILL_TRANSITION(SCANNED, 0, 0, ACK, ACCEPT, NONE),
+	// Never taken, the entry above always matches first
+	BILL_TRANSITION(SCANNED, 0, 0, REJ, REJECT, NONE),
+	BILL_TRANSITION(ACCEPT, BILL_PIN_ABN, BILL_PIN_ABN, NONE, ERROR, SCAN),
+	BILL_TRANSITION(ACCEPT, BILL_PIN_STKF, BILL_PIN_STKF, NONE, END, FULL),
+	BILL_TRANSITION(ACCEPT, 0, 0, NONE, END, REPORT),
+	BILL_TRANSITION(REJECT, 0, 0, NONE, END, NONE),
+	BILL_TRANSITION(ERROR, BILL_PIN_ABN, 0, NONE, END, NONE),
+	BILL_TRANSITION(END, BILL_PIN_VALID | BILL_PIN_BUSY, BILL_PIN_VALID, READY, IDLE, NONE),
+};
+
+/** @cond */
+static const char BILL_NAME_UNINITIALIZED[] PROGMEM = "uninitialized";
+static const char BILL_NAME_SELFTEST[] PROGMEM = "self-test";
+static const char BILL_NAME_IDLE[] PROGMEM = "idle";
+static const char BILL_NAME_VALIDATION[] PROGMEM = "validating";
+static const char BILL_NAME_SCANNED[] PROGMEM = "scanned";
+static const char BILL_NAME_ACCEPT[] PROGMEM = "accepting";
+static const char BILL_NAME_REJECT[] PROGMEM = "rejecting";
+static const char BILL_NAME_ERROR[] PROGMEM = "error";
+static const char BILL_NAME_END[] PROGMEM = "ended";
+/** @endcond */
+
+/**
+ * State names, in the order of bill_state_t
+ */
+static PGM_P const BILL_STATE_NAMES[] PROGMEM = {
+	BILL_NAME_UNINITIALIZED,
+	BILL_NAME_SELFTEST,
+	BILL_NAME_IDLE,
+	BILL_NAME_VALIDATION,
+	BILL_NAME_SCANNED,
+	BILL_NAME_ACCEPT,
+	BILL_NAME_REJECT,
+	BILL_NAME_ERROR,
+	BILL_NAME_END,
+};
+static_assert(sizeof(BILL_STATE_NAMES) / sizeof(BILL_STATE_NAMES[0]) == BILL_STATE_END + 1, "BILL_STATE_NAMES must contain all states");
+
 /**
  * Event type
  */
 typedef enum {
 	/** Port polling event (periodic) */
 	BILL_EVENT_POLL,
+	/** End of the ACK or REJ pulse (one-shot) */
+	BILL_EVENT_RELEASE,
 } bill_event_type_t;
 
 /**
@@ -199,6 +284,16 @@ typedef struct {
 	struct callout co;
 } bill_event_t;
 
+/**
+ * Pin state change
+ */
+typedef struct {
+	/** Time of the sample (low 16 bits of the system time) */
+	uint16_t time;
+	/** Input pin state bit map */
+	uint8_t pins;
+} bill_edge_t;
+
 /**
  * Driver state structure
  */
@@ -219,12 +314,22 @@ typedef struct {
 	bool escrow;
 	/** Value of the vend register */
 	uint8_t vend;
-	/** Periodic polling event */
+	/** Polling event, runs the state machine on the queued edges */
 	bill_event_t poll;
-	/** Memory manager for the event queue */
-	memory_t *memory;
-	/** Managed memory pool */
-	uint8_t pool[MEMORY_POOL_SIZE(BILL_QUEUE_SIZE, sizeof(bill_event_t))];
+	/** ACK/REJ pulse end event */
+	bill_event_t release;
+	/** Set while the polling event is scheduled to run immediately */
+	volatile bool pending;
+	/** Pin state of the last sample that was queued */
+	uint8_t sampled;
+	/** Edge queue write index (only modified by the sampler) */
+	volatile uint8_t in;
+	/** Edge queue read index (only modified by the polling event) */
+	volatile uint8_t out;
+	/** Edge queue */
+	bill_edge_t edges[BILL_EDGES];
+	/** Sampling rate */
+	rate_t rate;
 } bill_t;
 
 /**
@@ -236,123 +341,271 @@ static bill_t bill_global __attribute__((section(".noinit")));
  * Event callback
  */
 static void bill_callback(struct callout_mgr *cm, struct callout *tim, void *arg);
+#ifdef BILL_DEBUG
 /**
  * State debugging
  */
 static void bill_debug(uint8_t pins);
-/* State machine transitions */
-static void bill_state_unitialized(uint8_t pins);
-static void bill_state_selftest(uint8_t pins);
-static void bill_state_idle(uint8_t pins);
-static void bill_state_validation(uint8_t pins);
-static void bill_state_scanned(uint8_t pins);
-static void bill_state_accept(uint8_t pins);
-static void bill_state_reject(uint8_t pins);
-static void bill_state_error(uint8_t pins);
-static void bill_state_end(uint8_t pins);
+#endif
+/**
+ * Sample the input pins and queue the state if it changed.
+ * Called from the compare interrupt, or from the polling event without the
+ * tickless timer.
+ * @param time the sample time (low 16 bits of the system time)
+ * @return true, if a change was queued
+ */
+static bool bill_sample(uint16_t time);
+/**
+ * Evaluate the state machine until it is stable.
+ * @param pins the input pin state
+ * @param time the time of the pin state (ticks)
+ */
+static void bill_step(uint8_t pins, uint32_t time);
+/**
+ * Set the outputs on entry into a state.
+ * @param output the outputs to set
+ */
+static void bill_output(bill_output_t output);
+/**
+ * Call the report or error callback for a transition.
+ * @param notify the callback to call
+ * @param pins the input pin state
+ */
+static void bill_notify(bill_notify_t notify, uint8_t pins);
 
 bool bill_init(struct callout_mgr *manager, bill_report_cb *report, bill_error_cb *error) {
-	bill_global.memory = memory_init(bill_global.pool, sizeof(bill_global.pool), sizeof(bill_event_t));
-
-	if (bill_global.memory) {
-		bill_global.manager = manager;
-		bill_global.report = report;
-		bill_global.error = error;
-		bill_global.inhibit = false;
-		bill_global.escrow = false;
-		bill_global.vend = 0;
-		
-		// Signal the poll handler to capture state first
-		bill_global.state = BILL_STATE_UNINITIALIZED;
-		
-		BILL_INIT();
-		BILL_PORT_ACK(1);
-		BILL_PORT_REJ(1);
-		BILL_PORT_INH(0);
-		//bill_global.input = BILL_PINS();
-		
-		// ATmega128 doesn't support PCINT interrupts - use polling instead
-		bill_global.poll.type = BILL_EVENT_POLL;
-		callout_init(&bill_global.poll.co, bill_callback, &bill_global.poll, BILL_PRIORITY);
-		callout_schedule(bill_global.manager, &bill_global.poll.co, BILL_POLL_TIME);
-		
-		return true;
-	}
+	bill_global.manager = manager;
+	bill_global.report = report;
+	bill_global.error = error;
+	bill_global.inhibit = false;
+	bill_global.escrow = false;
+	bill_global.vend = 0;
+	
+	// Signal the poll handler to capture state first
+	bill_global.state = BILL_STATE_UNINITIALIZED;
+	
+	BILL_INIT();
+	BILL_PORT_ACK(1);
+	BILL_PORT_REJ(1);
+	BILL_PORT_INH(0);
+	//bill_global.input = BILL_PINS();
+	bill_global.pending = false;
+	bill_global.sampled = BILL_PINS_NONE;
+	bill_global.in = 0;
+	bill_global.out = 0;
+	rate_init(&bill_global.rate, BILL_SAMPLE_PERIOD, BILL_SAMPLE_IDLE, BILL_LINGER);
 	
-	return false;
+	// ATmega128 doesn't support PCINT interrupts, and none of the scanner
+	// outputs is on an external interrupt pin. Sample them instead, slowly
+	// while idle and fast while a banknote is processed, and only wake the
+	// state machine up when they change.
+	bill_global.poll.type = BILL_EVENT_POLL;
+	callout_init(&bill_global.poll.co, bill_callback, &bill_global.poll, BILL_PRIORITY);
+	bill_global.release.type = BILL_EVENT_RELEASE;
+	callout_init(&bill_global.release.co, bill_callback, &bill_global.release, BILL_PRIORITY);
+	
+#ifdef MAIN_TICKLESS
+	// Timer 3 is the free running system timer, its compare unit B is the sampling clock
+	OCR3B = TCNT3 + bill_global.rate.period;
+	ETIFR = _BV(OCF3B);
+	ETIMSK |= _BV(OCIE3B);
+#else
+	callout_schedule(bill_global.manager, &bill_global.poll.co, bill_global.rate.period);
+#endif
+	
+	return true;
 }
 
 void bill_shutdown(void) {
+#ifdef MAIN_TICKLESS
+	ETIMSK &= ~_BV(OCIE3B);
+#endif
 	callout_stop(bill_global.manager, &bill_global.poll.co);
+	callout_stop(bill_global.manager, &bill_global.release.co);
+}
+
+#ifdef MAIN_TICKLESS
+/**
+ * Sampling interrupt
+ */
+ISR(TIMER3_COMPB_vect) {
+	uint16_t time = OCR3B;
+	OCR3B = time + bill_global.rate.period;
+	bill_global.rate.runs++;
+	if (bill_sample(time) && !bill_global.pending) {
+		bill_global.pending = true;
+		callout_schedule(bill_global.manager, &bill_global.poll.co, 0);
+	}
+}
+#endif
+
+bool bill_sample(uint16_t time) {
+	uint8_t pins = BILL_PINS();
+	if (pins == bill_global.sampled) {
+		return false;
+	}
+	uint8_t in = bill_global.in;
+	if ((uint8_t) (in - bill_global.out) >= BILL_EDGES) {
+		// Queue full: the change is queued by a later sample, only short pulses get lost
+		return false;
+	}
+	bill_edge_t *edge = &bill_global.edges[in & (BILL_EDGES - 1)];
+	edge->time = time;
+	edge->pins = pins;
+	bill_global.in = in + 1;
+	bill_global.sampled = pins;
+	return true;
 }
 
+#ifdef BILL_DEBUG
 void bill_debug(uint8_t pins) {
 	// Calculate the difference in state (0 = same, 1 = changed)
 	uint8_t diff = pins ^ bill_global.input;
 	if (diff != 0) {
-		printf_P(PSTR("bill"));
-		if (BILL_PINS_VALID(diff)) printf_P(PSTR(" valid=%c"), BILL_PINS_VALID(pins) ? 'H' : 'L');
-		if (BILL_PINS_STKF(diff)) printf_P(PSTR(" stkf=%c"), BILL_PINS_STKF(pins) ? 'H' : 'L');
-		if (BILL_PINS_ABN(diff)) printf_P(PSTR(" abn=%c"), BILL_PINS_ABN(pins) ? 'H' : 'L');
-		if (BILL_PINS_BUSY(diff)) printf_P(PSTR(" busy=%c"), BILL_PINS_BUSY(pins) ? 'H' : 'L');
-		if (BILL_PINS_VEND(diff)) printf_P(PSTR(" vend=0x%x"), BILL_PINS_VEND(pins) >> 5);
-		printf_P(PSTR("\r\n"));
+		eventlog_write(EVENTLOG_BILL_PINS, pins, diff);
 	}
 }
+#endif
 
 void bill_callback(struct callout_mgr *cm, struct callout *tim, void *arg) {
 	if (arg) {
 		bill_event_t *priv = (bill_event_t *) arg;
 		if (priv->type == BILL_EVENT_POLL) {
-			// Capture pin state
-			uint8_t pins = BILL_PINS();
-			
-			// FIXME REMOVETHIS Dump pin state
-			bill_debug(pins);
+			// Clear first, so edges arriving while draining schedule another run
+			bill_global.pending = false;
+#ifndef MAIN_TICKLESS
+			// Without the sampling interrupt, pin changes are only seen here
+			bill_sample((uint16_t) main_time());
+#endif
 			
-			// Evaluate state and call transition handler
-			switch (bill_global.state) {
-				case BILL_STATE_UNINITIALIZED:
-					// Will only be entered once
-					bill_state_unitialized(pins);
-					break;
-				case BILL_STATE_SELFTEST:
-					bill_state_selftest(pins);
-					break;
-				case BILL_STATE_IDLE:
-					bill_state_idle(pins);
-					break;
-				case BILL_STATE_VALIDATION:
-					bill_state_validation(pins);
-					break;
-				case BILL_STATE_SCANNED:
-					bill_state_scanned(pins);
-					break;
-				case BILL_STATE_ACCEPT:
-					bill_state_accept(pins);
-					break;
-				case BILL_STATE_REJECT:
-					bill_state_reject(pins);
-					break;
-				case BILL_STATE_ERROR:
-					bill_state_error(pins);
-					break;
-				case BILL_STATE_END:
-					bill_state_end(pins);
-					break;
+			uint32_t now = main_time();
+			uint8_t out = bill_global.out;
+			bool active = out != bill_global.in;
+			while (out != bill_global.in) {
+				bill_edge_t edge = bill_global.edges[out & (BILL_EDGES - 1)];
+				bill_global.out = ++out;
+				
+#ifdef BILL_DEBUG
+				bill_debug(edge.pins);
+#endif
+				
+				// Extend the sample time to the full system time, it lies in the recent past
+				bill_step(edge.pins, now - (uint16_t) ((uint16_t) now - edge.time));
+				
+				// Update input pin cache
+				bill_global.input = edge.pins;
 			}
 			
-			// Update input pin cache
-			bill_global.input = pins;
-			
-			// Reschedule next poll event
-			callout_schedule(bill_global.manager, tim, BILL_POLL_TIME);
-		} else {
-			memory_release(arg);
+			// Sample fast until the banknote is processed and the pins have been quiet for a while
+			active = active || bill_global.state != BILL_STATE_IDLE;
+			uint8_t flags;
+			IRQ_LOCK(flags);
+			uint16_t period = rate_update(&bill_global.rate, now, active);
+#ifdef MAIN_TICKLESS
+			if ((uint16_t) (OCR3B - TCNT3) > period) {
+				// Do not wait for the sample that is due in the idle period
+				OCR3B = TCNT3 + period;
+			}
+			// The sampling interrupt uses the new period, this event only has to
+			// run again to return to the idle period, unless an edge was queued
+			if (!bill_global.pending && period != BILL_SAMPLE_IDLE) {
+				callout_schedule(bill_global.manager, tim, BILL_LINGER);
+			}
+#else
+			bill_global.rate.runs++;
+			callout_schedule(bill_global.manager, tim, period);
+#endif
+			IRQ_UNLOCK(flags);
+		} else if (priv->type == BILL_EVENT_RELEASE) {
+			BILL_PORT_ACK(1);
+			BILL_PORT_REJ(1);
 		}
 	}
 }
 
+void bill_step(uint8_t pins, uint32_t time) {
+	// Take transitions until none matches: a hop that does not wait for an input
+	// (like SCANNED->ACCEPT->END) is taken right away. For a fixed pin state, the
+	// state graph has no cycles.
+	bool moved;
+	do {
+		moved = false;
+		bill_state_t state = bill_global.state;
+		uint8_t i;
+		for (i = 0; i < sizeof(BILL_TRANSITIONS) / sizeof(BILL_TRANSITIONS[0]); i++) {
+			const bill_transition_t *transition = &BILL_TRANSITIONS[i];
+			uint8_t from = pgm_read_byte(&transition->state);
+			if (from > state) {
+				break;
+			}
+			if (from == state && (pins & pgm_read_byte(&transition->mask)) == pgm_read_byte(&transition->value)) {
+				bill_state_t next = pgm_read_byte(&transition->next);
+				bill_output(pgm_read_byte(&transition->output));
+				bill_notify(pgm_read_byte(&transition->notify), pins);
+				bill_global.state = next;
+				telemetry_write(TELEMETRY_BILL_STATE, time, state, next);
+				moved = true;
+				break;
+			}
+		}
+	} while (moved);
+}
+
+void bill_output(bill_output_t output) {
+	switch (output) {
+		case BILL_OUTPUT_NONE:
+			break;
+		case BILL_OUTPUT_READY:
+			// Inhibit stays as set by bill_inhibit()
+			BILL_PORT_ACK(1);
+			BILL_PORT_REJ(1);
+			BILL_PORT_INH(bill_global.inhibit ? 1 : 0);
+			break;
+		case BILL_OUTPUT_ACK:
+			BILL_PORT_ACK(0);
+			callout_schedule(bill_global.manager, &bill_global.release.co, BILL_ACK_TIME);
+			break;
+		case BILL_OUTPUT_REJ:
+			BILL_PORT_REJ(0);
+			callout_schedule(bill_global.manager, &bill_global.release.co, BILL_ACK_TIME);
+			break;
+	}
+}
+
+void bill_notify(bill_notify_t notify, uint8_t pins) {
+	switch (notify) {
+		case BILL_NOTIFY_NONE:
+			break;
+		case BILL_NOTIFY_REPORT: {
+			uint8_t i;
+			for (i = 0; i < sizeof(BILL_DENOMINATIONS) / sizeof(BILL_DENOMINATIONS[0]); i++) {
+				if (pgm_read_byte(&BILL_DENOMINATIONS[i].vend) == BILL_PINS_VEND(pins)) {
+					if (bill_global.report) {
+						bill_global.report(pgm_read_word(&BILL_DENOMINATIONS[i].denomination));
+					}
+					return;
+				}
+			}
+			if (bill_global.error) {
+				bill_global.error(BILL_ERROR_UNKNOWN, 0);
+			}
+			break;
+		}
+		case BILL_NOTIFY_SCAN:
+			// Abort, jam
+			if (bill_global.error) {
+				bill_global.error(BILL_ERROR_SCAN, 0);
+			}
+			break;
+		case BILL_NOTIFY_FULL:
+			// The banknote was stacked, but there is no room for the next one
+			if (bill_global.error) {
+				bill_global.error(BILL_ERROR_FULL, 0);
+			}
+			break;
+	}
+}
+
 void bill_inhibit(bool inhibit) {
 	bill_global.inhibit = inhibit;
 	BILL_PORT_INH(inhibit ? 1 : 0);
@@ -366,87 +619,19 @@ bill_state_t bill_state(void) {
 	return bill_global.state;
 }
 
-void bill_state_unitialized(uint8_t pins) {
-	bill_global.state = BILL_STATE_SELFTEST;
-}
-void bill_state_selftest(uint8_t pins) {
-	if (!BILL_PINS_BUSY(pins)) {
-		// Self-test complete
-		bill_global.state = BILL_STATE_IDLE;
-	}
-}
-void bill_state_idle(uint8_t pins) {
-	BILL_PORT_ACK(1);
-	BILL_PORT_REJ(1);
-	BILL_PORT_INH(0);
-	if (BILL_PINS_BUSY(pins)) {
-		// Scanning started
-		bill_global.state = BILL_STATE_VALIDATION;
-	}
-}
-void bill_state_validation(uint8_t pins) {
-	if (BILL_PINS_ABN(pins)) {
-		// Abort, jam
-		if (bill_global.error) {
-			bill_global.error(BILL_ERROR_SCAN, 0);
-		}
-		bill_global.state = BILL_STATE_ERROR;
-	} else if (!BILL_PINS_VALID(pins)) {
-		// Scan complete
-		bill_global.state = BILL_STATE_SCANNED;
-	}
-}
-void bill_state_scanned(uint8_t pins) {
-	// Scanning complete, accept or reject banknote
-	// TODO Implement escrow mode (go to state reject)
-	bill_global.state = BILL_STATE_ACCEPT;
-}
-void bill_state_accept(uint8_t pins) {
-	// Acknowledge
-	BILL_PORT_ACK(0);
-	// Check for errors
-	if (BILL_PINS_ABN(pins)) {
-		// Abort, jam
-		if (bill_global.error) {
-			bill_global.error(BILL_ERROR_SCAN, 0);
-		}
-		bill_global.state = BILL_STATE_ERROR;
-	} else if (BILL_PINS_STKF(pins)) {
-		// Report that the stack is full
-		if (bill_global.error) {
-			bill_global.error(BILL_ERROR_FULL, 0);
-		}
-		bill_global.state = BILL_STATE_END;
-	} else {
-		// Report accepted banknote
-		if (bill_global.report) {
-			size_t i;
-			for (i = 0; i < sizeof(BILL_DENOMINATIONS) / sizeof(BILL_DENOMINATIONS[0]); i++) {
-				if (pgm_read_byte(&BILL_DENOMINATIONS[i].vend) == BILL_PINS_VEND(pins)) {
-					bill_global.report(pgm_read_word(&BILL_DENOMINATIONS[i].denomination));
-					break;
-				}
-			}
-		}
-		bill_global.state = BILL_STATE_END;
-	}
+void bill_rate(rate_stats_t *stats) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	stats->period = bill_global.rate.period;
+	stats->runs = bill_global.rate.runs;
+	IRQ_UNLOCK(flags);
 }
-void bill_state_reject(uint8_t pins) {
-	// Reject
-	BILL_PORT_REJ(0);
-	bill_global.state = BILL_STATE_END;
-}
-void bill_state_error(uint8_t pins) {
-	if (!BILL_PINS_ABN(pins)) {
-		bill_global.state = BILL_STATE_END;
-	}
+
+PGM_P bill_state_name(bill_state_t state) {
+	return (PGM_P) pgm_read_ptr(&BILL_STATE_NAMES[state]);
 }
-void bill_state_end(uint8_t pins) {
-	// Deassert signals
-	BILL_PORT_ACK(1);
-	BILL_PORT_REJ(1);
-	if (!BILL_PINS_BUSY(pins)) {
-		// Return to idle state
-		bill_global.state = BILL_STATE_IDLE;
-	}
+
+const bill_transition_t *bill_transitions(uint8_t *count) {
+	*count = sizeof(BILL_TRANSITIONS) / sizeof(BILL_TRANSITIONS[0]);
+	return BILL_TRANSITIONS;
 }
@@ -5,12 +5,32 @@
  * To customise denominations and bit patterns, change `BILL_DENOMINATIONS` in
  * bill.c
  * 
+ * With the tickless system timer (MAIN_TICKLESS), the scanner outputs are
+ * sampled from the compare unit B interrupt of timer 3. Each change is queued
+ * with its time stamp, and the state machine is run on it right away. Without
+ * the tickless timer, the pins are sampled by a polling event instead.
+ * 
+ * While the scanner is idle, the pins are sampled every BILL_SAMPLE_IDLE
+ * ticks. From the first change until the banknote is processed and the pins
+ * have been quiet for BILL_LINGER, they are sampled every BILL_SAMPLE_PERIOD
+ * ticks, so the state machine follows the scanner within about a millisecond.
+ * 
+ * On every pin change, the state machine takes all transitions that the new
+ * pin state allows, including those that do not wait for an input, so a
+ * scanned banknote is reported as soon as VALID goes low. The ACK and REJ
+ * pulses are held for BILL_ACK_TIME by a one-shot event.
+ * 
  * @par Configurable options
  * 
  * Macro               | Default  | Values         | Description
  * --------------------|----------|----------------|-----------------------------------------------
- * BILL_QUEUE_SIZE     | [undef]  | 0..255         | Size of the event pool
  * BILL_PRIORITY       | [undef]  | 0..127         | Event queue priority
+ * BILL_ACK_TIME       | 160      | 1..32767       | Length of the ACK and REJ pulses (ticks)
+ * BILL_SAMPLE_PERIOD  | 16       | 2..32767       | Pin sampling period while a banknote is processed (ticks)
+ * BILL_SAMPLE_IDLE    | 800      | 2..32767       | Pin sampling period while idle (ticks)
+ * BILL_LINGER         | 31250    | 1..32767       | Quiet time before returning to the idle sampling period (ticks)
+ * BILL_EDGES          | 8        | 2^n, 2..128    | Number of queued pin changes
+ * BILL_DEBUG          | [undef]  | [undef], [def] | Log every pin change to the event log
  * 
  * @copyright Matemat controller firmware
  * Copyright © 2015 Chaostreff Basel
@@ -34,7 +54,9 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-#include <base/callout/callout.h>
+#include <avr/pgmspace.h>
+#include "dispatch.h"
+#include "rate.h"
 
 /**
  * Error codes
@@ -76,6 +98,74 @@ typedef enum {
 	BILL_STATE_END,
 } bill_state_t;
 
+/** Length of the longest state name */
+#define BILL_STATE_NAME_MAX 13
+
+/**
+ * Scanner input pins, as sampled
+ */
+typedef enum {
+	/** Stacker full */
+	BILL_PIN_STKF = 0x02,
+	/** Banknote valid (active low) */
+	BILL_PIN_VALID = 0x04,
+	/** Abnormal condition */
+	BILL_PIN_ABN = 0x08,
+	/** Scanner busy */
+	BILL_PIN_BUSY = 0x10,
+	/** Vend outputs, encoding the banknote value */
+	BILL_PIN_VEND = 0xe0,
+} bill_pin_t;
+
+/**
+ * Outputs that are set when a transition is taken
+ */
+typedef enum {
+	/** Leave the outputs alone */
+	BILL_OUTPUT_NONE,
+	/** Release ACK and REJ, apply the inhibit flag */
+	BILL_OUTPUT_READY,
+	/** Start the ACK pulse */
+	BILL_OUTPUT_ACK,
+	/** Start the REJ pulse */
+	BILL_OUTPUT_REJ,
+} bill_output_t;
+
+/**
+ * Callbacks that are made when a transition is taken
+ */
+typedef enum {
+	/** No callback */
+	BILL_NOTIFY_NONE,
+	/** Report the banknote given by the vend outputs */
+	BILL_NOTIFY_REPORT,
+	/** Report a scan error */
+	BILL_NOTIFY_SCAN,
+	/** Report a full stacker */
+	BILL_NOTIFY_FULL,
+} bill_notify_t;
+
+/**
+ * State transition table entry.
+ * 
+ * A transition is taken if the state matches and the input pins selected
+ * by mask have the given value.
+ */
+typedef struct {
+	/** The current state (bill_state_t) */
+	uint8_t state;
+	/** The input pins to check (bill_pin_t) */
+	uint8_t mask;
+	/** The required levels of the checked pins */
+	uint8_t value;
+	/** The outputs to set (bill_output_t) */
+	uint8_t output;
+	/** The next state (bill_state_t) */
+	uint8_t next;
+	/** The callback to make (bill_notify_t) */
+	uint8_t notify;
+} bill_transition_t;
+
 /**
  * Successful scan event handler.
  * 
@@ -129,4 +219,24 @@ void bill_escrow(bool escrow);
  */
 bill_state_t bill_state(void);
 
+/**
+ * Get the current pin sampling period and the number of samples taken.
+ * @param stats storage for the statistics
+ */
+void bill_rate(rate_stats_t *stats);
+
+/**
+ * Get the name of a scanner state.
+ * @param state the state
+ * @return the name (in program memory), at most BILL_STATE_NAME_MAX characters
+ */
+PGM_P bill_state_name(bill_state_t state);
+
+/**
+ * Get the state transition table, sorted by state.
+ * @param count storage for the number of entries
+ * @return the table (in program memory)
+ */
+const bill_transition_t *bill_transitions(uint8_t *count);
+
 #endif /*_BILL_H*/
@@ -0,0 +1,212 @@
+/**
+ * @file capture.c
+ * @brief Logic analyser capture implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <aversive/irq_lock.h>
+#include "autoconf.h"
+#include "capture.h"
+#include "gpio.h"
+#include "util.h"
+
+#ifndef CAPTURE_SIZE
+/** Number of records in the ring buffer (power of 2) */
+#define CAPTURE_SIZE 32
+#endif
+
+static_assert((CAPTURE_SIZE & (CAPTURE_SIZE - 1)) == 0, "CAPTURE_SIZE must be a power of 2");
+static_assert(CAPTURE_SIZE <= 128, "CAPTURE_SIZE must fit into the 8 bit ring indexes");
+static_assert(CAPTURE_RATE_MAX >= CAPTURE_RATE_MIN, "CAPTURE_RATE_MAX must not be below CAPTURE_RATE_MIN");
+
+/**
+ * Capture object
+ */
+typedef struct {
+	/** Input registers of the selected ports */
+	volatile uint8_t *ports[CAPTURE_PORTS_MAX];
+	/** Number of selected ports */
+	uint8_t count;
+	/** Set while samples are taken */
+	volatile bool active;
+	/** Set if the capture ended because the ring buffer was full */
+	volatile bool truncated;
+	/** Number of samples taken (only modified by the compare interrupt while active) */
+	volatile uint32_t samples;
+	/** Number of samples to take */
+	uint32_t limit;
+	/** Pin states of the last record */
+	uint8_t last[CAPTURE_PORTS_MAX];
+	/** Ring buffer write index (only modified by the compare interrupt) */
+	volatile uint8_t in;
+	/** Ring buffer read index (only modified by the reader) */
+	volatile uint8_t out;
+	/** Ring buffer */
+	capture_record_t ring[CAPTURE_SIZE];
+} capture_t;
+
+/**
+ * Global capture object
+ */
+static capture_t capture_global ATTRIBUTE_NOINIT;
+
+/**
+ * Timer0 prescalers as powers of 2, in the order of the clock select values 1..7
+ */
+static const uint8_t CAPTURE_PRESCALERS[] PROGMEM = { 0, 3, 5, 6, 7, 8, 10 };
+
+/**
+ * Stop the timer. Must be called with interrupts disabled.
+ */
+static void capture_halt(void);
+
+void capture_init(void) {
+	capture_global.count = 0;
+	capture_global.active = false;
+	capture_global.truncated = false;
+	capture_global.samples = 0;
+	capture_global.in = 0;
+	capture_global.out = 0;
+}
+
+uint16_t capture_start(uint8_t ports, uint16_t rate, uint32_t duration) {
+	if (ports == 0 || ports >= _BV(7) || rate < CAPTURE_RATE_MIN || rate > CAPTURE_RATE_MAX || duration == 0) {
+		return 0;
+	}
+	uint8_t count = 0;
+	uint8_t i;
+	for (i = 0; i < 7; i++) {
+		if (ports & _BV(i)) {
+			if (count == CAPTURE_PORTS_MAX) {
+				return 0;
+			}
+			capture_global.ports[count++] = gpio_input('A' + i);
+		}
+	}
+
+	// Smallest prescaler whose compare value fits into 8 bits, rounded to the nearest divider
+	uint8_t select;
+	uint32_t divider = 0;
+	uint8_t shift = 0;
+	for (select = 0; select < sizeof(CAPTURE_PRESCALERS); select++) {
+		shift = pgm_read_byte(&CAPTURE_PRESCALERS[select]);
+		uint32_t step = (uint32_t) rate << shift;
+		divider = (CONFIG_QUARTZ + step / 2) / step;
+		if (divider <= 256) {
+			break;
+		}
+	}
+	uint16_t actual = (uint16_t) (CONFIG_QUARTZ / (divider << shift));
+	uint32_t limit = (duration / 1000) * actual + (duration % 1000) * actual / 1000;
+
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	capture_halt();
+	capture_global.count = count;
+	capture_global.truncated = false;
+	capture_global.samples = 0;
+	capture_global.limit = limit > 0 ? limit : 1;
+	capture_global.in = 0;
+	capture_global.out = 0;
+	// Synchronous clock, CTC mode, the first sample is taken one period after the start
+	ASSR &= ~_BV(AS0);
+	TCNT0 = 0;
+	OCR0 = divider - 1;
+	TIFR = _BV(OCF0);
+	TIMSK |= _BV(OCIE0);
+	TCCR0 = _BV(WGM01) | (select + 1);
+	capture_global.active = true;
+	IRQ_UNLOCK(flags);
+	return actual;
+}
+
+void capture_halt(void) {
+	TCCR0 = 0;
+	TIMSK &= ~_BV(OCIE0);
+	capture_global.active = false;
+}
+
+void capture_stop(void) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	capture_halt();
+	IRQ_UNLOCK(flags);
+}
+
+bool capture_active(void) {
+	return capture_global.active;
+}
+
+bool capture_read(capture_record_t *record) {
+	// Single consumer, the compare interrupt is the only producer
+	uint8_t out = capture_global.out;
+	if (out == capture_global.in) {
+		return false;
+	}
+	// Copy the record before releasing its slot
+	*record = capture_global.ring[out & (CAPTURE_SIZE - 1)];
+	capture_global.out = out + 1;
+	return true;
+}
+
+void capture_result(capture_result_t *result) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	result->samples = capture_global.samples;
+	result->truncated = capture_global.truncated;
+	IRQ_UNLOCK(flags);
+}
+
+ISR(TIMER0_COMP_vect) {
+	uint32_t samples = capture_global.samples;
+	// The first sample and every wrap of the 16 bit timestamp are always stored
+	bool changed = (uint16_t) samples == 0;
+	uint8_t pins[CAPTURE_PORTS_MAX];
+	uint8_t i;
+	for (i = 0; i < capture_global.count; i++) {
+		pins[i] = *capture_global.ports[i];
+		if (pins[i] != capture_global.last[i]) {
+			changed = true;
+		}
+	}
+	if (changed) {
+		uint8_t in = capture_global.in;
+		if ((uint8_t) (in - capture_global.out) >= CAPTURE_SIZE) {
+			// A lost change would corrupt the trace, so end it here
+			capture_global.truncated = true;
+			capture_halt();
+			return;
+		}
+		capture_record_t *record = &capture_global.ring[in & (CAPTURE_SIZE - 1)];
+		record->time = (uint16_t) samples;
+		for (i = 0; i < capture_global.count; i++) {
+			record->pins[i] = pins[i];
+			capture_global.last[i] = pins[i];
+		}
+		capture_global.in = in + 1;
+	}
+	capture_global.samples = ++samples;
+	if (samples >= capture_global.limit) {
+		capture_halt();
+	}
+}
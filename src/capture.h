@@ -0,0 +1,121 @@
+/**
+ * @file capture.h
+ * @brief Logic analyser capture of GPIO ports
+ * 
+ * Samples up to CAPTURE_PORTS_MAX ports from the Timer0 compare interrupt at
+ * a fixed rate and stores only the samples in which a pin changed, together
+ * with the low 16 bits of the sample number. A record is also stored whenever
+ * the sample number wraps to 0 (including the first sample), so a reader can
+ * reconstruct the full sample number: a timestamp that is not greater than
+ * the previous one means a wrap.
+ * 
+ * The records are kept in a RAM ring buffer and read with capture_read()
+ * while the capture is running. If the ring buffer is full when a change
+ * has to be stored, the capture ends early and is reported as truncated.
+ * 
+ * Timer0 is clocked with the smallest prescaler that reaches the requested
+ * rate, so the actual rate may differ slightly (see capture_start()).
+ * 
+ * @par Configurable options
+ * 
+ * Macro               | Default  | Values         | Description
+ * --------------------|----------|----------------|-----------------------------------------------
+ * CAPTURE_SIZE        | 32       | 2..128         | Number of records in the ring buffer (power of 2)
+ * CAPTURE_PORTS_MAX   | 4        | 1..7           | Maximum number of ports sampled at once
+ * CAPTURE_RATE_MAX    | 50000    | 100..65535     | Maximum sample rate (Hz)
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef CAPTURE_PORTS_MAX
+/** Maximum number of ports sampled at once */
+#define CAPTURE_PORTS_MAX 4
+#endif
+
+#ifndef CAPTURE_RATE_MAX
+/** Maximum sample rate (Hz) */
+#define CAPTURE_RATE_MAX 50000
+#endif
+
+/** Minimum sample rate (Hz), limited by the Timer0 prescaler */
+#define CAPTURE_RATE_MIN 100
+
+/**
+ * Capture record
+ */
+typedef struct {
+	/** Sample number (low 16 bits) */
+	uint16_t time;
+	/** Pin states of the selected ports, in alphabetical order */
+	uint8_t pins[CAPTURE_PORTS_MAX];
+} capture_record_t;
+
+/**
+ * Capture summary, see capture_result()
+ */
+typedef struct {
+	/** Number of samples taken */
+	uint32_t samples;
+	/** Set if the capture ended early because the ring buffer was full */
+	bool truncated;
+} capture_result_t;
+
+/**
+ * Initialise the capture module.
+ */
+void capture_init(void);
+
+/**
+ * Start a capture. Records of a previous capture are discarded.
+ * @param ports the ports to sample (bit 0 is port A)
+ * @param rate the sample rate (Hz)
+ * @param duration the capture duration (milliseconds)
+ * @return the actual sample rate (Hz), or 0 if the arguments are out of range
+ */
+uint16_t capture_start(uint8_t ports, uint16_t rate, uint32_t duration);
+
+/**
+ * End the capture. Records that were already stored can still be read.
+ */
+void capture_stop(void);
+
+/**
+ * Check whether a capture is running.
+ * @return true, while samples are taken
+ */
+bool capture_active(void);
+
+/**
+ * Read the oldest stored record.
+ * @param record storage for the record
+ * @return false, if no record is stored
+ */
+bool capture_read(capture_record_t *record);
+
+/**
+ * Get the summary of the last capture.
+ * @param result storage for the summary
+ */
+void capture_result(capture_result_t *result);
+
+#endif /*_CAPTURE_H*/
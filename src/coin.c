@@ -13,7 +13,19 @@
  * 
  * In BCO mode, a bit pattern signals when a coin was inserted or an error has
  * occured. This pattern will be sent for a duration of 80-120ms, so a
- * suitable polling interval needs to be chosen.
+ * suitable polling interval needs to be chosen. While the pins do not change,
+ * they are polled at the slower COIN_POLL_IDLE period, which still catches
+ * every pattern. On the first change, the driver switches to COIN_POLL_TIME
+ * until the pins have been quiet for COIN_LINGER.
+ * 
+ * The samples are decoded by a majority vote over the last COIN_VOTES of
+ * them: the pin state only changes once a new state is seen in most of the
+ * window, so short glitches are filtered out and counted. The first pattern
+ * that is held for longer than COIN_WIDTH_MAX after startup is the resting
+ * pattern. Any other pattern is a pulse, and a coin is credited exactly
+ * once, when the pulse ends. The width of the pulse is known to lie between
+ * the samples around its edges; pulses that are certainly shorter than
+ * COIN_WIDTH_MIN or longer than COIN_WIDTH_MAX are rejected.
  * 
  * @copyright Matemat controller firmware
  * Copyright © 2015 Chaostreff Basel
@@ -32,11 +44,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <stdio.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 #include "coin.h"
-#include "memory.h"
+#include "eventlog.h"
+#include "main.h"
+#include "rate.h"
+#include "util.h"
 
 /**
  * Capture the input pin state of the acceptor.
@@ -62,10 +76,42 @@
 #define COIN_PINS_PATTERN(pins) (pins & (_BV(1) | _BV(3) | _BV(4) | _BV(5)))
 
 #ifndef COIN_POLL_TIME
-/** Polling period (~12ms) */
-#define COIN_POLL_TIME 200
+/** Polling period while active (~3ms) */
+#define COIN_POLL_TIME 50
+#endif
+
+#ifndef COIN_POLL_IDLE
+/** Polling period while idle (~64ms) */
+#define COIN_POLL_IDLE 1000
+#endif
+
+#ifndef COIN_LINGER
+/** Quiet time before returning to the idle polling period (~2s) */
+#define COIN_LINGER 31250
+#endif
+
+#ifndef COIN_VOTES
+/** Number of samples in the majority vote */
+#define COIN_VOTES 5
+#endif
+
+#ifndef COIN_WIDTH_MIN
+/** Shortest valid coin pattern (80ms) */
+#define COIN_WIDTH_MIN 1250
+#endif
+
+#ifndef COIN_WIDTH_MAX
+/** Longest valid coin pattern (120ms) */
+#define COIN_WIDTH_MAX 1875
 #endif
 
+/** A resting pattern that COIN_PINS_PATTERN() never returns, until the real one is known */
+#define COIN_REST_UNKNOWN 0xff
+
+static_assert(COIN_VOTES % 2 == 1 && COIN_VOTES <= 15, "COIN_VOTES must be odd and at most 15");
+static_assert(COIN_WIDTH_MIN <= COIN_WIDTH_MAX, "COIN_WIDTH_MIN must not be longer than COIN_WIDTH_MAX");
+static_assert(COIN_POLL_IDLE + COIN_POLL_TIME * (COIN_VOTES / 2 + 1) < COIN_WIDTH_MIN, "The vote must settle within the shortest coin pattern");
+
 /**
  * Descriptor for a single coin pattern
  */
@@ -120,14 +166,32 @@ typedef struct {
 	coin_error_cb *error;
 	/** Periodic polling event */
 	coin_event_t poll;
-	/** Port state */
+	/** Port state, as decided by the vote */
 	uint8_t pins;
 	/** Error state */
 	bool alarm;
-	/** Memory manager for the event queue */
-	memory_t *memory;
-	/** Managed memory pool */
-	uint8_t pool[MEMORY_POOL_SIZE(COIN_QUEUE_SIZE, sizeof(coin_event_t))];
+	/** Polling rate */
+	rate_t rate;
+	/** The last samples (ring buffer) */
+	uint8_t samples[COIN_VOTES];
+	/** Ring buffer index of the next sample */
+	uint8_t sample;
+	/** The last sample */
+	uint8_t raw;
+	/** Time of the last sample */
+	uint32_t sampled;
+	/** The samples around the last change of the raw pin state */
+	uint32_t edge[2];
+	/** The samples around the start of the current pulse */
+	uint32_t rise[2];
+	/** The pattern between pulses */
+	uint8_t rest;
+	/** A pulse pattern is being sent */
+	bool pulse;
+	/** A sample has disagreed with the vote */
+	bool disturbed;
+	/** Decoder statistics */
+	coin_stats_t stats;
 } coin_t;
 
 /**
@@ -143,77 +207,190 @@ static void coin_debug(uint8_t pins);
  * Event callback
  */
 static void coin_callback(struct callout_mgr *cm, struct callout *tim, void *arg);
+/**
+ * Take a pin sample and update the vote.
+ * @param pins the sampled pin state
+ * @param now the sample time
+ * @return true, if the pins are not at rest
+ */
+static bool coin_sample(uint8_t pins, uint32_t now);
+/**
+ * Handle a change of the voted pin state.
+ * @param pins the new pin state
+ */
+static void coin_change(uint8_t pins);
+/**
+ * Credit the coin that matches a pulse pattern.
+ * @param pins the pin state during the pulse
+ * @return true, if the pattern is a known coin
+ */
+static bool coin_credit(uint8_t pins);
 
 bool coin_init(struct callout_mgr *manager, coin_report_cb *report, coin_error_cb *error) {
-	coin_global.memory = memory_init(coin_global.pool, sizeof(coin_global.pool), sizeof(coin_event_t));
-	
-	if (coin_global.memory) {
-		coin_global.manager = manager;
-		coin_global.report = report;
-		coin_global.error = error;
-		coin_global.alarm = false;
-
-		coin_global.pins = COIN_PINS();
-		
-		// ATmega128 doesn't support PCINT interrupts - use polling instead
-		coin_global.poll.type = COIN_EVENT_POLL;
-		callout_init(&coin_global.poll.co, coin_callback, &coin_global.poll, COIN_PRIORITY);
-		callout_schedule(coin_global.manager, &coin_global.poll.co, COIN_POLL_TIME);
+	coin_global.manager = manager;
+	coin_global.report = report;
+	coin_global.error = error;
+	coin_global.alarm = false;
 
-		return true;
+	coin_global.pins = COIN_PINS();
+	uint8_t i;
+	for (i = 0; i < COIN_VOTES; i++) {
+		coin_global.samples[i] = coin_global.pins;
 	}
+	coin_global.sample = 0;
+	coin_global.raw = coin_global.pins;
+	coin_global.sampled = main_time();
+	coin_global.edge[0] = coin_global.sampled;
+	coin_global.edge[1] = coin_global.sampled;
+	coin_global.rise[0] = coin_global.sampled;
+	coin_global.rise[1] = coin_global.sampled;
+	coin_global.rest = COIN_REST_UNKNOWN;
+	coin_global.pulse = true;
+	coin_global.disturbed = false;
+	coin_global.stats.glitches = 0;
+	coin_global.stats.rejects = 0;
+	coin_global.stats.coins = 0;
+	rate_init(&coin_global.rate, COIN_POLL_TIME, COIN_POLL_IDLE, COIN_LINGER);
 	
-	return false;
+	// ATmega128 doesn't support PCINT interrupts - use polling instead
+	coin_global.poll.type = COIN_EVENT_POLL;
+	callout_init(&coin_global.poll.co, coin_callback, &coin_global.poll, COIN_PRIORITY);
+	callout_schedule(coin_global.manager, &coin_global.poll.co, coin_global.rate.period);
+
+	return true;
 }
 
 void coin_shutdown(void) {
-	// Nothing
+	callout_stop(coin_global.manager, &coin_global.poll.co);
+}
+
+bool coin_alarm(void) {
+	return coin_global.alarm;
+}
+
+uint8_t coin_pins(void) {
+	return coin_global.pins;
+}
+
+void coin_rate(rate_stats_t *stats) {
+	stats->period = coin_global.rate.period;
+	stats->runs = coin_global.rate.runs;
+}
+
+void coin_stats(coin_stats_t *stats) {
+	*stats = coin_global.stats;
 }
 
 void coin_debug(uint8_t pins) {
 	// Calculate the difference in state (0 = same, 1 = changed)
 	uint8_t diff = pins ^ coin_global.pins;
-	printf_P(PSTR("pins=0x%x diff=0x%x\r\n"), pins, diff);
+	eventlog_write(EVENTLOG_COIN_PINS, pins, diff);
 }
 
 void coin_callback(struct callout_mgr *cm, struct callout *tim, void *arg) {
 	if (arg) {
 		coin_event_t *priv = (coin_event_t *) arg;
 		if (priv->type == COIN_EVENT_POLL) {
-			// Capture pin state
-			uint8_t pins = COIN_PINS();
+			uint32_t now = main_time();
+			bool active = coin_sample(COIN_PINS(), now);
 			
-			// Check if any pins have changed
-			if (pins != coin_global.pins) {
-				coin_debug(pins);
-				
-				if (COIN_PINS_ALARM(pins)) {
-					if (!coin_global.alarm) {
-						coin_global.alarm = true;
-						if (coin_global.error) {
-							coin_global.error(COIN_ERROR_ALARM);
-						}
-					}
-				} else {
-					coin_global.alarm = false;
-				}
-				
-				if (!coin_global.alarm && coin_global.report) {
-					size_t i;
-					for (i = 0; i < sizeof(COIN_DENOMINATIONS) / sizeof(COIN_DENOMINATIONS[0]); i++) {
-						if (pgm_read_byte(&COIN_DENOMINATIONS[i].pattern) == COIN_PINS_PATTERN(pins)) {
-							currency_t denomination;
-							denomination.base = pgm_read_word(&COIN_DENOMINATIONS[i].denomination.base);
-							denomination.cents = pgm_read_byte(&COIN_DENOMINATIONS[i].denomination.cents);
-							coin_global.report(denomination);
-							break;
-						}
-					}
-				}
+			// Reschedule next poll event
+			coin_global.rate.runs++;
+			callout_schedule(coin_global.manager, tim, rate_update(&coin_global.rate, now, active));
+		}
+	}
+}
+
+bool coin_sample(uint8_t pins, uint32_t now) {
+	if (pins != coin_global.raw) {
+		// The change happened somewhere between the previous sample and this one
+		coin_global.raw = pins;
+		coin_global.edge[0] = coin_global.sampled;
+		coin_global.edge[1] = now;
+	}
+	coin_global.sampled = now;
+	coin_global.samples[coin_global.sample] = pins;
+	coin_global.sample = (coin_global.sample + 1) % COIN_VOTES;
+	
+	// Count the votes for this sample, the only new candidate
+	uint8_t votes = 0;
+	uint8_t i;
+	for (i = 0; i < COIN_VOTES; i++) {
+		if (coin_global.samples[i] == pins) {
+			votes++;
+		}
+	}
+	if (pins != coin_global.pins) {
+		if (votes > COIN_VOTES / 2) {
+			coin_change(pins);
+			coin_global.disturbed = false;
+		} else {
+			coin_global.disturbed = true;
+		}
+	} else if (votes == COIN_VOTES && coin_global.disturbed) {
+		// Outvoted samples have left the window
+		coin_global.disturbed = false;
+		coin_global.stats.glitches++;
+	}
+	
+	if (coin_global.pulse && now - coin_global.rise[1] > COIN_WIDTH_MAX) {
+		// Too long for a coin: the resting pattern, or a stuck acceptor
+		coin_global.pulse = false;
+		if (coin_global.rest == COIN_REST_UNKNOWN) {
+			coin_global.rest = COIN_PINS_PATTERN(coin_global.pins);
+		} else {
+			coin_global.stats.rejects++;
+		}
+	}
+	
+	return votes < COIN_VOTES || coin_global.pulse;
+}
+
+void coin_change(uint8_t pins) {
+	coin_debug(pins);
+	
+	if (COIN_PINS_ALARM(pins)) {
+		if (!coin_global.alarm) {
+			coin_global.alarm = true;
+			if (coin_global.error) {
+				coin_global.error(COIN_ERROR_ALARM);
+			}
+		}
+	} else {
+		coin_global.alarm = false;
+	}
+	
+	if (COIN_PINS_PATTERN(pins) != COIN_PINS_PATTERN(coin_global.pins)) {
+		if (coin_global.pulse) {
+			// Bounds of the pulse width, from the samples around both edges
+			uint32_t shortest = coin_global.edge[0] - coin_global.rise[1];
+			uint32_t longest = coin_global.edge[1] - coin_global.rise[0];
+			if (longest < COIN_WIDTH_MIN || shortest > COIN_WIDTH_MAX || coin_global.alarm || !coin_credit(coin_global.pins)) {
+				coin_global.stats.rejects++;
 			}
-			
-			// Update cached pin state
-			coin_global.pins = pins;
 		}
+		coin_global.pulse = COIN_PINS_PATTERN(pins) != coin_global.rest;
+		coin_global.rise[0] = coin_global.edge[0];
+		coin_global.rise[1] = coin_global.edge[1];
 	}
-}
\ No newline at end of file
+	
+	// Update cached pin state
+	coin_global.pins = pins;
+}
+
+bool coin_credit(uint8_t pins) {
+	size_t i;
+	for (i = 0; i < sizeof(COIN_DENOMINATIONS) / sizeof(COIN_DENOMINATIONS[0]); i++) {
+		if (pgm_read_byte(&COIN_DENOMINATIONS[i].pattern) == COIN_PINS_PATTERN(pins)) {
+			coin_global.stats.coins++;
+			if (coin_global.report) {
+				currency_t denomination;
+				denomination.base = pgm_read_word(&COIN_DENOMINATIONS[i].denomination.base);
+				denomination.cents = pgm_read_byte(&COIN_DENOMINATIONS[i].denomination.cents);
+				coin_global.report(denomination);
+			}
+			return true;
+		}
+	}
+	return false;
+}
@@ -6,8 +6,13 @@
  * 
  * Macro               | Default  | Values         | Description
  * --------------------|----------|----------------|-----------------------------------------------
- * COIN_QUEUE_SIZE     | [undef]  | 0..255         | Size of the event pool
  * COIN_PRIORITY       | [undef]  | 0..127         | Event queue priority
+ * COIN_POLL_TIME      | 50       | 1..COIN_POLL_IDLE | Polling period while coins are inserted (ticks)
+ * COIN_POLL_IDLE      | 1000     | 1..            | Polling period while idle (ticks), see COIN_WIDTH_MIN
+ * COIN_LINGER         | 31250    | 1..2^32-1      | Quiet time before returning to the idle period (ticks)
+ * COIN_VOTES          | 5        | 1..15, odd     | Number of samples in the majority vote
+ * COIN_WIDTH_MIN      | 1250     | > COIN_POLL_IDLE + COIN_POLL_TIME * (COIN_VOTES / 2 + 1) | Shortest valid coin pattern (ticks)
+ * COIN_WIDTH_MAX      | 1875     | COIN_WIDTH_MIN.. | Longest valid coin pattern (ticks)
  * 
  * @copyright Matemat controller firmware
  * Copyright © 2015 Chaostreff Basel
@@ -31,8 +36,9 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-#include <base/callout/callout.h>
+#include "dispatch.h"
 #include "bank.h"
+#include "rate.h"
 
 /**
  * Error codes
@@ -42,6 +48,18 @@ typedef enum {
 	COIN_ERROR_ALARM,
 } coin_error_t;
 
+/**
+ * Coin decoder statistics
+ */
+typedef struct {
+	/** Pin changes that were outvoted */
+	uint16_t glitches;
+	/** Pulses that were too short, too long or had an unknown pattern */
+	uint16_t rejects;
+	/** Coins credited */
+	uint16_t coins;
+} coin_stats_t;
+
 /**
  * Coin acceptance event handler.
  * 
@@ -72,4 +90,28 @@ bool coin_init(struct callout_mgr *manager, coin_report_cb *report, coin_error_c
  */
 void coin_shutdown(void);
 
+/**
+ * Check whether the coin acceptor signals an alarm.
+ * @return true, if the alarm pin is active
+ */
+bool coin_alarm(void);
+
+/**
+ * Get the state of the coin acceptor pins, as decided by the majority vote.
+ * @return the pin states
+ */
+uint8_t coin_pins(void);
+
+/**
+ * Get the current polling period and the number of polls.
+ * @param stats storage for the statistics
+ */
+void coin_rate(rate_stats_t *stats);
+
+/**
+ * Get the glitch, reject and coin counters of the decoder.
+ * @param stats storage for the statistics
+ */
+void coin_stats(coin_stats_t *stats);
+
 #endif /*_COIN_H*/
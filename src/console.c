@@ -25,30 +25,53 @@
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 #include <aversive/irq_lock.h>
-#include <comm/uart/uart.h>
 #include <ihm/rdline/rdline.h>
 #include "led.h"
-#include "memory.h"
+#include "gpio.h"
+#include "slab.h"
+#include "util.h"
 #include "bill.h"
+#include "coin.h"
 #include "main.h"
 #include "bank.h"
+#include "clock.h"
+#include "sched.h"
+#include "args.h"
+#include "remote.h"
+#include "telemetry.h"
+#include "serial.h"
+#include "capture.h"
+#include "fmt.h"
+#include "top.h"
 
-/** I/O event type */
-typedef enum {
-	CONSOLE_EVENT_READ,
-	CONSOLE_EVENT_WRITE,
-	CONSOLE_EVENT_CLOSE,
-} console_event_e;
+#ifndef CONSOLE_RX_SIZE
+/** Size of the receive ring buffer (power of 2) */
+#define CONSOLE_RX_SIZE 128
+#endif
 
-/** I/O event object */
-typedef struct {
-	/** Event data (self-referenced) */
-	struct callout co;
-	/** Event type (direction) */
-	console_event_e type;
-	/** Payload */
-	char character;
-} console_event_t;
+static_assert((CONSOLE_RX_SIZE & (CONSOLE_RX_SIZE - 1)) == 0, "CONSOLE_RX_SIZE must be a power of 2");
+static_assert(CONSOLE_RX_SIZE <= 128, "CONSOLE_RX_SIZE must fit into the 8 bit ring indexes");
+static_assert(CONSOLE_RX_SIZE > RDLINE_BUF_SIZE, "CONSOLE_RX_SIZE must hold a full input line");
+
+#ifndef CONSOLE_RTS_MARGIN
+/** Free space in the receive ring buffer at which the host is stopped */
+#define CONSOLE_RTS_MARGIN 16
+#endif
+
+static_assert(CONSOLE_RTS_MARGIN < CONSOLE_RX_SIZE / 2, "CONSOLE_RTS_MARGIN must leave room for hysteresis");
+
+#ifndef CONSOLE_WATCH_RATE
+/** Default gpio watch sample rate (Hz) */
+#define CONSOLE_WATCH_RATE 20000
+#endif
+
+#ifndef CONSOLE_WATCH_POLL
+/** Capture streaming interval (ticks) */
+#define CONSOLE_WATCH_POLL 32
+#endif
+
+/** Transmit buffer space needed to stream a capture line, or the end line and the prompt */
+#define CONSOLE_WATCH_SPACE 64
 
 /** Console driver state object */
 typedef struct {
@@ -56,22 +79,46 @@ typedef struct {
 	struct callout_mgr *manager;
 	/** Command prompt */
 	char prompt[RDLINE_PROMPT_SIZE];
-	/** Standard input, output and error */
-	FILE stdinout;
 	/** Readline state */
 	struct rdline rdline;
-	/** Memory manager for the event queue */
-	memory_t *memory;
-	/** Managed memory pool */
-	uint8_t pool[MEMORY_POOL_SIZE(CONSOLE_QUEUE_SIZE, sizeof(console_event_t))];
+	/** Receive event, drains the ring buffer */
+	struct callout reader;
+	/** Set while the receive event is scheduled */
+	volatile bool pending;
+	/** Receive ring buffer write index (only modified by the UART interrupt) */
+	volatile uint8_t in;
+	/** Receive ring buffer read index (only modified by the receive event) */
+	volatile uint8_t out;
+	/** Receive ring buffer */
+	char rx[CONSOLE_RX_SIZE];
+	/** Characters dropped because the receive ring buffer was full */
+	volatile uint16_t overflows;
+	/** Set while the console is in machine mode */
+	bool machine;
+	/** Set while a batch session is open */
+	bool batch;
+	/** Number of characters in the batch line buffer, UINT8_MAX if the line is too long */
+	uint8_t length;
+	/** Batch line buffer */
+	char line[RDLINE_BUF_SIZE];
+	/** Set while a gpio watch capture is streamed */
+	bool watching;
+	/** Number of ports of the capture */
+	uint8_t ports;
+	/** Capture streaming event */
+	struct callout watcher;
+	/** Idle statistics at the last idle command */
+	main_idle_t idle;
+	/** Time of the last idle command */
+	time_t idle_time;
 } console_t;
 
 /**
  * Validate callback prototype
- * @param buf a 0-terminated string containing the command buffer
- * @param size the length of the command buffer
+ * @param args the parsed arguments
+ * @param count the number of arguments (between the required and specified number)
  */
-typedef void (validate_t)(const char *buf, uint8_t size);
+typedef void (validate_t)(const args_value_t *args, uint8_t count);
 
 /** Data structure describing a command, its arguments, help text and a handler */
 typedef struct {
@@ -81,14 +128,75 @@ typedef struct {
 	const char *help;
 	/** Pointer to a handler callback */
 	validate_t *validate;
+	/** Argument specification */
+	const args_spec_t *args;
+	/** Number of specified arguments */
+	uint8_t count;
+	/** Number of required arguments */
+	uint8_t required;
 } command_t;
 
-static int console_putc(char character, FILE *fp);
-static int console_getc(FILE *fp);
 static void console_read(char character);
 static void console_write(char character);
 static void console_callback(struct callout_mgr *cm, struct callout *tim, void *arg);
+/**
+ * Feed a received character to the line editor or the protocol handler.
+ * @param character the character
+ * @return false, if the character was not consumed and must be fed again later
+ */
+static bool console_input(char character);
+/**
+ * Resume reading input that was not consumed.
+ */
+static void console_resume(void);
+/**
+ * Show the login message after machine mode was left (protocol handler callback).
+ */
+static void console_exit(void);
+/**
+ * Append a character to the batch line buffer, and evaluate the line at its end.
+ * @param character the character
+ */
+static void console_batch(char character);
+/**
+ * Show the prompt and start the line editor, unless a batch session is open.
+ */
+static void console_prompt(void);
 static void console_validate(const char *buf, uint8_t size);
+/**
+ * Report an invalid argument and show the command help.
+ * @param argument the number of the invalid argument (from 1)
+ * @param help the help text (in program memory)
+ */
+static void console_invalid(int8_t argument, PGM_P help);
+/**
+ * Write a pin name, e.g. "A7".
+ * @param port the port letter
+ * @param pin the pin number
+ */
+static void console_pin(char port, uint8_t pin);
+/**
+ * Write the rest of a baud rate line with the flow control state.
+ */
+static void console_flow(void);
+/**
+ * Write a polling rate line.
+ * @param rate the polling rate statistics
+ */
+static void console_rate(const rate_stats_t *rate);
+/**
+ * Capture streaming event, prints the stored capture records
+ * @param cm the event queue manager
+ * @param tim the streaming event
+ * @param arg unused
+ */
+static void console_watch(struct callout_mgr *cm, struct callout *tim, void *arg);
+/**
+ * Start a gpio watch capture.
+ * @param args the parsed arguments (ports, duration, rate)
+ * @param count the number of arguments
+ */
+static void console_validate_gpio_watch(const args_value_t *args, uint8_t count);
 static int8_t console_complete(const char *buf, char *dstbuf, uint8_t dstsize, int16_t *state);
 /**
  * Find the first occurence of whitespace in buf.
@@ -108,155 +216,367 @@ static size_t console_whitespace(const char *buf, int16_t maxlen);
  * @return the number of tokens found
  */
 static size_t console_tokenize(const char *buf, int16_t maxlen, size_t arraylen, const char **tokens, size_t *lengths);
+
+static void console_validate_help(const args_value_t *args, uint8_t count);
+static void console_validate_gpio(const args_value_t *args, uint8_t count);
+static void console_validate_led(const args_value_t *args, uint8_t count);
+static void console_validate_exit(const args_value_t *args, uint8_t count);
+static void console_validate_machine(const args_value_t *args, uint8_t count);
+static void console_validate_bill(const args_value_t *args, uint8_t count);
+static void console_validate_reboot(const args_value_t *args, uint8_t count);
+static void console_validate_balance(const args_value_t *args, uint8_t count);
+static void console_validate_coin(const args_value_t *args, uint8_t count);
+static void console_validate_mem(const args_value_t *args, uint8_t count);
+static void console_validate_idle(const args_value_t *args, uint8_t count);
+static void console_validate_serial(const args_value_t *args, uint8_t count);
+static void console_validate_sched(const args_value_t *args, uint8_t count);
+static void console_validate_telemetry(const args_value_t *args, uint8_t count);
+static void console_validate_top(const args_value_t *args, uint8_t count);
 /**
- * Parse a fixed-point signed decimal number with 16 bits of precision to the
- * left of the decimal point and two decimal digits to the right.
- * 
- * May return 32767.99 on overflow or -32768.99 on underflow.
- * @param buf a string
- * @param maxlen the string length
- * @param left a pointer to storage for the left hand side of the decimal point
- * @param right a pointer to storage for the decimal digits
- * @return the number of processed characters
+ * Print a dispatch statistics histogram as a table row.
+ * @param name the row name (in program memory)
+ * @param priority the priority
+ * @param histogram the histogram buckets
  */
-static size_t console_decimal24(const char *buf, int16_t maxlen, int16_t *left, uint8_t *right);
-static uint8_t gpio_pins(char port);
-static bool gpio_pin(char port, uint8_t pin);
-static void gpio_port(char port, uint8_t pin, bool state);
-static void gpio_ddr(char port, uint8_t pin, bool state);
-
-static void console_validate_help(const char *buf, uint8_t size);
-static void console_validate_gpio(const char *buf, uint8_t size);
-static void console_validate_led(const char *buf, uint8_t size);
-static void console_validate_exit(const char *buf, uint8_t size);
-static void console_validate_bill(const char *buf, uint8_t size);
-static void console_validate_reboot(const char *buf, uint8_t size);
-static void console_validate_balance(const char *buf, uint8_t size);
-static void console_validate_coin(const char *buf, uint8_t size);
+static void console_sched_row(PGM_P name, uint8_t priority, const uint16_t *histogram);
+/**
+ * Print a dispatch statistics worst case record.
+ * @param name the record name (in program memory)
+ * @param worst the worst case record
+ */
+static void console_sched_worst(PGM_P name, const sched_worst_t *worst);
 
 /** @cond DOXYGEN_IGNORE */
-static const char MESSAGE_LOGIN[] PROGMEM = "\r\nPress return to open session\r\n";
+static const char MESSAGE_LOGIN[] PROGMEM = "\r\nPress return to open session, or ! for a batch session\r\n";
 static const char MESSAGE_WELCOME[] PROGMEM = "Matemat Controller (c) 2015 Chaostreff Basel\r\n";
 static const char COMMAND_NAME_BILL[] PROGMEM = "bill";
 static const char COMMAND_NAME_HELP[] PROGMEM = "help";
 static const char COMMAND_NAME_GPIO[] PROGMEM = "gpio";
 static const char COMMAND_NAME_LED[] PROGMEM = "led";
 static const char COMMAND_NAME_EXIT[] PROGMEM = "exit";
+static const char COMMAND_NAME_MACHINE[] PROGMEM = "machine";
 static const char COMMAND_NAME_REBOOT[] PROGMEM = "reboot";
 static const char COMMAND_NAME_BALANCE[] PROGMEM = "balance";
 static const char COMMAND_NAME_COIN[] PROGMEM = "coin";
-static const char COMMAND_HELP_HELP[] PROGMEM = "Matemat Controller (c) 2015 Chaostreff Basel\r\n\r\nCommands:\r\nhelp\r\ngpio\r\nled\r\nexit\r\nbill\r\nbalance\r\nreboot\r\n";
-static const char COMMAND_HELP_GPIO[] PROGMEM = "Usage: gpio [A-G] [0-7] [in, out, on, off]\r\nConfigures (in/out), sets the logic level (on/off) or displays the port status (only port name and optionally bit #) of a GPIO port\r\n";
+static const char COMMAND_NAME_MEM[] PROGMEM = "mem";
+static const char COMMAND_NAME_IDLE[] PROGMEM = "idle";
+static const char COMMAND_NAME_SCHED[] PROGMEM = "sched";
+static const char COMMAND_NAME_SERIAL[] PROGMEM = "serial";
+static const char COMMAND_NAME_TELEMETRY[] PROGMEM = "telemetry";
+static const char COMMAND_NAME_TOP[] PROGMEM = "top";
+static const char COMMAND_HELP_HELP[] PROGMEM = "Matemat Controller (c) 2015 Chaostreff Basel\r\n\r\nCommands:\r\nhelp\r\ngpio\r\nled\r\nexit\r\nbill\r\nbalance\r\ncoin\r\nmachine\r\nmem\r\nidle\r\nsched\r\nserial\r\ntelemetry\r\ntop\r\nreboot\r\n";
+static const char COMMAND_HELP_GPIO[] PROGMEM = "Usage: gpio [A-G] [0-7] [in, out, on, off]\r\n       gpio watch [A-G...] [seconds] [Hz]\r\nConfigures (in/out), sets the logic level (on/off) or displays the port status (only port name and optionally bit #) of a GPIO port,\r\nor records the changes of up to 4 ports at a sample rate of 100..50000Hz (default 20000) until the time is up or a key is pressed\r\n";
 static const char COMMAND_HELP_LED[] PROGMEM = "Usage: led [A,B,C] [on, off, toggle]\r\nSets the status of LED A, B or C\r\n";
 static const char COMMAND_HELP_EXIT[] PROGMEM = "Ends the terminal session\r\n";
-static const char COMMAND_HELP_BILL[] PROGMEM = "Usage: bill [inhibit, accept, escrow, direct]\r\nChecks the state of the banknote scanner (no arguments),\r\ninhibits/enables reception or enables/disables escrow mode\r\n";
+static const char COMMAND_HELP_MACHINE[] PROGMEM = "Usage: machine\r\nSwitches the console to the framed binary host protocol until the host sends an exit message\r\n";
+static const char COMMAND_HELP_BILL[] PROGMEM = "Usage: bill [inhibit, accept, escrow, direct]\r\nChecks the state and the pin sampling rate of the banknote scanner (no arguments),\r\ninhibits/enables reception or enables/disables escrow mode\r\n";
 static const char COMMAND_HELP_REBOOT[] PROGMEM = "Usage: reboot\r\n";
 static const char COMMAND_HELP_BALANCE[] PROGMEM = "Usage: balance [0.00]\r\nDisplays the current balance or sets it\r\n";
-static const char COMMAND_HELP_COIN[] PROGMEM = "Usage: coin\r\nDisplays the state of the coin acceptor\r\n";
+static const char COMMAND_HELP_COIN[] PROGMEM = "Usage: coin\r\nDisplays the state, the polling rate and the decoder counters of the coin acceptor\r\n";
+static const char COMMAND_HELP_MEM[] PROGMEM = "Usage: mem\r\nDisplays the occupancy of the event memory size classes and the usage per module\r\n";
+static const char COMMAND_HELP_SCHED[] PROGMEM = "Usage: sched [reset]\r\nDisplays (or clears) the event dispatch lateness and callback run time histograms in ticks per priority\r\n";
+static const char COMMAND_HELP_IDLE[] PROGMEM = "Usage: idle\r\nDisplays the CPU wakeups and event dispatches per second since the last call\r\n";
+static const char COMMAND_HELP_SERIAL[] PROGMEM = "Usage: serial [9600, 38400, 57600, 115200, 230400, 250000] [on, off]\r\nDisplays the console line statistics, or sets the baud rate and hardware flow control\r\n";
+static const char COMMAND_HELP_TELEMETRY[] PROGMEM = "Usage: telemetry\r\nDisplays the number of records sent and dropped on the telemetry stream, and how often the UART was saturated\r\n";
+static const char COMMAND_HELP_TOP[] PROGMEM = "Usage: top\r\nShows a full-screen status display (VT100) that is updated every second until a key is pressed\r\n";
+
+static const char KEYWORD_ACCEPT[] PROGMEM = "accept";
+static const char KEYWORD_DIRECT[] PROGMEM = "direct";
+static const char KEYWORD_ESCROW[] PROGMEM = "escrow";
+static const char KEYWORD_INHIBIT[] PROGMEM = "inhibit";
+static const char KEYWORD_IN[] PROGMEM = "in";
+static const char KEYWORD_OFF[] PROGMEM = "off";
+static const char KEYWORD_ON[] PROGMEM = "on";
+static const char KEYWORD_OUT[] PROGMEM = "out";
+static const char KEYWORD_TOGGLE[] PROGMEM = "toggle";
+static const char KEYWORD_WATCH[] PROGMEM = "watch";
+static const char KEYWORD_115200[] PROGMEM = "115200";
+static const char KEYWORD_230400[] PROGMEM = "230400";
+static const char KEYWORD_250000[] PROGMEM = "250000";
+static const char KEYWORD_38400[] PROGMEM = "38400";
+static const char KEYWORD_57600[] PROGMEM = "57600";
+static const char KEYWORD_9600[] PROGMEM = "9600";
+static const char KEYWORD_RESET[] PROGMEM = "reset";
+static const char KEYWORD_A[] PROGMEM = "a";
+static const char KEYWORD_B[] PROGMEM = "b";
+static const char KEYWORD_C[] PROGMEM = "c";
 /** @endcond */
 
-/* Sorted lexicographically by command */
+/** Banknote scanner modes, sorted lexicographically */
+typedef enum {
+	BILL_MODE_ACCEPT,
+	BILL_MODE_DIRECT,
+	BILL_MODE_ESCROW,
+	BILL_MODE_INHIBIT,
+} bill_mode_e;
+static PGM_P const KEYWORDS_BILL[] PROGMEM = { KEYWORD_ACCEPT, KEYWORD_DIRECT, KEYWORD_ESCROW, KEYWORD_INHIBIT };
+static const args_table_t TABLE_BILL PROGMEM = ARGS_TABLE(KEYWORDS_BILL);
+
+/** GPIO actions, sorted lexicographically */
+typedef enum {
+	GPIO_ACTION_IN,
+	GPIO_ACTION_OFF,
+	GPIO_ACTION_ON,
+	GPIO_ACTION_OUT,
+} gpio_action_e;
+static PGM_P const KEYWORDS_GPIO[] PROGMEM = { KEYWORD_IN, KEYWORD_OFF, KEYWORD_ON, KEYWORD_OUT };
+static const args_table_t TABLE_GPIO PROGMEM = ARGS_TABLE(KEYWORDS_GPIO);
+
+/** GPIO subcommands, sorted lexicographically */
+static PGM_P const KEYWORDS_GPIO_COMMAND[] PROGMEM = { KEYWORD_WATCH };
+static const args_table_t TABLE_GPIO_COMMAND PROGMEM = ARGS_TABLE(KEYWORDS_GPIO_COMMAND);
+
+/** LED names, in the order of led_name_e */
+static PGM_P const KEYWORDS_LED_NAME[] PROGMEM = { KEYWORD_A, KEYWORD_B, KEYWORD_C };
+static const args_table_t TABLE_LED_NAME PROGMEM = ARGS_TABLE(KEYWORDS_LED_NAME);
+static_assert(ARGS_COUNT(KEYWORDS_LED_NAME) == LED_MAX, "KEYWORDS_LED_NAME must contain all LEDs");
+
+/** LED actions, sorted lexicographically */
+typedef enum {
+	LED_ACTION_OFF,
+	LED_ACTION_ON,
+	LED_ACTION_TOGGLE,
+} led_action_e;
+static PGM_P const KEYWORDS_LED_ACTION[] PROGMEM = { KEYWORD_OFF, KEYWORD_ON, KEYWORD_TOGGLE };
+static const args_table_t TABLE_LED_ACTION PROGMEM = ARGS_TABLE(KEYWORDS_LED_ACTION);
+
+static PGM_P const KEYWORDS_SCHED[] PROGMEM = { KEYWORD_RESET };
+static const args_table_t TABLE_SCHED PROGMEM = ARGS_TABLE(KEYWORDS_SCHED);
+
+/** Baud rates, sorted lexicographically */
+static PGM_P const KEYWORDS_BAUD[] PROGMEM = { KEYWORD_115200, KEYWORD_230400, KEYWORD_250000, KEYWORD_38400, KEYWORD_57600, KEYWORD_9600 };
+static const uint32_t BAUD_RATES[] PROGMEM = { 115200, 230400, 250000, 38400, 57600, 9600 };
+static const args_table_t TABLE_BAUD PROGMEM = ARGS_TABLE(KEYWORDS_BAUD);
+static_assert(ARGS_COUNT(KEYWORDS_BAUD) == ARGS_COUNT(BAUD_RATES), "BAUD_RATES must contain one rate per keyword");
+
+/** Switch states, sorted lexicographically */
+static PGM_P const KEYWORDS_SWITCH[] PROGMEM = { KEYWORD_OFF, KEYWORD_ON };
+static const args_table_t TABLE_SWITCH PROGMEM = ARGS_TABLE(KEYWORDS_SWITCH);
+
+static const args_spec_t ARGS_BALANCE[] PROGMEM = { { ARGS_DECIMAL, NULL } };
+static const args_spec_t ARGS_BILL[] PROGMEM = { { ARGS_KEYWORD, &TABLE_BILL } };
+/* The gpio words are parsed again by the handler, with the specification selected by the first one */
+static const args_spec_t ARGS_GPIO[] PROGMEM = { { ARGS_WORD, NULL }, { ARGS_WORD, NULL }, { ARGS_WORD, NULL }, { ARGS_WORD, NULL } };
+static const args_spec_t ARGS_GPIO_PIN[] PROGMEM = { { ARGS_PORT, NULL }, { ARGS_PIN, NULL }, { ARGS_KEYWORD, &TABLE_GPIO } };
+static const args_spec_t ARGS_GPIO_WATCH[] PROGMEM = { { ARGS_PORTS, NULL }, { ARGS_DECIMAL, NULL }, { ARGS_NUMBER, NULL } };
+static const args_spec_t ARGS_HELP[] PROGMEM = { { ARGS_WORD, NULL } };
+static const args_spec_t ARGS_LED[] PROGMEM = { { ARGS_KEYWORD, &TABLE_LED_NAME }, { ARGS_KEYWORD, &TABLE_LED_ACTION } };
+static const args_spec_t ARGS_SCHED[] PROGMEM = { { ARGS_KEYWORD, &TABLE_SCHED } };
+static const args_spec_t ARGS_SERIAL[] PROGMEM = { { ARGS_KEYWORD, &TABLE_BAUD }, { ARGS_KEYWORD, &TABLE_SWITCH } };
+
+/* Sorted lexicographically by command (binary search) */
 static const command_t COMMANDS[] PROGMEM = {
-	{ COMMAND_NAME_BALANCE, COMMAND_HELP_BALANCE, console_validate_balance },
-	{ COMMAND_NAME_BILL, COMMAND_HELP_BILL, console_validate_bill },
-	{ COMMAND_NAME_COIN, COMMAND_HELP_COIN, console_validate_coin },
-	{ COMMAND_NAME_EXIT, COMMAND_HELP_EXIT, console_validate_exit },
-	{ COMMAND_NAME_HELP, COMMAND_HELP_HELP, console_validate_help },
-	{ COMMAND_NAME_GPIO, COMMAND_HELP_GPIO, console_validate_gpio },
-	{ COMMAND_NAME_LED, COMMAND_HELP_LED, console_validate_led },
-	{ COMMAND_NAME_REBOOT, COMMAND_HELP_REBOOT, console_validate_reboot },
+	{ COMMAND_NAME_BALANCE, COMMAND_HELP_BALANCE, console_validate_balance, ARGS_BALANCE, ARGS_COUNT(ARGS_BALANCE), 0 },
+	{ COMMAND_NAME_BILL, COMMAND_HELP_BILL, console_validate_bill, ARGS_BILL, ARGS_COUNT(ARGS_BILL), 0 },
+	{ COMMAND_NAME_COIN, COMMAND_HELP_COIN, console_validate_coin, NULL, 0, 0 },
+	{ COMMAND_NAME_EXIT, COMMAND_HELP_EXIT, console_validate_exit, NULL, 0, 0 },
+	{ COMMAND_NAME_GPIO, COMMAND_HELP_GPIO, console_validate_gpio, ARGS_GPIO, ARGS_COUNT(ARGS_GPIO), 1 },
+	{ COMMAND_NAME_HELP, COMMAND_HELP_HELP, console_validate_help, ARGS_HELP, ARGS_COUNT(ARGS_HELP), 0 },
+	{ COMMAND_NAME_IDLE, COMMAND_HELP_IDLE, console_validate_idle, NULL, 0, 0 },
+	{ COMMAND_NAME_LED, COMMAND_HELP_LED, console_validate_led, ARGS_LED, ARGS_COUNT(ARGS_LED), 2 },
+	{ COMMAND_NAME_MACHINE, COMMAND_HELP_MACHINE, console_validate_machine, NULL, 0, 0 },
+	{ COMMAND_NAME_MEM, COMMAND_HELP_MEM, console_validate_mem, NULL, 0, 0 },
+	{ COMMAND_NAME_REBOOT, COMMAND_HELP_REBOOT, console_validate_reboot, NULL, 0, 0 },
+	{ COMMAND_NAME_SCHED, COMMAND_HELP_SCHED, console_validate_sched, ARGS_SCHED, ARGS_COUNT(ARGS_SCHED), 0 },
+	{ COMMAND_NAME_SERIAL, COMMAND_HELP_SERIAL, console_validate_serial, ARGS_SERIAL, ARGS_COUNT(ARGS_SERIAL), 0 },
+	{ COMMAND_NAME_TELEMETRY, COMMAND_HELP_TELEMETRY, console_validate_telemetry, NULL, 0, 0 },
+	{ COMMAND_NAME_TOP, COMMAND_HELP_TOP, console_validate_top, NULL, 0, 0 },
 };
 
 static console_t console_global  __attribute__((section (".noinit")));
 
 bool console_init(struct callout_mgr *manager, const char *prompt) {
-	console_global.memory = memory_init(console_global.pool, sizeof(console_global.pool), sizeof(console_event_t));
-	if (console_global.memory) {
-		console_global.manager = manager;
-		
-		strncpy(console_global.prompt, prompt, sizeof(console_global.prompt));
-		
-		uart_setconf(CONSOLE_UART, NULL);
-		
-		fdev_setup_stream(&console_global.stdinout, console_putc, console_getc, _FDEV_SETUP_RW);
-		stdin = &console_global.stdinout;
-		stdout = &console_global.stdinout;
-		stderr = &console_global.stdinout;
-		
-		// Welcome message
-		printf_P(MESSAGE_WELCOME);
-		
-		uart_register_rx_event(CONSOLE_UART, console_read);
-
-		rdline_init(&console_global.rdline, console_write, console_validate, console_complete);
-		//rdline_newline(&console_global.rdline, console_global.prompt);
-		rdline_stop(&console_global.rdline);
-		printf_P(MESSAGE_LOGIN);
-		
-		return true;
-	}
-	return false;
+	console_global.manager = manager;
+	
+	strncpy(console_global.prompt, prompt, sizeof(console_global.prompt));
+	
+	console_global.pending = false;
+	console_global.in = 0;
+	console_global.out = 0;
+	console_global.overflows = 0;
+	console_global.machine = false;
+	console_global.batch = false;
+	console_global.watching = false;
+	callout_init(&console_global.reader, console_callback, NULL, CONSOLE_PRIORITY);
+	callout_init(&console_global.watcher, console_watch, NULL, CONSOLE_PRIORITY);
+	capture_init();
+	top_init(manager);
+	remote_init(manager, console_resume, console_exit);
+	serial_init(manager, console_read);
+	
+	// Welcome message
+	fmt_P(MESSAGE_WELCOME);
+	
+	main_get_idle(&console_global.idle);
+	console_global.idle_time = time(NULL);
+	
+
+	rdline_init(&console_global.rdline, console_write, console_validate, console_complete);
+	//rdline_newline(&console_global.rdline, console_global.prompt);
+	rdline_stop(&console_global.rdline);
+	fmt_P(MESSAGE_LOGIN);
+	
+	return true;
 }
 
 void console_shutdown(void) {
+	capture_stop();
+	top_stop();
 	rdline_stop(&console_global.rdline);
+	serial_shutdown();
 }
 
 void console_read(char character) {
-	uint8_t flags;
-	IRQ_LOCK(flags);
-	console_event_t *event = (console_event_t *) memory_allocate(console_global.memory);
-	IRQ_UNLOCK(flags);
-	if (event) {
-		event->type = CONSOLE_EVENT_READ;
-		event->character = character;
-		callout_init(&event->co, console_callback, event, CONSOLE_PRIORITY);
-		callout_schedule(console_global.manager, &event->co, 0);
+	// Called from the UART interrupt: single producer, the receive event is the only consumer
+	uint8_t in = console_global.in;
+	uint8_t used = in - console_global.out;
+	if (used < CONSOLE_RX_SIZE) {
+		console_global.rx[in & (CONSOLE_RX_SIZE - 1)] = character;
+		console_global.in = in + 1;
+		if (used + 1 >= CONSOLE_RX_SIZE - CONSOLE_RTS_MARGIN) {
+			// Stop the host early, it may still send a few characters
+			serial_rx_ready(false);
+		}
+	} else if (console_global.overflows < UINT16_MAX) {
+		console_global.overflows++;
+	}
+	if (!console_global.pending) {
+		console_global.pending = true;
+		callout_schedule(console_global.manager, &console_global.reader, 0);
 	}
 }
 
-int console_putc(char character, FILE *fp) {
-	console_write(character);
-	return character;
+void console_write(char character) {
+	serial_send(character);
 }
 
-int console_getc(FILE *fp) {
-	return uart_recv_nowait(CONSOLE_UART);
+void console_callback(struct callout_mgr *cm, struct callout *tim, void *arg) {
+	// Clear first, so characters arriving while draining schedule another run
+	console_global.pending = false;
+	uint8_t out = console_global.out;
+	while (out != console_global.in) {
+		char character = console_global.rx[out & (CONSOLE_RX_SIZE - 1)];
+		if (!console_input(character)) {
+			// Leave the character in the ring buffer, console_resume() schedules another run
+			break;
+		}
+		console_global.out = ++out;
+	}
+	// Let the host continue once half of the ring buffer is free (hysteresis)
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	if ((uint8_t) (console_global.in - out) <= CONSOLE_RX_SIZE / 2) {
+		serial_rx_ready(true);
+	}
+	IRQ_UNLOCK(flags);
 }
 
-void console_write(char character) {
-	//if (character == '\n') uart_send_nowait(CONSOLE_UART, '\r');
-	uart_send_nowait(CONSOLE_UART, character);
+void console_exit(void) {
+	console_global.machine = false;
+	fmt_P(MESSAGE_LOGIN);
+	console_resume();
 }
 
-void console_callback(struct callout_mgr *cm, struct callout *tim, void *arg) {
-	if (arg) {
-		console_event_t *priv = (console_event_t *) arg;
-		if (priv->type == CONSOLE_EVENT_READ) {
+void console_resume(void) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	if (!console_global.pending) {
+		console_global.pending = true;
+		callout_schedule(console_global.manager, &console_global.reader, 0);
+	}
+	IRQ_UNLOCK(flags);
+}
+
+bool console_input(char character) {
+	// In a batch session, the line end of the starting command is no key, and
+	// the key is the first character of the next command
+	bool key = !console_global.batch || (character != '\r' && character != '\n');
+	if (console_global.watching) {
+		// Any key ends the capture, the streaming event prints the rest
+		if (key) {
+			capture_stop();
+		}
+		// Hold the next command back until the end line, console_watch() resumes
+		return !(key && console_global.batch);
+	}
+	if (top_active()) {
+		// Any key closes the dashboard
+		if (!key) {
+			return true;
+		}
+		top_stop();
+		console_prompt();
+		if (!console_global.batch) {
+			return true;
+		}
+	}
+	if (console_global.machine) {
+		if (!remote_active()) {
+			// Hold the input back until the login message was shown, console_exit() resumes
+			return false;
+		}
+		switch (remote_input(character)) {
+			case REMOTE_INPUT_BUSY:
+				return false;
+			case REMOTE_INPUT_EXIT:
+				// console_exit() shows the login message after the last response
+				remote_stop();
+				break;
+			default:
+				break;
+		}
+	} else if (console_global.batch) {
+		console_batch(character);
+	} else if (console_global.rdline.status == RDLINE_RUNNING) {
+		int8_t ret = rdline_char_in(&console_global.rdline, character);
+		if (ret == 1) {
+			// Evaluate again so the prompt isn't shown when the user exits
 			if (console_global.rdline.status == RDLINE_RUNNING) {
-				int8_t ret = rdline_char_in(&console_global.rdline, priv->character);
-				if (ret == 1) {
-					// Evaluate again so the prompt isn't shown when the user exits
-					if (console_global.rdline.status == RDLINE_RUNNING) {
-						rdline_newline(&console_global.rdline, console_global.prompt);
-					}
-				} else if (ret == -2) {
-					rdline_stop(&console_global.rdline);
-					printf_P(MESSAGE_LOGIN);
-				}
-			} else {
-				if (priv->character == '\r' || priv->character == '\n') {
-					printf_P(MESSAGE_WELCOME);
-					printf_P(PSTR("# of commands: %u\r\n"), sizeof(COMMANDS) / sizeof(COMMANDS[0]));
-					rdline_restart(&console_global.rdline);
-					rdline_newline(&console_global.rdline, console_global.prompt);
-				}
+				rdline_newline(&console_global.rdline, console_global.prompt);
 			}
-		} else if (priv->type == CONSOLE_EVENT_CLOSE) {
+		} else if (ret == -2) {
 			rdline_stop(&console_global.rdline);
-			printf_P(MESSAGE_LOGIN);
+			fmt_P(MESSAGE_LOGIN);
+		}
+	} else {
+		if (character == '\r' || character == '\n') {
+			fmt_P(MESSAGE_WELCOME);
+			fmt_P(PSTR("# of commands: "));
+			fmt_uint(ARGS_COUNT(COMMANDS), 0);
+			fmt_eol();
+			rdline_restart(&console_global.rdline);
+			rdline_newline(&console_global.rdline, console_global.prompt);
+		} else if (character == '!') {
+			// No banner and no prompt, the output carries only the responses
+			console_global.batch = true;
+			console_global.length = 0;
 		}
-		memory_release(arg);
+	}
+	return true;
+}
+
+void console_batch(char character) {
+	if (character == '\r' || character == '\n') {
+		if (console_global.length == UINT8_MAX) {
+			fmt_P(PSTR("Line too long\r\n"));
+		} else if (console_global.length > 0) {
+			console_global.line[console_global.length] = '\0';
+			console_validate(console_global.line, console_global.length);
+		}
+		// The line feed of a CR LF pair ends an empty line, which is ignored
+		console_global.length = 0;
+	} else if (console_global.length < sizeof(console_global.line) - 1) {
+		console_global.line[console_global.length++] = character;
+	} else {
+		// Discard the rest of the line
+		console_global.length = UINT8_MAX;
+	}
+}
+
+void console_prompt(void) {
+	if (!console_global.batch) {
+		rdline_restart(&console_global.rdline);
+		rdline_newline(&console_global.rdline, console_global.prompt);
 	}
 }
 
@@ -273,7 +593,7 @@ size_t console_whitespace(const char *buf, int16_t maxlen) {
 
 size_t console_tokenize(const char *buf, int16_t maxlen, size_t arraylen, const char **tokens, size_t *lengths) {
 	size_t i;
-	for (i = 0; *buf && maxlen != 0; i++) {
+	for (i = 0; *buf && maxlen != 0 && i < arraylen; i++) {
 		tokens[i] = buf;
 		size_t ws = console_whitespace(buf, maxlen);
 		if (ws < maxlen) {
@@ -289,388 +609,488 @@ size_t console_tokenize(const char *buf, int16_t maxlen, size_t arraylen, const
 	return i;
 }
 
-size_t console_decimal24(const char *buf, int16_t maxlen, int16_t *left, uint8_t *right) {
-	if (buf && maxlen > 0) {
-		size_t i = 0;
-		bool negative = false;
-		if (maxlen > i) {
-			if (buf[i] == '-') {
-				negative = true;
-				i++;
-			}
-			if (buf[i] == '+') {
-				i++;
-			}
-		}
-		int16_t v = 0;
-		while (maxlen > i && buf[i] != '.') {
-			if (buf[i] >= '0' && buf[i] <= '9') {
-				uint8_t digit = buf[i] - '0';
-				if (v >= 3276) {
-					if (negative) {
-						if (digit > 7) {
-							// Overflow, stop parsing
-							*left = 32767;
-							*right = 99;
-							return i + 1;
-						}
-					} else {
-						if (digit > 8) {
-							// Underflow, stop parsing
-							*left = -32768;
-							*right = 99;
-							return i + 1;
-						}
-					}
-				}
-				v *= 10;
-				i++;
-			}
-		}
-		uint8_t d = 0;
-		if (maxlen > i + 1 && buf[i] == '.') {
-			i++;
-			if (buf[i] >= '0' && buf[i] <= '9') {
-				d = (buf[i] - '0') * 10;
-				i++;
-				if (maxlen > i && buf[i] == '.') {
-					if (buf[i] >= '0' && buf[i] <= '9') {
-						d += buf[i] - '0';
-						i++;
-					}
-				}
+void console_validate(const char *buf, uint8_t size) {
+	// One more token than arguments, to detect surplus arguments
+	const char *tokens[ARGS_MAX + 2];
+	size_t lengths[ARGS_MAX + 2];
+	size_t count = console_tokenize(buf, size, ARGS_MAX + 2, tokens, lengths);
+	if (count > 0) {
+		int16_t index = args_search(COMMANDS, ARGS_COUNT(COMMANDS), sizeof(COMMANDS[0]), tokens[0], lengths[0]);
+		if (index >= 0) {
+			const command_t *command = &COMMANDS[index];
+			args_value_t args[ARGS_MAX];
+			int8_t parsed = args_parse(
+				(const args_spec_t *) pgm_read_ptr(&command->args),
+				pgm_read_byte(&command->count),
+				pgm_read_byte(&command->required),
+				tokens + 1, lengths + 1, count - 1, args
+			);
+			if (parsed >= 0) {
+				validate_t *validate = (validate_t *) pgm_read_ptr(&command->validate);
+				validate(args, parsed);
+			} else {
+				console_invalid(-parsed, (PGM_P) pgm_read_ptr(&command->help));
 			}
-		}
-		if (negative) {
-			*left = -v;
 		} else {
-			*left = v;
+			fmt_P(PSTR("Unknown command\r\n"));
 		}
-		*right = d;
-		return i;
 	}
-	*left = 0;
-	*right = 0;
-	return 0;
 }
 
-void console_validate(const char *buf, uint8_t size) {
-	//printf_P(PSTR("Validating '%s'\n"), buf);
-	size_t ws = console_whitespace(buf, size);
-	//printf_P(PSTR("Whitespace at %d\r\n"), ws);
-	if (ws > 0) {
-		// TODO Do a binary search instead of a linear search
-		size_t i;
-		for (i = 0; i < sizeof(COMMANDS) / sizeof(COMMANDS[0]); i++) {
-			PGM_P command = (PGM_P) pgm_read_ptr(&COMMANDS[i].command);
-			//printf_P(PSTR("Comparing %u characters of '%s' against '%S'\r\n"), ws, buf, command);
-			if (strncmp_P(buf, command, ws) == 0) {
-				//printf_P(PSTR("Found command %S\r\n"), command);
-				validate_t *validate = (validate_t *) pgm_read_ptr(&COMMANDS[i].validate);
-				validate(buf, size);
-				//rdline_add_history(&console_global.rdline, buf);
-				return;
-			}
-		}
-	}
+void console_invalid(int8_t argument, PGM_P help) {
+	fmt_P(PSTR("Invalid argument "));
+	fmt_int(argument, 0);
+	fmt_eol();
+	fmt_P(help);
 }
 
-void console_validate_help(const char *buf, uint8_t size) {
-	const char *arguments[2];
-	size_t lengths[2];
-	size_t count = console_tokenize(buf, size, 2, arguments, lengths);
-	if (count == 1) {
-		printf_P(COMMAND_HELP_HELP);
-	} else if (count == 2) {
-		// TODO Do a binary search instead of a linear search
-		size_t i;
-		for (i = 0; i < sizeof(COMMANDS) / sizeof(COMMANDS[0]); i++) {
-			PGM_P command = (PGM_P) pgm_read_ptr(&COMMANDS[i].command);
-			if (strncmp_P(arguments[1], command, lengths[1]) == 0) {
-				printf_P((PGM_P) pgm_read_ptr(&COMMANDS[i].help));
-			}
-		}
-	}
+void console_pin(char port, uint8_t pin) {
+	fmt_char(port);
+	fmt_char('0' + pin);
 }
 
-uint8_t gpio_pins(char port) {
-	switch (port) {
-		case 'A':
-			return PINA;
-		case 'B':
-			return PINB;
-		case 'C':
-			return PINC;
-		case 'D':
-			return PIND;
-		case 'E':
-			return PINE;
-		case 'F':
-			return PINF;
-		case 'G':
-			return PING;
-	}
-	return 0;
+void console_flow(void) {
+	fmt_P(PSTR(" baud, flow control "));
+	fmt_P(serial_flow() ? PSTR("on\r\n") : PSTR("off\r\n"));
 }
 
-bool gpio_pin(char port, uint8_t pin) {
-	return (gpio_pins(port) & _BV(pin)) != 0;
+void console_validate_help(const args_value_t *args, uint8_t count) {
+	if (count == 0) {
+		fmt_P(COMMAND_HELP_HELP);
+	} else {
+		int16_t index = args_search(COMMANDS, ARGS_COUNT(COMMANDS), sizeof(COMMANDS[0]), args[0].word.buf, args[0].word.length);
+		if (index >= 0) {
+			fmt_P((PGM_P) pgm_read_ptr(&COMMANDS[index].help));
+		}
+	}
 }
 
-void gpio_port(char port, uint8_t pin, bool state) {
-	switch (port) {
-		case 'A':
-			if (state) PORTA |= _BV(pin); else PORTA &= _BV(pin);
-			break;
-		case 'B':
-			if (state) PORTB |= _BV(pin); else PORTB &= _BV(pin);
-			break;
-		case 'C':
-			if (state) PORTC |= _BV(pin); else PORTC &= _BV(pin);
-			break;
-		case 'D':
-			if (state) PORTD |= _BV(pin); else PORTD &= _BV(pin);
-			break;
-		case 'E':
-			if (state) PORTE |= _BV(pin); else PORTE &= _BV(pin);
-			break;
-		case 'F':
-			if (state) PORTF |= _BV(pin); else PORTF &= _BV(pin);
-			break;
-		case 'G':
-			if (state) PORTG |= _BV(pin); else PORTG &= _BV(pin);
-			break;
+void console_validate_gpio(const args_value_t *args, uint8_t count) {
+	const char *tokens[ARGS_MAX];
+	size_t lengths[ARGS_MAX];
+	uint8_t i;
+	for (i = 0; i < count; i++) {
+		tokens[i] = args[i].word.buf;
+		lengths[i] = args[i].word.length;
+	}
+	// Port letters are no prefix of a subcommand, so the first word decides
+	bool watch = args_lookup(&TABLE_GPIO_COMMAND, tokens[0], lengths[0]) == 0;
+	args_value_t values[ARGS_MAX];
+	int8_t parsed;
+	if (watch) {
+		parsed = args_parse(ARGS_GPIO_WATCH, ARGS_COUNT(ARGS_GPIO_WATCH), 2, tokens + 1, lengths + 1, count - 1, values);
+	} else {
+		parsed = args_parse(ARGS_GPIO_PIN, ARGS_COUNT(ARGS_GPIO_PIN), 1, tokens, lengths, count, values);
+	}
+	if (parsed < 0) {
+		console_invalid(watch ? 1 - parsed : -parsed, COMMAND_HELP_GPIO);
+		return;
+	}
+	if (watch) {
+		console_validate_gpio_watch(values, parsed);
+		return;
+	}
+	args = values;
+	count = parsed;
+
+	char port = args[0].port;
+	if (count == 1) {
+		uint8_t pins = gpio_pins(port);
+		char portb[9];
+		uint8_t i;
+		for (i = 0; i < 8; i++) {
+			portb[i] = (pins & (0x80 >> i)) ? '1' : '0';
+		}
+		portb[8] = '\0';
+		fmt_P(PSTR("Status of GPIO port "));
+		fmt_char(port);
+		fmt_P(PSTR(" is "));
+		fmt_str(portb);
+		fmt_eol();
+	} else {
+		uint8_t pin = args[1].pin;
+		if (count == 2) {
+			fmt_P(PSTR("Status of GPIO pin "));
+			console_pin(port, pin);
+			fmt_P(PSTR(" is "));
+			fmt_P(gpio_pin(port, pin) ? PSTR("high\r\n") : PSTR("low\r\n"));
+		} else {
+			switch (args[2].index) {
+				case GPIO_ACTION_ON:
+					fmt_P(PSTR("Turning GPIO pin "));
+					console_pin(port, pin);
+					fmt_P(PSTR(" on\r\n"));
+					gpio_port(port, pin, true);
+					break;
+				case GPIO_ACTION_OFF:
+					fmt_P(PSTR("Turning GPIO pin "));
+					console_pin(port, pin);
+					fmt_P(PSTR(" off\r\n"));
+					gpio_port(port, pin, false);
+					break;
+				case GPIO_ACTION_IN:
+					fmt_P(PSTR("Setting GPIO pin "));
+					console_pin(port, pin);
+					fmt_P(PSTR(" direction to input\r\n"));
+					gpio_ddr(port, pin, false);
+					break;
+				case GPIO_ACTION_OUT:
+					fmt_P(PSTR("Setting GPIO pin "));
+					console_pin(port, pin);
+					fmt_P(PSTR(" direction to output\r\n"));
+					gpio_ddr(port, pin, true);
+					break;
+			}
+		}
 	}
 }
 
-void gpio_ddr(char port, uint8_t pin, bool state) {
-	switch (port) {
-		case 'A':
-			if (state) DDRA |= _BV(pin); else DDRA &= _BV(pin);
-			break;
-		case 'B':
-			if (state) DDRB |= _BV(pin); else DDRB &= _BV(pin);
-			break;
-		case 'C':
-			if (state) DDRC |= _BV(pin); else DDRC &= _BV(pin);
-			break;
-		case 'D':
-			if (state) DDRD |= _BV(pin); else DDRD &= _BV(pin);
-			break;
-		case 'E':
-			if (state) DDRE |= _BV(pin); else DDRE &= _BV(pin);
-			break;
-		case 'F':
-			if (state) DDRF |= _BV(pin); else DDRF &= _BV(pin);
-			break;
-		case 'G':
-			if (state) DDRG |= _BV(pin); else DDRG &= _BV(pin);
-			break;
+void console_validate_gpio_watch(const args_value_t *args, uint8_t count) {
+	uint8_t ports = args[0].ports;
+	uint16_t rate = count > 2 ? args[2].number : CONSOLE_WATCH_RATE;
+	int16_t seconds = args[1].decimal.left;
+	uint32_t duration = seconds < 0 ? 0 : (uint32_t) seconds * 1000 + args[1].decimal.right * 10;
+	uint16_t actual = capture_start(ports, rate, duration);
+	if (actual == 0) {
+		fmt_P(PSTR("Invalid capture settings\r\n"));
+		fmt_P(COMMAND_HELP_GPIO);
+		return;
 	}
+	// Stop the line editor, so no prompt is shown until the capture has been streamed
+	rdline_stop(&console_global.rdline);
+	console_global.watching = true;
+	console_global.ports = 0;
+	fmt_P(PSTR("capture "));
+	uint8_t i;
+	for (i = 0; i < 7; i++) {
+		if (ports & _BV(i)) {
+			fmt_char('A' + i);
+			console_global.ports++;
+		}
+	}
+	fmt_char(' ');
+	fmt_uint(actual, 0);
+	fmt_P(PSTR(" Hz\r\n"));
+	callout_schedule(console_global.manager, &console_global.watcher, CONSOLE_WATCH_POLL);
 }
 
-void console_validate_gpio(const char *buf, uint8_t size) {
-	const char *arguments[4];
-	size_t lengths[4];
-	size_t count = console_tokenize(buf, size, 4, arguments, lengths);
-	if (count == 2) {
-		if (((arguments[1][0] >= 'a' && arguments[1][0] <= 'g') || (arguments[1][0] >= 'A' && arguments[1][0] <= 'G')) && lengths[1] == 1) {
-			char port;
-			if (arguments[1][0] >= 'a' && arguments[1][0] <= 'g') {
-				port = arguments[1][0] - 'a' + 'A';
-			} else {
-				port = arguments[1][0];
-			}
-			uint8_t pins = gpio_pins(port);
-			char portb[9];
-			uint8_t i;
-			for (i = 0; i < 8; i++) {
-				portb[i] = (pins & (0x80 >> i)) ? '1' : '0';
+void console_watch(struct callout_mgr *cm, struct callout *tim, void *arg) {
+	// Checked first, so all records stored before the end are printed before the end line
+	bool done = !capture_active();
+	capture_record_t record;
+	while (serial_tx_free() >= CONSOLE_WATCH_SPACE) {
+		if (!capture_read(&record)) {
+			if (!done) {
+				break;
 			}
-			portb[8] = '\0';
-			printf_P(PSTR("Status of GPIO port %c is %s\r\n"), port, portb);
+			capture_result_t result;
+			capture_result(&result);
+			fmt_P(PSTR("end "));
+			fmt_uint(result.samples, 0);
+			fmt_P(result.truncated ? PSTR(" samples truncated\r\n") : PSTR(" samples\r\n"));
+			console_global.watching = false;
+			console_prompt();
+			console_resume();
+			return;
 		}
-	} else if (count >= 3) {
-		if (arguments[2][0] >= '0' && arguments[2][0] <= '7' && lengths[2] == 1) {
-			char pin = arguments[2][0] - '0';
-			if (((arguments[1][0] >= 'a' && arguments[1][0] <= 'g') || (arguments[1][0] >= 'A' && arguments[1][0] <= 'G')) && lengths[1] == 1) {
-				char port;
-				if (arguments[1][0] >= 'a' && arguments[1][0] <= 'g') {
-					port = arguments[1][0] - 'a' + 'A';
-				} else {
-					port = arguments[1][0];
-				}
-				if (count == 3) {
-					printf_P(PSTR("Status of GPIO pin %c%u is %S\r\n"), port, pin, gpio_pin(port, pin) ? PSTR("high") : PSTR("low"));
-				} else {
-					uint8_t flags;
-					if (strncasecmp_P(arguments[3], PSTR("on"), lengths[3]) == 0) {
-						printf_P(PSTR("Turning GPIO pin %c%u on\r\n"), port, pin);
-						IRQ_LOCK(flags);
-						gpio_port(port, pin, true);
-						IRQ_UNLOCK(flags);
-					} else if (strncasecmp_P(arguments[3], PSTR("off"), lengths[3]) == 0) {
-						printf_P(PSTR("Turning GPIO pin %c%u off\r\n"), port, pin);
-						IRQ_LOCK(flags);
-						gpio_port(port, pin, false);
-						IRQ_UNLOCK(flags);
-					} else if (strncasecmp_P(arguments[3], PSTR("in"), lengths[3]) == 0) {
-						printf_P(PSTR("Setting GPIO pin %c%u direction to input\r\n"), port, pin);
-						IRQ_LOCK(flags);
-						gpio_ddr(port, pin, false);
-						IRQ_UNLOCK(flags);
-					} else if (strncasecmp_P(arguments[3], PSTR("out"), lengths[3]) == 0) {
-						printf_P(PSTR("Setting GPIO pin %c%u direction to output\r\n"), port, pin);
-						IRQ_LOCK(flags);
-						gpio_ddr(port, pin, true);
-						IRQ_UNLOCK(flags);
-					}
-				}
-			}
+		fmt_hex(record.time, 4);
+		fmt_char(' ');
+		uint8_t i;
+		for (i = 0; i < console_global.ports; i++) {
+			fmt_hex(record.pins[i], 2);
 		}
+		fmt_eol();
 	}
+	callout_schedule(cm, tim, CONSOLE_WATCH_POLL);
 }
 
-void console_validate_led(const char *buf, uint8_t size) {
-	const char *arguments[3];
-	size_t lengths[3];
-	size_t count = console_tokenize(buf, size, 3, arguments, lengths);
-	if (count == 3) {
-		printf_P(PSTR("Turning LED "));
-		led_name_e led;
-		if (strncasecmp_P(arguments[1], PSTR("A"), lengths[1]) == 0) {
-			printf_P(PSTR("A "));
-			led = LED_A;
-		} else if (strncasecmp_P(arguments[1], PSTR("B"), lengths[1]) == 0) {
-			printf_P(PSTR("B "));
-			led = LED_B;
-		} else if (strncasecmp_P(arguments[1], PSTR("C"), lengths[1]) == 0) {
-			printf_P(PSTR("C "));
-			led = LED_C;
-		} else {
-			printf_P(PSTR("oops\r\n"));
-			return;
-		}
-		led_event_type_e action;
-		if (strncasecmp_P(arguments[2], PSTR("on"), lengths[2]) == 0) {
-			printf_P(PSTR("on\r\n"));
+void console_validate_led(const args_value_t *args, uint8_t count) {
+	led_name_e led = args[0].index;
+	led_event_type_e action;
+	PGM_P description;
+	switch (args[1].index) {
+		case LED_ACTION_ON:
 			action = LED_EVENT_TYPE_ON;
-		} else if (strncasecmp_P(arguments[2], PSTR("off"), lengths[2]) == 0) {
-			printf_P(PSTR("off\r\n"));
+			description = PSTR("on");
+			break;
+		case LED_ACTION_OFF:
 			action = LED_EVENT_TYPE_OFF;
-		} else if (strncasecmp_P(arguments[2], PSTR("toggle"), lengths[2]) == 0) {
-			printf_P(PSTR("around\r\n"));
+			description = PSTR("off");
+			break;
+		default:
 			action = LED_EVENT_TYPE_TOGGLE;
-		} else {
-			printf_P(PSTR("oops\r\n"));
-			return;
-		}
-		led_action(led, action);
+			description = PSTR("around");
+			break;
 	}
+	fmt_P(PSTR("Turning LED "));
+	fmt_char('A' + led);
+	fmt_char(' ');
+	fmt_P(description);
+	fmt_eol();
+	led_action(led, action);
 }
 
-void console_validate_bill(const char *buf, uint8_t size) {
-	const char *arguments[2];
-	size_t lengths[2];
-	size_t count = console_tokenize(buf, size, 2, arguments, lengths);
-	if (count == 1) {
-		printf_P(PSTR("Banknote scanner state: "));
-		bill_state_t state = bill_state();
-		switch (state) {
-			case BILL_STATE_UNINITIALIZED:
-				printf_P(PSTR("uninitialized"));
-				break;
-			case BILL_STATE_SELFTEST:
-				printf_P(PSTR("self-test"));
-				break;
-			case BILL_STATE_IDLE:
-				printf_P(PSTR("idle"));
-				break;
-			case BILL_STATE_VALIDATION:
-				printf_P(PSTR("validating"));
-				break;
-			case BILL_STATE_END:
-				printf_P(PSTR("ended"));
-				break;
-			case BILL_STATE_ACCEPT:
-				printf_P(PSTR("accepting"));
+void console_validate_bill(const args_value_t *args, uint8_t count) {
+	if (count == 0) {
+		fmt_P(PSTR("Banknote scanner state: "));
+		fmt_P(bill_state_name(bill_state()));
+		fmt_eol();
+		rate_stats_t rate;
+		bill_rate(&rate);
+		console_rate(&rate);
+	} else {
+		switch (args[0].index) {
+			case BILL_MODE_INHIBIT:
+				fmt_P(PSTR("Banknote scanner inhibit is on\r\n"));
+				bill_inhibit(true);
 				break;
-			case BILL_STATE_REJECT:
-				printf_P(PSTR("rejecting"));
+			case BILL_MODE_ACCEPT:
+				fmt_P(PSTR("Banknote scanner inhibit is off\r\n"));
+				bill_inhibit(false);
 				break;
-			case BILL_STATE_SCANNED:
-				printf_P(PSTR("scanned"));
+			case BILL_MODE_ESCROW:
+				fmt_P(PSTR("Banknote scanner escrow mode is on\r\n"));
+				bill_escrow(true);
 				break;
-			case BILL_STATE_ERROR:
-				printf_P(PSTR("error"));
+			case BILL_MODE_DIRECT:
+				fmt_P(PSTR("Banknote scanner escrow mode is off\r\n"));
+				bill_escrow(false);
 				break;
 		}
-		printf_P(PSTR("\r\n"));
+	}
+}
+
+void console_validate_coin(const args_value_t *args, uint8_t count) {
+	fmt_P(PSTR("Coin acceptor is "));
+	fmt_P(coin_alarm() ? PSTR("in alarm state") : PSTR("ready"));
+	fmt_P(PSTR(", pins=0x"));
+	fmt_hex(coin_pins(), 2);
+	fmt_eol();
+	rate_stats_t rate;
+	coin_rate(&rate);
+	console_rate(&rate);
+	coin_stats_t stats;
+	coin_stats(&stats);
+	fmt_uint(stats.coins, 0);
+	fmt_P(PSTR(" coins, "));
+	fmt_uint(stats.glitches, 0);
+	fmt_P(PSTR(" glitches, "));
+	fmt_uint(stats.rejects, 0);
+	fmt_P(PSTR(" rejected pulses\r\n"));
+}
+
+void console_rate(const rate_stats_t *rate) {
+	fmt_P(PSTR("Polling every "));
+	fmt_uint(rate->period, 0);
+	fmt_P(PSTR(" ticks, "));
+	fmt_uint(rate->runs, 0);
+	fmt_P(PSTR(" polls\r\n"));
+}
+
+void console_validate_mem(const args_value_t *args, uint8_t count) {
+	static const char OWNERS[SLAB_OWNER_MAX][8] PROGMEM = {
+		[SLAB_OWNER_MAIN] = "main",
+		[SLAB_OWNER_LED] = "led",
+	};
+	fmt_P(PSTR("Class Size Chunks Used Peak     Allocs  Fails\r\n"));
+	slab_class_e sclass;
+	for (sclass = 0; sclass < SLAB_CLASS_MAX; sclass++) {
+		memory_stats_t stats;
+		memory_stats(slab_class(sclass), &stats);
+		fmt_uint(sclass, 5);
+		fmt_uint(slab_class_size(sclass), 5);
+		fmt_uint(stats.chunks, 7);
+		fmt_uint(stats.used, 5);
+		fmt_uint(stats.peak, 5);
+		fmt_uint(stats.allocations, 11);
+		fmt_uint(stats.failures, 7);
+		fmt_eol();
+	}
+	fmt_P(PSTR("Owner   Quota  Used\r\n"));
+	slab_owner_e owner;
+	for (owner = 1; owner < SLAB_OWNER_MAX; owner++) {
+		fmt_P_left(OWNERS[owner], 7);
+		fmt_uint(slab_quota(owner), 6);
+		fmt_uint(slab_owned(owner), 6);
+		fmt_eol();
+	}
+}
+
+void console_validate_idle(const args_value_t *args, uint8_t count) {
+	main_idle_t idle;
+	main_get_idle(&idle);
+	time_t now = time(NULL);
+	uint32_t seconds = difftime(now, console_global.idle_time);
+	uint32_t wakeups = idle.wakeups - console_global.idle.wakeups;
+	uint32_t dispatches = idle.dispatches - console_global.idle.dispatches;
+	fmt_P(PSTR("System timer: "));
+	fmt_P(main_tickless() ? PSTR("tickless\r\n") : PSTR("periodic\r\n"));
+	fmt_P(PSTR("Total: "));
+	fmt_uint(idle.wakeups, 0);
+	fmt_P(PSTR(" wakeups, "));
+	fmt_uint(idle.dispatches, 0);
+	fmt_P(PSTR(" dispatches\r\n"));
+	if (seconds > 0) {
+		fmt_P(PSTR("Last "));
+		fmt_uint(seconds, 0);
+		fmt_P(PSTR("s: "));
+		fmt_uint(wakeups / seconds, 0);
+		fmt_P(PSTR(" wakeups/s, "));
+		fmt_uint(dispatches / seconds, 0);
+		fmt_P(PSTR(" dispatches/s\r\n"));
+	}
+	console_global.idle = idle;
+	console_global.idle_time = now;
+}
+
+void console_sched_row(PGM_P name, uint8_t priority, const uint16_t *histogram) {
+	fmt_P_left(name, 5);
+	fmt_uint(priority, 5);
+	uint8_t bucket;
+	for (bucket = 0; bucket < SCHED_BUCKETS; bucket++) {
+		fmt_uint(histogram[bucket], 7);
+	}
+	fmt_eol();
+}
+
+void console_sched_worst(PGM_P name, const sched_worst_t *worst) {
+	if (worst->f) {
+		// Function pointers are word addresses, print the byte address as in the map file
+		fmt_P(name);
+		fmt_P(PSTR(": "));
+		fmt_uint(worst->ticks, 0);
+		fmt_P(PSTR(" ticks, callback 0x"));
+		fmt_hex((uint32_t) (uintptr_t) worst->f << 1, 5);
+		fmt_P(PSTR(", priority "));
+		fmt_uint(worst->priority, 0);
+		fmt_eol();
+	}
+}
+
+void console_validate_sched(const args_value_t *args, uint8_t count) {
+	if (count == 1) {
+		sched_reset();
 	} else {
-		if (strncasecmp_P(arguments[1], PSTR("inhibit"), lengths[1]) == 0) {
-			printf_P(PSTR("Banknote scanner inhibit is on\r\n"));
-			bill_inhibit(true);
-		} else if (strncasecmp_P(arguments[1], PSTR("accept"), lengths[1]) == 0) {
-			printf_P(PSTR("Banknote scanner inhibit is off\r\n"));
-			bill_inhibit(false);
-		} else if (strncasecmp_P(arguments[1], PSTR("escrow"), lengths[1]) == 0) {
-			printf_P(PSTR("Banknote scanner escrow mode is on\r\n"));
-			bill_escrow(true);
-		} else if (strncasecmp_P(arguments[1], PSTR("direct"), lengths[1]) == 0) {
-			printf_P(PSTR("Banknote scanner escrow mode is off\r\n"));
-			bill_escrow(false);
-		} else {
-			printf_P(PSTR("oops\r\n"));
-			return;
+		const sched_stats_t *stats = sched_stats();
+		fmt_P(PSTR("Type  Prio      0      1    2-3    4-7   8-15  16-31  32-63    64+\r\n"));
+		uint8_t priority;
+		for (priority = 0; priority < SCHED_PRIORITIES; priority++) {
+			console_sched_row(PSTR("late"), priority, stats->histograms[priority].lateness);
+			console_sched_row(PSTR("run"), priority, stats->histograms[priority].runtime);
 		}
+		console_sched_worst(PSTR("Latest"), &stats->late);
+		console_sched_worst(PSTR("Slowest"), &stats->slow);
+	}
+}
+
+void console_validate_serial(const args_value_t *args, uint8_t count) {
+	if (count >= 2) {
+		serial_set_flow(args[1].index == 1);
+	}
+	if (count >= 1) {
+		uint32_t baud = pgm_read_dword(&BAUD_RATES[args[0].index]);
+		// The rate is switched after this message was sent
+		fmt_P(PSTR("Switching to "));
+		fmt_uint(serial_set_baud(baud), 0);
+		console_flow();
+	} else {
+		serial_stats_t stats;
+		serial_stats(&stats);
+		fmt_uint(serial_baud(), 0);
+		console_flow();
+		fmt_uint(stats.overruns, 0);
+		fmt_P(PSTR(" overruns, "));
+		fmt_uint(stats.framing, 0);
+		fmt_P(PSTR(" framing errors, "));
+		fmt_uint(console_global.overflows, 0);
+		fmt_P(PSTR(" buffer overflows, "));
+		fmt_uint(stats.pauses, 0);
+		fmt_P(PSTR(" RTS pauses, "));
+		fmt_uint(stats.stalls, 0);
+		fmt_P(PSTR(" CTS stalls, "));
+		fmt_uint(stats.drops, 0);
+		fmt_P(PSTR(" dropped\r\n"));
 	}
 }
 
-void console_validate_coin(const char *buf, uint8_t size) {
-	printf_P(PSTR("Coin acceptor is (unknown)\r\n"));
+void console_validate_telemetry(const args_value_t *args, uint8_t count) {
+	telemetry_stats_t stats;
+	telemetry_stats(&stats);
+	fmt_P(PSTR("Telemetry: "));
+	fmt_uint(stats.sent, 0);
+	fmt_P(PSTR(" records sent, "));
+	fmt_uint(stats.dropped, 0);
+	fmt_P(PSTR(" dropped, "));
+	fmt_uint(stats.stalls, 0);
+	fmt_P(PSTR(" UART stalls\r\n"));
 }
 
-void console_validate_exit(const char *buf, uint8_t size) {
+void console_validate_top(const args_value_t *args, uint8_t count) {
+	// Stop the line editor, so no prompt is shown while the dashboard is active
 	rdline_stop(&console_global.rdline);
-	printf_P(MESSAGE_LOGIN);
+	top_start();
 }
 
-void console_validate_reboot(const char *buf, uint8_t size) {
+void console_validate_exit(const args_value_t *args, uint8_t count) {
+	rdline_stop(&console_global.rdline);
+	console_global.batch = false;
+	fmt_P(MESSAGE_LOGIN);
+}
+
+void console_validate_machine(const args_value_t *args, uint8_t count) {
+	// Stop the line editor, so no prompt is shown
+	rdline_stop(&console_global.rdline);
+	// The host protocol ends at the login prompt
+	console_global.batch = false;
+	console_global.machine = true;
+	remote_start();
+}
+
+void console_validate_reboot(const args_value_t *args, uint8_t count) {
 	main_shutdown();
 }
 
-void console_validate_balance(const char *buf, uint8_t size) {
-	const char *arguments[2];
-	size_t lengths[2];
-	size_t count = console_tokenize(buf, size, 2, arguments, lengths);
-	if (count == 2) {
+void console_validate_balance(const args_value_t *args, uint8_t count) {
+	if (count == 1) {
 		currency_t balance;
-		console_decimal24(arguments[1], lengths[1], &balance.base, &balance.cents);
+		balance.base = args[0].decimal.left;
+		balance.cents = args[0].decimal.right;
 		bank_set_balance(main_get_bank(), balance);
 	} else {
 		currency_t balance = bank_get_balance(main_get_bank());
-		printf_P(PSTR("Current balance: %d.%d\r\n"), balance.base, balance.cents);
+		fmt_P(PSTR("Current balance: "));
+		fmt_currency(balance);
+		fmt_eol();
 	}
 }
 
 int8_t console_complete(const char *buf, char *dstbuf, uint8_t dstsize, int16_t *state) {
-	//printf_P(PSTR("Completing '%s'\n"), buf);
 	size_t ws = console_whitespace(buf, -1);
-	// TODO Do a binary search instead of a linear search
-	size_t i;
-	for (i = *state; i < sizeof(COMMANDS) / sizeof(COMMANDS[0]); i++) {
-		PGM_P command = (PGM_P) pgm_read_ptr(&COMMANDS[i].command);
-		if (strncmp_P(buf, command, ws) == 0) {
-			strncpy_P(dstbuf, command + ws, dstsize);
-			/*if (i + 1 < sizeof(COMMANDS) / sizeof(COMMANDS[0])) {
-				PGM_P command2 = (PGM_P) pgm_read_ptr(&COMMANDS[i + 1].command);
-				if (strncmp_P(buf, command2, ws) == 0) {
-					*state = i;
-					return 1;
-				}
-			}*/
+	if (buf[ws] != '\0') {
+		// Only the command name is completed
+		return 0;
+	}
+	// The state is 0 on the first call, then the index of the next choice to list
+	int16_t index = *state;
+	if (index == 0) {
+		index = args_prefix(COMMANDS, ARGS_COUNT(COMMANDS), sizeof(COMMANDS[0]), buf, ws);
+		if (index < 0) {
+			return 0;
+		}
+		if (index + 1 >= ARGS_COUNT(COMMANDS) || strncasecmp_P(buf, (PGM_P) pgm_read_ptr(&COMMANDS[index + 1].command), ws) != 0) {
+			// Unique, complete the name
+			strncpy_P(dstbuf, (PGM_P) pgm_read_ptr(&COMMANDS[index].command) + ws, dstsize);
 			return 2;
 		}
 	}
+	// Ambiguous, list the matching names (they are contiguous in the sorted table)
+	if (index < ARGS_COUNT(COMMANDS)) {
+		PGM_P command = (PGM_P) pgm_read_ptr(&COMMANDS[index].command);
+		if (strncasecmp_P(buf, command, ws) == 0) {
+			strncpy_P(dstbuf, command, dstsize);
+			*state = index + 1;
+			return 1;
+		}
+	}
 	return 0;
 }
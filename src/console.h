@@ -5,16 +5,44 @@
  * This module implements a simple shell with basic command line editing and
  * autocompletion support. The Aversive rdline module is used for this purpose.
  * 
- * Console output is done through stdio, with asynchronous serial communication.
- * You should set the serial port buffer to the maximum line length.
+ * Console output is written with the fmt routines (see fmt.h), with
+ * asynchronous serial communication on UART0 (see serial.h). When the receive ring buffer nears full, the host
+ * is stopped with RTS if hardware flow control is enabled.
+ * 
+ * The gpio watch command samples GPIO ports with the capture module (see
+ * capture.h) and streams the changes as text while the capture runs:
+ * 
+ *     capture AE 20000 Hz
+ *     0000 ff08
+ *     01f3 ff0c
+ *     end 10000 samples
+ * 
+ * Each record line holds the 16 bit sample number and the pin states of the
+ * ports in hex. A line "end <samples> samples truncated" marks a capture that
+ * was cut short. Any key ends the capture early. tools/vcd converts a log of
+ * this output to a value change dump.
+ * 
+ * The top command shows a full-screen status display on a VT100 terminal
+ * (see top.h) until a key is pressed.
+ * 
+ * For scripts, the login prompt also accepts '!' instead of return, which
+ * opens a batch session. The line editor is bypassed: there is no echo,
+ * editing, completion or prompt, received characters are collected until
+ * CR or LF and the line is evaluated as a command. Empty lines are ignored,
+ * so CR LF line ends work, and the output carries only the responses. The
+ * exit command ends the session as usual. A capture or the status display
+ * ends with the first character of the next command, not with the line end
+ * of its own command. That command runs after the end line of the capture.
  * 
  * @par Configurable options
  * 
  * Macro                   | Default  | Values         | Description
  * ------------------------|----------|----------------|-----------------------------------------------
- * CONSOLE_QUEUE_SIZE      | [undef]  | 0..255         | Size of the event pool
+ * CONSOLE_RX_SIZE         | 128      | 2^n, 2..128    | Receive ring buffer size (> RDLINE_BUF_SIZE)
  * CONSOLE_PRIORITY        | [undef]  | 0..127         | Event queue priority
- * CONSOLE_UART            | [undef]  | 0..N           | UART port number
+ * CONSOLE_RTS_MARGIN      | 16       | 1..RX_SIZE/2-1 | Free ring buffer space at which RTS stops the host
+ * CONSOLE_WATCH_RATE      | 20000    | 100..50000     | Default gpio watch sample rate (Hz)
+ * CONSOLE_WATCH_POLL      | 32       | 1..32767       | Capture streaming interval (ticks)
  * 
  * @copyright Matemat controller firmware
  * Copyright © 2015 Chaostreff Basel
@@ -37,7 +65,7 @@
 #define _CONSOLE_H
 
 #include <stdbool.h>
-#include <base/callout/callout.h>
+#include "dispatch.h"
 
 /**
  * Initialise the (global) UART console driver.
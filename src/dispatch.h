@@ -0,0 +1,141 @@
+/**
+ * @file dispatch.h
+ * @brief Event queue backend selection
+ * 
+ * All modules include this header instead of the Aversive callout module
+ * and use the callout API (struct callout_mgr, struct callout,
+ * callout_init(), callout_schedule(), callout_stop(), ...).
+ * 
+ * If MAIN_TIMING_WHEEL is defined, the callout API is mapped to the
+ * hierarchical timing wheel (wheel.h) at compile time. Otherwise, the
+ * Aversive callout module is used.
+ * 
+ * Event times have the type dispatch_time_t and are compared with wrap-safe
+ * signed arithmetic (dispatch_diff_t). The timing wheel keeps 32 bit time,
+ * so events can be scheduled hours ahead. The Aversive callout module only
+ * keeps 16 bit time, which limits delays to DISPATCH_DELAY_MAX ticks (2 s).
+ * Only the timing wheel can run the callbacks through a dispatch hook
+ * (callout_set_hook()).
+ * 
+ * @par Configurable options
+ * 
+ * Macro               | Default  | Values         | Description
+ * --------------------|----------|----------------|-----------------------------------------------
+ * MAIN_TIMING_WHEEL   | [undef]  | [def/undef]    | Use the timing wheel as event queue backend
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DISPATCH_H
+#define _DISPATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef MAIN_TIMING_WHEEL
+
+#include "wheel.h"
+
+/* Map the callout API onto the timing wheel */
+#define callout_mgr wheel_mgr
+#define callout wheel_timer
+#define callout_cb_t wheel_cb_t
+#define get_time_t wheel_time_t
+#define callout_mgr_init wheel_mgr_init
+#define callout_init wheel_init
+#define callout_schedule wheel_schedule
+#define callout_reschedule wheel_reschedule
+#define callout_stop wheel_stop
+#define callout_manage wheel_manage
+#define callout_hook_t wheel_hook_t
+#define callout_set_hook wheel_set_hook
+#define CALLOUT_STATE_STOPPED WHEEL_STATE_STOPPED
+#define CALLOUT_STATE_SCHEDULED WHEEL_STATE_SCHEDULED
+#define CALLOUT_STATE_RUNNING WHEEL_STATE_RUNNING
+
+/** Event time */
+typedef uint32_t dispatch_time_t;
+/** Signed difference between two event times */
+typedef int32_t dispatch_diff_t;
+/** Longest delay that can be scheduled */
+#define DISPATCH_DELAY_MAX 0x7fffffffUL
+
+/**
+ * Iterate over the callouts that are due (or may be due) at the current time.
+ * @param tim the loop variable (struct callout *)
+ * @param cm the event queue
+ */
+#define DISPATCH_FOREACH_DUE(tim, cm) \
+	wheel_advance(cm); \
+	LIST_FOREACH(tim, &(cm)->expired, next)
+
+/**
+ * Get the time at which the event queue needs to be managed next.
+ * Must be called with interrupts disabled.
+ * @param cm the event queue
+ * @param time a pointer to storage for the time
+ * @return false, if no event is scheduled
+ */
+static inline bool dispatch_next(struct callout_mgr *cm, dispatch_time_t *time) {
+	return wheel_next(cm, time);
+}
+
+#else /*MAIN_TIMING_WHEEL*/
+
+#include <base/callout/callout.h>
+
+/** Event time */
+typedef uint16_t dispatch_time_t;
+/** Signed difference between two event times */
+typedef int16_t dispatch_diff_t;
+/** Longest delay that can be scheduled */
+#define DISPATCH_DELAY_MAX 0x7fffU
+
+/**
+ * Iterate over the callouts that are due (or may be due) at the current time.
+ * @param tim the loop variable (struct callout *)
+ * @param cm the event queue
+ */
+#define DISPATCH_FOREACH_DUE(tim, cm) \
+	LIST_FOREACH(tim, &(cm)->sched_list, next)
+
+/**
+ * Get the time at which the event queue needs to be managed next.
+ * Must be called with interrupts disabled.
+ * @param cm the event queue
+ * @param time a pointer to storage for the time
+ * @return false, if no event is scheduled
+ */
+static inline bool dispatch_next(struct callout_mgr *cm, dispatch_time_t *time) {
+	struct callout *tim;
+	struct callout *next = NULL;
+	LIST_FOREACH(tim, &cm->sched_list, next) {
+		if (!next || (dispatch_diff_t) (tim->expire - next->expire) < 0) {
+			next = tim;
+		}
+	}
+	if (next) {
+		*time = next->expire;
+		return true;
+	}
+	return false;
+}
+
+#endif /*MAIN_TIMING_WHEEL*/
+
+#endif /*_DISPATCH_H*/
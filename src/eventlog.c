@@ -0,0 +1,319 @@
+/**
+ * @file eventlog.c
+ * @brief Deferred binary event log implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+#include <aversive/irq_lock.h>
+#include "eventlog.h"
+#include "bill.h"
+#include "main.h"
+#include "remote.h"
+#include "telemetry.h"
+#include "serial.h"
+#include "fmt.h"
+#include "util.h"
+
+#ifndef EVENTLOG_SIZE
+/** Number of records in the ring buffer (power of 2) */
+#define EVENTLOG_SIZE 16
+#endif
+
+#ifndef EVENTLOG_RETRY
+/** Drain retry delay when the UART transmit buffer is full (ticks) */
+#define EVENTLOG_RETRY 32
+#endif
+
+/** Transmit buffer space needed to print the longest line */
+#define EVENTLOG_LINE_SIZE 64
+
+static_assert((EVENTLOG_SIZE & (EVENTLOG_SIZE - 1)) == 0, "EVENTLOG_SIZE must be a power of 2");
+static_assert(EVENTLOG_SIZE <= 128, "EVENTLOG_SIZE must fit into the 8 bit ring indexes");
+
+/** @cond */
+static const char EVENTLOG_BILL_INTERNAL[] PROGMEM = "Internal error";
+static const char EVENTLOG_BILL_SCAN[] PROGMEM = "Scan error, fake banknote, or jam";
+static const char EVENTLOG_BILL_STACK[] PROGMEM = "Stacker error";
+static const char EVENTLOG_BILL_FULL[] PROGMEM = "Holder full";
+static const char EVENTLOG_BILL_UNKNOWN[] PROGMEM = "Unknown banknote";
+/** @endcond */
+
+/**
+ * Banknote scanner error texts, indexed by bill_error_t
+ */
+static PGM_P const EVENTLOG_BILL_ERRORS[] PROGMEM = {
+	[BILL_ERROR_INTERNAL] = EVENTLOG_BILL_INTERNAL,
+	[BILL_ERROR_SCAN] = EVENTLOG_BILL_SCAN,
+	[BILL_ERROR_STACK] = EVENTLOG_BILL_STACK,
+	[BILL_ERROR_FULL] = EVENTLOG_BILL_FULL,
+	[BILL_ERROR_UNKNOWN] = EVENTLOG_BILL_UNKNOWN,
+};
+static_assert(sizeof(EVENTLOG_BILL_ERRORS) / sizeof(EVENTLOG_BILL_ERRORS[0]) == BILL_ERROR_UNKNOWN + 1, "EVENTLOG_BILL_ERRORS must contain all error codes");
+
+/**
+ * Event log record
+ */
+typedef struct {
+	/** System time (ticks) */
+	uint32_t time;
+	/** Event id */
+	uint8_t id;
+	/** First argument */
+	uint16_t a;
+	/** Second argument */
+	uint16_t b;
+} eventlog_record_t;
+
+/**
+ * Event log object
+ */
+typedef struct {
+	/** Event queue */
+	struct callout_mgr *manager;
+	/** Drain event */
+	struct callout drain;
+	/** Set while the drain event is scheduled or running */
+	volatile bool pending;
+	/** Ring buffer write index (modified with interrupts disabled) */
+	volatile uint8_t in;
+	/** Ring buffer read index (only modified by the drain event) */
+	volatile uint8_t out;
+	/** Number of records dropped since the last report */
+	volatile uint16_t dropped;
+	/** Ring buffer */
+	eventlog_record_t ring[EVENTLOG_SIZE];
+} eventlog_t;
+
+/**
+ * Global event log object
+ */
+static eventlog_t eventlog_global ATTRIBUTE_NOINIT;
+
+/**
+ * Drain event, formats and sends records until the UART is busy
+ * @param cm the event queue manager
+ * @param tim the drain event
+ * @param arg unused
+ */
+static void eventlog_callback(struct callout_mgr *cm, struct callout *tim, void *arg);
+
+/**
+ * Print the next line.
+ * Clears the pending flag if there is nothing left to print.
+ * @return false, if the ring buffer is empty
+ */
+static bool eventlog_print(void);
+
+/**
+ * Print the message of a record, without the time and line ending.
+ * @param record the record
+ */
+static void eventlog_message(const eventlog_record_t *record);
+
+/**
+ * Print the pin part of a pin change message.
+ * @param pins the pin states
+ * @param diff the changed pins
+ */
+static void eventlog_pins(uint16_t pins, uint16_t diff);
+
+/**
+ * Send records as event notifications until the transmit buffer is full.
+ * Clears the pending flag if there is nothing left to send.
+ * @param cm the event queue manager
+ * @param tim the drain event
+ */
+static void eventlog_notify(struct callout_mgr *cm, struct callout *tim);
+
+void eventlog_init(struct callout_mgr *manager) {
+	eventlog_global.manager = manager;
+	eventlog_global.pending = false;
+	eventlog_global.in = 0;
+	eventlog_global.out = 0;
+	eventlog_global.dropped = 0;
+	callout_init(&eventlog_global.drain, eventlog_callback, NULL, EVENTLOG_PRIORITY);
+}
+
+void eventlog_shutdown(void) {
+	callout_stop(eventlog_global.manager, &eventlog_global.drain);
+}
+
+bool eventlog_write(eventlog_id_e id, uint16_t a, uint16_t b) {
+	bool ret = false;
+	uint32_t time = main_time();
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	uint8_t in = eventlog_global.in;
+	if ((uint8_t) (in - eventlog_global.out) < EVENTLOG_SIZE) {
+		eventlog_record_t *record = &eventlog_global.ring[in & (EVENTLOG_SIZE - 1)];
+		record->time = time;
+		record->id = id;
+		record->a = a;
+		record->b = b;
+		eventlog_global.in = in + 1;
+		ret = true;
+	} else if (eventlog_global.dropped < UINT16_MAX) {
+		eventlog_global.dropped++;
+	}
+	if (!eventlog_global.pending) {
+		eventlog_global.pending = true;
+		callout_schedule(eventlog_global.manager, &eventlog_global.drain, 0);
+	}
+	IRQ_UNLOCK(flags);
+	// Every record is also streamed, independent of the console drain
+	telemetry_write(id, time, a, b);
+	return ret;
+}
+
+void eventlog_callback(struct callout_mgr *cm, struct callout *tim, void *arg) {
+	if (remote_active()) {
+		eventlog_notify(cm, tim);
+		return;
+	}
+	// A line is only started if it fits, so lines are never cut off or mixed with frames
+	while (serial_tx_free() >= EVENTLOG_LINE_SIZE) {
+		if (!eventlog_print()) {
+			return;
+		}
+	}
+	// Transmit buffer full, try again later
+	callout_schedule(cm, tim, EVENTLOG_RETRY);
+}
+
+bool eventlog_print(void) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	uint16_t dropped = eventlog_global.dropped;
+	eventlog_global.dropped = 0;
+	uint8_t out = eventlog_global.out;
+	bool empty = out == eventlog_global.in;
+	if (empty && !dropped) {
+		// Checked with interrupts disabled, so a concurrent write schedules the drain again
+		eventlog_global.pending = false;
+	}
+	IRQ_UNLOCK(flags);
+
+	if (dropped) {
+		fmt_char('[');
+		fmt_uint(dropped, 0);
+		fmt_P(PSTR(" events dropped]\r\n"));
+	} else if (!empty) {
+		// Copy the record before releasing its slot
+		eventlog_record_t record = eventlog_global.ring[out & (EVENTLOG_SIZE - 1)];
+		eventlog_global.out = out + 1;
+		fmt_char('[');
+		fmt_uint(record.time / MAIN_TICKS_PER_SECOND, 0);
+		fmt_char('.');
+		fmt_zero((uint16_t) ((record.time % MAIN_TICKS_PER_SECOND) * 8 / 125), 3);
+		fmt_P(PSTR("] "));
+		eventlog_message(&record);
+		fmt_eol();
+	} else {
+		return false;
+	}
+	return true;
+}
+
+void eventlog_message(const eventlog_record_t *record) {
+	currency_t amount;
+	switch (record->id) {
+		case EVENTLOG_BILL_PINS:
+			fmt_P(PSTR("bill"));
+			eventlog_pins(record->a, record->b);
+			break;
+		case EVENTLOG_BILL_REPORT:
+			fmt_P(PSTR("Scanned banknote: "));
+			fmt_uint(record->a, 0);
+			break;
+		case EVENTLOG_BILL_ERROR:
+			fmt_P(PSTR("Banknote scan error: "));
+			if (record->a < sizeof(EVENTLOG_BILL_ERRORS) / sizeof(EVENTLOG_BILL_ERRORS[0])) {
+				fmt_P((PGM_P) pgm_read_ptr(&EVENTLOG_BILL_ERRORS[record->a]));
+			} else {
+				fmt_uint(record->a, 0);
+			}
+			fmt_P(PSTR(" ("));
+			fmt_uint(record->b, 0);
+			fmt_char(')');
+			break;
+		case EVENTLOG_COIN_PINS:
+			fmt_P(PSTR("coin"));
+			eventlog_pins(record->a, record->b);
+			break;
+		case EVENTLOG_COIN_REPORT:
+			fmt_P(PSTR("Scanned coin: "));
+			amount.base = record->a;
+			amount.cents = record->b;
+			fmt_currency(amount);
+			break;
+		case EVENTLOG_COIN_ERROR:
+			fmt_P(PSTR("Coin acceptor alarm"));
+			break;
+		case EVENTLOG_BALANCE:
+			fmt_P(PSTR("Current balance: "));
+			amount.base = record->a;
+			amount.cents = record->b;
+			fmt_currency(amount);
+			break;
+	}
+}
+
+void eventlog_pins(uint16_t pins, uint16_t diff) {
+	fmt_P(PSTR(" pins=0x"));
+	fmt_hex(pins, 2);
+	fmt_P(PSTR(" changed=0x"));
+	fmt_hex(diff, 2);
+}
+
+void eventlog_notify(struct callout_mgr *cm, struct callout *tim) {
+	for (;;) {
+		uint8_t flags;
+		IRQ_LOCK(flags);
+		uint16_t dropped = eventlog_global.dropped;
+		uint8_t out = eventlog_global.out;
+		bool empty = out == eventlog_global.in;
+		if (empty && !dropped) {
+			// Checked with interrupts disabled, so a concurrent write schedules the drain again
+			eventlog_global.pending = false;
+		}
+		IRQ_UNLOCK(flags);
+
+		if (dropped) {
+			if (!remote_event(EVENTLOG_DROPPED, main_time(), dropped, 0)) {
+				break;
+			}
+			IRQ_LOCK(flags);
+			eventlog_global.dropped -= dropped;
+			IRQ_UNLOCK(flags);
+		} else if (!empty) {
+			// The slot is not reused before the read index moves on
+			const eventlog_record_t *record = &eventlog_global.ring[out & (EVENTLOG_SIZE - 1)];
+			if (!remote_event(record->id, record->time, record->a, record->b)) {
+				break;
+			}
+			eventlog_global.out = out + 1;
+		} else {
+			return;
+		}
+	}
+	// Transmit buffer full, try again later
+	callout_schedule(cm, tim, EVENTLOG_RETRY);
+}
@@ -0,0 +1,100 @@
+/**
+ * @file eventlog.h
+ * @brief Deferred binary event log interface
+ * 
+ * Drivers record events with eventlog_write() instead of printing them.
+ * A record is a fixed-size binary entry (event id, system time and two
+ * arguments) that is copied into a RAM ring buffer, so writing costs a few
+ * cycles and can be done from any callout or interrupt.
+ * 
+ * A low priority callout prints the records as text lines to the console
+ * UART (see fmt.h). A line is only started while the transmit buffer has
+ * room for the longest one, otherwise the drain is retried after
+ * EVENTLOG_RETRY ticks.
+ * 
+ * Every record is also queued on the telemetry stream (see telemetry.h).
+ * 
+ * If the ring is full, new records are dropped and counted. The number of
+ * dropped records is reported before the next record is drained.
+ * 
+ * While the console is in machine mode (see remote.h), records are sent
+ * unformatted as FRAME_EVENT notifications, and a dropped records report
+ * as a notification with id EVENTLOG_DROPPED.
+ * 
+ * @par Configurable options
+ * 
+ * Macro               | Default  | Values         | Description
+ * --------------------|----------|----------------|-----------------------------------------------
+ * EVENTLOG_SIZE       | 16       | 2..128         | Number of records in the ring buffer (power of 2)
+ * EVENTLOG_PRIORITY   | [undef]  | 0..127         | Event queue priority of the drain
+ * EVENTLOG_RETRY      | 32       | 1..32767       | Drain retry delay when the UART is busy (ticks)
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _EVENTLOG_H
+#define _EVENTLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "dispatch.h"
+
+/**
+ * Event ids, each one has a format string in eventlog.c
+ */
+typedef enum {
+	/** Banknote scanner pin change (pins, changed pins) */
+	EVENTLOG_BILL_PINS,
+	/** Banknote scanned (denomination) */
+	EVENTLOG_BILL_REPORT,
+	/** Banknote scanner error (bill_error_t, denomination) */
+	EVENTLOG_BILL_ERROR,
+	/** Coin acceptor pin change (pins, changed pins) */
+	EVENTLOG_COIN_PINS,
+	/** Coin scanned (base, cents) */
+	EVENTLOG_COIN_REPORT,
+	/** Coin acceptor alarm */
+	EVENTLOG_COIN_ERROR,
+	/** Balance changed (base, cents) */
+	EVENTLOG_BALANCE,
+	/** Number of event ids */
+	EVENTLOG_MAX,
+	/** Records were dropped (count), only used for reports */
+	EVENTLOG_DROPPED = 0xff,
+} eventlog_id_e;
+
+/**
+ * Initialise the event log.
+ * @param manager the event queue
+ */
+void eventlog_init(struct callout_mgr *manager);
+
+/**
+ * Stop draining the event log. Pending records are discarded.
+ */
+void eventlog_shutdown(void);
+
+/**
+ * Record an event. May be called from interrupts.
+ * @param id the event id
+ * @param a the first argument
+ * @param b the second argument
+ * @return false, if the ring buffer was full and the record was dropped
+ */
+bool eventlog_write(eventlog_id_e id, uint16_t a, uint16_t b);
+
+#endif /*_EVENTLOG_H*/
@@ -0,0 +1,173 @@
+/**
+ * @file fmt.c
+ * @brief Lightweight console output formatting implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <avr/pgmspace.h>
+#include "fmt.h"
+#include "serial.h"
+
+/** Longest program memory string that is copied, longer ones are queued by reference */
+#define FMT_COPY_MAX 16
+
+/** Maximum number of decimal digits of a 32 bit number */
+#define FMT_DIGITS_MAX 10
+
+/**
+ * Powers of ten, from the highest one that fits into 32 bits
+ */
+static const uint32_t FMT_POWERS[FMT_DIGITS_MAX - 1] PROGMEM = {
+	1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL, 10000UL, 1000UL, 100UL, 10UL,
+};
+
+/**
+ * Convert a number to decimal digits.
+ * @param value the number
+ * @param digits storage for at least FMT_DIGITS_MAX digits (not terminated)
+ * @return the number of digits
+ */
+static uint8_t fmt_decimal(uint32_t value, char *digits);
+
+/**
+ * Write spaces.
+ * @param count the number of spaces
+ */
+static void fmt_spaces(uint8_t count);
+
+void fmt_char(char character) {
+	serial_send(character);
+}
+
+void fmt_str(const char *string) {
+	char character;
+	while ((character = *string++) != '\0') {
+		serial_send(character);
+	}
+}
+
+void fmt_P(PGM_P string) {
+	size_t length = strlen_P(string);
+	if (length > FMT_COPY_MAX) {
+		// Sent from program memory by the transmit interrupt, a queue entry is cheaper than a copy
+		serial_send_P(string, length);
+	} else {
+		while (length-- > 0) {
+			serial_send(pgm_read_byte(string++));
+		}
+	}
+}
+
+void fmt_P_left(PGM_P string, uint8_t width) {
+	size_t length = strlen_P(string);
+	fmt_P(string);
+	if (length < width) {
+		fmt_spaces(width - length);
+	}
+}
+
+void fmt_eol(void) {
+	serial_send('\r');
+	serial_send('\n');
+}
+
+void fmt_spaces(uint8_t count) {
+	while (count-- > 0) {
+		serial_send(' ');
+	}
+}
+
+uint8_t fmt_decimal(uint32_t value, char *digits) {
+	uint8_t length = 0;
+	uint8_t i;
+	for (i = 0; i < FMT_DIGITS_MAX - 1; i++) {
+		uint32_t power = pgm_read_dword(&FMT_POWERS[i]);
+		// At most 9 subtractions (4 for the highest power), cheaper than a software division
+		char digit = '0';
+		while (value >= power) {
+			value -= power;
+			digit++;
+		}
+		if (digit != '0' || length > 0) {
+			digits[length++] = digit;
+		}
+	}
+	digits[length++] = '0' + (uint8_t) value;
+	return length;
+}
+
+void fmt_uint(uint32_t value, uint8_t width) {
+	char digits[FMT_DIGITS_MAX];
+	uint8_t length = fmt_decimal(value, digits);
+	if (length < width) {
+		fmt_spaces(width - length);
+	}
+	uint8_t i;
+	for (i = 0; i < length; i++) {
+		serial_send(digits[i]);
+	}
+}
+
+void fmt_int(int32_t value, uint8_t width) {
+	char digits[FMT_DIGITS_MAX];
+	// Negated as unsigned, so INT32_MIN does not overflow
+	uint32_t magnitude = value < 0 ? -(uint32_t) value : (uint32_t) value;
+	uint8_t length = fmt_decimal(magnitude, digits);
+	if (value < 0) {
+		length++;
+	}
+	if (length < width) {
+		fmt_spaces(width - length);
+	}
+	if (value < 0) {
+		serial_send('-');
+		length--;
+	}
+	uint8_t i;
+	for (i = 0; i < length; i++) {
+		serial_send(digits[i]);
+	}
+}
+
+void fmt_zero(uint32_t value, uint8_t digits) {
+	char buf[FMT_DIGITS_MAX];
+	uint8_t length = fmt_decimal(value, buf);
+	uint8_t i;
+	for (i = length; i < digits; i++) {
+		serial_send('0');
+	}
+	for (i = length > digits ? length - digits : 0; i < length; i++) {
+		serial_send(buf[i]);
+	}
+}
+
+void fmt_hex(uint32_t value, uint8_t digits) {
+	while (digits-- > 0) {
+		uint8_t nibble = (value >> (digits * 4)) & 0x0f;
+		serial_send(nibble < 10 ? '0' + nibble : 'a' - 10 + nibble);
+	}
+}
+
+void fmt_currency(currency_t value) {
+	// The sign is carried by the base, the cents are always positive
+	fmt_int(value.base, 0);
+	serial_send('.');
+	fmt_zero(value.cents, 2);
+}
@@ -0,0 +1,109 @@
+/**
+ * @file fmt.h
+ * @brief Lightweight console output formatting
+ * 
+ * Dedicated routines for the few kinds of values the firmware prints, as a
+ * replacement for printf_P(). Every routine writes straight into the console
+ * UART transmit queue (see serial.h), without an intermediate line buffer
+ * and without parsing a format string at runtime, so the avr-libc vfprintf
+ * implementation is not linked. Long strings from program memory are queued
+ * by reference and sent from flash by the transmit interrupt.
+ * 
+ * Decimal conversion uses repeated subtraction of powers of ten from a table
+ * in program memory instead of 32 bit divisions, which the AVR has to do in
+ * software.
+ * 
+ * Like serial_send(), the routines wait while the transmit queue is full.
+ * Writers that must not wait, such as periodic output, should check
+ * serial_tx_free() first.
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FMT_H
+#define _FMT_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "bank.h"
+
+/**
+ * Write a character.
+ * @param character the character
+ */
+void fmt_char(char character);
+
+/**
+ * Write a string.
+ * @param string the string (in RAM)
+ */
+void fmt_str(const char *string);
+
+/**
+ * Write a string from program memory.
+ * @param string the string (in program memory)
+ */
+void fmt_P(PGM_P string);
+
+/**
+ * Write a string from program memory, padded with spaces on the right.
+ * @param string the string (in program memory)
+ * @param width the minimum field width
+ */
+void fmt_P_left(PGM_P string, uint8_t width);
+
+/**
+ * Write a line ending (CR LF).
+ */
+void fmt_eol(void);
+
+/**
+ * Write an unsigned decimal number, padded with spaces on the left.
+ * @param value the number
+ * @param width the minimum field width (0 for none)
+ */
+void fmt_uint(uint32_t value, uint8_t width);
+
+/**
+ * Write a signed decimal number, padded with spaces on the left.
+ * @param value the number
+ * @param width the minimum field width (0 for none)
+ */
+void fmt_int(int32_t value, uint8_t width);
+
+/**
+ * Write an unsigned decimal number with a fixed number of digits, padded
+ * with zeros, e.g. for fractions.
+ * @param value the number
+ * @param digits the number of digits (1..10), higher digits are cut off
+ */
+void fmt_zero(uint32_t value, uint8_t digits);
+
+/**
+ * Write a hexadecimal number with lowercase digits, padded with zeros.
+ * @param value the number
+ * @param digits the number of digits (1..8), higher digits are cut off
+ */
+void fmt_hex(uint32_t value, uint8_t digits);
+
+/**
+ * Write a monetary amount with two fraction digits, e.g. "-12.05".
+ * @param value the amount
+ */
+void fmt_currency(currency_t value);
+
+#endif /*_FMT_H*/
@@ -0,0 +1,135 @@
+/**
+ * @file frame.c
+ * @brief Host protocol framing implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef __AVR__
+#include <util/crc16.h>
+#endif
+#include "frame.h"
+
+/**
+ * Decoder states
+ */
+typedef enum {
+	/** Waiting for the synchronisation byte */
+	FRAME_STATE_SYNC,
+	/** Waiting for the payload length */
+	FRAME_STATE_LENGTH,
+	/** Waiting for the message type */
+	FRAME_STATE_TYPE,
+	/** Waiting for the sequence number */
+	FRAME_STATE_SEQ,
+	/** Receiving the payload */
+	FRAME_STATE_PAYLOAD,
+	/** Waiting for the checksum high byte */
+	FRAME_STATE_CRC_HIGH,
+	/** Waiting for the checksum low byte */
+	FRAME_STATE_CRC_LOW,
+} frame_state_e;
+
+uint16_t frame_crc(uint16_t crc, uint8_t data) {
+#ifdef __AVR__
+	return _crc_xmodem_update(crc, data);
+#else
+	uint8_t i;
+	crc ^= (uint16_t) data << 8;
+	for (i = 0; i < 8; i++) {
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+#endif
+}
+
+void frame_decoder_init(frame_decoder_t *decoder) {
+	decoder->state = FRAME_STATE_SYNC;
+	decoder->errors = 0;
+}
+
+bool frame_decode(frame_decoder_t *decoder, uint8_t data) {
+	switch (decoder->state) {
+		case FRAME_STATE_SYNC:
+			if (data == FRAME_SYNC) {
+				decoder->crc = 0;
+				decoder->state = FRAME_STATE_LENGTH;
+			}
+			break;
+		case FRAME_STATE_LENGTH:
+			if (data > FRAME_PAYLOAD_MAX) {
+				decoder->errors++;
+				// The length might have been a synchronisation byte
+				decoder->state = data == FRAME_SYNC ? FRAME_STATE_LENGTH : FRAME_STATE_SYNC;
+				break;
+			}
+			decoder->frame.length = data;
+			decoder->crc = frame_crc(decoder->crc, data);
+			decoder->state = FRAME_STATE_TYPE;
+			break;
+		case FRAME_STATE_TYPE:
+			decoder->frame.type = data;
+			decoder->crc = frame_crc(decoder->crc, data);
+			decoder->state = FRAME_STATE_SEQ;
+			break;
+		case FRAME_STATE_SEQ:
+			decoder->frame.seq = data;
+			decoder->crc = frame_crc(decoder->crc, data);
+			decoder->index = 0;
+			decoder->state = decoder->frame.length > 0 ? FRAME_STATE_PAYLOAD : FRAME_STATE_CRC_HIGH;
+			break;
+		case FRAME_STATE_PAYLOAD:
+			decoder->frame.payload[decoder->index++] = data;
+			decoder->crc = frame_crc(decoder->crc, data);
+			if (decoder->index == decoder->frame.length) {
+				decoder->state = FRAME_STATE_CRC_HIGH;
+			}
+			break;
+		case FRAME_STATE_CRC_HIGH:
+			decoder->check = (uint16_t) data << 8;
+			decoder->state = FRAME_STATE_CRC_LOW;
+			break;
+		case FRAME_STATE_CRC_LOW:
+			decoder->state = FRAME_STATE_SYNC;
+			if ((decoder->check | data) == decoder->crc) {
+				return true;
+			}
+			decoder->errors++;
+			break;
+	}
+	return false;
+}
+
+uint8_t frame_encode(const frame_t *frame, uint8_t *buf) {
+	uint8_t length = frame->length <= FRAME_PAYLOAD_MAX ? frame->length : FRAME_PAYLOAD_MAX;
+	uint16_t crc = 0;
+	uint8_t size = 0;
+	uint8_t i;
+	buf[size++] = FRAME_SYNC;
+	buf[size++] = length;
+	buf[size++] = frame->type;
+	buf[size++] = frame->seq;
+	for (i = 0; i < length; i++) {
+		buf[size++] = frame->payload[i];
+	}
+	for (i = 1; i < size; i++) {
+		crc = frame_crc(crc, buf[i]);
+	}
+	buf[size++] = crc >> 8;
+	buf[size++] = crc & 0xff;
+	return size;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file frame.h
+ * @brief Host protocol framing and message definitions
+ * 
+ * The host protocol is spoken on the console UART in machine mode (see
+ * remote.h). It is shared by the firmware and the host client (tools/).
+ * 
+ * @par Frame format
+ * 
+ * Offset | Size   | Field
+ * -------|--------|----------------------------------------------------------
+ * 0      | 1      | Synchronisation byte FRAME_SYNC
+ * 1      | 1      | Payload length (0..FRAME_PAYLOAD_MAX)
+ * 2      | 1      | Message type (frame_type_e)
+ * 3      | 1      | Sequence number, copied from the request into the response
+ * 4      | length | Payload
+ * 4+n    | 2      | CRC16/XMODEM over length, type, sequence and payload (high byte first)
+ * 
+ * Multi-byte payload fields are little endian. A receiver that sees an
+ * invalid length or checksum drops the frame and waits for the next
+ * synchronisation byte, which does not occur in console text.
+ * 
+ * @par Messages
+ * 
+ * Responses carry the request type with FRAME_RESPONSE set. Requests may be
+ * pipelined; they are answered in order. A request that cannot be handled is
+ * answered with FRAME_ERROR.
+ * 
+ * Type              | Request payload           | Response payload
+ * ------------------|---------------------------|---------------------------------
+ * FRAME_PING        | any                       | the request payload
+ * FRAME_BALANCE_GET | -                         | int16 base, uint8 cents
+ * FRAME_BALANCE_SET | int16 base, uint8 cents   | int16 base, uint8 cents
+ * FRAME_BILL_GET    | -                         | uint8 state (bill_state_t)
+ * FRAME_COIN_GET    | -                         | uint8 alarm, uint8 pins
+ * FRAME_GPIO_GET    | char port                 | char port, uint8 pins
+ * FRAME_GPIO_SET    | char port, uint8 pin, uint8 action (frame_gpio_e) | char port, uint8 pins
+ * FRAME_EXIT        | -                         | - (then back to the console shell)
+ * FRAME_ERROR       | (response only)           | uint8 request type, uint8 code (frame_error_e)
+ * FRAME_EVENT       | (notification only)       | uint8 id (eventlog_id_e), uint32 time, uint16 a, uint16 b
+ * 
+ * Event notifications are sent unsolicited, with their own sequence numbers.
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Synchronisation byte */
+#define FRAME_SYNC 0xa5
+/** Maximum payload length */
+#define FRAME_PAYLOAD_MAX 16
+/** Number of framing bytes (synchronisation, length, type, sequence, CRC) */
+#define FRAME_OVERHEAD 6
+/** Maximum size of an encoded frame */
+#define FRAME_SIZE_MAX (FRAME_PAYLOAD_MAX + FRAME_OVERHEAD)
+/** Event id that reports dropped event log records (a = count) */
+#define FRAME_EVENT_DROPPED 0xff
+
+/**
+ * Message types
+ */
+typedef enum {
+	FRAME_PING = 0x01,
+	FRAME_BALANCE_GET = 0x02,
+	FRAME_BALANCE_SET = 0x03,
+	FRAME_BILL_GET = 0x04,
+	FRAME_COIN_GET = 0x05,
+	FRAME_GPIO_GET = 0x06,
+	FRAME_GPIO_SET = 0x07,
+	FRAME_EXIT = 0x0f,
+	FRAME_EVENT = 0x40,
+	FRAME_ERROR = 0x7f,
+	/** Response flag */
+	FRAME_RESPONSE = 0x80,
+} frame_type_e;
+
+/**
+ * Error codes
+ */
+typedef enum {
+	/** Unknown message type */
+	FRAME_ERROR_TYPE = 1,
+	/** Invalid payload length */
+	FRAME_ERROR_LENGTH = 2,
+	/** Invalid argument */
+	FRAME_ERROR_ARGUMENT = 3,
+	/** No response from the controller (only sent by the host multiplexer, see tools/mux.h) */
+	FRAME_ERROR_TIMEOUT = 4,
+} frame_error_e;
+
+/**
+ * GPIO actions
+ */
+typedef enum {
+	/** Configure as input */
+	FRAME_GPIO_IN = 0,
+	/** Drive low (or disable the pull-up) */
+	FRAME_GPIO_OFF = 1,
+	/** Drive high (or enable the pull-up) */
+	FRAME_GPIO_ON = 2,
+	/** Configure as output */
+	FRAME_GPIO_OUT = 3,
+} frame_gpio_e;
+
+/**
+ * Decoded frame
+ */
+typedef struct {
+	/** Message type */
+	uint8_t type;
+	/** Sequence number */
+	uint8_t seq;
+	/** Payload length */
+	uint8_t length;
+	/** Payload */
+	uint8_t payload[FRAME_PAYLOAD_MAX];
+} frame_t;
+
+/**
+ * Frame decoder state
+ */
+typedef struct {
+	/** Decoder state (internal) */
+	uint8_t state;
+	/** Number of payload bytes received */
+	uint8_t index;
+	/** Running checksum */
+	uint16_t crc;
+	/** Received checksum */
+	uint16_t check;
+	/** Number of frames dropped because of an invalid length or checksum */
+	uint16_t errors;
+	/** The frame being received, valid after frame_decode() returned true */
+	frame_t frame;
+} frame_decoder_t;
+
+/**
+ * Update a CRC16/XMODEM checksum (polynomial 0x1021, initial value 0).
+ * @param crc the checksum so far
+ * @param data the next byte
+ * @return the updated checksum
+ */
+uint16_t frame_crc(uint16_t crc, uint8_t data);
+
+/**
+ * Initialise (or reset) a frame decoder.
+ * @param decoder the decoder
+ */
+void frame_decoder_init(frame_decoder_t *decoder);
+
+/**
+ * Feed a received byte to a frame decoder.
+ * @param decoder the decoder
+ * @param data the byte
+ * @return true, if a valid frame is complete (in decoder->frame)
+ */
+bool frame_decode(frame_decoder_t *decoder, uint8_t data);
+
+/**
+ * Encode a frame.
+ * @param frame the frame
+ * @param buf storage for at least FRAME_SIZE_MAX bytes
+ * @return the number of bytes written
+ */
+uint8_t frame_encode(const frame_t *frame, uint8_t *buf);
+
+/**
+ * Store a 16 bit value in a payload (little endian).
+ * @param buf the payload position
+ * @param value the value
+ */
+static inline void frame_put16(uint8_t *buf, uint16_t value) {
+	buf[0] = value & 0xff;
+	buf[1] = value >> 8;
+}
+
+/**
+ * Store a 32 bit value in a payload (little endian).
+ * @param buf the payload position
+ * @param value the value
+ */
+static inline void frame_put32(uint8_t *buf, uint32_t value) {
+	frame_put16(buf, value & 0xffff);
+	frame_put16(buf + 2, value >> 16);
+}
+
+/**
+ * Load a 16 bit value from a payload (little endian).
+ * @param buf the payload position
+ * @return the value
+ */
+static inline uint16_t frame_get16(const uint8_t *buf) {
+	return buf[0] | (uint16_t) buf[1] << 8;
+}
+
+/**
+ * Load a 32 bit value from a payload (little endian).
+ * @param buf the payload position
+ * @return the value
+ */
+static inline uint32_t frame_get32(const uint8_t *buf) {
+	return frame_get16(buf) | (uint32_t) frame_get16(buf + 2) << 16;
+}
+
+#endif /*_FRAME_H*/
@@ -0,0 +1,129 @@
+/**
+ * @file gpio.c
+ * @brief General purpose I/O port access implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <avr/io.h>
+#include <aversive/irq_lock.h>
+#include "gpio.h"
+
+uint8_t gpio_pins(char port) {
+	switch (port) {
+		case 'A':
+			return PINA;
+		case 'B':
+			return PINB;
+		case 'C':
+			return PINC;
+		case 'D':
+			return PIND;
+		case 'E':
+			return PINE;
+		case 'F':
+			return PINF;
+		case 'G':
+			return PING;
+	}
+	return 0;
+}
+
+volatile uint8_t *gpio_input(char port) {
+	switch (port) {
+		case 'A':
+			return &PINA;
+		case 'B':
+			return &PINB;
+		case 'C':
+			return &PINC;
+		case 'D':
+			return &PIND;
+		case 'E':
+			return &PINE;
+		case 'F':
+			return &PINF;
+		case 'G':
+			return &PING;
+	}
+	return NULL;
+}
+
+bool gpio_pin(char port, uint8_t pin) {
+	return (gpio_pins(port) & _BV(pin)) != 0;
+}
+
+void gpio_port(char port, uint8_t pin, bool state) {
+	// Ports F and G are not bit addressable, so the update is not atomic
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	switch (port) {
+		case 'A':
+			if (state) PORTA |= _BV(pin); else PORTA &= ~_BV(pin);
+			break;
+		case 'B':
+			if (state) PORTB |= _BV(pin); else PORTB &= ~_BV(pin);
+			break;
+		case 'C':
+			if (state) PORTC |= _BV(pin); else PORTC &= ~_BV(pin);
+			break;
+		case 'D':
+			if (state) PORTD |= _BV(pin); else PORTD &= ~_BV(pin);
+			break;
+		case 'E':
+			if (state) PORTE |= _BV(pin); else PORTE &= ~_BV(pin);
+			break;
+		case 'F':
+			if (state) PORTF |= _BV(pin); else PORTF &= ~_BV(pin);
+			break;
+		case 'G':
+			if (state) PORTG |= _BV(pin); else PORTG &= ~_BV(pin);
+			break;
+	}
+	IRQ_UNLOCK(flags);
+}
+
+void gpio_ddr(char port, uint8_t pin, bool state) {
+	// Ports F and G are not bit addressable, so the update is not atomic
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	switch (port) {
+		case 'A':
+			if (state) DDRA |= _BV(pin); else DDRA &= ~_BV(pin);
+			break;
+		case 'B':
+			if (state) DDRB |= _BV(pin); else DDRB &= ~_BV(pin);
+			break;
+		case 'C':
+			if (state) DDRC |= _BV(pin); else DDRC &= ~_BV(pin);
+			break;
+		case 'D':
+			if (state) DDRD |= _BV(pin); else DDRD &= ~_BV(pin);
+			break;
+		case 'E':
+			if (state) DDRE |= _BV(pin); else DDRE &= ~_BV(pin);
+			break;
+		case 'F':
+			if (state) DDRF |= _BV(pin); else DDRF &= ~_BV(pin);
+			break;
+		case 'G':
+			if (state) DDRG |= _BV(pin); else DDRG &= ~_BV(pin);
+			break;
+	}
+	IRQ_UNLOCK(flags);
+}
@@ -0,0 +1,69 @@
+/**
+ * @file gpio.h
+ * @brief General purpose I/O port access
+ * 
+ * Access to the I/O ports A to G by port letter and pin number, for
+ * diagnostic commands and the host protocol.
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GPIO_H
+#define _GPIO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Read the input state of a port.
+ * @param port the port letter ('A'..'G')
+ * @return the pin states, or 0 for an invalid port
+ */
+uint8_t gpio_pins(char port);
+
+/**
+ * Get the input register of a port, for fast repeated reads.
+ * @param port the port letter ('A'..'G')
+ * @return the input register, or NULL for an invalid port
+ */
+volatile uint8_t *gpio_input(char port);
+
+/**
+ * Read the input state of a pin.
+ * @param port the port letter ('A'..'G')
+ * @param pin the pin number (0..7)
+ * @return true, if the pin is high
+ */
+bool gpio_pin(char port, uint8_t pin);
+
+/**
+ * Set the output level (or pull-up) of a pin.
+ * @param port the port letter ('A'..'G')
+ * @param pin the pin number (0..7)
+ * @param state true for high
+ */
+void gpio_port(char port, uint8_t pin, bool state);
+
+/**
+ * Set the direction of a pin.
+ * @param port the port letter ('A'..'G')
+ * @param pin the pin number (0..7)
+ * @param state true for output
+ */
+void gpio_ddr(char port, uint8_t pin, bool state);
+
+#endif /*_GPIO_H*/
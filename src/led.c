@@ -20,10 +20,8 @@
  */
 
 #include <avr/io.h>
-#include <avr/interrupt.h>
-#include <aversive/irq_lock.h>
 #include "led.h"
-#include "memory.h"
+#include "slab.h"
 
 /* TODO These should go into a configuration header */
 
@@ -63,9 +61,9 @@ typedef struct {
 	/** Affected LED */
 	led_name_e name;
 	/** On time */
-	uint16_t on;
+	dispatch_time_t on;
 	/** Off time */
-	uint16_t off;
+	dispatch_time_t off;
 	/** Blink? */
 	bool blink;
 	/** Periodic? */
@@ -80,10 +78,6 @@ typedef struct {
 	struct callout_mgr *manager;
 	/** Preallocated events for blink requests */
 	led_event_t blink[3];
-	/** Memory manager for the event queue */
-	memory_t *memory;
-	/** Managed memory pool */
-	uint8_t pool[MEMORY_POOL_SIZE(LED_QUEUE_SIZE, sizeof(led_event_t))];
 } led_t;
 
 /**
@@ -100,8 +94,8 @@ static led_t led_global __attribute__((section(".noinit")));
 static void led_callback(struct callout_mgr *cm, struct callout *tim, void *arg);
 
 bool led_init(struct callout_mgr *manager) {
-	led_global.memory = memory_init(led_global.pool, sizeof(led_global.pool), sizeof(led_event_t));
-
+	led_global.manager = manager;
+	
 	led_name_e led;
 	for (led = 0; led < LED_MAX; led++) {
 		led_event_t *event = &led_global.blink[led];
@@ -110,20 +104,14 @@ bool led_init(struct callout_mgr *manager) {
 		callout_init(&event->co, led_callback, event, LED_PRIORITY);
 	}
 	
-	if (led_global.memory) {
-		led_global.manager = manager;
-		
-		LED_PORT_A &= ~_BV(LED_P_A);
-		LED_DDR_A |= _BV(LED_P_A);
-		LED_PORT_B &= ~_BV(LED_P_B);
-		LED_DDR_B |= _BV(LED_P_B);
-		LED_PORT_C &= ~_BV(LED_P_C);
-		LED_DDR_C |= _BV(LED_P_C);
-		
-		return true;
-	}
-
-	return false;
+	LED_PORT_A &= ~_BV(LED_P_A);
+	LED_DDR_A |= _BV(LED_P_A);
+	LED_PORT_B &= ~_BV(LED_P_B);
+	LED_DDR_B |= _BV(LED_P_B);
+	LED_PORT_C &= ~_BV(LED_P_C);
+	LED_DDR_C |= _BV(LED_P_C);
+	
+	return true;
 }
 
 void led_shutdown(bool off) {
@@ -144,10 +132,7 @@ void led_shutdown(bool off) {
 
 bool led_action(led_name_e led, led_event_type_e action) {
 	if (led < LED_MAX) {
-		uint8_t flags;
-		IRQ_LOCK(flags);
-		led_event_t *event = (led_event_t *) memory_allocate(led_global.memory);
-		IRQ_UNLOCK(flags);
+		led_event_t *event = (led_event_t *) slab_allocate(SLAB_OWNER_LED, sizeof(led_event_t));
 		
 		if (event) {
 			event->type = action;
@@ -162,7 +147,7 @@ bool led_action(led_name_e led, led_event_type_e action) {
 	return false;
 }
 
-bool led_blink(led_name_e led, uint16_t ontime, uint16_t offtime, bool repeat) {
+bool led_blink(led_name_e led, dispatch_time_t ontime, dispatch_time_t offtime, bool repeat) {
 	if (led < LED_MAX) {
 		led_event_t *event = &led_global.blink[led];
 		
@@ -180,7 +165,6 @@ bool led_blink(led_name_e led, uint16_t ontime, uint16_t offtime, bool repeat) {
 }
 
 static void led_callback(struct callout_mgr *cm, struct callout *tim, void *arg) {
-	uint8_t flags;
 	if (arg) {
 		led_event_t *priv = (led_event_t *) arg;
 		
@@ -254,8 +238,6 @@ static void led_callback(struct callout_mgr *cm, struct callout *tim, void *arg)
 			callout_stop(led_global.manager, &led_global.blink[priv->name].co);
 		}
 		
-		IRQ_LOCK(flags);
-		memory_release(arg);
-		IRQ_UNLOCK(flags);
+		slab_release(arg);
 	}
 }
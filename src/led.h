@@ -13,7 +13,7 @@
  * 
  * Macro               | Default  | Values         | Description
  * --------------------|----------|----------------|-----------------------------------------------
- * LED_QUEUE_SIZE      | [undef]  | 0..255         | Size of the event pool
+ * LED_QUEUE_SIZE      | [undef]  | 0..255         | Event memory quota (0 = no limit)
  * LED_PRIORITY        | [undef]  | 0..127         | Event queue priority
  * 
  * @copyright Matemat controller firmware
@@ -37,7 +37,7 @@
 #define _LED_H
 
 #include <stdbool.h>
-#include <base/callout/callout.h>
+#include "dispatch.h"
 
 /**
  * LED driver event types
@@ -90,11 +90,11 @@ bool led_action(led_name_e led, led_event_type_e action);
 /**
  * Schedule a periodic or one-shot event to make the LED turn off and on
  * @param led the LED to act upon
- * @param ontime the length of the on-time in ticks
- * @param offtime the length of the off-time in ticks
+ * @param ontime the length of the on-time in ticks (at most DISPATCH_DELAY_MAX)
+ * @param offtime the length of the off-time in ticks (at most DISPATCH_DELAY_MAX)
  * @param repeat true, if the blinking should be periodic
  * @return true, if the event was queued successfully.
  */
-bool led_blink(led_name_e led, uint16_t ontime, uint16_t offtime, bool repeat);
+bool led_blink(led_name_e led, dispatch_time_t ontime, dispatch_time_t offtime, bool repeat);
 
 #endif /*_LED_H*/
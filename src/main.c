@@ -20,7 +20,6 @@
  */
 
 #include <stdbool.h>
-#include <stdio.h>
 #include <avr/io.h>
 #include <avr/wdt.h>
 #include <avr/sleep.h>
@@ -28,10 +27,13 @@
 #include <avr/version.h>
 #include <avr/pgmspace.h>
 #include <aversive/irq_lock.h>
-#include <base/callout/callout.h>
+#include "dispatch.h"
 #include <hardware/timer/timer.h>
 #include "main.h"
-#include "memory.h"
+#include "slab.h"
+#include "sched.h"
+#include "eventlog.h"
+#include "telemetry.h"
 #include "led.h"
 #include "clock.h"
 #include "util.h"
@@ -64,16 +66,14 @@ typedef struct {
 typedef struct {
 	/** Global running state */
 	bool running;
-	/** System time (in ticks) */
-	uint16_t time;
+	/** System time (in ticks), the low bits are supplied by the hardware counter */
+	uint32_t time;
 	/** Global event queue manager */
 	struct callout_mgr manager;
 	/** Global credit store */
 	bank_t bank;
-	/** Main process event memory manager */
-	memory_t *memory;
-	/** Main process event memory pool */
-	uint8_t pool[MEMORY_POOL_SIZE(MAIN_QUEUE_SIZE, sizeof(main_event_t))];
+	/** Idle statistics */
+	main_idle_t idle;
 } main_t;
 
 /**
@@ -103,9 +103,28 @@ void watchdog_init(void) __attribute__((naked)) __attribute__((section(".init3")
 static void main_callback(struct callout_mgr *cm, struct callout *tim, void *arg);
 
 /**
- * Update the system timer and call the event queue manager
+ * Event queue time source
+ */
+static dispatch_time_t main_dispatch_time(void);
+
+/**
+ * Run the due events from the main loop. The callbacks run with interrupts
+ * enabled, so the UART and sampling interrupts are served in the meantime.
+ */
+static void main_dispatch(void);
+
+#ifdef MAIN_TICKLESS
+/**
+ * Program the timer compare unit to the earliest pending event deadline.
+ * Must be called with interrupts disabled.
+ */
+static void main_arm(void);
+#else
+/**
+ * Update the system timer
  */
 static void main_systick(void);
+#endif
 
 /**
  * Add a scanned banknote value to the piggybank (callback)
@@ -139,10 +158,7 @@ void watchdog_init(void) {
 }
 
 void main_shutdown(void) {
-	uint8_t flags;
-	IRQ_LOCK(flags);
-	main_event_t *event = (main_event_t *) memory_allocate(main_global.memory);
-	IRQ_UNLOCK(flags);
+	main_event_t *event = (main_event_t *) slab_allocate(SLAB_OWNER_MAIN, sizeof(main_event_t));
 	if (event) {
 		event->type = MAIN_EVENT_TYPE_SHUTDOWN;
 		callout_init(&event->co, main_callback, event, MAIN_PRIORITY);
@@ -151,7 +167,6 @@ void main_shutdown(void) {
 }
 
 static void main_callback(struct callout_mgr *cm, struct callout *tim, void *arg) {
-	uint8_t flags;
 	if (arg) {
 		main_event_t *priv = (main_event_t *) arg;
 		switch (priv->type) {
@@ -159,30 +174,110 @@ static void main_callback(struct callout_mgr *cm, struct callout *tim, void *arg
 				main_global.running = false;
 				break;
 		}
-		IRQ_LOCK(flags);
-		memory_release(arg);
-		IRQ_UNLOCK(flags);
+		slab_release(arg);
+	}
+}
+
+dispatch_time_t main_dispatch_time(void) {
+	return main_time();
+}
+
+void main_dispatch(void) {
+	cli();
+	dispatch_time_t next;
+	if (dispatch_next(&main_global.manager, &next) && (dispatch_diff_t) (main_time() - next) >= 0) {
+		main_global.idle.dispatches++;
+#ifndef MAIN_TIMING_WHEEL
+		sched_begin(&main_global.manager);
+#endif
+		sei();
+		callout_manage(&main_global.manager);
+#ifndef MAIN_TIMING_WHEEL
+		sched_end();
+#endif
+	}
+	sei();
+}
+
+#ifdef MAIN_TICKLESS
+
+/**
+ * Timer overflow interrupt, extends the system time
+ */
+ISR(TIMER3_OVF_vect) {
+	main_global.time += 0x10000;
+}
+
+/**
+ * Timer compare interrupt, an event is due. Only wakes up the main loop,
+ * which dispatches the event and programs the next deadline.
+ */
+ISR(TIMER3_COMPA_vect) {
+	ETIMSK &= ~_BV(OCIE3A);
+}
+
+static void main_arm(void) {
+	dispatch_time_t now = main_time();
+	dispatch_time_t next;
+	if (dispatch_next(&main_global.manager, &next)) {
+		dispatch_diff_t delta = next - now;
+		// Fire on the next tick if the deadline has passed or is too close to program safely
+		if (delta < 2) {
+			delta = 2;
+		}
+		if ((uint32_t) delta <= UINT16_MAX) {
+			OCR3A = (uint16_t) (now + delta);
+			ETIFR = _BV(OCF3A);
+			ETIMSK |= _BV(OCIE3A);
+		} else {
+			// Beyond the counter range, the overflow interrupt wakes us up before the deadline
+			ETIMSK &= ~_BV(OCIE3A);
+		}
+	} else {
+		// Nothing scheduled, sleep until another interrupt
+		ETIMSK &= ~_BV(OCIE3A);
 	}
 }
 
+uint32_t main_time(void) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	uint16_t count = TCNT3;
+	uint32_t time = main_global.time;
+	// The counter may have wrapped while interrupts are locked, before the overflow interrupt could run
+	if ((ETIFR & _BV(TOV3)) && count < 0x8000) {
+		time += 0x10000;
+	}
+	IRQ_UNLOCK(flags);
+	return time | count;
+}
+
+#else /*MAIN_TICKLESS*/
+
 static void main_systick(void) {
 	uint8_t flags;
 	IRQ_LOCK(flags);
 	main_global.time += 0x100;
 	IRQ_UNLOCK(flags);
-	callout_manage(&main_global.manager);
 }
 
-uint16_t main_time(void) {
+uint32_t main_time(void) {
 	uint8_t flags;
 	IRQ_LOCK(flags);
-	uint16_t time = main_global.time | timer2_get();
+	uint8_t count = timer2_get();
+	uint32_t time = main_global.time;
+	// The counter may have wrapped while interrupts are locked, before the overflow interrupt could run
+	if ((TIFR & _BV(TOV2)) && count < 0x80) {
+		time += 0x100;
+	}
 	IRQ_UNLOCK(flags);
-	return time;
+	return time | count;
 }
 
+#endif /*MAIN_TICKLESS*/
+
 static void main_bill_report(uint16_t denomination) {
-	printf_P(PSTR("Scanned banknote: %d\r\n"), denomination);
+	eventlog_write(EVENTLOG_BILL_REPORT, denomination, 0);
 	currency_t deposit;
 	deposit.base = denomination;
 	deposit.cents = 0;
@@ -190,54 +285,58 @@ static void main_bill_report(uint16_t denomination) {
 }
 
 static void main_bill_error(bill_error_t error, uint16_t denomination) {
-	PGM_P errstr = PSTR("");
-	switch (error) {
-		case BILL_ERROR_INTERNAL:
-			errstr = PSTR("Internal error");
-			break;
-		case BILL_ERROR_SCAN:
-			errstr = PSTR("Scan error, fake banknote, or jam");
-			break;
-		case BILL_ERROR_STACK:
-			errstr = PSTR("Stacker error");
-			break;
-		case BILL_ERROR_FULL:
-			errstr = PSTR("Holder full");
-			break;
-		case BILL_ERROR_UNKNOWN:
-			errstr = PSTR("Unknown banknote");
-			break;
-	}
-	printf_P(PSTR("Banknote scan error: %S\r\n"), errstr);
+	eventlog_write(EVENTLOG_BILL_ERROR, error, denomination);
 }
 
 static void main_balance_report(currency_t balance) {
-	printf_P(PSTR("Current balance: %d.%d\r\n"), balance.base, balance.cents);
+	eventlog_write(EVENTLOG_BALANCE, balance.base, balance.cents);
 }
 
 static void main_coin_report(currency_t denomination) {
-	printf_P(PSTR("Scanned coin: %d.%d\r\n"), denomination.base, denomination.cents);
+	eventlog_write(EVENTLOG_COIN_REPORT, denomination.base, denomination.cents);
 	bank_deposit(&main_global.bank, denomination);
 }
 
 static void main_coin_error(coin_error_t error) {
-	printf_P(PSTR("Coin acceptor alarm\r\n"));
+	eventlog_write(EVENTLOG_COIN_ERROR, error, 0);
 }
 
 bank_t *main_get_bank(void) {
 	return &main_global.bank;
 }
 
+void main_get_idle(main_idle_t *stats) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	*stats = main_global.idle;
+	IRQ_UNLOCK(flags);
+}
+
+bool main_tickless(void) {
+#ifdef MAIN_TICKLESS
+	return true;
+#else
+	return false;
+#endif
+}
+
 int main(void) {
 	// System initialisation
-	main_global.memory = memory_init(main_global.pool, sizeof(main_global.pool), sizeof(main_event_t));
-	callout_mgr_init(&main_global.manager, main_time);
+	slab_init();
+	callout_mgr_init(&main_global.manager, main_dispatch_time);
+	sched_init(&main_global.manager, main_dispatch_time);
+	eventlog_init(&main_global.manager);
+	telemetry_init(&main_global.manager);
 	main_global.time = 0;
+	main_global.idle.wakeups = 0;
+	main_global.idle.dispatches = 0;
 	
 	// Initialize timers
 	timer_init();
+#ifndef MAIN_TICKLESS
 	// System timer
 	timer2_register_OV_intr(main_systick);
+#endif
 	
 	// Driver initialisation
 	led_init(&main_global.manager);
@@ -253,7 +352,7 @@ int main(void) {
 	// Turn the third LED on
 	led_action(LED_C, LED_EVENT_TYPE_ON);
 	// Make the second LED blink once per second
-	led_blink(LED_B, 15625, 15625, true);
+	led_blink(LED_B, MAIN_SECONDS(1), MAIN_SECONDS(1), true);
 	
 	// Set idle sleep mode
 	set_sleep_mode(SLEEP_MODE_IDLE);
@@ -262,14 +361,32 @@ int main(void) {
 	sei();
 	
 	// Start timers
+#ifdef MAIN_TICKLESS
+	// Normal mode, CS30:2 = 0b101 (1024), same tick length as timer 2
+	TCCR3A = 0;
+	TCNT3 = 0;
+	ETIFR = _BV(TOV3);
+	ETIMSK |= _BV(TOIE3);
+	TCCR3B = _BV(CS30) | _BV(CS32);
+#else
 	timer2_start();
+#endif
 	// Start real time clock
 	clock_start();
 	
 	main_global.running = true;
 	while (main_global.running) {
-		// Halt CPU and wait for the next interrupt
-		sleep_mode();
+		main_dispatch();
+		cli();
+		main_global.idle.wakeups++;
+#ifdef MAIN_TICKLESS
+		main_arm();
+#endif
+		// Halt CPU and wait for the next interrupt (sei only takes effect after the next instruction)
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
 	}
 	
 	// System shutdown
@@ -279,6 +396,8 @@ int main(void) {
 	bill_shutdown();
 	led_shutdown(true);
 	console_shutdown();
+	eventlog_shutdown();
+	telemetry_shutdown();
 	
 	// Perform a software reset by enabling the watchdog at its shortest setting, then go to sleep
 	wdt_enable(WDTO_15MS);
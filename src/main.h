@@ -6,8 +6,24 @@
  * 
  * Macro               | Default  | Values         | Description
  * --------------------|----------|----------------|-----------------------------------------------
- * MAIN_QUEUE_SIZE     | [undef]  | 0..255         | Size of the event pool
+ * MAIN_QUEUE_SIZE     | [undef]  | 0..255         | Event memory quota (0 = no limit)
  * MAIN_PRIORITY       | [undef]  | 0..127         | Event queue priority
+ * MAIN_TICKLESS       | [undef]  | [def/undef]    | Tickless system timer (timer 3) instead of a periodic tick (timer 2)
+ * 
+ * In tickless mode, the system time is the 16 bit counter of timer 3, and its
+ * compare unit is programmed to the earliest pending event deadline before the
+ * CPU goes to sleep. The CPU only wakes up when an event is due or another
+ * interrupt occurs. Timer 3 must not be used for other purposes in this mode,
+ * except for its compare unit B, which clocks the banknote scanner sampling
+ * (see bill.h).
+ * 
+ * In both modes, the due events are dispatched from the main loop after
+ * every wakeup, with interrupts enabled.
+ * 
+ * The system time is a 32 bit tick counter (64 us per tick) that wraps around
+ * after 76 hours. The hardware counter supplies the low bits, its overflow
+ * interrupt the high bits. Tick counts must only be compared with the wrap-safe
+ * helpers main_time_after() and main_time_reached().
  * 
  * @copyright Matemat controller firmware
  * Copyright © 2014 Chaostreff Basel
@@ -29,12 +45,57 @@
 #ifndef _MAIN_H
 #define _MAIN_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "bank.h"
 
 /**
- * Get the current system time (ticks)
+ * Idle statistics
+ */
+typedef struct {
+	/** Number of times the CPU woke up from sleep */
+	uint32_t wakeups;
+	/** Number of times the event queue was dispatched */
+	uint32_t dispatches;
+} main_idle_t;
+
+/** Number of system timer ticks per second */
+#define MAIN_TICKS_PER_SECOND 15625UL
+
+/**
+ * Convert seconds to system timer ticks.
+ * @param seconds the number of seconds
+ */
+#define MAIN_SECONDS(seconds) ((uint32_t) (seconds) * MAIN_TICKS_PER_SECOND)
+
+/**
+ * Get the current system time (ticks).
+ * 
+ * The read is consistent even with interrupts disabled, when a pending
+ * timer overflow has not been accounted for yet.
+ * @return the number of ticks since startup
  */
-uint16_t main_time(void);
+uint32_t main_time(void);
+
+/**
+ * Check whether a point in time lies after another one.
+ * @param a a tick count
+ * @param b another tick count
+ * @return true, if a is later than b (modulo wrap-around)
+ */
+static inline bool main_time_after(uint32_t a, uint32_t b) {
+	return (int32_t) (a - b) > 0;
+}
+
+/**
+ * Check whether a deadline has been reached.
+ * @param now the current tick count
+ * @param deadline the deadline
+ * @return true, if now is equal to or later than the deadline (modulo wrap-around)
+ */
+static inline bool main_time_reached(uint32_t now, uint32_t deadline) {
+	return (int32_t) (now - deadline) >= 0;
+}
 
 /**
  * Signal the main process to shut down.
@@ -46,4 +107,16 @@ void main_shutdown(void);
  */
 bank_t *main_get_bank(void);
 
+/**
+ * Get the idle statistics (wakeups and event queue dispatches since startup).
+ * @param stats a pointer to storage for the statistics
+ */
+void main_get_idle(main_idle_t *stats);
+
+/**
+ * Check whether the tickless system timer is compiled in.
+ * @return true, if MAIN_TICKLESS is defined
+ */
+bool main_tickless(void);
+
 #endif /*_MAIN_H*/
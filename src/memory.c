@@ -19,36 +19,91 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+#include <aversive/irq_lock.h>
 #include "memory.h"
 
+/**
+ * Check if a chunk is being claimed by an interrupted allocation.
+ * @param manager the memory manager
+ * @param level the nesting level of the caller
+ * @param index the chunk index
+ * @return true, if any level below the caller has announced the chunk
+ */
+static bool memory_claimed(memory_t *manager, uint8_t level, uint8_t index);
+
 memory_t *memory_init(void *pool, size_t size, size_t chunksize) {
 	if (pool && size > sizeof(memory_t)) {
 		memory_t *manager = (memory_t *) pool;
-		void *prev = (uint8_t *) pool + sizeof(memory_t);
-		manager->head = prev;
-		size_t blocksize = chunksize + sizeof(void *);
+		size_t blocksize = chunksize + sizeof(memory_chunk_t);
 		size -= sizeof(memory_t);
-		size_t i;
-		for (i = 0; size >= (blocksize << 1); i++, size -= blocksize) {
-			void *next = (uint8_t *) prev + blocksize;
-			*(void **) prev = next;
-			prev = next;
+		manager->blocksize = blocksize;
+		manager->depth = 0;
+		uint8_t level;
+		for (level = 0; level < MEMORY_NEST_MAX; level++) {
+			manager->claim[level] = MEMORY_CLAIM_NONE;
 		}
-		if (size >= blocksize) {
-			*(void **) prev = NULL;
+		memset(manager->counters, 0, sizeof(manager->counters));
+		uint8_t *block = (uint8_t *) pool + sizeof(memory_t);
+		uint8_t count;
+		for (count = 0; count < MEMORY_CLAIM_NONE && size >= blocksize; count++, size -= blocksize, block += blocksize) {
+			memory_chunk_t *chunk = (memory_chunk_t *) block;
+			chunk->manager = manager;
+			chunk->state = 0;
+		}
+		manager->count = count;
+		if (count > 0) {
 			return manager;
 		}
 	}
 	return NULL;
 }
 
+bool memory_claimed(memory_t *manager, uint8_t level, uint8_t index) {
+	uint8_t i;
+	for (i = 0; i < level; i++) {
+		if (manager->claim[i] == index) {
+			return true;
+		}
+	}
+	return false;
+}
+
 void *memory_allocate(memory_t *manager) {
+	return memory_allocate_owner(manager, MEMORY_OWNER_ANY);
+}
+
+void *memory_allocate_owner(memory_t *manager, uint8_t owner) {
 	if (manager) {
-		if (manager->head) {
-			void *chunk = manager->head;
-			manager->head = *(void **) chunk;
-			*(void **) chunk = manager;
-			return (uint8_t *) chunk + sizeof(void *);
+		// Reserve a claim slot. Interrupts arriving before depth is stored
+		// use the same slot, but they restore depth before we resume.
+		uint8_t level = manager->depth;
+		if (level < MEMORY_NEST_MAX) {
+			manager->claim[level] = MEMORY_CLAIM_NONE;
+			manager->depth = level + 1;
+			uint8_t *block = (uint8_t *) manager + sizeof(memory_t);
+			uint8_t i;
+			for (i = 0; i < manager->count; i++, block += manager->blocksize) {
+				// Announce the chunk before testing it, so interrupts leave it alone
+				manager->claim[level] = i;
+				memory_chunk_t *chunk = (memory_chunk_t *) block;
+				if (chunk->state == 0 && !memory_claimed(manager, level, i)) {
+					chunk->state = owner;
+					break;
+				}
+			}
+			manager->claim[level] = MEMORY_CLAIM_NONE;
+			memory_counter_t *counter = &manager->counters[level];
+			if (i < manager->count) {
+				counter->allocations++;
+				if (i >= counter->peak) {
+					counter->peak = i + 1;
+				}
+				manager->depth = level;
+				return block + sizeof(memory_chunk_t);
+			}
+			counter->failures++;
+			manager->depth = level;
 		}
 	}
 	return NULL;
@@ -56,11 +111,47 @@ void *memory_allocate(memory_t *manager) {
 
 bool memory_release(void *memory) {
 	if (memory) {
-		memory_t **chunk = (memory_t **) memory - 1;
-		memory_t *manager = *chunk;
-		*(void **) chunk = manager->head;
-		manager->head = chunk;
-		return true;
+		memory_chunk_t *chunk = (memory_chunk_t *) ((uint8_t *) memory - sizeof(memory_chunk_t));
+		if (chunk->state) {
+			chunk->state = 0;
+			return true;
+		}
 	}
 	return false;
 }
+
+void memory_stats(memory_t *manager, memory_stats_t *stats) {
+	memset(stats, 0, sizeof(*stats));
+	if (manager) {
+		stats->chunks = manager->count;
+		// Copy the counters atomically, an interrupt may update them in between
+		memory_counter_t counters[MEMORY_NEST_MAX];
+		uint8_t flags;
+		IRQ_LOCK(flags);
+		memcpy(counters, manager->counters, sizeof(counters));
+		IRQ_UNLOCK(flags);
+		uint8_t level;
+		for (level = 0; level < MEMORY_NEST_MAX; level++) {
+			stats->allocations += counters[level].allocations;
+			stats->failures += counters[level].failures;
+			if (counters[level].peak > stats->peak) {
+				stats->peak = counters[level].peak;
+			}
+		}
+		uint8_t *block = (uint8_t *) manager + sizeof(memory_t);
+		uint8_t i;
+		for (i = 0; i < manager->count; i++, block += manager->blocksize) {
+			if (((memory_chunk_t *) block)->state) {
+				stats->used++;
+			}
+		}
+	}
+}
+
+uint8_t memory_owner(void *memory) {
+	if (memory) {
+		memory_chunk_t *chunk = (memory_chunk_t *) ((uint8_t *) memory - sizeof(memory_chunk_t));
+		return chunk->state;
+	}
+	return 0;
+}
@@ -26,14 +26,95 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#ifndef MEMORY_NEST_MAX
 /**
- * Dynamic memory manager based on fixed-size chunk allocation.
+ * Maximum number of allocations that may be in progress at the same time,
+ * i.e. the deepest interrupt nesting level that calls memory_allocate().
+ * Allocations beyond this level fail.
+ */
+#define MEMORY_NEST_MAX 4
+#endif
+
+/** Chunk index that marks an unused claim slot */
+#define MEMORY_CLAIM_NONE 0xff
+/** Owner tag of chunks allocated with memory_allocate() */
+#define MEMORY_OWNER_ANY 0xff
+
+struct memory;
+
+/**
+ * Allocation counters of one nesting level.
  * 
- * @warning The manager is not thread- or interrupt-safe.
+ * Each level is only ever updated by the allocation currently holding it,
+ * so the counters need no locking either.
+ */
+typedef struct {
+	/** Number of successful allocations */
+	uint32_t allocations;
+	/** Number of failed allocations */
+	uint16_t failures;
+	/** Highest chunk index + 1 handed out (high-water mark) */
+	uint8_t peak;
+} memory_counter_t;
+
+/**
+ * Pool occupancy statistics, see memory_stats().
  */
 typedef struct {
-	/** Pointer to the head chunk */
-	void *head;
+	/** Number of chunks in the pool */
+	uint8_t chunks;
+	/** Number of chunks currently allocated */
+	uint8_t used;
+	/** Maximum number of chunks that were allocated at the same time */
+	uint8_t peak;
+	/** Total number of successful allocations */
+	uint32_t allocations;
+	/** Total number of failed allocations */
+	uint16_t failures;
+} memory_stats_t;
+
+/**
+ * Chunk header, prepended to every chunk in the pool.
+ */
+typedef struct {
+	/** The manager owning this chunk (constant after initialisation) */
+	struct memory *manager;
+	/** Allocation state (0 = free, otherwise the owner tag) */
+	volatile uint8_t state;
+} memory_chunk_t;
+
+/**
+ * Dynamic memory manager based on fixed-size chunk allocation.
+ * 
+ * Allocation and release are interrupt-safe and do not mask interrupts.
+ * This relies on two properties of the AVR architecture:
+ * - Single-byte loads and stores are atomic.
+ * - Interrupts nest strictly: An interrupted context only resumes after the
+ *   interrupting context has returned.
+ * 
+ * Every chunk carries a state byte that is set to the owner tag on
+ * allocation and cleared on release. Before testing a chunk, an allocation announces its index in a
+ * claim slot that corresponds to its nesting level. Allocations that
+ * interrupt it skip all chunks announced by the levels below, so a chunk can
+ * never be handed out twice.
+ * 
+ * Chunks are always allocated from the lowest free index, so the highest
+ * index handed out so far is also the high-water mark of the pool.
+ * 
+ * @note Allocation is O(n) in the number of chunks. A pool may hold up to
+ * 255 chunks, additional space is ignored.
+ */
+typedef struct memory {
+	/** Number of chunks in the pool */
+	uint8_t count;
+	/** Size of a chunk, including its header */
+	size_t blocksize;
+	/** Number of allocations currently in progress */
+	volatile uint8_t depth;
+	/** Chunk index announced by each nesting level */
+	volatile uint8_t claim[MEMORY_NEST_MAX];
+	/** Allocation counters of each nesting level */
+	memory_counter_t counters[MEMORY_NEST_MAX];
 } memory_t;
 
 /**
@@ -44,7 +125,7 @@ typedef struct {
  * 
  *     char pool[MEMORY_POOL_SIZE(16, sizeof(int))];
  */
-#define MEMORY_POOL_SIZE(chunks, size) (sizeof(memory_t) + chunks * (size + sizeof(void *)))
+#define MEMORY_POOL_SIZE(chunks, size) (sizeof(memory_t) + (chunks) * ((size) + sizeof(memory_chunk_t)))
 
 /**
  * Initialize a dynamic memory manager.
@@ -59,17 +140,50 @@ memory_t *memory_init(void *pool, size_t size, size_t chunksize);
 
 /**
  * Allocate a chunk from the memory pool.
+ * 
+ * May be called from interrupt context.
  * @param manager the memory manager
  * @return a pointer to the allocated memory, or NULL if no free chunk was found
  */
 void *memory_allocate(memory_t *manager);
 
+/**
+ * Allocate a chunk on behalf of an owner.
+ * 
+ * May be called from interrupt context.
+ * @param manager the memory manager
+ * @param owner the owner tag (1..254)
+ * @return a pointer to the allocated memory, or NULL if no free chunk was
+ * found
+ */
+void *memory_allocate_owner(memory_t *manager, uint8_t owner);
+
 /**
  * Relinquish a chunk back to the memory pool.
+ * 
+ * May be called from interrupt context.
  * @param memory a pointer to the allocated memory
- * @return true, if the chunk was released successfully; false if manager or
- * chunk were NULL or if this chunk doesn't belong to manager
+ * @return true, if the chunk was released successfully; false if the chunk
+ * was NULL or not allocated
  */
 bool memory_release(void *memory);
 
+/**
+ * Collect the occupancy statistics of a memory pool.
+ * 
+ * Allocations beyond @ref MEMORY_NEST_MAX are not counted.
+ * @param manager the memory manager
+ * @param stats storage for the statistics
+ */
+void memory_stats(memory_t *manager, memory_stats_t *stats);
+
+/**
+ * Get the owner tag of an allocated chunk.
+ * 
+ * May be called from interrupt context.
+ * @param memory a pointer to the allocated memory
+ * @return the owner tag, or 0 if the chunk was NULL or not allocated
+ */
+uint8_t memory_owner(void *memory);
+
 #endif /*_MEMORY_H*/
@@ -0,0 +1,41 @@
+/**
+ * @file rate.c
+ * @brief Adaptive polling rate implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rate.h"
+
+void rate_init(rate_t *rate, uint16_t fast, uint16_t slow, uint32_t linger) {
+	rate->fast = fast;
+	rate->slow = slow;
+	rate->linger = linger;
+	rate->period = slow;
+	rate->last = 0;
+	rate->runs = 0;
+}
+
+uint16_t rate_update(rate_t *rate, uint32_t now, bool active) {
+	if (active) {
+		rate->last = now;
+		rate->period = rate->fast;
+	} else if (rate->period != rate->slow && now - rate->last >= rate->linger) {
+		rate->period = rate->slow;
+	}
+	return rate->period;
+}
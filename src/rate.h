@@ -0,0 +1,89 @@
+/**
+ * @file rate.h
+ * @brief Adaptive polling rate
+ * 
+ * Drivers that have to poll their inputs keep a slow rate while nothing
+ * happens and switch to a fast rate as soon as they detect activity. After
+ * the inputs have been quiet for the linger time, the rate falls back to
+ * the slow one:
+ * 
+ *     rate_t rate;
+ *     rate_init(&rate, 200, 1000, MAIN_SECONDS(2));
+ *     ...
+ *     // In the polling event
+ *     rate.runs++;
+ *     callout_schedule(cm, tim, rate_update(&rate, main_time(), pins != last));
+ * 
+ * The number of polls is counted by the driver, so it can also count
+ * polls taken in an interrupt.
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RATE_H
+#define _RATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Adaptive polling rate state
+ */
+typedef struct {
+	/** Polling period while active (ticks) */
+	uint16_t fast;
+	/** Polling period while idle (ticks) */
+	uint16_t slow;
+	/** Quiet time after which the slow period is used again (ticks) */
+	uint32_t linger;
+	/** Current polling period (ticks) */
+	uint16_t period;
+	/** Time of the last activity (ticks) */
+	uint32_t last;
+	/** Number of polls, maintained by the driver */
+	uint32_t runs;
+} rate_t;
+
+/**
+ * Polling rate statistics, for display
+ */
+typedef struct {
+	/** Current polling period (ticks) */
+	uint16_t period;
+	/** Number of polls */
+	uint32_t runs;
+} rate_stats_t;
+
+/**
+ * Initialise a polling rate, starting with the slow period.
+ * @param rate the polling rate
+ * @param fast the polling period while active (ticks)
+ * @param slow the polling period while idle (ticks)
+ * @param linger the quiet time before returning to the slow period (ticks)
+ */
+void rate_init(rate_t *rate, uint16_t fast, uint16_t slow, uint32_t linger);
+
+/**
+ * Record the result of a poll and get the period until the next one.
+ * @param rate the polling rate
+ * @param now the current time (ticks)
+ * @param active true, if the poll detected activity
+ * @return the polling period (ticks)
+ */
+uint16_t rate_update(rate_t *rate, uint32_t now, bool active);
+
+#endif /*_RATE_H*/
@@ -0,0 +1,332 @@
+/**
+ * @file remote.c
+ * @brief Console machine mode implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <aversive/irq_lock.h>
+#include "remote.h"
+#include "main.h"
+#include "bank.h"
+#include "bill.h"
+#include "coin.h"
+#include "gpio.h"
+#include "eventlog.h"
+#include "serial.h"
+#include "util.h"
+
+#ifndef REMOTE_TX_SIZE
+/** Size of the transmit ring buffer (power of 2) */
+#define REMOTE_TX_SIZE 64
+#endif
+
+#ifndef REMOTE_RETRY
+/** Transmit retry delay when the UART transmit buffer is full (ticks) */
+#define REMOTE_RETRY 16
+#endif
+
+static_assert((REMOTE_TX_SIZE & (REMOTE_TX_SIZE - 1)) == 0, "REMOTE_TX_SIZE must be a power of 2");
+static_assert(REMOTE_TX_SIZE <= 128, "REMOTE_TX_SIZE must fit into the 8 bit ring indexes");
+static_assert(REMOTE_TX_SIZE >= 2 * FRAME_SIZE_MAX, "REMOTE_TX_SIZE must hold a response and an event");
+static_assert(EVENTLOG_DROPPED == FRAME_EVENT_DROPPED, "Event ids must match the protocol");
+
+/**
+ * Protocol handler object
+ */
+typedef struct {
+	/** Event queue */
+	struct callout_mgr *manager;
+	/** Resume callback */
+	remote_resume_cb *resume;
+	/** Exit callback */
+	remote_exit_cb *exit;
+	/** Transmit event, drains the ring buffer */
+	struct callout drain;
+	/** Set while machine mode is active */
+	volatile bool active;
+	/** Set while the transmit event is scheduled */
+	volatile bool pending;
+	/** Set when input was refused */
+	volatile bool blocked;
+	/** Set from leaving machine mode until the transmit ring buffer is drained */
+	volatile bool stopping;
+	/** Sequence number of the next event notification */
+	uint8_t event;
+	/** Transmit ring buffer write index (modified with interrupts disabled) */
+	volatile uint8_t in;
+	/** Transmit ring buffer read index (only modified by the transmit event) */
+	volatile uint8_t out;
+	/** Request decoder */
+	frame_decoder_t decoder;
+	/** Transmit ring buffer */
+	uint8_t tx[REMOTE_TX_SIZE];
+} remote_t;
+
+/**
+ * Global protocol handler object
+ */
+static remote_t remote_global ATTRIBUTE_NOINIT;
+
+/**
+ * Transmit event, sends queued bytes until the UART is busy
+ * @param cm the event queue manager
+ * @param tim the transmit event
+ * @param arg unused
+ */
+static void remote_callback(struct callout_mgr *cm, struct callout *tim, void *arg);
+
+/**
+ * Handle a request and queue the response.
+ * @param request the request
+ * @return true, if the request was an exit request
+ */
+static bool remote_handle(const frame_t *request);
+
+/**
+ * Get the free space in the transmit ring buffer.
+ * @return the number of free bytes
+ */
+static uint8_t remote_free(void);
+
+void remote_init(struct callout_mgr *manager, remote_resume_cb *resume, remote_exit_cb *exit) {
+	remote_global.manager = manager;
+	remote_global.resume = resume;
+	remote_global.exit = exit;
+	remote_global.active = false;
+	remote_global.pending = false;
+	remote_global.blocked = false;
+	remote_global.stopping = false;
+	remote_global.event = 0;
+	remote_global.in = 0;
+	remote_global.out = 0;
+	callout_init(&remote_global.drain, remote_callback, NULL, CONSOLE_PRIORITY);
+}
+
+void remote_start(void) {
+	frame_decoder_init(&remote_global.decoder);
+	remote_global.blocked = false;
+	remote_global.stopping = false;
+	remote_global.active = true;
+}
+
+void remote_stop(void) {
+	remote_global.active = false;
+	remote_global.stopping = true;
+	// The transmit event calls the exit callback once the ring buffer is drained
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	if (!remote_global.pending) {
+		remote_global.pending = true;
+		callout_schedule(remote_global.manager, &remote_global.drain, 0);
+	}
+	IRQ_UNLOCK(flags);
+}
+
+bool remote_active(void) {
+	return remote_global.active;
+}
+
+uint8_t remote_free(void) {
+	return REMOTE_TX_SIZE - (uint8_t) (remote_global.in - remote_global.out);
+}
+
+remote_input_e remote_input(uint8_t data) {
+	// Only accept input if the largest possible response fits
+	if (remote_free() < FRAME_SIZE_MAX) {
+		remote_global.blocked = true;
+		return REMOTE_INPUT_BUSY;
+	}
+	if (frame_decode(&remote_global.decoder, data)) {
+		if (remote_handle(&remote_global.decoder.frame)) {
+			return REMOTE_INPUT_EXIT;
+		}
+	}
+	return REMOTE_INPUT_OK;
+}
+
+bool remote_send(const frame_t *frame) {
+	uint8_t buf[FRAME_SIZE_MAX];
+	uint8_t size = frame_encode(frame, buf);
+	bool ret = false;
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	if (remote_free() >= size) {
+		// Frames are copied completely or not at all, so they are never interleaved
+		uint8_t in = remote_global.in;
+		uint8_t i;
+		for (i = 0; i < size; i++) {
+			remote_global.tx[in++ & (REMOTE_TX_SIZE - 1)] = buf[i];
+		}
+		remote_global.in = in;
+		if (!remote_global.pending) {
+			remote_global.pending = true;
+			callout_schedule(remote_global.manager, &remote_global.drain, 0);
+		}
+		ret = true;
+	}
+	IRQ_UNLOCK(flags);
+	return ret;
+}
+
+bool remote_event(uint8_t id, uint32_t time, uint16_t a, uint16_t b) {
+	frame_t frame;
+	frame.type = FRAME_EVENT;
+	frame.seq = remote_global.event;
+	frame.length = 9;
+	frame.payload[0] = id;
+	frame_put32(&frame.payload[1], time);
+	frame_put16(&frame.payload[5], a);
+	frame_put16(&frame.payload[7], b);
+	if (remote_send(&frame)) {
+		remote_global.event++;
+		return true;
+	}
+	return false;
+}
+
+void remote_callback(struct callout_mgr *cm, struct callout *tim, void *arg) {
+	uint8_t out = remote_global.out;
+	while (out != remote_global.in) {
+		if (serial_send_nowait(remote_global.tx[out & (REMOTE_TX_SIZE - 1)]) < 0) {
+			// Transmit buffer full, try again later
+			callout_schedule(cm, tim, REMOTE_RETRY);
+			break;
+		}
+		remote_global.out = ++out;
+	}
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	if (out == remote_global.in && remote_global.pending) {
+		// Checked with interrupts disabled, so a concurrent send schedules the event again
+		remote_global.pending = false;
+	}
+	IRQ_UNLOCK(flags);
+	if (remote_global.blocked && remote_free() >= FRAME_SIZE_MAX) {
+		remote_global.blocked = false;
+		remote_global.resume();
+	}
+	// No frames are queued after leaving machine mode, the last response was sent
+	if (remote_global.stopping && out == remote_global.in) {
+		remote_global.stopping = false;
+		remote_global.exit();
+	}
+}
+
+bool remote_handle(const frame_t *request) {
+	frame_t response;
+	bool exit = false;
+	uint8_t error = 0;
+	response.type = request->type | FRAME_RESPONSE;
+	response.seq = request->seq;
+	response.length = 0;
+	switch (request->type) {
+		case FRAME_PING:
+			memcpy(response.payload, request->payload, request->length);
+			response.length = request->length;
+			break;
+		case FRAME_BALANCE_SET:
+			if (request->length != 3) {
+				error = FRAME_ERROR_LENGTH;
+			} else if (request->payload[2] > 99) {
+				error = FRAME_ERROR_ARGUMENT;
+			} else {
+				currency_t balance;
+				balance.base = (int16_t) frame_get16(&request->payload[0]);
+				balance.cents = request->payload[2];
+				bank_set_balance(main_get_bank(), balance);
+			}
+			// Fall through: respond with the new balance
+		case FRAME_BALANCE_GET:
+			if (error) {
+				break;
+			} else if (request->type == FRAME_BALANCE_GET && request->length != 0) {
+				error = FRAME_ERROR_LENGTH;
+			} else {
+				currency_t balance = bank_get_balance(main_get_bank());
+				frame_put16(&response.payload[0], balance.base);
+				response.payload[2] = balance.cents;
+				response.length = 3;
+			}
+			break;
+		case FRAME_BILL_GET:
+			response.payload[0] = bill_state();
+			response.length = 1;
+			break;
+		case FRAME_COIN_GET:
+			response.payload[0] = coin_alarm();
+			response.payload[1] = coin_pins();
+			response.length = 2;
+			break;
+		case FRAME_GPIO_SET:
+			if (request->length != 3) {
+				error = FRAME_ERROR_LENGTH;
+			} else if (request->payload[0] < 'A' || request->payload[0] > 'G' || request->payload[1] > 7) {
+				error = FRAME_ERROR_ARGUMENT;
+			} else {
+				char port = request->payload[0];
+				uint8_t pin = request->payload[1];
+				switch (request->payload[2]) {
+					case FRAME_GPIO_IN:
+						gpio_ddr(port, pin, false);
+						break;
+					case FRAME_GPIO_OFF:
+						gpio_port(port, pin, false);
+						break;
+					case FRAME_GPIO_ON:
+						gpio_port(port, pin, true);
+						break;
+					case FRAME_GPIO_OUT:
+						gpio_ddr(port, pin, true);
+						break;
+					default:
+						error = FRAME_ERROR_ARGUMENT;
+						break;
+				}
+			}
+			// Fall through: respond with the port state
+		case FRAME_GPIO_GET:
+			if (error) {
+				break;
+			} else if (request->type == FRAME_GPIO_GET && request->length != 1) {
+				error = FRAME_ERROR_LENGTH;
+			} else if (request->payload[0] < 'A' || request->payload[0] > 'G') {
+				error = FRAME_ERROR_ARGUMENT;
+			} else {
+				response.payload[0] = request->payload[0];
+				response.payload[1] = gpio_pins(request->payload[0]);
+				response.length = 2;
+			}
+			break;
+		case FRAME_EXIT:
+			exit = true;
+			break;
+		default:
+			error = FRAME_ERROR_TYPE;
+			break;
+	}
+	if (error) {
+		response.type = FRAME_ERROR;
+		response.payload[0] = request->type;
+		response.payload[1] = error;
+		response.length = 2;
+	}
+	// Input is only accepted when a response fits
+	remote_send(&response);
+	return exit;
+}
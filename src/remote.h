@@ -0,0 +1,125 @@
+/**
+ * @file remote.h
+ * @brief Console machine mode
+ * 
+ * In machine mode, the console UART speaks the framed host protocol
+ * described in frame.h instead of the interactive shell. The console
+ * command `machine` enters machine mode, a FRAME_EXIT request leaves it.
+ * 
+ * Requests are handled in the order they arrive, so a host may pipeline
+ * them without waiting for responses. Responses and event notifications
+ * are queued as complete frames in a transmit ring buffer, which is
+ * drained into the UART by an event. When the ring cannot hold another
+ * response, received bytes stay in the console receive buffer until there
+ * is room again. A host should therefore not have more requests in flight
+ * than fit into the console receive buffer (CONSOLE_RX_SIZE).
+ * 
+ * While machine mode is active, the event log sends its records as
+ * FRAME_EVENT notifications instead of text.
+ * 
+ * @par Configurable options
+ * 
+ * Macro               | Default  | Values         | Description
+ * --------------------|----------|----------------|-----------------------------------------------
+ * REMOTE_TX_SIZE      | 64       | 32..128        | Size of the transmit ring buffer (power of 2)
+ * REMOTE_RETRY        | 16       | 1..32767       | Transmit retry delay when the UART is busy (ticks)
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REMOTE_H
+#define _REMOTE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "dispatch.h"
+#include "frame.h"
+
+/**
+ * Result of feeding a byte to the protocol handler
+ */
+typedef enum {
+	/** The byte was consumed */
+	REMOTE_INPUT_OK,
+	/** The transmit buffer is full, feed the byte again after the resume callback */
+	REMOTE_INPUT_BUSY,
+	/** The byte was consumed and completed an exit request */
+	REMOTE_INPUT_EXIT,
+} remote_input_e;
+
+/**
+ * Resume callback prototype, called when input may be fed again after
+ * REMOTE_INPUT_BUSY was returned.
+ */
+typedef void (remote_resume_cb)(void);
+
+/**
+ * Exit callback prototype, called when machine mode was left and all queued
+ * frames were handed to the UART.
+ */
+typedef void (remote_exit_cb)(void);
+
+/**
+ * Initialise the protocol handler.
+ * @param manager the event queue
+ * @param resume the resume callback
+ * @param exit the exit callback
+ */
+void remote_init(struct callout_mgr *manager, remote_resume_cb *resume, remote_exit_cb *exit);
+
+/**
+ * Enter machine mode.
+ */
+void remote_start(void);
+
+/**
+ * Leave machine mode. Queued frames are still sent, then the exit callback
+ * is called.
+ */
+void remote_stop(void);
+
+/**
+ * Check whether machine mode is active.
+ * @return true, if active
+ */
+bool remote_active(void);
+
+/**
+ * Feed a received byte to the protocol handler.
+ * @param data the byte
+ * @return the result
+ */
+remote_input_e remote_input(uint8_t data);
+
+/**
+ * Queue a frame for transmission. May be called from interrupts.
+ * @param frame the frame
+ * @return false, if the transmit buffer is full
+ */
+bool remote_send(const frame_t *frame);
+
+/**
+ * Queue an event notification for transmission.
+ * @param id the event id
+ * @param time the event time (ticks)
+ * @param a the first event argument
+ * @param b the second event argument
+ * @return false, if the transmit buffer is full
+ */
+bool remote_event(uint8_t id, uint32_t time, uint16_t a, uint16_t b);
+
+#endif /*_REMOTE_H*/
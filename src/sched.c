@@ -0,0 +1,154 @@
+/**
+ * @file sched.c
+ * @brief Event dispatch statistics implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "sched.h"
+#include "util.h"
+
+/**
+ * Dispatch statistics state
+ */
+typedef struct {
+	/** System time source */
+	get_time_t *get_time;
+#ifndef MAIN_TIMING_WHEEL
+	/** Earliest due callback of the measured pass, NULL if there is none */
+	callout_cb_t *f;
+	/** Its priority */
+	uint8_t priority;
+	/** Start time of the measured pass */
+	dispatch_time_t start;
+#endif
+	/** Statistics */
+	sched_stats_t stats;
+} sched_t;
+
+/**
+ * Global dispatch statistics state
+ */
+static sched_t sched_global ATTRIBUTE_NOINIT;
+
+#ifdef MAIN_TIMING_WHEEL
+/**
+ * Dispatch hook, measures a callout and calls its callback.
+ * @param cm the event queue manager
+ * @param tim the callout
+ */
+static void sched_hook(struct callout_mgr *cm, struct callout *tim);
+#endif
+
+/**
+ * Get the histograms of a priority.
+ * @param priority the priority
+ * @return the histograms
+ */
+static sched_histogram_t *sched_histogram(uint8_t priority);
+
+/**
+ * Add a measurement to a histogram and worst case record.
+ * @param histogram the histogram buckets
+ * @param worst the worst case record
+ * @param f the measured callback
+ * @param priority its priority
+ * @param ticks the measured value (saturated to 16 bits in the worst case record)
+ */
+static void sched_record(uint16_t *histogram, sched_worst_t *worst, callout_cb_t *f, uint8_t priority, dispatch_time_t ticks);
+
+void sched_init(struct callout_mgr *cm, get_time_t *get_time) {
+	sched_global.get_time = get_time;
+#ifdef MAIN_TIMING_WHEEL
+	callout_set_hook(cm, sched_hook);
+#else
+	sched_global.f = NULL;
+#endif
+	sched_reset();
+}
+
+#ifdef MAIN_TIMING_WHEEL
+
+void sched_hook(struct callout_mgr *cm, struct callout *tim) {
+	// The callout may be released by the callback, copy everything needed afterwards
+	callout_cb_t *f = tim->f;
+	uint8_t priority = tim->priority;
+	sched_histogram_t *histogram = sched_histogram(priority);
+	dispatch_time_t start = sched_global.get_time();
+	dispatch_diff_t late = start - tim->expire;
+	sched_record(histogram->lateness, &sched_global.stats.late, f, priority, late > 0 ? late : 0);
+	f(cm, tim, tim->arg);
+	sched_record(histogram->runtime, &sched_global.stats.slow, f, priority, sched_global.get_time() - start);
+}
+
+#else /*MAIN_TIMING_WHEEL*/
+
+void sched_begin(struct callout_mgr *cm) {
+	dispatch_time_t now = sched_global.get_time();
+	struct callout *tim;
+	struct callout *first = NULL;
+	DISPATCH_FOREACH_DUE(tim, cm) {
+		if ((dispatch_diff_t) (now - tim->expire) >= 0 && (!first || (dispatch_diff_t) (tim->expire - first->expire) < 0)) {
+			first = tim;
+		}
+	}
+	if (first) {
+		sched_global.f = first->f;
+		sched_global.priority = first->priority;
+		sched_global.start = now;
+		dispatch_diff_t late = now - first->expire;
+		sched_record(sched_histogram(first->priority)->lateness, &sched_global.stats.late, first->f, first->priority, late);
+	}
+}
+
+void sched_end(void) {
+	if (sched_global.f) {
+		sched_record(sched_histogram(sched_global.priority)->runtime, &sched_global.stats.slow, sched_global.f, sched_global.priority, sched_global.get_time() - sched_global.start);
+		sched_global.f = NULL;
+	}
+}
+
+#endif /*MAIN_TIMING_WHEEL*/
+
+const sched_stats_t *sched_stats(void) {
+	return &sched_global.stats;
+}
+
+void sched_reset(void) {
+	memset(&sched_global.stats, 0, sizeof(sched_global.stats));
+}
+
+sched_histogram_t *sched_histogram(uint8_t priority) {
+	return &sched_global.stats.histograms[priority < SCHED_PRIORITIES ? priority : SCHED_PRIORITIES - 1];
+}
+
+void sched_record(uint16_t *histogram, sched_worst_t *worst, callout_cb_t *f, uint8_t priority, dispatch_time_t ticks) {
+	uint8_t bucket = 0;
+	dispatch_time_t value;
+	for (value = ticks; value && bucket < SCHED_BUCKETS - 1; value >>= 1) {
+		bucket++;
+	}
+	if (histogram[bucket] < UINT16_MAX) {
+		histogram[bucket]++;
+	}
+	if (!worst->f || ticks > worst->ticks) {
+		worst->f = f;
+		worst->priority = priority;
+		worst->ticks = ticks < UINT16_MAX ? ticks : UINT16_MAX;
+	}
+}
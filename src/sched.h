@@ -0,0 +1,114 @@
+/**
+ * @file sched.h
+ * @brief Event dispatch statistics
+ * 
+ * Records how late callouts are dispatched relative to their scheduled
+ * expiry time and how long their callbacks run, in system timer ticks.
+ * 
+ * With the timing wheel (MAIN_TIMING_WHEEL), every callback is called
+ * through the dispatch hook of the event queue, which takes the
+ * measurements. Without it, sched_begin() and sched_end() measure each
+ * dispatch pass as a whole, and attribute it to the earliest due callout.
+ * 
+ * Both quantities are collected in logarithmic histograms per priority.
+ * Bucket 0 counts 0 ticks, bucket n counts [2^(n-1), 2^n) ticks, the last
+ * bucket counts everything above. The callbacks with the largest lateness
+ * and run time are recorded as well.
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include <stdint.h>
+#include "dispatch.h"
+
+/** Number of histogram buckets */
+#define SCHED_BUCKETS 8
+/** Number of priorities with separate histograms (higher priorities share the last one) */
+#define SCHED_PRIORITIES 4
+
+/**
+ * Histograms of one priority
+ */
+typedef struct {
+	/** Dispatch lateness (ticks after expiry) */
+	uint16_t lateness[SCHED_BUCKETS];
+	/** Callback run time (ticks) */
+	uint16_t runtime[SCHED_BUCKETS];
+} sched_histogram_t;
+
+/**
+ * Worst case record
+ */
+typedef struct {
+	/** The offending callback */
+	callout_cb_t *f;
+	/** Its priority */
+	uint8_t priority;
+	/** The measured number of ticks */
+	uint16_t ticks;
+} sched_worst_t;
+
+/**
+ * Dispatch statistics
+ */
+typedef struct {
+	/** Histograms per priority */
+	sched_histogram_t histograms[SCHED_PRIORITIES];
+	/** Latest dispatch */
+	sched_worst_t late;
+	/** Longest running callback */
+	sched_worst_t slow;
+} sched_stats_t;
+
+/**
+ * Initialise (and reset) the dispatch statistics.
+ * With the timing wheel, this installs the dispatch hook of the event queue.
+ * @param cm the event queue
+ * @param get_time the system time source
+ */
+void sched_init(struct callout_mgr *cm, get_time_t *get_time);
+
+#ifndef MAIN_TIMING_WHEEL
+/**
+ * Start measuring a dispatch pass.
+ * Call immediately before callout_manage(), with interrupts disabled.
+ * @param cm the event queue
+ */
+void sched_begin(struct callout_mgr *cm);
+
+/**
+ * Finish measuring a dispatch pass.
+ * Call immediately after callout_manage().
+ */
+void sched_end(void);
+#endif
+
+/**
+ * Get the dispatch statistics.
+ * @return a pointer to the statistics
+ */
+const sched_stats_t *sched_stats(void);
+
+/**
+ * Clear the dispatch statistics.
+ */
+void sched_reset(void);
+
+#endif /*_SCHED_H*/
@@ -0,0 +1,503 @@
+/**
+ * @file serial.c
+ * @brief Console UART driver implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <aversive/irq_lock.h>
+#include "autoconf.h"
+#include "serial.h"
+#include "util.h"
+
+#ifndef SERIAL_TX_SIZE
+/** Size of the transmit ring buffer (power of 2) */
+#define SERIAL_TX_SIZE 128
+#endif
+
+#ifndef SERIAL_QUEUE_SIZE
+/** Number of transmit descriptors (power of 2) */
+#define SERIAL_QUEUE_SIZE 8
+#endif
+
+#ifndef SERIAL_BAUDRATE
+/** Baud rate after initialisation */
+#define SERIAL_BAUDRATE 38400
+#endif
+
+#ifndef SERIAL_CTS_POLL
+/** CTS poll interval while transmission is paused (ticks) */
+#define SERIAL_CTS_POLL 2
+#endif
+
+#ifndef SERIAL_CTS_TIMEOUT
+/** Longest wait for CTS before output is discarded (ticks) */
+#define SERIAL_CTS_TIMEOUT 15625
+#endif
+
+static_assert((SERIAL_TX_SIZE & (SERIAL_TX_SIZE - 1)) == 0, "SERIAL_TX_SIZE must be a power of 2");
+static_assert(SERIAL_TX_SIZE <= 128, "SERIAL_TX_SIZE must fit into the 8 bit ring indexes");
+static_assert((SERIAL_QUEUE_SIZE & (SERIAL_QUEUE_SIZE - 1)) == 0, "SERIAL_QUEUE_SIZE must be a power of 2");
+static_assert(SERIAL_QUEUE_SIZE <= 128, "SERIAL_QUEUE_SIZE must fit into the 8 bit queue indexes");
+
+/** RTS output (MATECON_PORT_UART0_RTS, active low) */
+#define SERIAL_RTS(on) do { if (on) { PORTE &= ~_BV(PE2); } else { PORTE |= _BV(PE2); } } while (0)
+/** CTS input (MATECON_PORT_UART0_CTS, active low) */
+#define SERIAL_CTS() (!(PINE & _BV(PE3)))
+/** No baud rate change pending */
+#define SERIAL_UBRR_NONE 0xffff
+
+/**
+ * Transmit descriptor sources
+ */
+typedef enum {
+	/** Characters in the transmit ring buffer */
+	SERIAL_SOURCE_RING,
+	/** Characters in RAM */
+	SERIAL_SOURCE_RAM,
+	/** Characters in program memory */
+	SERIAL_SOURCE_PGM,
+} serial_source_e;
+
+/**
+ * Transmit descriptor, a span of characters that are sent in one piece
+ */
+typedef struct {
+	/** Next character (unused for the ring buffer) */
+	const char *data;
+	/** Number of characters left */
+	uint16_t length;
+	/** Source of the characters (serial_source_e) */
+	uint8_t source;
+} serial_desc_t;
+
+/**
+ * Serial driver object
+ */
+typedef struct {
+	/** Event queue */
+	struct callout_mgr *manager;
+	/** Receive callback */
+	serial_rx_cb *rx;
+	/** CTS poll event */
+	struct callout poll;
+	/** Set while flow control is enabled */
+	volatile bool flow;
+	/** Set while the receiver accepts characters */
+	volatile bool ready;
+	/** Set while transmission is paused by CTS */
+	volatile bool stalled;
+	/** Time at which transmission was paused by CTS */
+	dispatch_time_t stall_time;
+	/** Set while a character is being shifted out */
+	volatile bool busy;
+	/** Baud rate register value to apply when the transmitter is idle */
+	volatile uint16_t pending;
+	/** Current (or pending) baud rate register value */
+	uint16_t ubrr;
+	/** Transmit ring buffer write index (modified with interrupts disabled) */
+	volatile uint8_t in;
+	/** Transmit ring buffer read index (only modified by the transmit interrupt) */
+	volatile uint8_t out;
+	/** Descriptor queue write index (modified with interrupts disabled) */
+	volatile uint8_t tail;
+	/** Descriptor queue read index (only modified by the transmit interrupt) */
+	volatile uint8_t head;
+	/** Line statistics */
+	serial_stats_t stats;
+	/** Transmit ring buffer */
+	char tx[SERIAL_TX_SIZE];
+	/** Transmit descriptor queue */
+	serial_desc_t queue[SERIAL_QUEUE_SIZE];
+} serial_t;
+
+/**
+ * Global serial driver object
+ */
+static serial_t serial_global ATTRIBUTE_NOINIT;
+
+/**
+ * CTS poll event, resumes transmission when the host is ready again
+ * @param cm the event queue manager
+ * @param tim the poll event
+ * @param arg unused
+ */
+static void serial_callback(struct callout_mgr *cm, struct callout *tim, void *arg);
+
+/**
+ * Calculate the baud rate register value for double speed mode.
+ * @param baud the baud rate
+ * @return the register value, or SERIAL_UBRR_NONE if out of range
+ */
+static uint16_t serial_ubrr(uint32_t baud);
+
+/**
+ * Set the baud rate register. Must be called with interrupts disabled.
+ * @param ubrr the register value
+ */
+static void serial_apply(uint16_t ubrr);
+
+/**
+ * Enable the data register empty interrupt, unless transmission is paused.
+ * Must be called with interrupts disabled.
+ */
+static void serial_start(void);
+
+/**
+ * Resume transmission after a CTS pause.
+ */
+static void serial_resume(void);
+
+/**
+ * Make room in the transmit queue. Waits for the transmit interrupt, or
+ * with interrupts disabled, polls the data register and sends the next
+ * character directly. While transmission is paused, CTS is polled here,
+ * because the caller may hold up the CTS poll event.
+ * @return false, if no room can be made: the transmitter is off, or
+ * transmission is paused by CTS while interrupts are disabled or for longer
+ * than SERIAL_CTS_TIMEOUT
+ */
+static bool serial_wait(void);
+
+/**
+ * Count characters that were discarded because no room could be made.
+ * @param length the number of characters
+ */
+static void serial_drop(uint16_t length);
+
+/**
+ * Send the next queued character. Called when the data register is empty,
+ * with interrupts disabled.
+ */
+static void serial_transmit(void);
+
+void serial_init(struct callout_mgr *manager, serial_rx_cb *rx) {
+	serial_global.manager = manager;
+	serial_global.rx = rx;
+#ifdef SERIAL_FLOW_CONTROL
+	serial_global.flow = true;
+#else
+	serial_global.flow = false;
+#endif
+	serial_global.ready = true;
+	serial_global.stalled = false;
+	serial_global.busy = false;
+	serial_global.pending = SERIAL_UBRR_NONE;
+	serial_global.in = 0;
+	serial_global.out = 0;
+	serial_global.tail = 0;
+	serial_global.head = 0;
+	serial_global.stats.overruns = 0;
+	serial_global.stats.framing = 0;
+	serial_global.stats.pauses = 0;
+	serial_global.stats.stalls = 0;
+	serial_global.stats.drops = 0;
+	callout_init(&serial_global.poll, serial_callback, NULL, SERIAL_PRIORITY);
+
+	// RTS output (ready), CTS input with pull-up, so an open line reads as not ready
+	SERIAL_RTS(true);
+	DDRE |= _BV(PE2);
+	DDRE &= ~_BV(PE3);
+	PORTE |= _BV(PE3);
+
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	serial_apply(serial_ubrr(SERIAL_BAUDRATE));
+	// 8N1, receiver and transmitter with interrupts
+	UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+	UCSR0B = _BV(RXCIE0) | _BV(TXCIE0) | _BV(RXEN0) | _BV(TXEN0);
+	IRQ_UNLOCK(flags);
+}
+
+void serial_shutdown(void) {
+	UCSR0B = 0;
+	callout_stop(serial_global.manager, &serial_global.poll);
+	serial_global.out = serial_global.in;
+	serial_global.head = serial_global.tail;
+}
+
+int8_t serial_send_nowait(char character) {
+	int8_t ret = -1;
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	uint8_t in = serial_global.in;
+	uint8_t tail = serial_global.tail;
+	serial_desc_t *last = &serial_global.queue[(uint8_t) (tail - 1) & (SERIAL_QUEUE_SIZE - 1)];
+	if ((uint8_t) (in - serial_global.out) < SERIAL_TX_SIZE) {
+		if (tail != serial_global.head && last->source == SERIAL_SOURCE_RING) {
+			// Extend the last span of ring buffer characters, the interrupt has not finished it yet
+			last->length++;
+			ret = 0;
+		} else if ((uint8_t) (tail - serial_global.head) < SERIAL_QUEUE_SIZE) {
+			serial_desc_t *desc = &serial_global.queue[tail & (SERIAL_QUEUE_SIZE - 1)];
+			desc->source = SERIAL_SOURCE_RING;
+			desc->length = 1;
+			serial_global.tail = tail + 1;
+			ret = 0;
+		}
+	}
+	if (ret == 0) {
+		serial_global.tx[in & (SERIAL_TX_SIZE - 1)] = character;
+		serial_global.in = in + 1;
+		serial_start();
+	}
+	IRQ_UNLOCK(flags);
+	return ret;
+}
+
+void serial_send(char character) {
+	while (serial_send_nowait(character) < 0) {
+		if (!serial_wait()) {
+			serial_drop(1);
+			return;
+		}
+	}
+}
+
+int8_t serial_queue(const char *data, uint16_t length, bool progmem) {
+	if (length == 0) {
+		return 0;
+	}
+	int8_t ret = -1;
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	uint8_t tail = serial_global.tail;
+	if ((uint8_t) (tail - serial_global.head) < SERIAL_QUEUE_SIZE) {
+		serial_desc_t *desc = &serial_global.queue[tail & (SERIAL_QUEUE_SIZE - 1)];
+		desc->data = data;
+		desc->length = length;
+		desc->source = progmem ? SERIAL_SOURCE_PGM : SERIAL_SOURCE_RAM;
+		serial_global.tail = tail + 1;
+		serial_start();
+		ret = 0;
+	}
+	IRQ_UNLOCK(flags);
+	return ret;
+}
+
+void serial_send_P(PGM_P data, uint16_t length) {
+	while (serial_queue(data, length, true) < 0) {
+		if (!serial_wait()) {
+			serial_drop(length);
+			return;
+		}
+	}
+}
+
+void serial_start(void) {
+	if (!serial_global.stalled) {
+		UCSR0B |= _BV(UDRIE0);
+	}
+}
+
+bool serial_wait(void) {
+	if (!(UCSR0B & _BV(TXEN0))) {
+		return false;
+	}
+	if (serial_global.stalled) {
+		if (serial_global.flow && !SERIAL_CTS()) {
+			// Wait for the host, unless interrupts are disabled and time stands still
+			dispatch_diff_t waited = serial_global.manager->get_time() - serial_global.stall_time;
+			return (SREG & _BV(SREG_I)) && waited < SERIAL_CTS_TIMEOUT;
+		}
+		serial_resume();
+	}
+	if (SREG & _BV(SREG_I)) {
+		// The transmit interrupt makes room
+		return true;
+	}
+	// The interrupt cannot run, do its work here
+	while (!(UCSR0A & _BV(UDRE0))) {
+		// The previous character is still in the data register
+	}
+	serial_transmit();
+	return true;
+}
+
+void serial_drop(uint16_t length) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	serial_global.stats.drops += length;
+	IRQ_UNLOCK(flags);
+}
+
+uint8_t serial_tx_free(void) {
+	// No room at all without a free descriptor, characters may need a new one
+	if ((uint8_t) (serial_global.tail - serial_global.head) >= SERIAL_QUEUE_SIZE) {
+		return 0;
+	}
+	return SERIAL_TX_SIZE - (uint8_t) (serial_global.in - serial_global.out);
+}
+
+uint16_t serial_ubrr(uint32_t baud) {
+	if (baud < 2400 || baud > 250000) {
+		return SERIAL_UBRR_NONE;
+	}
+	// Rounded to the nearest divider
+	return (uint16_t) ((CONFIG_QUARTZ + 4 * baud) / (8 * baud) - 1);
+}
+
+void serial_apply(uint16_t ubrr) {
+	UBRR0H = ubrr >> 8;
+	UBRR0L = ubrr & 0xff;
+	UCSR0A = _BV(U2X0);
+	serial_global.ubrr = ubrr;
+	serial_global.pending = SERIAL_UBRR_NONE;
+}
+
+uint32_t serial_set_baud(uint32_t baud) {
+	uint16_t ubrr = serial_ubrr(baud);
+	if (ubrr == SERIAL_UBRR_NONE) {
+		return 0;
+	}
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	if (!serial_global.busy && serial_global.head == serial_global.tail) {
+		serial_apply(ubrr);
+	} else {
+		// Applied by the transmit complete interrupt
+		serial_global.pending = ubrr;
+		serial_global.ubrr = ubrr;
+	}
+	IRQ_UNLOCK(flags);
+	return serial_baud();
+}
+
+uint32_t serial_baud(void) {
+	return CONFIG_QUARTZ / (8 * ((uint32_t) serial_global.ubrr + 1));
+}
+
+void serial_set_flow(bool enable) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	serial_global.flow = enable;
+	SERIAL_RTS(!enable || serial_global.ready);
+	IRQ_UNLOCK(flags);
+	if (!enable && serial_global.stalled) {
+		// Resume right away instead of waiting for CTS
+		callout_schedule(serial_global.manager, &serial_global.poll, 0);
+	}
+}
+
+bool serial_flow(void) {
+	return serial_global.flow;
+}
+
+void serial_rx_ready(bool ready) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	if (ready != serial_global.ready) {
+		serial_global.ready = ready;
+		if (serial_global.flow) {
+			SERIAL_RTS(ready);
+			if (!ready) {
+				serial_global.stats.pauses++;
+			}
+		}
+	}
+	IRQ_UNLOCK(flags);
+}
+
+void serial_stats(serial_stats_t *stats) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	*stats = serial_global.stats;
+	IRQ_UNLOCK(flags);
+}
+
+void serial_callback(struct callout_mgr *cm, struct callout *tim, void *arg) {
+	if (serial_global.flow && !SERIAL_CTS()) {
+		callout_schedule(cm, tim, SERIAL_CTS_POLL);
+		return;
+	}
+	serial_resume();
+}
+
+void serial_resume(void) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	serial_global.stalled = false;
+	UCSR0B |= _BV(UDRIE0);
+	IRQ_UNLOCK(flags);
+}
+
+ISR(USART0_RX_vect) {
+	// Error flags must be read before the data register
+	uint8_t status = UCSR0A;
+	char character = UDR0;
+	if (status & _BV(DOR0)) {
+		serial_global.stats.overruns++;
+	}
+	if (status & _BV(FE0)) {
+		serial_global.stats.framing++;
+		return;
+	}
+	serial_global.rx(character);
+}
+
+ISR(USART0_UDRE_vect) {
+	serial_transmit();
+}
+
+void serial_transmit(void) {
+	uint8_t head = serial_global.head;
+	if (head == serial_global.tail) {
+		UCSR0B &= ~_BV(UDRIE0);
+		return;
+	}
+	if (serial_global.flow && !SERIAL_CTS()) {
+		// Pause after the character in the shift register, poll until the host is ready
+		UCSR0B &= ~_BV(UDRIE0);
+		serial_global.stalled = true;
+		serial_global.stall_time = serial_global.manager->get_time();
+		serial_global.stats.stalls++;
+		callout_schedule(serial_global.manager, &serial_global.poll, SERIAL_CTS_POLL);
+		return;
+	}
+	serial_desc_t *desc = &serial_global.queue[head & (SERIAL_QUEUE_SIZE - 1)];
+	switch (desc->source) {
+		case SERIAL_SOURCE_RING: {
+			uint8_t out = serial_global.out;
+			UDR0 = serial_global.tx[out & (SERIAL_TX_SIZE - 1)];
+			serial_global.out = out + 1;
+			break;
+		}
+		case SERIAL_SOURCE_PGM:
+			UDR0 = pgm_read_byte(desc->data++);
+			break;
+		default:
+			UDR0 = *desc->data++;
+			break;
+	}
+	serial_global.busy = true;
+	if (--desc->length == 0) {
+		serial_global.head = head + 1;
+	}
+}
+
+ISR(USART0_TX_vect) {
+	// Only raised when the data register ran empty, i.e. after the last queued or the last character before a pause
+	serial_global.busy = false;
+	if (serial_global.pending != SERIAL_UBRR_NONE && serial_global.head == serial_global.tail) {
+		serial_apply(serial_global.pending);
+	}
+}
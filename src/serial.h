@@ -0,0 +1,208 @@
+/**
+ * @file serial.h
+ * @brief Console UART driver with hardware flow control
+ * 
+ * Interrupt driven driver for UART0, which replaces the Aversive UART
+ * module for the console port. Received characters are passed to a
+ * callback from the receive interrupt.
+ * 
+ * @par Transmit queue
+ * 
+ * Output is a queue of descriptors, each one a span of characters that the
+ * data register empty interrupt sends directly from its source:
+ * - Single characters are copied into a ring buffer. Consecutive characters
+ *   share one descriptor.
+ * - Constant text in program memory or RAM is queued by pointer and length
+ *   (serial_queue()), without a copy and without a length limit. The data
+ *   must stay valid until it has been sent.
+ * 
+ * The _nowait functions fail when the ring buffer or the descriptor queue
+ * is full. serial_send() and serial_send_P() wait for room instead, for the
+ * transmit interrupt (events run with interrupts enabled). With interrupts
+ * disabled, they poll the data register and send the queued characters
+ * themselves, like a blocking UART driver. Characters that cannot be sent
+ * are counted in serial_stats_t::drops.
+ * 
+ * The UART always runs in double speed mode, so that 250000 baud can be
+ * generated exactly from the 16MHz crystal. The baud rate can be changed
+ * at runtime. The change takes effect after all queued characters were
+ * sent, so a confirmation message at the old rate is not garbled.
+ * 
+ * Rate    | UBRR | Actual rate | Error
+ * --------|------|-------------|------
+ * 38400   | 51   | 38462       | +0.2%
+ * 57600   | 34   | 57143       | -0.8%
+ * 115200  | 16   | 117647      | +2.1%
+ * 230400  | 8    | 222222      | -3.5%
+ * 250000  | 7    | 250000      | 0%
+ * 
+ * 230400 baud is outside the tolerance of most receivers at 16MHz. Use
+ * 250000 baud for the fastest reliable link (supported by FTDI and CP210x
+ * adapters).
+ * 
+ * @par Hardware flow control
+ * 
+ * When flow control is enabled, RTS (MATECON_PORT_UART0_RTS) and CTS
+ * (MATECON_PORT_UART0_CTS) are used with active low logic levels, as on
+ * TTL serial adapters:
+ * - The receiver calls serial_rx_ready(false) when its buffer nears full.
+ *   RTS is then driven high, which stops the host after the characters
+ *   that are already in flight.
+ * - While CTS is high, transmission is paused after the current character.
+ *   CTS has no pin change interrupt, so it is polled every SERIAL_CTS_POLL
+ *   ticks until it is low again. A waiting serial_send() polls it as well,
+ *   for at most SERIAL_CTS_TIMEOUT ticks per pause.
+ * When flow control is disabled, RTS is always low and CTS is ignored.
+ * 
+ * @par Configurable options
+ * 
+ * Macro               | Default  | Values         | Description
+ * --------------------|----------|----------------|-----------------------------------------------
+ * SERIAL_TX_SIZE      | 128      | 2..128         | Size of the transmit ring buffer (power of 2)
+ * SERIAL_QUEUE_SIZE   | 8        | 2..128         | Number of transmit descriptors (power of 2)
+ * SERIAL_BAUDRATE     | 38400    | 2400..250000   | Baud rate after initialisation
+ * SERIAL_FLOW_CONTROL | [undef]  | [def]/[undef]  | Enable hardware flow control after initialisation
+ * SERIAL_PRIORITY     | [undef]  | 0..127         | Event queue priority of the CTS poll
+ * SERIAL_CTS_POLL     | 2        | 1..32767       | CTS poll interval while transmission is paused (ticks)
+ * SERIAL_CTS_TIMEOUT  | 15625    | 1..32767       | Longest wait for CTS before output is discarded (ticks)
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SERIAL_H
+#define _SERIAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "dispatch.h"
+
+/**
+ * Receive callback prototype, called from the receive interrupt
+ * @param character the received character
+ */
+typedef void (serial_rx_cb)(char character);
+
+/**
+ * Line statistics, see serial_stats()
+ */
+typedef struct {
+	/** Characters lost because the receive interrupt was late (hardware overrun) */
+	uint16_t overruns;
+	/** Characters received with a framing error (wrong baud rate or line noise) */
+	uint16_t framing;
+	/** Number of times the host was stopped with RTS */
+	uint16_t pauses;
+	/** Number of times transmission was paused by CTS */
+	uint16_t stalls;
+	/** Characters discarded because the transmit queue stayed full */
+	uint16_t drops;
+} serial_stats_t;
+
+/**
+ * Initialise UART0.
+ * @param manager the event queue
+ * @param rx the receive callback
+ */
+void serial_init(struct callout_mgr *manager, serial_rx_cb *rx);
+
+/**
+ * Disable UART0. Queued characters are discarded.
+ */
+void serial_shutdown(void);
+
+/**
+ * Queue a character for transmission.
+ * @param character the character
+ * @return 0 on success, -1 if the transmit buffer is full
+ */
+int8_t serial_send_nowait(char character);
+
+/**
+ * Queue a character for transmission, wait while the transmit buffer is full.
+ * The character is dropped if UART0 is shut down, or if transmission is
+ * paused by CTS while interrupts are disabled or for longer than
+ * SERIAL_CTS_TIMEOUT.
+ * @param character the character
+ */
+void serial_send(char character);
+
+/**
+ * Queue a string for transmission without copying it.
+ * @param data the string, which must stay unchanged until it has been sent
+ * @param length the number of characters
+ * @param progmem true if the string is in program memory
+ * @return 0 on success, -1 if the descriptor queue is full
+ */
+int8_t serial_queue(const char *data, uint16_t length, bool progmem);
+
+/**
+ * Queue a string from program memory for transmission, wait while the
+ * descriptor queue is full. Dropped if UART0 is shut down, or if
+ * transmission is paused by CTS while interrupts are disabled or for longer
+ * than SERIAL_CTS_TIMEOUT.
+ * @param data the string (in program memory)
+ * @param length the number of characters
+ */
+void serial_send_P(PGM_P data, uint16_t length);
+
+/**
+ * Get the free space in the transmit buffer.
+ * @return the number of characters that can be queued without loss, 0 if
+ * the descriptor queue is full
+ */
+uint8_t serial_tx_free(void);
+
+/**
+ * Select a baud rate. The rate is changed after the transmit buffer is empty.
+ * @param baud the requested baud rate
+ * @return the actual baud rate, or 0 if the rate cannot be generated
+ */
+uint32_t serial_set_baud(uint32_t baud);
+
+/**
+ * Get the current (or pending) baud rate.
+ * @return the actual baud rate
+ */
+uint32_t serial_baud(void);
+
+/**
+ * Enable or disable hardware flow control.
+ * @param enable true to enable
+ */
+void serial_set_flow(bool enable);
+
+/**
+ * Check whether hardware flow control is enabled.
+ * @return true, if enabled
+ */
+bool serial_flow(void);
+
+/**
+ * Signal whether the receiver can accept more characters (RTS).
+ * May be called from interrupts.
+ * @param ready false to stop the host
+ */
+void serial_rx_ready(bool ready);
+
+/**
+ * Get a copy of the line statistics.
+ * @param stats storage for the statistics
+ */
+void serial_stats(serial_stats_t *stats);
+
+#endif /*_SERIAL_H*/
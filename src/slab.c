@@ -0,0 +1,158 @@
+/**
+ * @file slab.c
+ * @brief Shared event memory implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <avr/pgmspace.h>
+#include <aversive/irq_lock.h>
+#include "slab.h"
+#include "util.h"
+
+#ifndef SLAB_SIZE
+/** Total event memory (bytes) */
+#define SLAB_SIZE 384
+#endif
+
+#ifndef SLAB_SMALL_SIZE
+/** Chunk size of the small class (bytes) */
+#define SLAB_SMALL_SIZE 16
+#endif
+
+#ifndef SLAB_LARGE_SIZE
+/** Chunk size of the large class (bytes) */
+#define SLAB_LARGE_SIZE 24
+#endif
+
+static_assert(SLAB_SMALL_SIZE <= SLAB_LARGE_SIZE, "Size classes must be sorted");
+static_assert(SLAB_SIZE / SLAB_CLASS_MAX >= MEMORY_POOL_SIZE(1, SLAB_LARGE_SIZE), "SLAB_SIZE too small");
+
+/** Chunk sizes of all classes, sorted by size */
+static const uint16_t SLAB_CLASS_SIZES[SLAB_CLASS_MAX] PROGMEM = {
+	SLAB_SMALL_SIZE,
+	SLAB_LARGE_SIZE,
+};
+
+/** Quotas of all owners */
+static const uint8_t SLAB_QUOTAS[SLAB_OWNER_MAX] PROGMEM = {
+	[SLAB_OWNER_MAIN] = MAIN_QUEUE_SIZE,
+	[SLAB_OWNER_LED] = LED_QUEUE_SIZE,
+};
+
+/**
+ * Slab state structure
+ */
+typedef struct {
+	/** Memory managers of all classes */
+	memory_t *classes[SLAB_CLASS_MAX];
+	/** Number of chunks held by each owner (all classes) */
+	volatile uint8_t owned[SLAB_OWNER_MAX];
+	/** Memory pools of all classes (evenly divided) */
+	uint8_t pool[SLAB_CLASS_MAX][SLAB_SIZE / SLAB_CLASS_MAX];
+} slab_t;
+
+/**
+ * Global slab state
+ */
+static slab_t slab_global ATTRIBUTE_NOINIT;
+
+bool slab_init(void) {
+	slab_class_e sclass;
+	for (sclass = 0; sclass < SLAB_CLASS_MAX; sclass++) {
+		slab_global.classes[sclass] = memory_init(slab_global.pool[sclass], sizeof(slab_global.pool[sclass]), slab_class_size(sclass));
+		if (!slab_global.classes[sclass]) {
+			return false;
+		}
+	}
+	slab_owner_e owner;
+	for (owner = 0; owner < SLAB_OWNER_MAX; owner++) {
+		slab_global.owned[owner] = 0;
+	}
+	return true;
+}
+
+void *slab_allocate(slab_owner_e owner, size_t size) {
+	if (owner > 0 && owner < SLAB_OWNER_MAX) {
+		// Reserve a chunk of the quota first, so interrupts cannot exceed it
+		uint8_t quota = slab_quota(owner);
+		uint8_t flags;
+		IRQ_LOCK(flags);
+		bool reserved = quota == 0 || slab_global.owned[owner] < quota;
+		if (reserved) {
+			slab_global.owned[owner]++;
+		}
+		IRQ_UNLOCK(flags);
+		if (reserved) {
+			slab_class_e sclass;
+			for (sclass = 0; sclass < SLAB_CLASS_MAX; sclass++) {
+				if (size <= slab_class_size(sclass)) {
+					void *memory = memory_allocate_owner(slab_global.classes[sclass], owner);
+					if (memory) {
+						return memory;
+					}
+				}
+			}
+			IRQ_LOCK(flags);
+			slab_global.owned[owner]--;
+			IRQ_UNLOCK(flags);
+		}
+	}
+	return NULL;
+}
+
+bool slab_release(void *memory) {
+	uint8_t owner = memory_owner(memory);
+	if (memory_release(memory)) {
+		if (owner < SLAB_OWNER_MAX) {
+			uint8_t flags;
+			IRQ_LOCK(flags);
+			slab_global.owned[owner]--;
+			IRQ_UNLOCK(flags);
+		}
+		return true;
+	}
+	return false;
+}
+
+memory_t *slab_class(slab_class_e sclass) {
+	if (sclass < SLAB_CLASS_MAX) {
+		return slab_global.classes[sclass];
+	}
+	return NULL;
+}
+
+size_t slab_class_size(slab_class_e sclass) {
+	if (sclass < SLAB_CLASS_MAX) {
+		return pgm_read_word(&SLAB_CLASS_SIZES[sclass]);
+	}
+	return 0;
+}
+
+uint8_t slab_owned(slab_owner_e owner) {
+	if (owner < SLAB_OWNER_MAX) {
+		return slab_global.owned[owner];
+	}
+	return 0;
+}
+
+uint8_t slab_quota(slab_owner_e owner) {
+	if (owner < SLAB_OWNER_MAX) {
+		return pgm_read_byte(&SLAB_QUOTAS[owner]);
+	}
+	return 0;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file slab.h
+ * @brief Shared event memory
+ * 
+ * All drivers allocate their event structures from a single slab, which is
+ * divided into a few pools with different chunk sizes (size classes).
+ * An allocation is served from the smallest class that fits, and falls back
+ * to the next larger class when that one is exhausted.
+ * 
+ * Every module is limited to a quota of chunks across all size classes, so a
+ * single module cannot starve the others. The quotas are the `*_QUEUE_SIZE`
+ * options of the individual modules.
+ * 
+ * @par Configurable options
+ * 
+ * Macro               | Default  | Values         | Description
+ * --------------------|----------|----------------|-----------------------------------------------
+ * SLAB_SIZE           | 384      | 0..65535       | Total event memory in bytes (all classes)
+ * SLAB_SMALL_SIZE     | 16       | 1..SLAB_LARGE  | Chunk size of the small class
+ * SLAB_LARGE_SIZE     | 24       | 1..65535       | Chunk size of the large class
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "memory.h"
+
+/**
+ * Slab memory owners
+ */
+typedef enum {
+	/** Main process */
+	SLAB_OWNER_MAIN = 1,
+	/** LED driver */
+	SLAB_OWNER_LED,
+	/** Number of owners + 1 */
+	SLAB_OWNER_MAX,
+} slab_owner_e;
+
+/**
+ * Size classes
+ */
+typedef enum {
+	/** Small chunks (SLAB_SMALL_SIZE) */
+	SLAB_CLASS_SMALL = 0,
+	/** Large chunks (SLAB_LARGE_SIZE) */
+	SLAB_CLASS_LARGE,
+	/** Number of size classes */
+	SLAB_CLASS_MAX,
+} slab_class_e;
+
+/**
+ * Initialise the (global) event memory.
+ * Must be called before any driver is initialised.
+ * @return true, if initialisation was successful
+ */
+bool slab_init(void);
+
+/**
+ * Allocate an event structure.
+ * 
+ * May be called from interrupt context.
+ * @param owner the allocating module
+ * @param size the size of the structure
+ * @return a pointer to the allocated memory, or NULL if no chunk was
+ * available or the owner's quota is exhausted
+ */
+void *slab_allocate(slab_owner_e owner, size_t size);
+
+/**
+ * Release an event structure.
+ * 
+ * May be called from interrupt context.
+ * @param memory a pointer to memory allocated with slab_allocate()
+ * @return true, if the chunk was released successfully
+ */
+bool slab_release(void *memory);
+
+/**
+ * Get the memory manager of a size class (for statistics).
+ * @param sclass the size class
+ * @return the memory manager or NULL if the class is invalid
+ */
+memory_t *slab_class(slab_class_e sclass);
+
+/**
+ * Get the chunk size of a size class.
+ * @param sclass the size class
+ * @return the chunk size in bytes
+ */
+size_t slab_class_size(slab_class_e sclass);
+
+/**
+ * Get the number of chunks held by an owner.
+ * @param owner the module
+ * @return the number of chunks the owner holds in all size classes
+ */
+uint8_t slab_owned(slab_owner_e owner);
+
+/**
+ * Get the quota of an owner.
+ * @param owner the module
+ * @return the maximum number of chunks the owner may hold in all size classes
+ */
+uint8_t slab_quota(slab_owner_e owner);
+
+#endif /*_SLAB_H*/
@@ -0,0 +1,268 @@
+/**
+ * @file telemetry.c
+ * @brief Telemetry stream implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <aversive/irq_lock.h>
+#include <comm/uart/uart.h>
+#include "telemetry.h"
+#include "eventlog.h"
+#include "frame.h"
+#include "main.h"
+#include "slab.h"
+#include "sched.h"
+#include "util.h"
+
+#ifndef TELEMETRY_SIZE
+/** Number of records in the ring buffer (power of 2) */
+#define TELEMETRY_SIZE 16
+#endif
+
+#ifndef TELEMETRY_PERIOD
+/** Snapshot period (ticks) */
+#define TELEMETRY_PERIOD 15625
+#endif
+
+#ifndef TELEMETRY_RETRY
+/** Drain retry delay when the UART transmit buffer is full (ticks) */
+#define TELEMETRY_RETRY 16
+#endif
+
+static_assert((TELEMETRY_SIZE & (TELEMETRY_SIZE - 1)) == 0, "TELEMETRY_SIZE must be a power of 2");
+static_assert(TELEMETRY_SIZE <= 128, "TELEMETRY_SIZE must fit into the 8 bit ring indexes");
+static_assert((uint8_t) EVENTLOG_MAX <= (uint8_t) TELEMETRY_BILL_STATE, "Event log ids must not overlap telemetry ids");
+
+/**
+ * Telemetry record
+ */
+typedef struct {
+	/** System time (ticks) */
+	uint32_t time;
+	/** Record id */
+	uint8_t id;
+	/** First argument */
+	uint16_t a;
+	/** Second argument */
+	uint16_t b;
+} telemetry_record_t;
+
+/**
+ * Telemetry object
+ */
+typedef struct {
+	/** Event queue */
+	struct callout_mgr *manager;
+	/** Drain event */
+	struct callout drain;
+	/** Snapshot event */
+	struct callout snapshot;
+	/** Set while the drain event is scheduled or running */
+	volatile bool pending;
+	/** Ring buffer write index (modified with interrupts disabled) */
+	volatile uint8_t in;
+	/** Ring buffer read index (only modified by the drain event) */
+	volatile uint8_t out;
+	/** Sequence number of the next frame */
+	uint8_t seq;
+	/** Number of bytes of the frame that have been sent */
+	uint8_t position;
+	/** Length of the encoded frame */
+	uint8_t length;
+	/** Records dropped since the last link snapshot (modified with interrupts disabled) */
+	volatile uint16_t dropped;
+	/** UART stalls since the last link snapshot */
+	uint16_t stalls;
+	/** Link counters (dropped is modified with interrupts disabled) */
+	telemetry_stats_t stats;
+	/** Encoded frame */
+	uint8_t frame[FRAME_SIZE_MAX];
+	/** Ring buffer */
+	telemetry_record_t ring[TELEMETRY_SIZE];
+} telemetry_t;
+
+/**
+ * Global telemetry object
+ */
+static telemetry_t telemetry_global ATTRIBUTE_NOINIT;
+
+/**
+ * Drain event, encodes and sends records until the UART is busy
+ * @param cm the event queue manager
+ * @param tim the drain event
+ * @param arg unused
+ */
+static void telemetry_callback(struct callout_mgr *cm, struct callout *tim, void *arg);
+
+/**
+ * Snapshot event, records the pool, dispatch and link statistics
+ * @param cm the event queue manager
+ * @param tim the snapshot event
+ * @param arg unused
+ */
+static void telemetry_snapshot(struct callout_mgr *cm, struct callout *tim, void *arg);
+
+/**
+ * Encode the next record into the frame buffer.
+ * Clears the pending flag if there is nothing left to encode.
+ * @return false, if the ring buffer is empty
+ */
+static bool telemetry_encode(void);
+
+void telemetry_init(struct callout_mgr *manager) {
+	telemetry_global.manager = manager;
+	telemetry_global.pending = false;
+	telemetry_global.in = 0;
+	telemetry_global.out = 0;
+	telemetry_global.seq = 0;
+	telemetry_global.position = 0;
+	telemetry_global.length = 0;
+	telemetry_global.dropped = 0;
+	telemetry_global.stalls = 0;
+	telemetry_global.stats.sent = 0;
+	telemetry_global.stats.dropped = 0;
+	telemetry_global.stats.stalls = 0;
+
+	uart_setconf(TELEMETRY_UART, NULL);
+
+	callout_init(&telemetry_global.drain, telemetry_callback, NULL, TELEMETRY_PRIORITY);
+	callout_init(&telemetry_global.snapshot, telemetry_snapshot, NULL, TELEMETRY_PRIORITY);
+	callout_schedule(manager, &telemetry_global.snapshot, TELEMETRY_PERIOD);
+}
+
+void telemetry_shutdown(void) {
+	callout_stop(telemetry_global.manager, &telemetry_global.snapshot);
+	callout_stop(telemetry_global.manager, &telemetry_global.drain);
+}
+
+bool telemetry_write(uint8_t id, uint32_t time, uint16_t a, uint16_t b) {
+	bool ret = false;
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	uint8_t in = telemetry_global.in;
+	if ((uint8_t) (in - telemetry_global.out) < TELEMETRY_SIZE) {
+		telemetry_record_t *record = &telemetry_global.ring[in & (TELEMETRY_SIZE - 1)];
+		record->time = time;
+		record->id = id;
+		record->a = a;
+		record->b = b;
+		telemetry_global.in = in + 1;
+		ret = true;
+	} else {
+		if (telemetry_global.dropped < UINT16_MAX) {
+			telemetry_global.dropped++;
+		}
+		telemetry_global.stats.dropped++;
+	}
+	if (!telemetry_global.pending) {
+		telemetry_global.pending = true;
+		callout_schedule(telemetry_global.manager, &telemetry_global.drain, 0);
+	}
+	IRQ_UNLOCK(flags);
+	return ret;
+}
+
+void telemetry_stats(telemetry_stats_t *stats) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	*stats = telemetry_global.stats;
+	IRQ_UNLOCK(flags);
+}
+
+void telemetry_callback(struct callout_mgr *cm, struct callout *tim, void *arg) {
+	do {
+		while (telemetry_global.position < telemetry_global.length) {
+			if (uart_send_nowait(TELEMETRY_UART, telemetry_global.frame[telemetry_global.position]) < 0) {
+				// Transmit buffer full, try again later
+				if (telemetry_global.stalls < UINT16_MAX) {
+					telemetry_global.stalls++;
+				}
+				telemetry_global.stats.stalls++;
+				callout_schedule(cm, tim, TELEMETRY_RETRY);
+				return;
+			}
+			telemetry_global.position++;
+		}
+	} while (telemetry_encode());
+}
+
+bool telemetry_encode(void) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	uint8_t out = telemetry_global.out;
+	bool empty = out == telemetry_global.in;
+	if (empty) {
+		// Checked with interrupts disabled, so a concurrent write schedules the drain again
+		telemetry_global.pending = false;
+	}
+	IRQ_UNLOCK(flags);
+
+	telemetry_global.position = 0;
+	telemetry_global.length = 0;
+	if (empty) {
+		return false;
+	}
+	// Copy the record before releasing its slot
+	telemetry_record_t record = telemetry_global.ring[out & (TELEMETRY_SIZE - 1)];
+	telemetry_global.out = out + 1;
+	frame_t frame;
+	frame.type = FRAME_EVENT;
+	frame.seq = telemetry_global.seq++;
+	frame.length = 9;
+	frame.payload[0] = record.id;
+	frame_put32(&frame.payload[1], record.time);
+	frame_put16(&frame.payload[5], record.a);
+	frame_put16(&frame.payload[7], record.b);
+	telemetry_global.length = frame_encode(&frame, telemetry_global.frame);
+	telemetry_global.stats.sent++;
+	return true;
+}
+
+void telemetry_snapshot(struct callout_mgr *cm, struct callout *tim, void *arg) {
+	uint32_t now = main_time();
+
+	slab_class_e sclass;
+	for (sclass = 0; sclass < SLAB_CLASS_MAX; sclass++) {
+		memory_stats_t stats;
+		memory_stats(slab_class(sclass), &stats);
+		telemetry_write(TELEMETRY_POOL, now, (uint16_t) sclass << 8 | stats.used, stats.failures);
+	}
+
+	const sched_stats_t *sched = sched_stats();
+	telemetry_write(TELEMETRY_SCHED, now, sched->late.ticks, sched->slow.ticks);
+
+	// The link snapshot reports the counters since the previous one
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	uint16_t dropped = telemetry_global.dropped;
+	telemetry_global.dropped = 0;
+	IRQ_UNLOCK(flags);
+	uint16_t stalls = telemetry_global.stalls;
+	telemetry_global.stalls = 0;
+	if (!telemetry_write(TELEMETRY_LINK, now, dropped, stalls)) {
+		// Report the drops with the next snapshot instead
+		IRQ_LOCK(flags);
+		uint16_t total = telemetry_global.dropped + dropped;
+		telemetry_global.dropped = total < dropped ? UINT16_MAX : total;
+		IRQ_UNLOCK(flags);
+	}
+
+	callout_schedule(cm, tim, TELEMETRY_PERIOD);
+}
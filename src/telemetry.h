@@ -0,0 +1,114 @@
+/**
+ * @file telemetry.h
+ * @brief Telemetry stream on a dedicated UART
+ * 
+ * The telemetry stream continuously sends structured records to a second
+ * UART, independent of the interactive console. Records use the FRAME_EVENT
+ * frame format of the host protocol (see frame.h): an id, the system time
+ * and two 16 bit arguments. The frame sequence numbers increase by one per
+ * record, so a receiver can detect lost frames.
+ * 
+ * Records are written into a RAM ring buffer from any context and encoded
+ * by a low priority callout, which only sends as much as fits into the
+ * UART transmit buffer and retries later. Writers never wait: when the
+ * ring is full, records are dropped and counted. Besides all event log
+ * records, the stream carries banknote scanner state transitions and a
+ * periodic snapshot of the memory pools, the dispatch statistics and the
+ * link itself.
+ * 
+ * Id                   | a                              | b
+ * ---------------------|--------------------------------|------------------------------------------
+ * 0..EVENTLOG_MAX-1    | as in the event log            | as in the event log (eventlog_id_e)
+ * TELEMETRY_BILL_STATE | previous state (bill_state_t)  | new state
+ * TELEMETRY_POOL       | size class << 8 \| used chunks  | failed allocations
+ * TELEMETRY_SCHED      | worst lateness (ticks)         | worst callback run time (ticks)
+ * TELEMETRY_LINK       | records dropped since the last | UART stalls since the last
+ * 
+ * @par Configurable options
+ * 
+ * Macro               | Default  | Values         | Description
+ * --------------------|----------|----------------|-----------------------------------------------
+ * TELEMETRY_SIZE      | 16       | 2..128         | Number of records in the ring buffer (power of 2)
+ * TELEMETRY_PRIORITY  | [undef]  | 0..127         | Event queue priority of the drain and snapshot
+ * TELEMETRY_UART      | [undef]  | 0..N           | UART port number
+ * TELEMETRY_PERIOD    | 15625    | 1..32767       | Snapshot period (ticks)
+ * TELEMETRY_RETRY     | 16       | 1..32767       | Drain retry delay when the UART is busy (ticks)
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "dispatch.h"
+
+/**
+ * Telemetry record ids, in addition to the event log ids
+ */
+typedef enum {
+	/** Banknote scanner state transition (previous state, new state) */
+	TELEMETRY_BILL_STATE = 0x20,
+	/** Memory pool snapshot, one per size class (class << 8 | used chunks, failures) */
+	TELEMETRY_POOL,
+	/** Dispatch statistics snapshot (worst lateness, worst run time) */
+	TELEMETRY_SCHED,
+	/** Link snapshot (records dropped, UART stalls since the last snapshot) */
+	TELEMETRY_LINK,
+} telemetry_id_e;
+
+/**
+ * Link counters, see telemetry_stats()
+ */
+typedef struct {
+	/** Number of records sent */
+	uint32_t sent;
+	/** Number of records dropped because the ring buffer was full */
+	uint32_t dropped;
+	/** Number of times the UART transmit buffer was full */
+	uint32_t stalls;
+} telemetry_stats_t;
+
+/**
+ * Initialise the telemetry stream and start the periodic snapshots.
+ * @param manager the event queue
+ */
+void telemetry_init(struct callout_mgr *manager);
+
+/**
+ * Stop the telemetry stream. Pending records are discarded.
+ */
+void telemetry_shutdown(void);
+
+/**
+ * Queue a record. May be called from interrupts.
+ * @param id the record id (eventlog_id_e or telemetry_id_e)
+ * @param time the system time (ticks)
+ * @param a the first argument
+ * @param b the second argument
+ * @return false, if the ring buffer was full and the record was dropped
+ */
+bool telemetry_write(uint8_t id, uint32_t time, uint16_t a, uint16_t b);
+
+/**
+ * Get a copy of the link counters.
+ * @param stats storage for the counters
+ */
+void telemetry_stats(telemetry_stats_t *stats);
+
+#endif /*_TELEMETRY_H*/
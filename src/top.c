@@ -0,0 +1,398 @@
+/**
+ * @file top.c
+ * @brief Full-screen status dashboard implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+#include "top.h"
+#include "fmt.h"
+#include "serial.h"
+#include "bank.h"
+#include "bill.h"
+#include "coin.h"
+#include "main.h"
+#include "clock.h"
+#include "slab.h"
+#include "sched.h"
+#include "util.h"
+
+#ifndef TOP_PERIOD
+/** Refresh period (ticks) */
+#define TOP_PERIOD 15625
+#endif
+
+#ifndef TOP_RETRY
+/** Delay until the next fields are sent when the transmit buffer is full (ticks) */
+#define TOP_RETRY 16
+#endif
+
+/* Keeps the rate calculation within 32 bits up to 68000 events per second */
+static_assert(TOP_PERIOD <= 4 * MAIN_TICKS_PER_SECOND, "TOP_PERIOD must not exceed 4 seconds");
+
+/** Transmit buffer space needed for a cursor movement and the widest field */
+#define TOP_FIELD_SPACE 24
+
+/**
+ * Field types, which determine the formatting and the width
+ */
+typedef enum {
+	/** Unsigned number up to 65535 */
+	TOP_TYPE_UINT16,
+	/** Unsigned number */
+	TOP_TYPE_UINT32,
+	/** Currency, base << 8 | cents */
+	TOP_TYPE_CURRENCY,
+	/** Two hex digits */
+	TOP_TYPE_HEX8,
+	/** Banknote scanner state (bill_state_t) */
+	TOP_TYPE_BILL,
+	/** Coin acceptor alarm flag */
+	TOP_TYPE_COIN,
+} top_type_e;
+
+/**
+ * Field widths, in the order of top_type_e
+ */
+static const uint8_t TOP_WIDTHS[] PROGMEM = { 5, 10, 9, 2, BILL_STATE_NAME_MAX, 5 };
+
+/**
+ * Columns of the pool table, one row per size class
+ */
+typedef enum {
+	TOP_POOL_USED,
+	TOP_POOL_CHUNKS,
+	TOP_POOL_PEAK,
+	TOP_POOL_FAILS,
+	/** Number of fields per size class */
+	TOP_POOL_FIELDS,
+} top_pool_e;
+
+/**
+ * Dashboard fields
+ */
+typedef enum {
+	TOP_FIELD_UPTIME,
+	TOP_FIELD_BALANCE,
+	TOP_FIELD_BILL,
+	TOP_FIELD_COIN,
+	TOP_FIELD_PINS,
+	/** First pool field, followed by TOP_POOL_FIELDS fields per size class */
+	TOP_FIELD_POOL,
+	TOP_FIELD_WAKEUPS = TOP_FIELD_POOL + SLAB_CLASS_MAX * TOP_POOL_FIELDS,
+	TOP_FIELD_DISPATCHES,
+	TOP_FIELD_LATE,
+	TOP_FIELD_SLOW,
+	/** Number of fields */
+	TOP_FIELD_MAX,
+} top_field_e;
+
+static_assert(TOP_FIELD_MAX <= 32, "The dirty flags must fit into 32 bits");
+
+/**
+ * Field position and type
+ */
+typedef struct {
+	/** Screen row (1 = top) */
+	uint8_t row;
+	/** Screen column of the first character (1 = left) */
+	uint8_t column;
+	/** Field type (top_type_e) */
+	uint8_t type;
+} top_layout_t;
+
+/**
+ * Field layout, matching the labels in TOP_SCREEN
+ */
+static const top_layout_t TOP_LAYOUT[TOP_FIELD_MAX] PROGMEM = {
+	[TOP_FIELD_UPTIME] = { 1, 64, TOP_TYPE_UINT32 },
+	[TOP_FIELD_BALANCE] = { 3, 9, TOP_TYPE_CURRENCY },
+	[TOP_FIELD_BILL] = { 3, 26, TOP_TYPE_BILL },
+	[TOP_FIELD_COIN] = { 3, 47, TOP_TYPE_COIN },
+	[TOP_FIELD_PINS] = { 3, 62, TOP_TYPE_HEX8 },
+	[TOP_FIELD_POOL + TOP_POOL_USED] = { 6, 10, TOP_TYPE_UINT16 },
+	[TOP_FIELD_POOL + TOP_POOL_CHUNKS] = { 6, 18, TOP_TYPE_UINT16 },
+	[TOP_FIELD_POOL + TOP_POOL_PEAK] = { 6, 25, TOP_TYPE_UINT16 },
+	[TOP_FIELD_POOL + TOP_POOL_FAILS] = { 6, 32, TOP_TYPE_UINT16 },
+	[TOP_FIELD_POOL + TOP_POOL_FIELDS + TOP_POOL_USED] = { 7, 10, TOP_TYPE_UINT16 },
+	[TOP_FIELD_POOL + TOP_POOL_FIELDS + TOP_POOL_CHUNKS] = { 7, 18, TOP_TYPE_UINT16 },
+	[TOP_FIELD_POOL + TOP_POOL_FIELDS + TOP_POOL_PEAK] = { 7, 25, TOP_TYPE_UINT16 },
+	[TOP_FIELD_POOL + TOP_POOL_FIELDS + TOP_POOL_FAILS] = { 7, 32, TOP_TYPE_UINT16 },
+	[TOP_FIELD_WAKEUPS] = { 9, 14, TOP_TYPE_UINT32 },
+	[TOP_FIELD_DISPATCHES] = { 10, 14, TOP_TYPE_UINT32 },
+	[TOP_FIELD_LATE] = { 9, 44, TOP_TYPE_UINT16 },
+	[TOP_FIELD_SLOW] = { 10, 44, TOP_TYPE_UINT16 },
+};
+
+static_assert(SLAB_CLASS_MAX == 2, "TOP_LAYOUT and TOP_SCREEN contain two pool rows");
+
+/**
+ * Static part of the screen: hide the cursor, clear the screen and draw the labels
+ */
+static const char TOP_SCREEN[] PROGMEM = "\033[?25l\033[H\033[2J"
+	"Matemat status                                          Uptime            s\r\n"
+	"\r\n"
+	"Balance             Bill                 Coin         Pins 0x\r\n"
+	"\r\n"
+	"Pool      Used  Chunks   Peak  Fails\r\n"
+	"small\r\n"
+	"large\r\n"
+	"\r\n"
+	"Wakeups/s                 Latest dispatch        ticks\r\n"
+	"Dispatches/s              Slowest callback       ticks\r\n"
+	"\r\n"
+	"Press any key to exit";
+
+/**
+ * Dashboard state
+ */
+typedef struct {
+	/** Event queue */
+	struct callout_mgr *manager;
+	/** Refresh event */
+	struct callout refresh;
+	/** Set while the dashboard is shown */
+	bool active;
+	/** Cursor row, 0 if unknown */
+	uint8_t row;
+	/** Cursor column */
+	uint8_t column;
+	/** Fields that have to be sent, one bit per top_field_e */
+	uint32_t dirty;
+	/** Time of the next sample */
+	uint32_t next;
+	/** Time of the last sample */
+	uint32_t time;
+	/** Idle statistics at the last sample */
+	main_idle_t idle;
+	/** Field values */
+	uint32_t values[TOP_FIELD_MAX];
+} top_t;
+
+/**
+ * Global dashboard state
+ */
+static top_t top_global ATTRIBUTE_NOINIT;
+
+/**
+ * Refresh event, samples the values once per period and sends the changed fields
+ * @param cm the event queue manager
+ * @param tim the refresh event
+ * @param arg unused
+ */
+static void top_callback(struct callout_mgr *cm, struct callout *tim, void *arg);
+
+/**
+ * Update a field value and mark it for sending if it changed.
+ * @param field the field
+ * @param value the new value
+ */
+static void top_set(top_field_e field, uint32_t value);
+
+/**
+ * Sample all field values.
+ * @param now the current time (ticks)
+ */
+static void top_sample(uint32_t now);
+
+/**
+ * Convert an event count to a rate.
+ * @param count the number of events
+ * @param elapsed the time in which they occurred (ticks, at most 4 seconds)
+ * @return events per second
+ */
+static uint32_t top_rate(uint32_t count, uint32_t elapsed);
+
+/**
+ * Send the changed fields, as far as the transmit buffer allows.
+ * @return false, if fields are left because the transmit buffer is full
+ */
+static bool top_draw(void);
+
+/**
+ * Move the cursor, with the shortest sequence that reaches the position.
+ * @param row the row
+ * @param column the column
+ */
+static void top_move(uint8_t row, uint8_t column);
+
+void top_init(struct callout_mgr *manager) {
+	top_global.manager = manager;
+	top_global.active = false;
+	callout_init(&top_global.refresh, top_callback, NULL, TOP_PRIORITY);
+}
+
+void top_start(void) {
+	fmt_P(TOP_SCREEN);
+	top_global.active = true;
+	top_global.row = 0;
+	top_global.dirty = UINT32_MAX;
+	uint32_t now = main_time();
+	// The rates are 0 until one period has passed
+	top_global.values[TOP_FIELD_WAKEUPS] = 0;
+	top_global.values[TOP_FIELD_DISPATCHES] = 0;
+	top_global.time = now;
+	main_get_idle(&top_global.idle);
+	top_sample(now);
+	top_global.next = now + TOP_PERIOD;
+	callout_schedule(top_global.manager, &top_global.refresh, 0);
+}
+
+void top_stop(void) {
+	if (top_global.active) {
+		callout_stop(top_global.manager, &top_global.refresh);
+		top_global.active = false;
+		top_move(TOP_ROWS + 1, 1);
+		// Show the cursor again
+		fmt_P(PSTR("\033[?25h"));
+	}
+}
+
+bool top_active(void) {
+	return top_global.active;
+}
+
+void top_callback(struct callout_mgr *cm, struct callout *tim, void *arg) {
+	uint32_t now = main_time();
+	if (main_time_reached(now, top_global.next)) {
+		top_sample(now);
+		top_global.next += TOP_PERIOD;
+		if (main_time_reached(now, top_global.next)) {
+			// Fell behind, skip the missed frames
+			top_global.next = now + TOP_PERIOD;
+		}
+	}
+	if (top_draw()) {
+		callout_schedule(cm, tim, top_global.next - now);
+	} else {
+		callout_schedule(cm, tim, TOP_RETRY);
+	}
+}
+
+void top_set(top_field_e field, uint32_t value) {
+	if (top_global.values[field] != value) {
+		top_global.values[field] = value;
+		top_global.dirty |= (uint32_t) 1 << field;
+	}
+}
+
+void top_sample(uint32_t now) {
+	top_set(TOP_FIELD_UPTIME, time(NULL));
+	currency_t balance = bank_get_balance(main_get_bank());
+	top_set(TOP_FIELD_BALANCE, (uint32_t) (uint16_t) balance.base << 8 | balance.cents);
+	top_set(TOP_FIELD_BILL, bill_state());
+	top_set(TOP_FIELD_COIN, coin_alarm());
+	top_set(TOP_FIELD_PINS, coin_pins());
+
+	slab_class_e sclass;
+	for (sclass = 0; sclass < SLAB_CLASS_MAX; sclass++) {
+		memory_stats_t stats;
+		memory_stats(slab_class(sclass), &stats);
+		top_field_e field = TOP_FIELD_POOL + sclass * TOP_POOL_FIELDS;
+		top_set(field + TOP_POOL_USED, stats.used);
+		top_set(field + TOP_POOL_CHUNKS, stats.chunks);
+		top_set(field + TOP_POOL_PEAK, stats.peak);
+		top_set(field + TOP_POOL_FAILS, stats.failures);
+	}
+
+	uint32_t elapsed = now - top_global.time;
+	if (elapsed > 0) {
+		main_idle_t idle;
+		main_get_idle(&idle);
+		top_set(TOP_FIELD_WAKEUPS, top_rate(idle.wakeups - top_global.idle.wakeups, elapsed));
+		top_set(TOP_FIELD_DISPATCHES, top_rate(idle.dispatches - top_global.idle.dispatches, elapsed));
+		top_global.idle = idle;
+		top_global.time = now;
+	}
+	const sched_stats_t *sched = sched_stats();
+	top_set(TOP_FIELD_LATE, sched->late.ticks);
+	top_set(TOP_FIELD_SLOW, sched->slow.ticks);
+}
+
+uint32_t top_rate(uint32_t count, uint32_t elapsed) {
+	// Rounded to the nearest integer
+	return (count * MAIN_TICKS_PER_SECOND + elapsed / 2) / elapsed;
+}
+
+bool top_draw(void) {
+	top_field_e field;
+	for (field = 0; field < TOP_FIELD_MAX; field++) {
+		uint32_t mask = (uint32_t) 1 << field;
+		if (!(top_global.dirty & mask)) {
+			continue;
+		}
+		if (serial_tx_free() < TOP_FIELD_SPACE) {
+			return false;
+		}
+		uint8_t row = pgm_read_byte(&TOP_LAYOUT[field].row);
+		uint8_t column = pgm_read_byte(&TOP_LAYOUT[field].column);
+		top_type_e type = pgm_read_byte(&TOP_LAYOUT[field].type);
+		uint32_t value = top_global.values[field];
+		top_move(row, column);
+		switch (type) {
+			case TOP_TYPE_UINT16:
+				fmt_uint(value, 5);
+				break;
+			case TOP_TYPE_UINT32:
+				fmt_uint(value, 10);
+				break;
+			case TOP_TYPE_CURRENCY: {
+				currency_t balance = { (int16_t) (value >> 8), (uint8_t) value };
+				fmt_int(balance.base, 6);
+				fmt_char('.');
+				fmt_zero(balance.cents, 2);
+				break;
+			}
+			case TOP_TYPE_HEX8:
+				fmt_hex(value, 2);
+				break;
+			case TOP_TYPE_BILL:
+				fmt_P_left(bill_state_name(value), BILL_STATE_NAME_MAX);
+				break;
+			case TOP_TYPE_COIN:
+				fmt_P(value ? PSTR("alarm") : PSTR("ready"));
+				break;
+		}
+		top_global.row = row;
+		top_global.column = column + pgm_read_byte(&TOP_WIDTHS[type]);
+		top_global.dirty &= ~mask;
+	}
+	return true;
+}
+
+void top_move(uint8_t row, uint8_t column) {
+	if (row == top_global.row && column == top_global.column) {
+		// Already there, the previous field ends where this one starts
+		return;
+	}
+	fmt_P(PSTR("\033["));
+	if (row == top_global.row && column > top_global.column) {
+		// Cursor forward on the same row is shorter than an absolute position
+		fmt_uint(column - top_global.column, 0);
+		fmt_char('C');
+	} else {
+		fmt_uint(row, 0);
+		fmt_char(';');
+		fmt_uint(column, 0);
+		fmt_char('H');
+	}
+	top_global.row = row;
+	top_global.column = column;
+}
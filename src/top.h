@@ -0,0 +1,85 @@
+/**
+ * @file top.h
+ * @brief Full-screen status dashboard
+ * 
+ * Shows the balance, the banknote scanner and coin acceptor state, the event
+ * memory pools, the scheduler load and the uptime on a VT100 terminal, and
+ * keeps them up to date while it is active:
+ * 
+ *     Matemat status                                          Uptime       3605 s
+ * 
+ *     Balance     12.50   Bill idle            Coin ready   Pins 0x1f
+ * 
+ *     Pool      Used  Chunks   Peak  Fails
+ *     small        2      12      5      0
+ *     large        0       8      1      0
+ * 
+ *     Wakeups/s            31   Latest dispatch      2 ticks
+ *     Dispatches/s         12   Slowest callback    40 ticks
+ * 
+ * The labels are drawn once when the dashboard is started. After that, every
+ * field has a fixed position and width, and only the fields whose value
+ * changed since the last frame are sent: a cursor movement and the new value.
+ * In a steady state, a refresh costs a few dozen characters per second, so
+ * the dashboard can be left running on a 38400 baud link.
+ * 
+ * Fields are only sent while there is room in the transmit buffer, the rest
+ * follow after a short delay. A refresh never waits for the UART.
+ * 
+ * @par Configurable options
+ * 
+ * Macro               | Default  | Values         | Description
+ * --------------------|----------|----------------|-----------------------------------------------
+ * TOP_PRIORITY        | [undef]  | 0..127         | Event queue priority of the refresh
+ * TOP_PERIOD          | 15625    | 1..62500       | Refresh period (ticks)
+ * TOP_RETRY           | 16       | 1..32767       | Delay until the next fields are sent when the transmit buffer is full (ticks)
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TOP_H
+#define _TOP_H
+
+#include <stdbool.h>
+#include "dispatch.h"
+
+/** Number of screen rows used by the dashboard */
+#define TOP_ROWS 12
+
+/**
+ * Initialise the dashboard.
+ * @param manager the event queue
+ */
+void top_init(struct callout_mgr *manager);
+
+/**
+ * Clear the screen, draw the dashboard and start the periodic refresh.
+ */
+void top_start(void);
+
+/**
+ * Stop the refresh. The cursor is placed below the dashboard.
+ */
+void top_stop(void);
+
+/**
+ * Check whether the dashboard is shown.
+ * @return true, if started and not stopped yet
+ */
+bool top_active(void);
+
+#endif /*_TOP_H*/
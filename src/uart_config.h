@@ -19,10 +19,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-/** Compile in support for UART0 */
-#define UART0_COMPILE
-/** Enable UART0 */
-#define UART0_ENABLED 1
+/* UART0 (console) is driven by serial.c, which needs its interrupt vectors */
+/** Do not compile in support for UART0 */
+#undef UART0_COMPILE
+/** Disable UART0 */
+#define UART0_ENABLED 0
 /** Enable UART0 interrupt handlers */
 #define UART0_INTERRUPT_ENABLED 1
 /** Set default baud rate */
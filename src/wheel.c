@@ -0,0 +1,285 @@
+/**
+ * @file wheel.c
+ * @brief Hierarchical timing wheel implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <aversive/irq_lock.h>
+#include "wheel.h"
+
+/** Slot index mask */
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+/**
+ * Insert a timer into the slot or expired list that matches its expiry time.
+ * Must be called with interrupts disabled.
+ * @param cm the timer manager
+ * @param tim the timer
+ */
+static void wheel_insert(struct wheel_mgr *cm, struct wheel_timer *tim);
+
+/**
+ * Remove a timer from its slot or the expired list.
+ * Must be called with interrupts disabled.
+ * @param cm the timer manager
+ * @param tim the timer
+ */
+static void wheel_remove(struct wheel_mgr *cm, struct wheel_timer *tim);
+
+/**
+ * Process one wheel time step: cascade the slots of higher levels that start
+ * at this time and expire the current slot of the lowest level.
+ * Must be called with interrupts disabled.
+ * @param cm the timer manager
+ */
+static void wheel_step(struct wheel_mgr *cm);
+
+/**
+ * Find the next wheel time after cm->now at which a slot must be processed.
+ * Must be called with interrupts disabled.
+ * @param cm the timer manager
+ * @param time a pointer to storage for the time
+ * @return false, if all slots are empty
+ */
+static bool wheel_next_slot(struct wheel_mgr *cm, uint32_t *time);
+
+void wheel_mgr_init(struct wheel_mgr *cm, wheel_time_t *get_time) {
+	cm->get_time = get_time;
+	cm->hook = NULL;
+	cm->now = get_time();
+	cm->cur_priority = 0;
+	cm->depth = 0;
+	cm->armed = false;
+	cm->next = 0;
+	uint8_t level, index;
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		cm->occupied[level] = 0;
+		for (index = 0; index < WHEEL_SLOTS; index++) {
+			LIST_INIT(&cm->slots[level][index]);
+		}
+	}
+	LIST_INIT(&cm->expired);
+}
+
+void wheel_set_hook(struct wheel_mgr *cm, wheel_hook_t *hook) {
+	cm->hook = hook;
+}
+
+void wheel_init(struct wheel_timer *tim, wheel_cb_t *f, void *arg, uint8_t priority) {
+	tim->f = f;
+	tim->arg = arg;
+	tim->priority = priority;
+	tim->state = WHEEL_STATE_STOPPED;
+	tim->expire = 0;
+}
+
+int wheel_schedule(struct wheel_mgr *cm, struct wheel_timer *tim, uint32_t ticks) {
+	return wheel_reschedule(cm, tim, cm->get_time() - tim->expire + ticks);
+}
+
+int wheel_reschedule(struct wheel_mgr *cm, struct wheel_timer *tim, uint32_t ticks) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	if (tim->state == WHEEL_STATE_SCHEDULED) {
+		wheel_remove(cm, tim);
+	}
+	tim->expire += ticks;
+	tim->state = WHEEL_STATE_SCHEDULED;
+	wheel_insert(cm, tim);
+	IRQ_UNLOCK(flags);
+	return 0;
+}
+
+void wheel_stop(struct wheel_mgr *cm, struct wheel_timer *tim) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	if (tim->state == WHEEL_STATE_SCHEDULED) {
+		wheel_remove(cm, tim);
+	}
+	tim->state = WHEEL_STATE_STOPPED;
+	IRQ_UNLOCK(flags);
+}
+
+void wheel_advance(struct wheel_mgr *cm) {
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	uint32_t now = cm->get_time();
+	if (cm->armed && (int32_t) (now - cm->next) >= 0) {
+		// Jump from one occupied slot to the next, skipping empty time spans
+		while ((cm->armed = wheel_next_slot(cm, &cm->next)) && (int32_t) (now - cm->next) >= 0) {
+			cm->now = cm->next;
+			wheel_step(cm);
+		}
+	}
+	cm->now = now;
+	IRQ_UNLOCK(flags);
+}
+
+void wheel_manage(struct wheel_mgr *cm) {
+	wheel_advance(cm);
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	struct wheel_timer *tim;
+	// The list is sorted, so stop at the first timer that may not preempt the running one
+	while ((tim = LIST_FIRST(&cm->expired)) && (cm->depth == 0 || tim->priority > cm->cur_priority)) {
+		LIST_REMOVE(tim, next);
+		tim->state = WHEEL_STATE_RUNNING;
+		uint8_t priority = cm->cur_priority;
+		cm->cur_priority = tim->priority;
+		cm->depth++;
+		IRQ_UNLOCK(flags);
+		if (cm->hook) {
+			cm->hook(cm, tim);
+		} else {
+			tim->f(cm, tim, tim->arg);
+		}
+		IRQ_LOCK(flags);
+		cm->depth--;
+		cm->cur_priority = priority;
+		// The callback may have rescheduled or even released the timer, only touch it when still running
+		if (tim->state == WHEEL_STATE_RUNNING) {
+			tim->state = WHEEL_STATE_STOPPED;
+		}
+	}
+	IRQ_UNLOCK(flags);
+}
+
+bool wheel_next(struct wheel_mgr *cm, uint32_t *time) {
+	bool ret = true;
+	uint8_t flags;
+	IRQ_LOCK(flags);
+	if (!LIST_EMPTY(&cm->expired)) {
+		*time = cm->now;
+	} else if (cm->armed) {
+		*time = cm->next;
+	} else {
+		ret = false;
+	}
+	IRQ_UNLOCK(flags);
+	return ret;
+}
+
+void wheel_insert(struct wheel_mgr *cm, struct wheel_timer *tim) {
+	if ((int32_t) (tim->expire - cm->now) <= 0) {
+		// Already due, keep the expired list sorted by priority (FIFO within the same priority)
+		struct wheel_timer *pos = LIST_FIRST(&cm->expired);
+		if (!pos || pos->priority < tim->priority) {
+			LIST_INSERT_HEAD(&cm->expired, tim, next);
+		} else {
+			while (LIST_NEXT(pos, next) && LIST_NEXT(pos, next)->priority >= tim->priority) {
+				pos = LIST_NEXT(pos, next);
+			}
+			LIST_INSERT_AFTER(pos, tim, next);
+		}
+		tim->slot = WHEEL_SLOT_EXPIRED;
+	} else {
+		// Timers beyond the wheel span are parked in the farthest top level slot and placed again from there
+		uint32_t key = tim->expire;
+		if (key - cm->now > WHEEL_SPAN) {
+			key = cm->now + WHEEL_SPAN;
+		}
+		// The level is determined by the most significant digit that differs from the wheel time,
+		// digits above the top level can only differ when the top level wraps around
+		uint32_t diff = key ^ cm->now;
+		uint8_t level = 0;
+		while (diff >= WHEEL_SLOTS && level < WHEEL_LEVELS - 1) {
+			diff >>= WHEEL_BITS;
+			level++;
+		}
+		uint8_t shift = level * WHEEL_BITS;
+		uint8_t index = (key >> shift) & WHEEL_MASK;
+		LIST_INSERT_HEAD(&cm->slots[level][index], tim, next);
+		cm->occupied[level] |= WHEEL_BIT(index);
+		tim->slot = level * WHEEL_SLOTS + index;
+		// The slot is processed when the wheel time reaches its start
+		uint32_t start = (key >> shift) << shift;
+		if (!cm->armed || (int32_t) (start - cm->next) < 0) {
+			cm->next = start;
+			cm->armed = true;
+		}
+	}
+}
+
+void wheel_remove(struct wheel_mgr *cm, struct wheel_timer *tim) {
+	LIST_REMOVE(tim, next);
+	if (tim->slot != WHEEL_SLOT_EXPIRED) {
+		uint8_t level = tim->slot / WHEEL_SLOTS;
+		uint8_t index = tim->slot & WHEEL_MASK;
+		if (LIST_EMPTY(&cm->slots[level][index])) {
+			cm->occupied[level] &= ~WHEEL_BIT(index);
+		}
+	}
+}
+
+void wheel_step(struct wheel_mgr *cm) {
+	uint8_t level;
+	// Cascade from the top, so timers can fall through several levels at once
+	for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+		uint8_t shift = level * WHEEL_BITS;
+		if ((cm->now & WHEEL_LOW(shift)) == 0) {
+			uint8_t index = (cm->now >> shift) & WHEEL_MASK;
+			if (cm->occupied[level] & WHEEL_BIT(index)) {
+				struct wheel_list *slot = &cm->slots[level][index];
+				struct wheel_timer *tim;
+				cm->occupied[level] &= ~WHEEL_BIT(index);
+				while ((tim = LIST_FIRST(slot))) {
+					LIST_REMOVE(tim, next);
+					wheel_insert(cm, tim);
+				}
+			}
+		}
+	}
+	uint8_t index = cm->now & WHEEL_MASK;
+	if (cm->occupied[0] & WHEEL_BIT(index)) {
+		struct wheel_list *slot = &cm->slots[0][index];
+		struct wheel_timer *tim;
+		cm->occupied[0] &= ~WHEEL_BIT(index);
+		while ((tim = LIST_FIRST(slot))) {
+			LIST_REMOVE(tim, next);
+			wheel_insert(cm, tim);
+		}
+	}
+}
+
+bool wheel_next_slot(struct wheel_mgr *cm, uint32_t *time) {
+	bool found = false;
+	uint32_t best = 0;
+	uint8_t level;
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		uint16_t occupied = cm->occupied[level];
+		if (occupied) {
+			uint8_t shift = level * WHEEL_BITS;
+			uint32_t base = cm->now >> shift;
+			// The earliest occupied slot after the current one, in wheel order:
+			// rotate the bitmap so the following slot is bit 0 and find the lowest set bit
+			// (in 32 bits, a 16 bit int cannot be shifted by WHEEL_SLOTS when rotate is 0)
+			uint8_t rotate = (base + 1) & WHEEL_MASK;
+			uint32_t wide = occupied;
+			uint16_t rotated = (uint16_t) ((wide >> rotate) | (wide << (WHEEL_SLOTS - rotate)));
+			uint8_t step = 1 + __builtin_ctz(rotated);
+			uint32_t start = (base + step) << shift;
+			if (!found || (int32_t) (start - best) < 0) {
+				best = start;
+				found = true;
+			}
+		}
+	}
+	*time = best;
+	return found;
+}
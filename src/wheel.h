@@ -0,0 +1,224 @@
+/**
+ * @file wheel.h
+ * @brief Hierarchical timing wheel
+ * 
+ * An event queue with the same interface as the Aversive callout module,
+ * but constant time scheduling and cancellation.
+ * 
+ * Time is kept in 32 bit ticks. Pending timers are hashed into 5 levels of
+ * 16 slots each. Level n covers 16^(n+1) ticks with a slot resolution of
+ * 16^n ticks, so the wheel spans 2^20 ticks (67 s at 64 us per tick). A
+ * timer is placed on the lowest level at which its expiry time and the
+ * current wheel time only differ in that level's digit. When the wheel time
+ * crosses a slot boundary of a higher level, the timers of that slot are
+ * moved down (cascaded). Timers further ahead than the wheel span are parked
+ * on the top level and placed again each time their slot is reached.
+ * 
+ * Each level keeps an occupancy bitmap of its slots, so the wheel can skip
+ * empty time spans instead of visiting every tick, and the next deadline
+ * can be found quickly (for the tickless system timer).
+ * 
+ * Due timers are moved to an expired list, ordered by descending priority,
+ * and dispatched from there. As with Aversive callouts, a dispatch only runs
+ * timers with a higher priority than the one currently running, so the
+ * queue may be dispatched from nested interrupts.
+ * 
+ * Expiry times are compared with signed 32 bit arithmetic, so timers may be
+ * scheduled up to 2^31 - 1 ticks (38 hours) ahead.
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WHEEL_H
+#define _WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/queue.h>
+
+/** Number of levels */
+#define WHEEL_LEVELS 5
+/** Number of bits per level */
+#define WHEEL_BITS 4
+/** Number of slots per level */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+/** Longest distance between the wheel time and the slot a timer is placed in */
+#define WHEEL_SPAN ((1UL << (WHEEL_LEVELS * WHEEL_BITS)) - (1UL << ((WHEEL_LEVELS - 1) * WHEEL_BITS)) - 1)
+/** Occupancy bit of a slot (independent of the width of int, which is 16 bits on AVR) */
+#define WHEEL_BIT(index) ((uint16_t) (1U << (index)))
+/** Mask of the time bits below a level (independent of the width of int) */
+#define WHEEL_LOW(shift) (((uint32_t) 1 << (shift)) - 1)
+/** Slot number of timers in the expired list */
+#define WHEEL_SLOT_EXPIRED 0xff
+
+/** Timer is not scheduled */
+#define WHEEL_STATE_STOPPED 0
+/** Timer is scheduled */
+#define WHEEL_STATE_SCHEDULED 1
+/** Timer callback is running */
+#define WHEEL_STATE_RUNNING 2
+
+struct wheel_mgr;
+struct wheel_timer;
+
+/**
+ * Time source prototype
+ * @return the current time in ticks
+ */
+typedef uint32_t (wheel_time_t)(void);
+
+/**
+ * Timer callback prototype
+ * @param cm the timer manager
+ * @param tim the expired timer
+ * @param arg the private argument of the timer
+ */
+typedef void (wheel_cb_t)(struct wheel_mgr *cm, struct wheel_timer *tim, void *arg);
+
+/**
+ * Dispatch hook prototype, calls the callback of an expired timer in place
+ * of the manager (e.g. to measure it)
+ * @param cm the timer manager
+ * @param tim the expired timer
+ */
+typedef void (wheel_hook_t)(struct wheel_mgr *cm, struct wheel_timer *tim);
+
+/**
+ * Timer object
+ */
+struct wheel_timer {
+	/** List link (slot or expired list) */
+	LIST_ENTRY(wheel_timer) next;
+	/** Callback */
+	wheel_cb_t *f;
+	/** Private callback argument */
+	void *arg;
+	/** Expiry time */
+	uint32_t expire;
+	/** Priority */
+	uint8_t priority;
+	/** State (WHEEL_STATE_*) */
+	uint8_t state;
+	/** Current slot (level * WHEEL_SLOTS + index, or WHEEL_SLOT_EXPIRED) */
+	uint8_t slot;
+};
+
+/** Timer list */
+LIST_HEAD(wheel_list, wheel_timer);
+
+/**
+ * Timer manager object
+ */
+struct wheel_mgr {
+	/** Time source */
+	wheel_time_t *get_time;
+	/** Dispatch hook, NULL to call the callbacks directly */
+	wheel_hook_t *hook;
+	/** Wheel time, all timers up to this time have been moved to the expired list */
+	uint32_t now;
+	/** Priority of the running timer */
+	uint8_t cur_priority;
+	/** Number of nested running timers */
+	uint8_t depth;
+	/** Set if any slot is occupied */
+	bool armed;
+	/** Next wheel time at which a slot must be processed (if armed, may be early) */
+	uint32_t next;
+	/** Occupancy bitmaps (one bit per slot) */
+	uint16_t occupied[WHEEL_LEVELS];
+	/** Slots */
+	struct wheel_list slots[WHEEL_LEVELS][WHEEL_SLOTS];
+	/** Due timers, sorted by descending priority */
+	struct wheel_list expired;
+};
+
+/**
+ * Initialise a timer manager.
+ * @param cm the timer manager
+ * @param get_time the time source
+ */
+void wheel_mgr_init(struct wheel_mgr *cm, wheel_time_t *get_time);
+
+/**
+ * Set the dispatch hook of a timer manager.
+ * @param cm the timer manager
+ * @param hook the hook, which must call the callback of the timer (NULL to
+ * call the callbacks directly)
+ */
+void wheel_set_hook(struct wheel_mgr *cm, wheel_hook_t *hook);
+
+/**
+ * Initialise a timer.
+ * @param tim the timer
+ * @param f the callback
+ * @param arg the private callback argument
+ * @param priority the priority (higher values preempt lower ones)
+ */
+void wheel_init(struct wheel_timer *tim, wheel_cb_t *f, void *arg, uint8_t priority);
+
+/**
+ * Schedule a timer relative to the current time.
+ * A scheduled timer is rescheduled.
+ * @param cm the timer manager
+ * @param tim the timer
+ * @param ticks the number of ticks from now
+ * @return 0 on success
+ */
+int wheel_schedule(struct wheel_mgr *cm, struct wheel_timer *tim, uint32_t ticks);
+
+/**
+ * Schedule a timer relative to its previous expiry time, to avoid drift
+ * in periodic timers.
+ * @param cm the timer manager
+ * @param tim the timer
+ * @param ticks the number of ticks from the previous expiry
+ * @return 0 on success
+ */
+int wheel_reschedule(struct wheel_mgr *cm, struct wheel_timer *tim, uint32_t ticks);
+
+/**
+ * Stop a timer. Nothing happens if the timer is not scheduled.
+ * @param cm the timer manager
+ * @param tim the timer
+ */
+void wheel_stop(struct wheel_mgr *cm, struct wheel_timer *tim);
+
+/**
+ * Move all timers that are due at the current time to the expired list.
+ * @param cm the timer manager
+ */
+void wheel_advance(struct wheel_mgr *cm);
+
+/**
+ * Advance the wheel and run all due timers with a higher priority than the
+ * one currently running.
+ * @param cm the timer manager
+ */
+void wheel_manage(struct wheel_mgr *cm);
+
+/**
+ * Get the time at which the wheel needs to be managed next.
+ * 
+ * This is the expiry time of the next timer, or an earlier time at which
+ * timers have to be cascaded.
+ * @param cm the timer manager
+ * @param time a pointer to storage for the time
+ * @return false, if no timer is scheduled
+ */
+bool wheel_next(struct wheel_mgr *cm, uint32_t *time);
+
+#endif /*_WHEEL_H*/
@@ -0,0 +1,381 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/queue.h>
+#include "memory.h"
+#include "bank.h"
+#include "wheel.h"
+#include "fmt.h"
+#include "serial.h"
+
+/* Default number of iterations per benchmark, override with argv[1] */
+#define ITERATIONS 10000000UL
+
+/* Event payload similar in size to the firmware event structures */
+typedef struct event {
+	struct event *next;
+	uint16_t expire;
+	uint8_t type;
+	void (*f)(struct event *);
+} event_t;
+
+#define CHUNKS 16
+
+static uint8_t pool[MEMORY_POOL_SIZE(CHUNKS, sizeof(event_t))];
+
+/* Keeps the compiler from optimising the benchmarked calls away */
+static volatile uint32_t sink;
+
+static uint64_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *name, unsigned long ops, uint64_t ns) {
+	double nsop = (double) ns / ops;
+	printf("%-26s %10lu ops %10.2f ns/op %14.0f ops/s\n", name, ops, nsop, 1e9 / nsop);
+}
+
+static void bench_memory(unsigned long iterations) {
+	memory_t *manager = memory_init(pool, sizeof(pool), sizeof(event_t));
+	assert(manager != NULL);
+	unsigned long i;
+
+	/* Allocate and release from an empty pool (best case) */
+	uint64_t start = now();
+	for (i = 0; i < iterations; i++) {
+		void *chunk = memory_allocate(manager);
+		memory_release(chunk);
+	}
+	report("memory alloc+release", iterations, now() - start);
+
+	/* Same, but with all but the last chunk in use (worst case scan) */
+	void *held[CHUNKS - 1];
+	for (i = 0; i < CHUNKS - 1; i++) {
+		held[i] = memory_allocate(manager);
+		assert(held[i] != NULL);
+	}
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		void *chunk = memory_allocate(manager);
+		memory_release(chunk);
+	}
+	report("memory alloc+release/full", iterations, now() - start);
+	for (i = 0; i < CHUNKS - 1; i++) {
+		memory_release(held[i]);
+	}
+}
+
+static void bench_currency(unsigned long iterations) {
+	currency_t acc = { 0, 0 };
+	currency_t step = { 1, 37 };
+	unsigned long i;
+
+	uint64_t start = now();
+	for (i = 0; i < iterations; i++) {
+		acc = currency_add(acc, step);
+		if (acc.base > 30000) {
+			acc.base = -30000;
+		}
+	}
+	report("currency_add", iterations, now() - start);
+	sink = acc.base;
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		acc = currency_sub(acc, step);
+		if (acc.base < -30000) {
+			acc.base = 30000;
+		}
+	}
+	report("currency_sub", iterations, now() - start);
+	sink = acc.base;
+}
+
+/*
+ * Mocked callout manager: a list sorted by expiry time, like the one in
+ * aversive. The dispatch path of a driver is allocate, schedule, expire,
+ * run the callback and release.
+ */
+static event_t *queue;
+
+static void schedule(event_t *event) {
+	event_t **pos = &queue;
+	while (*pos && (int16_t) ((*pos)->expire - event->expire) <= 0) {
+		pos = &(*pos)->next;
+	}
+	event->next = *pos;
+	*pos = event;
+}
+
+static void dispatch(uint16_t time) {
+	while (queue && (int16_t) (queue->expire - time) <= 0) {
+		event_t *event = queue;
+		queue = event->next;
+		event->f(event);
+	}
+}
+
+static void callback(event_t *event) {
+	sink += event->type;
+	memory_release(event);
+}
+
+static void bench_dispatch(unsigned long iterations) {
+	memory_t *manager = memory_init(pool, sizeof(pool), sizeof(event_t));
+	assert(manager != NULL);
+	queue = NULL;
+	uint16_t time = 0;
+	unsigned long i;
+
+	/* Keep a few events pending, like the poll timers of the drivers */
+	uint64_t start = now();
+	for (i = 0; i < iterations; i++) {
+		event_t *event = (event_t *) memory_allocate(manager);
+		if (event) {
+			event->type = i & 0x7;
+			event->expire = time + (i & 0x3);
+			event->f = callback;
+			schedule(event);
+		}
+		dispatch(time++);
+	}
+	report("dispatch loop", iterations, now() - start);
+	dispatch(time + 4);
+	assert(queue == NULL);
+}
+
+/*
+ * Timer backends: the timing wheel against a reference list kept sorted by
+ * expiry time, with the same insertion, removal and expiry strategy as the
+ * aversive callout list.
+ */
+#define TIMERS_MAX 64
+/* Timer delays are drawn from 1..DELAY_MAX ticks (the bill poll uses 1600) */
+#define DELAY_MAX 2048
+
+struct list_timer {
+	LIST_ENTRY(list_timer) next;
+	uint32_t expire;
+	bool scheduled;
+};
+LIST_HEAD(list_head, list_timer);
+
+static struct list_head list_queue;
+static uint32_t timer_time;
+static uint16_t delays[TIMERS_MAX];
+
+static uint32_t timer_get_time(void) {
+	return timer_time;
+}
+
+static void list_schedule(struct list_timer *tim, uint16_t ticks) {
+	if (tim->scheduled) {
+		LIST_REMOVE(tim, next);
+	}
+	tim->expire = timer_time + ticks;
+	struct list_timer *pos = LIST_FIRST(&list_queue);
+	struct list_timer *prev = NULL;
+	while (pos && (int32_t) (pos->expire - tim->expire) <= 0) {
+		prev = pos;
+		pos = LIST_NEXT(pos, next);
+	}
+	if (prev) {
+		LIST_INSERT_AFTER(prev, tim, next);
+	} else {
+		LIST_INSERT_HEAD(&list_queue, tim, next);
+	}
+	tim->scheduled = true;
+}
+
+static void list_stop(struct list_timer *tim) {
+	if (tim->scheduled) {
+		LIST_REMOVE(tim, next);
+		tim->scheduled = false;
+	}
+}
+
+static void list_manage(void) {
+	struct list_timer *tim;
+	while ((tim = LIST_FIRST(&list_queue)) && (int32_t) (timer_time - tim->expire) >= 0) {
+		LIST_REMOVE(tim, next);
+		tim->scheduled = false;
+		sink++;
+	}
+}
+
+static void wheel_callback(struct wheel_mgr *cm, struct wheel_timer *tim, void *arg) {
+	sink++;
+}
+
+/* Cost of one clock reading, subtracted from the per-batch measurements */
+static uint64_t clock_overhead(void) {
+	uint64_t start = now();
+	unsigned long i;
+	for (i = 0; i < 100000; i++) {
+		now();
+	}
+	return (now() - start) / 100000;
+}
+
+/* Elapsed time of a batch without the clock overhead, a fast batch may take less than the average overhead */
+static uint64_t elapsed(uint64_t start, uint64_t end, uint64_t overhead) {
+	return end - start > overhead ? end - start - overhead : 0;
+}
+
+static void bench_timers(unsigned long iterations, size_t count) {
+	static struct list_timer list_timers[TIMERS_MAX];
+	static struct wheel_timer wheel_timers[TIMERS_MAX];
+	static struct wheel_mgr wheel;
+	char name[32];
+	uint64_t overhead = clock_overhead();
+	unsigned long rounds = iterations / count / 16;
+	unsigned long round;
+	size_t i;
+	if (rounds == 0) {
+		rounds = 1;
+	}
+
+	LIST_INIT(&list_queue);
+	wheel_mgr_init(&wheel, timer_get_time);
+	for (i = 0; i < count; i++) {
+		list_timers[i].scheduled = false;
+		wheel_init(&wheel_timers[i], wheel_callback, NULL, 1);
+	}
+
+	/* Insert and cancel, timed separately per batch of count timers */
+	uint64_t list_insert = 0, list_cancel = 0, wheel_insert = 0, wheel_cancel = 0;
+	for (round = 0; round < rounds; round++) {
+		for (i = 0; i < count; i++) {
+			delays[i] = 1 + rand() % DELAY_MAX;
+		}
+		timer_time += rand() % DELAY_MAX;
+		uint64_t start = now();
+		for (i = 0; i < count; i++) {
+			list_schedule(&list_timers[i], delays[i]);
+		}
+		uint64_t middle = now();
+		for (i = 0; i < count; i++) {
+			list_stop(&list_timers[i]);
+		}
+		uint64_t end = now();
+		list_insert += elapsed(start, middle, overhead);
+		list_cancel += elapsed(middle, end, overhead);
+		start = now();
+		for (i = 0; i < count; i++) {
+			wheel_schedule(&wheel, &wheel_timers[i], delays[i]);
+		}
+		middle = now();
+		for (i = 0; i < count; i++) {
+			wheel_stop(&wheel, &wheel_timers[i]);
+		}
+		end = now();
+		wheel_insert += elapsed(start, middle, overhead);
+		wheel_cancel += elapsed(middle, end, overhead);
+	}
+	snprintf(name, sizeof(name), "list insert/%zu", count);
+	report(name, rounds * count, list_insert);
+	snprintf(name, sizeof(name), "wheel insert/%zu", count);
+	report(name, rounds * count, wheel_insert);
+	snprintf(name, sizeof(name), "list cancel/%zu", count);
+	report(name, rounds * count, list_cancel);
+	snprintf(name, sizeof(name), "wheel cancel/%zu", count);
+	report(name, rounds * count, wheel_cancel);
+
+	/* Expire: schedule all timers, then advance one tick per dispatch until all have run */
+	uint64_t list_expire = 0, wheel_expire = 0;
+	rounds = rounds / (DELAY_MAX / 16) + 1;
+	for (round = 0; round < rounds; round++) {
+		uint32_t base = timer_time;
+		uint32_t tick;
+		for (i = 0; i < count; i++) {
+			delays[i] = 1 + rand() % DELAY_MAX;
+			list_schedule(&list_timers[i], delays[i]);
+		}
+		uint64_t start = now();
+		for (tick = 1; tick <= DELAY_MAX; tick++) {
+			timer_time = base + tick;
+			list_manage();
+		}
+		list_expire += now() - start;
+		assert(LIST_EMPTY(&list_queue));
+		timer_time = base;
+		for (i = 0; i < count; i++) {
+			wheel_schedule(&wheel, &wheel_timers[i], delays[i]);
+		}
+		start = now();
+		for (tick = 1; tick <= DELAY_MAX; tick++) {
+			timer_time = base + tick;
+			wheel_manage(&wheel);
+		}
+		wheel_expire += now() - start;
+		assert(LIST_EMPTY(&wheel.expired) && !wheel_next(&wheel, &tick));
+	}
+	snprintf(name, sizeof(name), "list expire/%zu", count);
+	report(name, rounds * count, list_expire);
+	snprintf(name, sizeof(name), "wheel expire/%zu", count);
+	report(name, rounds * count, wheel_expire);
+}
+
+/* Formatted output, replaces the UART transmit buffer */
+static char line[64];
+static size_t line_length;
+
+void serial_send(char character) {
+	line[line_length++ & (sizeof(line) - 1)] = character;
+}
+
+void serial_send_P(PGM_P data, uint16_t length) {
+	while (length-- > 0) {
+		serial_send(*data++);
+	}
+}
+
+static void bench_format(unsigned long iterations) {
+	/* A typical event log line: "[1234.567] Current balance: 12.05" */
+	uint32_t seconds = 1234;
+	uint16_t millis = 567;
+	currency_t balance = { 12, 5 };
+	unsigned long i;
+
+	uint64_t start = now();
+	for (i = 0; i < iterations; i++) {
+		line_length = snprintf(line, sizeof(line), "[%lu.%03u] Current balance: %d.%02u\r\n", (unsigned long) seconds + (i & 1), millis, balance.base, balance.cents);
+		sink += line_length;
+	}
+	report("snprintf line", iterations, now() - start);
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		line_length = 0;
+		fmt_char('[');
+		fmt_uint(seconds + (i & 1), 0);
+		fmt_char('.');
+		fmt_zero(millis, 3);
+		fmt_P(PSTR("] Current balance: "));
+		fmt_currency(balance);
+		fmt_eol();
+		sink += line_length;
+	}
+	report("fmt line", iterations, now() - start);
+}
+
+int main(int argc, char **argv) {
+	unsigned long iterations = ITERATIONS;
+	if (argc > 1) {
+		iterations = strtoul(argv[1], NULL, 0);
+	}
+	bench_memory(iterations);
+	bench_currency(iterations);
+	bench_dispatch(iterations);
+	bench_timers(iterations, 4);
+	bench_timers(iterations, 16);
+	bench_timers(iterations, 64);
+	bench_format(iterations);
+	return 0;
+}
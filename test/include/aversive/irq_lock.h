@@ -0,0 +1,15 @@
+/**
+ * @file irq_lock.h
+ * @brief Host replacement for the aversive interrupt lock
+ * 
+ * The host test programs are single-threaded, so locking interrupts is a
+ * no-op. Only used when firmware sources are compiled for the host.
+ */
+
+#ifndef _AVERSIVE_IRQ_LOCK_H_
+#define _AVERSIVE_IRQ_LOCK_H_
+
+#define IRQ_LOCK(flags) do { (flags) = 0; } while (0)
+#define IRQ_UNLOCK(flags) do { (void) (flags); } while (0)
+
+#endif /*_AVERSIVE_IRQ_LOCK_H_*/
@@ -0,0 +1,15 @@
+/**
+ * @file interrupt.h
+ * @brief Host replacement for the avr-libc interrupt definitions
+ * 
+ * An interrupt handler becomes a plain function named after its vector, so
+ * the test program can call it to simulate the interrupt. Only used when
+ * firmware sources are compiled for the host.
+ */
+
+#ifndef _AVR_INTERRUPT_H_
+#define _AVR_INTERRUPT_H_
+
+#define ISR(vector, ...) void vector(void)
+
+#endif /*_AVR_INTERRUPT_H_*/
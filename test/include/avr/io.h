@@ -0,0 +1,76 @@
+/**
+ * @file io.h
+ * @brief Host replacement for the avr-libc I/O register definitions
+ * 
+ * The registers used by the host tested drivers are plain variables, which
+ * the test program defines and inspects. The UART data register is the
+ * exception: every access goes through udr0(), so the test program sees
+ * every character that is written. Only used when firmware sources are
+ * compiled for the host.
+ */
+
+#ifndef _AVR_IO_H_
+#define _AVR_IO_H_
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+extern volatile uint8_t PINA;
+extern volatile uint8_t PINB, PORTB, DDRB;
+extern volatile uint8_t PINC, PORTC, DDRC;
+extern volatile uint8_t ETIFR, ETIMSK;
+extern volatile uint16_t TCNT3, OCR3B;
+extern volatile uint8_t PINE, PORTE, DDRE;
+extern volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+extern volatile uint8_t SREG;
+
+volatile uint8_t *udr0(void);
+#define UDR0 (*udr0())
+
+#define PA4 4
+#define PA5 5
+#define PA6 6
+#define PA7 7
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PC7 7
+
+#define PE2 2
+#define PE3 3
+
+#define OCIE3B 3
+#define OCF3B 3
+
+#define SREG_I 7
+
+#define UDRE0 5
+#define FE0 4
+#define DOR0 3
+#define U2X0 1
+
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+
+#define UCSZ01 2
+#define UCSZ00 1
+
+#endif /*_AVR_IO_H_*/
@@ -0,0 +1,31 @@
+/**
+ * @file pgmspace.h
+ * @brief Host replacement for the avr-libc program memory interface
+ * 
+ * The host has a single address space, so program memory accessors are plain
+ * memory reads and the _P string functions map to their standard versions.
+ * Only used when firmware sources are compiled for the host.
+ */
+
+#ifndef _AVR_PGMSPACE_H_
+#define _AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define PGM_P const char *
+
+#define pgm_read_byte(address) (*(const uint8_t *) (address))
+#define pgm_read_word(address) (*(const uint16_t *) (address))
+#define pgm_read_dword(address) (*(const uint32_t *) (address))
+#define pgm_read_ptr(address) (*(const void * const *) (address))
+
+#define strncmp_P strncmp
+#define strncasecmp_P strncasecmp
+#define strncpy_P strncpy
+#define strlen_P strlen
+
+#endif /*_AVR_PGMSPACE_H_*/
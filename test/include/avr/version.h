@@ -0,0 +1,14 @@
+/**
+ * @file version.h
+ * @brief Host replacement for the avr-libc version header
+ * 
+ * Announces a C library with time.h, so firmware sources use the host one.
+ * Only used when firmware sources are compiled for the host.
+ */
+
+#ifndef _AVR_VERSION_H_
+#define _AVR_VERSION_H_
+
+#define __AVR_LIBC_VERSION__ 10801UL
+
+#endif /*_AVR_VERSION_H_*/
@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "args.h"
+
+/* A command-like table with additional fields after the name */
+typedef struct {
+	const char *name;
+	int id;
+} entry_t;
+
+static const entry_t ENTRIES[] = {
+	{ "balance", 0 },
+	{ "bill", 1 },
+	{ "coin", 2 },
+	{ "exit", 3 },
+	{ "gpio", 4 },
+	{ "help", 5 },
+	{ "idle", 6 },
+	{ "led", 7 },
+	{ "ledger", 8 },
+	{ "mem", 9 },
+	{ "reboot", 10 },
+	{ "sched", 11 },
+};
+
+static const char *const STATES[] = { "in", "off", "on", "out" };
+static const args_table_t STATE_TABLE = ARGS_TABLE(STATES);
+
+static const args_spec_t GPIO[] = {
+	{ ARGS_PORT, NULL },
+	{ ARGS_PIN, NULL },
+	{ ARGS_KEYWORD, &STATE_TABLE },
+};
+
+static const args_spec_t WATCH[] = {
+	{ ARGS_PORTS, NULL },
+	{ ARGS_DECIMAL, NULL },
+	{ ARGS_NUMBER, NULL },
+};
+
+static int16_t search(const char *token) {
+	return args_search(ENTRIES, ARGS_COUNT(ENTRIES), sizeof(ENTRIES[0]), token, strlen(token));
+}
+
+static void test_search(void) {
+	size_t i;
+	/* Every name, and unique prefixes */
+	for (i = 0; i < ARGS_COUNT(ENTRIES); i++) {
+		assert(search(ENTRIES[i].name) == i);
+		assert(ENTRIES[search(ENTRIES[i].name)].id == ENTRIES[i].id);
+	}
+	/* Ambiguous prefixes match nothing, but are found as the start of the matching names */
+	assert(search("b") == -1);
+	assert(args_prefix(ENTRIES, ARGS_COUNT(ENTRIES), sizeof(ENTRIES[0]), "b", 1) == 0);
+	assert(search("le") == -1);
+	assert(args_prefix(ENTRIES, ARGS_COUNT(ENTRIES), sizeof(ENTRIES[0]), "LE", 2) == 7);
+	assert(search("bi") == 1);
+	assert(search("LED") == 7);
+	assert(search("ledg") == 8);
+	assert(search("s") == 11);
+	assert(search("a") == -1);
+	assert(search("z") == -1);
+	assert(search("helpme") == -1);
+	assert(search("") == -1);
+	/* Tokens are not terminated */
+	assert(args_search(ENTRIES, ARGS_COUNT(ENTRIES), sizeof(ENTRIES[0]), "coin 1", 4) == 2);
+	assert(args_lookup(&STATE_TABLE, "o", 1) == -1);
+	assert(args_lookup(&STATE_TABLE, "of", 2) == 1);
+	assert(args_lookup(&STATE_TABLE, "On", 2) == 2);
+	assert(args_lookup(&STATE_TABLE, "ou", 2) == 3);
+	assert(args_lookup(&STATE_TABLE, "x", 1) == -1);
+}
+
+static void check_decimal(const char *buf, bool valid, int16_t left, uint8_t right) {
+	int16_t l = 1234;
+	uint8_t r = 56;
+	bool ret = args_decimal(buf, strlen(buf), &l, &r);
+	assert(ret == valid);
+	if (valid) {
+		assert(l == left && r == right);
+	}
+}
+
+static void test_decimal(void) {
+	check_decimal("0", true, 0, 0);
+	check_decimal("12", true, 12, 0);
+	check_decimal("12.5", true, 12, 50);
+	check_decimal("12.05", true, 12, 5);
+	check_decimal("12.999", true, 12, 99);
+	check_decimal(".5", true, 0, 50);
+	check_decimal("7.", true, 7, 0);
+	check_decimal("+3.10", true, 3, 10);
+	check_decimal("-3.10", true, -3, 10);
+	check_decimal("32767.99", true, 32767, 99);
+	check_decimal("32768", true, 32767, 99);
+	check_decimal("99999999999", true, 32767, 99);
+	check_decimal("-32768.99", true, -32768, 99);
+	check_decimal("-40000", true, -32768, 99);
+	check_decimal("", false, 0, 0);
+	check_decimal("-", false, 0, 0);
+	check_decimal(".", false, 0, 0);
+	check_decimal("1a", false, 0, 0);
+	check_decimal("1.2.3", false, 0, 0);
+}
+
+static int8_t parse_spec(const args_spec_t *spec, uint8_t count, uint8_t required, const char *line, args_value_t *values) {
+	const char *tokens[ARGS_MAX + 1];
+	size_t lengths[ARGS_MAX + 1];
+	uint8_t ntokens = 0;
+	const char *p = line;
+	while (*p && ntokens < ARGS_MAX + 1) {
+		size_t length = strcspn(p, " ");
+		tokens[ntokens] = p;
+		lengths[ntokens] = length;
+		ntokens++;
+		p += length;
+		p += strspn(p, " ");
+	}
+	return args_parse(spec, count, required, tokens, lengths, ntokens, values);
+}
+
+static int8_t parse(const char *line, args_value_t *values) {
+	return parse_spec(GPIO, ARGS_COUNT(GPIO), 1, line, values);
+}
+
+static int8_t parse_watch(const char *line, args_value_t *values) {
+	return parse_spec(WATCH, ARGS_COUNT(WATCH), 2, line, values);
+}
+
+static void test_parse(void) {
+	args_value_t values[ARGS_MAX];
+	assert(parse("c", values) == 1 && values[0].port == 'C');
+	assert(parse("G 7", values) == 2 && values[0].port == 'G' && values[1].pin == 7);
+	assert(parse("a 0 OUT", values) == 3 && values[0].port == 'A' && values[1].pin == 0 && values[2].index == 3);
+	assert(parse("a 0 of", values) == 3 && values[2].index == 1);
+	assert(parse("", values) == -1);
+	assert(parse("h", values) == -1);
+	assert(parse("ab", values) == -1);
+	assert(parse("a 8", values) == -2);
+	assert(parse("a 1 up", values) == -3);
+	assert(parse("a 1 on extra", values) == -4);
+}
+
+static void test_watch(void) {
+	args_value_t values[ARGS_MAX];
+	assert(parse_watch("e 1", values) == 2 && values[0].ports == 0x10 && values[1].decimal.left == 1);
+	assert(parse_watch("aGc 0.25 20000", values) == 3 && values[0].ports == 0x45);
+	assert(values[1].decimal.left == 0 && values[1].decimal.right == 25 && values[2].number == 20000);
+	assert(parse_watch("a 1 65535", values) == 3 && values[2].number == 65535);
+	assert(parse_watch("a 1 0", values) == 3 && values[2].number == 0);
+	assert(parse_watch("a", values) == -2);
+	assert(parse_watch("aa 1", values) == -1);
+	assert(parse_watch("ah 1", values) == -1);
+	assert(parse_watch("a x", values) == -2);
+	assert(parse_watch("a 1 65536", values) == -3);
+	assert(parse_watch("a 1 -1", values) == -3);
+	assert(parse_watch("a 1 2k", values) == -3);
+}
+
+int main(int argc, char **argv) {
+	test_search();
+	test_decimal();
+	test_parse();
+	test_watch();
+	printf("args: ok\n");
+	return 0;
+}
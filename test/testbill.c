@@ -0,0 +1,329 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <avr/io.h>
+#include "bill.h"
+#include "eventlog.h"
+#include "telemetry.h"
+#include "main.h"
+
+/* Simulated I/O registers, see include/avr/io.h */
+volatile uint8_t PINB, PORTB, DDRB;
+volatile uint8_t PINC, PORTC, DDRC;
+volatile uint8_t ETIFR, ETIMSK;
+volatile uint16_t TCNT3, OCR3B;
+
+/* The sampling interrupt of bill.c */
+void TIMER3_COMPB_vect(void);
+
+/* VEND pattern of a 20 banknote (VEND1 H, VEND2 L, VEND3 H) and of no banknote */
+#define VEND_20 0xa0
+#define VEND_NONE 0xe0
+
+static uint32_t now;
+static struct wheel_mgr manager;
+
+/* Reports and errors, with the time they were made */
+static int reports;
+static uint16_t denomination;
+static uint32_t reported;
+static int errors;
+static bill_error_t error;
+static int transitions;
+
+uint32_t main_time(void) {
+	return now;
+}
+
+bool eventlog_write(eventlog_id_e id, uint16_t a, uint16_t b) {
+	return true;
+}
+
+bool telemetry_write(uint8_t id, uint32_t time, uint16_t a, uint16_t b) {
+	assert(id == TELEMETRY_BILL_STATE);
+	// Transitions are stamped with the sample time, never the future
+	assert(!main_time_after(time, now));
+	assert(a != b);
+	transitions++;
+	return true;
+}
+
+static void report(uint16_t value) {
+	reports++;
+	denomination = value;
+	reported = now;
+}
+
+static void fail(bill_error_t code, uint16_t value) {
+	errors++;
+	error = code;
+}
+
+/* Set the scanner outputs (levels, true = H) */
+static void scanner(bool busy, bool abn, bool valid, bool stkf, uint8_t vend) {
+	PINB = (stkf ? _BV(PB6) : 0) | (valid ? _BV(PB7) : 0);
+	PINC = (abn ? _BV(PC3) : 0) | (busy ? _BV(PC4) : 0) | vend;
+}
+
+/* Advance the time, with the timer 3 compare interrupt and the event queue */
+static void run(uint32_t ticks) {
+	while (ticks-- > 0) {
+		now++;
+		TCNT3 = (uint16_t) now;
+		if ((ETIMSK & _BV(OCIE3B)) && TCNT3 == OCR3B) {
+			TIMER3_COMPB_vect();
+		}
+		wheel_manage(&manager);
+	}
+}
+
+static bool ack(void) {
+	return (PORTC & _BV(PC1)) != 0;
+}
+
+static void test_bill(void) {
+	wheel_mgr_init(&manager, main_time);
+	scanner(true, false, true, false, VEND_NONE);
+	assert(bill_init(&manager, report, fail));
+	assert(ETIMSK & _BV(OCIE3B));
+
+	// The first sample starts the self-test, until BUSY goes low
+	rate_stats_t rate;
+	bill_rate(&rate);
+	assert(rate.period == BILL_SAMPLE_IDLE);
+	run(BILL_SAMPLE_IDLE);
+	assert(bill_state() == BILL_STATE_SELFTEST);
+	bill_rate(&rate);
+	assert(rate.period == BILL_SAMPLE_PERIOD);
+	scanner(false, false, true, false, VEND_NONE);
+	run(BILL_SAMPLE_PERIOD);
+	assert(bill_state() == BILL_STATE_IDLE);
+	assert(ack());
+
+	// A banknote is inserted and scanned
+	scanner(true, false, true, false, VEND_NONE);
+	run(BILL_SAMPLE_PERIOD);
+	assert(bill_state() == BILL_STATE_VALIDATION);
+	scanner(true, false, true, false, VEND_20);
+	run(1000);
+	assert(bill_state() == BILL_STATE_VALIDATION);
+	assert(reports == 0);
+
+	// VALID goes low: the banknote is accepted and reported within one sample period
+	uint32_t valid = now;
+	scanner(true, false, false, false, VEND_20);
+	run(BILL_SAMPLE_PERIOD);
+	assert(reports == 1);
+	assert(denomination == 20);
+	assert(reported - valid <= BILL_SAMPLE_PERIOD);
+	printf("bill: reported %u ticks after VALID\n", (unsigned) (reported - valid));
+	// VALIDATION, SCANNED, ACCEPT and END on the same pin state
+	assert(bill_state() == BILL_STATE_END);
+	assert(transitions == 6);
+
+	// ACK is held low for its pulse time, not for a poll period
+	assert(!ack());
+	run(BILL_ACK_TIME - (now - reported) - 1);
+	assert(!ack());
+	run(1);
+	assert(ack());
+
+	// The scanner releases BUSY after the acknowledgement
+	scanner(false, false, true, false, VEND_NONE);
+	run(BILL_SAMPLE_PERIOD);
+	assert(bill_state() == BILL_STATE_IDLE);
+	assert(reports == 1 && errors == 0);
+
+	// A jam during validation
+	scanner(true, false, true, false, VEND_NONE);
+	run(BILL_SAMPLE_PERIOD);
+	assert(bill_state() == BILL_STATE_VALIDATION);
+	scanner(true, true, true, false, VEND_NONE);
+	run(BILL_SAMPLE_PERIOD);
+	assert(bill_state() == BILL_STATE_ERROR);
+	assert(errors == 1 && error == BILL_ERROR_SCAN);
+	scanner(true, false, true, false, VEND_NONE);
+	run(BILL_SAMPLE_PERIOD);
+	assert(bill_state() == BILL_STATE_END);
+	scanner(false, false, true, false, VEND_NONE);
+	run(BILL_SAMPLE_PERIOD);
+	assert(bill_state() == BILL_STATE_IDLE);
+
+	// A full stacker is reported instead of the banknote
+	scanner(true, false, true, false, VEND_NONE);
+	run(BILL_SAMPLE_PERIOD);
+	scanner(true, false, false, true, VEND_20);
+	run(BILL_SAMPLE_PERIOD);
+	assert(errors == 2 && error == BILL_ERROR_FULL);
+	assert(reports == 1);
+	assert(bill_state() == BILL_STATE_END);
+	scanner(false, false, true, false, VEND_NONE);
+	run(BILL_SAMPLE_PERIOD);
+	assert(bill_state() == BILL_STATE_IDLE);
+
+	// Sampling returns to the idle period once the pins have been quiet, and nothing else happens
+	int before = transitions;
+	run(BILL_LINGER - BILL_SAMPLE_PERIOD - 1);
+	bill_rate(&rate);
+	assert(rate.period == BILL_SAMPLE_PERIOD);
+	run(BILL_SAMPLE_PERIOD + 1);
+	bill_rate(&rate);
+	assert(rate.period == BILL_SAMPLE_IDLE);
+	uint32_t runs = rate.runs;
+	run(MAIN_TICKS_PER_SECOND);
+	bill_rate(&rate);
+	assert(rate.runs - runs <= MAIN_TICKS_PER_SECOND / BILL_SAMPLE_IDLE + 1);
+	assert(transitions == before);
+
+	// The next banknote is seen within the idle period, then sampled fast again
+	scanner(true, false, true, false, VEND_NONE);
+	run(BILL_SAMPLE_IDLE);
+	assert(bill_state() == BILL_STATE_VALIDATION);
+	bill_rate(&rate);
+	assert(rate.period == BILL_SAMPLE_PERIOD);
+	runs = rate.runs;
+	run(BILL_SAMPLE_IDLE);
+	bill_rate(&rate);
+	assert(rate.runs - runs >= BILL_SAMPLE_IDLE / BILL_SAMPLE_PERIOD);
+
+	bill_shutdown();
+	assert(!(ETIMSK & _BV(OCIE3B)));
+}
+
+/* State names as used in the state diagram, in bill_state_t order */
+static const char *NODES[] = {
+	"UNINITIALIZED", "SELFTEST", "IDLE", "VALIDATION", "SCANNED", "ACCEPT", "REJECT", "ERROR", "END",
+};
+
+static uint8_t node(const char *name, size_t length) {
+	uint8_t state;
+	for (state = 0; state < sizeof(NODES) / sizeof(NODES[0]); state++) {
+		if (strlen(NODES[state]) == length && strncmp(NODES[state], name, length) == 0) {
+			return state;
+		}
+	}
+	assert(false);
+	return 0;
+}
+
+/* Translate a diagram label like "V:H B:L" into a pin mask and value */
+static void levels(const char *label, uint8_t *mask, uint8_t *value) {
+	*mask = 0;
+	*value = 0;
+	for (; *label && *label != '"'; label++) {
+		uint8_t pin;
+		switch (*label) {
+			case 'V': pin = BILL_PIN_VALID; break;
+			case 'S': pin = BILL_PIN_STKF; break;
+			case 'A': pin = BILL_PIN_ABN; break;
+			case 'B': pin = BILL_PIN_BUSY; break;
+			case 'E': pin = BILL_PIN_VEND; break;
+			default: continue;
+		}
+		assert(label[1] == ':' && (label[2] == 'H' || label[2] == 'L'));
+		*mask |= pin;
+		*value |= label[2] == 'H' ? pin : 0;
+		label += 2;
+	}
+}
+
+/* Translate a diagram node label into the output set on entry */
+static uint8_t output(const char *label) {
+	if (strncmp(label, "I:L K:H R:H}", 12) == 0) {
+		return BILL_OUTPUT_READY;
+	}
+	if (strncmp(label, "K:L}", 4) == 0) {
+		return BILL_OUTPUT_ACK;
+	}
+	if (strncmp(label, "R:L}", 4) == 0) {
+		return BILL_OUTPUT_REJ;
+	}
+	assert(*label == '}');
+	return BILL_OUTPUT_NONE;
+}
+
+/* The transition table implements the state diagram in the driver documentation */
+static void test_graph(void) {
+	FILE *file = fopen("../src/bill.c", "r");
+	assert(file != NULL);
+	uint8_t count;
+	const bill_transition_t *table = bill_transitions(&count);
+	uint8_t outputs[sizeof(NODES) / sizeof(NODES[0])] = { 0 };
+	uint8_t edges = 0;
+	bool graph = false;
+	char line[256];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (strstr(line, "digraph State {") != NULL) {
+			graph = true;
+			continue;
+		}
+		if (!graph) {
+			continue;
+		}
+		if (strcmp(line, " * }\n") == 0) {
+			break;
+		}
+		char *name = line + strspn(line, " *\t");
+		size_t length = strcspn(name, " -[");
+		char *arrow = strstr(name, "->");
+		char *record = strstr(name, "[label=\"{");
+		if (arrow != NULL) {
+			// Edges are listed in table order
+			char *to = arrow + 2;
+			uint8_t mask, value;
+			levels(strstr(to, "label=\"") + 7, &mask, &value);
+			assert(edges < count);
+			const bill_transition_t *transition = &table[edges++];
+			assert(transition->state == node(name, length));
+			assert(transition->next == node(to, strcspn(to, " [")));
+			assert(transition->mask == mask);
+			assert(transition->value == value);
+		} else if (record != NULL) {
+			char *outs = strchr(record, '|');
+			assert(outs != NULL);
+			outputs[node(name, length)] = output(outs + 1 + strspn(outs + 1, " "));
+		}
+	}
+	fclose(file);
+	assert(graph);
+	assert(edges == count);
+
+	uint8_t i;
+	for (i = 0; i < count; i++) {
+		// Sorted by state, and the outputs are those of the next state
+		assert(i == 0 || table[i - 1].state <= table[i].state);
+		assert(table[i].output == outputs[table[i].next]);
+		assert((table[i].value & ~table[i].mask) == 0);
+	}
+
+	// For a fixed pin state, every state settles after a few transitions
+	uint16_t pins;
+	for (pins = 0; pins < 256; pins++) {
+		uint8_t start;
+		for (start = 0; start < sizeof(NODES) / sizeof(NODES[0]); start++) {
+			uint8_t state = start;
+			uint8_t hops = 0;
+			bool moved;
+			do {
+				moved = false;
+				for (i = 0; i < count; i++) {
+					if (table[i].state == state && (pins & table[i].mask) == table[i].value) {
+						state = table[i].next;
+						moved = true;
+						break;
+					}
+				}
+				assert(hops++ <= sizeof(NODES) / sizeof(NODES[0]));
+			} while (moved);
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	test_graph();
+	test_bill();
+	printf("bill: ok\n");
+	return 0;
+}
@@ -0,0 +1,186 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <assert.h>
+#include <avr/io.h>
+#include "coin.h"
+#include "eventlog.h"
+#include "main.h"
+
+/* Simulated I/O registers, see include/avr/io.h */
+volatile uint8_t PINA;
+volatile uint8_t PINB, PORTB, DDRB;
+volatile uint8_t PINC, PORTC, DDRC;
+volatile uint8_t ETIFR, ETIMSK;
+volatile uint16_t TCNT3, OCR3B;
+
+/* Coin patterns as returned by coin_pins(): F, E, D, C (alarm), B */
+#define PATTERN(f, e, d, b) ((f << 5) | (e << 4) | (d << 3) | (b << 1))
+#define REST PATTERN(0, 1, 1, 0)
+#define CHF_1 PATTERN(0, 1, 0, 1)
+#define CHF_2 PATTERN(1, 1, 1, 1)
+#define UNKNOWN PATTERN(1, 0, 1, 1)
+#define ALARM 0x04
+
+/* Pulse widths (ticks) */
+#define MS(ms) ((uint32_t) (ms) * MAIN_TICKS_PER_SECOND / 1000)
+
+static uint32_t now;
+static struct wheel_mgr manager;
+
+static int reports;
+static currency_t denomination;
+static uint32_t reported;
+static int alarms;
+
+uint32_t main_time(void) {
+	return now;
+}
+
+bool eventlog_write(eventlog_id_e id, uint16_t a, uint16_t b) {
+	return true;
+}
+
+static void report(currency_t value) {
+	reports++;
+	denomination = value;
+	reported = now;
+}
+
+static void fail(coin_error_t error) {
+	assert(error == COIN_ERROR_ALARM);
+	alarms++;
+}
+
+/* Set the acceptor outputs */
+static void acceptor(uint8_t pins) {
+	PINA = (pins & 0x1e) << 3;
+	PINB = pins & _BV(PB5);
+}
+
+static void run(uint32_t ticks) {
+	while (ticks-- > 0) {
+		now++;
+		wheel_manage(&manager);
+	}
+}
+
+/* Send a pattern for a number of ticks, then return to rest */
+static void pulse(uint8_t pins, uint32_t width) {
+	acceptor(pins);
+	run(width);
+	acceptor(REST);
+}
+
+/* Wait until the driver is back at the idle polling period */
+static void settle(void) {
+	run(COIN_LINGER + MS(200));
+	rate_stats_t rate;
+	coin_rate(&rate);
+	assert(rate.period == COIN_POLL_IDLE);
+}
+
+static void test_coin(void) {
+	wheel_mgr_init(&manager, main_time);
+	acceptor(REST);
+	assert(coin_init(&manager, report, fail));
+	coin_stats_t stats;
+
+	// The resting pattern is learned, nothing else happens
+	run(MAIN_TICKS_PER_SECOND);
+	coin_stats(&stats);
+	assert(stats.rejects == 0);
+	assert(reports == 0);
+	assert(coin_pins() == REST);
+
+	// One pulse is one coin, credited when it ends
+	pulse(CHF_1, MS(100));
+	uint32_t end = now;
+	run(MS(50));
+	assert(reports == 1);
+	assert(denomination.base == 1 && denomination.cents == 0);
+	assert(reported - end <= COIN_POLL_TIME * COIN_VOTES);
+	run(MS(500));
+	assert(reports == 1);
+
+	// A single disagreeing sample is outvoted
+	pulse(CHF_2, COIN_POLL_TIME);
+	run(MS(50));
+	coin_stats(&stats);
+	assert(stats.glitches == 1);
+	assert(reports == 1);
+
+	// Glitches inside a pulse neither end it nor credit twice
+	acceptor(CHF_2);
+	run(MS(50));
+	pulse(REST, COIN_POLL_TIME);
+	acceptor(CHF_2);
+	run(MS(50));
+	acceptor(REST);
+	run(MS(50));
+	coin_stats(&stats);
+	assert(stats.glitches == 2);
+	assert(reports == 2 && denomination.base == 2);
+
+	// Pulses out of spec are rejected
+	pulse(CHF_1, MS(40));
+	run(MS(50));
+	pulse(CHF_1, MS(160));
+	run(MS(50));
+	pulse(UNKNOWN, MS(100));
+	run(MS(50));
+	coin_stats(&stats);
+	assert(stats.rejects == 3);
+	assert(reports == 2);
+
+	// A stuck pattern is rejected once
+	acceptor(CHF_1);
+	run(MS(500));
+	acceptor(REST);
+	run(MS(500));
+	coin_stats(&stats);
+	assert(stats.rejects == 4);
+	assert(reports == 2);
+	pulse(CHF_1, MS(100));
+	run(MS(50));
+	assert(reports == 3);
+
+	// Pulses of any valid width are credited from the idle period, at any phase
+	uint32_t offset;
+	for (offset = 0; offset < COIN_POLL_IDLE; offset += COIN_POLL_IDLE / 7) {
+		settle();
+		run(offset);
+		pulse(CHF_1, MS(80));
+		run(MS(50));
+		settle();
+		run(offset);
+		pulse(CHF_2, MS(120));
+		run(MS(50));
+	}
+	coin_stats(&stats);
+	assert(stats.rejects == 4);
+	assert(stats.coins == reports);
+	assert(reports == 3 + 2 * 8);
+	printf("coin: %d coins, %u glitches, %u rejects\n", reports, stats.glitches, stats.rejects);
+
+	// The alarm is reported once, and no coin is credited during it
+	acceptor(REST | ALARM);
+	run(MS(50));
+	assert(alarms == 1);
+	assert(coin_alarm());
+	pulse(CHF_1 | ALARM, MS(100));
+	acceptor(REST | ALARM);
+	run(MS(50));
+	assert(reports == 3 + 2 * 8);
+	acceptor(REST);
+	run(MS(50));
+	assert(!coin_alarm());
+
+	coin_shutdown();
+}
+
+int main(int argc, char **argv) {
+	test_coin();
+	printf("coin: ok\n");
+	return 0;
+}
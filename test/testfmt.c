@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "fmt.h"
+#include "serial.h"
+
+/* Captured output, replaces the UART transmit buffer */
+static char output[128];
+static size_t length;
+/* Number of strings queued by reference */
+static int spans;
+
+void serial_send(char character) {
+	assert(length < sizeof(output) - 1);
+	output[length++] = character;
+	output[length] = '\0';
+}
+
+void serial_send_P(PGM_P data, uint16_t size) {
+	assert(length + size < sizeof(output));
+	memcpy(&output[length], data, size);
+	length += size;
+	output[length] = '\0';
+	spans++;
+}
+
+static void expect(const char *expected) {
+	if (strcmp(output, expected) != 0) {
+		printf("expected \"%s\", got \"%s\"\n", expected, output);
+		assert(false);
+	}
+	length = 0;
+	output[0] = '\0';
+}
+
+static void test_strings(void) {
+	fmt_char('x');
+	expect("x");
+	fmt_str("abc");
+	expect("abc");
+	fmt_P(PSTR("def"));
+	fmt_eol();
+	expect("def\r\n");
+	fmt_P_left(PSTR("run"), 5);
+	fmt_P_left(PSTR("toolong"), 5);
+	fmt_P_left(PSTR(""), 2);
+	expect("run  toolong  ");
+	// Short strings are copied, long ones queued without a copy
+	assert(spans == 0);
+	fmt_P_left(PSTR("a rather long help text"), 25);
+	expect("a rather long help text  ");
+	assert(spans == 1);
+}
+
+static void test_decimal(void) {
+	fmt_uint(0, 0);
+	expect("0");
+	fmt_uint(7, 0);
+	expect("7");
+	fmt_uint(10, 0);
+	expect("10");
+	fmt_uint(65535, 0);
+	expect("65535");
+	fmt_uint(1000000000UL, 0);
+	expect("1000000000");
+	fmt_uint(4294967295UL, 0);
+	expect("4294967295");
+	fmt_uint(42, 5);
+	expect("   42");
+	fmt_uint(123456, 3);
+	expect("123456");
+	fmt_int(0, 0);
+	expect("0");
+	fmt_int(-5, 0);
+	expect("-5");
+	fmt_int(-5, 4);
+	expect("  -5");
+	fmt_int(32767, 6);
+	expect(" 32767");
+	fmt_int(INT32_MIN, 0);
+	expect("-2147483648");
+	fmt_zero(5, 3);
+	expect("005");
+	fmt_zero(999, 3);
+	expect("999");
+	fmt_zero(12345, 3);
+	expect("345");
+	fmt_zero(0, 1);
+	expect("0");
+}
+
+static void test_hex(void) {
+	fmt_hex(0x0a, 2);
+	expect("0a");
+	fmt_hex(0xbeef, 4);
+	expect("beef");
+	fmt_hex(0x123, 2);
+	expect("23");
+	fmt_hex(0x1fffe, 5);
+	expect("1fffe");
+	fmt_hex(0xdeadbeef, 8);
+	expect("deadbeef");
+}
+
+static void test_currency(void) {
+	currency_t value;
+	value.base = 12;
+	value.cents = 5;
+	fmt_currency(value);
+	expect("12.05");
+	value.base = 0;
+	value.cents = 50;
+	fmt_currency(value);
+	expect("0.50");
+	value.base = -3;
+	value.cents = 0;
+	fmt_currency(value);
+	expect("-3.00");
+	value.base = -32768;
+	value.cents = 99;
+	fmt_currency(value);
+	expect("-32768.99");
+	value.base = 32767;
+	value.cents = 99;
+	fmt_currency(value);
+	expect("32767.99");
+}
+
+int main(int argc, char **argv) {
+	test_strings();
+	test_decimal();
+	test_hex();
+	test_currency();
+	printf("fmt: ok\n");
+	return 0;
+}
@@ -0,0 +1,300 @@
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "frame.h"
+#include "client.h"
+
+/* Response timeout of the loopback test (milliseconds) */
+#define TIMEOUT 2000
+/* Event id sent by the simulated device after a balance change */
+#define EVENT_BALANCE 6
+
+static void encode(uint8_t type, uint8_t seq, const char *payload, uint8_t length, uint8_t *buf, uint8_t *size) {
+	frame_t frame;
+	frame.type = type;
+	frame.seq = seq;
+	frame.length = length;
+	memcpy(frame.payload, payload, length);
+	*size = frame_encode(&frame, buf);
+}
+
+/* Feed bytes to a decoder, returns the number of complete frames */
+static int feed(frame_decoder_t *decoder, const uint8_t *buf, size_t size) {
+	int frames = 0;
+	size_t i;
+	for (i = 0; i < size; i++) {
+		if (frame_decode(decoder, buf[i])) {
+			frames++;
+		}
+	}
+	return frames;
+}
+
+static void test_crc(void) {
+	const char *vector = "123456789";
+	uint16_t crc = 0;
+	size_t i;
+	for (i = 0; i < strlen(vector); i++) {
+		crc = frame_crc(crc, vector[i]);
+	}
+	assert(crc == 0x31c3);
+}
+
+static void test_roundtrip(void) {
+	frame_decoder_t decoder;
+	frame_decoder_init(&decoder);
+	uint8_t length;
+	for (length = 0; length <= FRAME_PAYLOAD_MAX; length++) {
+		uint8_t buf[FRAME_SIZE_MAX];
+		uint8_t size;
+		char payload[FRAME_PAYLOAD_MAX];
+		uint8_t i;
+		for (i = 0; i < length; i++) {
+			// Include synchronisation bytes in the payload
+			payload[i] = (char) (i % 2 ? FRAME_SYNC : i);
+		}
+		encode(FRAME_PING, length, payload, length, buf, &size);
+		assert(size == length + FRAME_OVERHEAD);
+		assert(feed(&decoder, buf, size) == 1);
+		assert(decoder.frame.type == FRAME_PING);
+		assert(decoder.frame.seq == length);
+		assert(decoder.frame.length == length);
+		assert(memcmp(decoder.frame.payload, payload, length) == 0);
+	}
+	assert(decoder.errors == 0);
+	// Multi-byte fields
+	uint8_t field[4];
+	frame_put16(field, 0xbeef);
+	assert(field[0] == 0xef && field[1] == 0xbe);
+	assert(frame_get16(field) == 0xbeef);
+	frame_put32(field, 0x12345678);
+	assert(field[0] == 0x78 && field[3] == 0x12);
+	assert(frame_get32(field) == 0x12345678);
+}
+
+static void test_resync(void) {
+	frame_decoder_t decoder;
+	frame_decoder_init(&decoder);
+	uint8_t buf[FRAME_SIZE_MAX];
+	uint8_t size;
+	encode(FRAME_BALANCE_GET, 7, NULL, 0, buf, &size);
+
+	// Console text before a frame is skipped
+	const char *text = "\r\nPress return to open session\r\nMatemat> machine\r\n";
+	assert(feed(&decoder, (const uint8_t *) text, strlen(text)) == 0);
+	assert(feed(&decoder, buf, size) == 1);
+	assert(decoder.frame.seq == 7);
+
+	// A corrupted frame is dropped, the next one is received
+	uint8_t bad[FRAME_SIZE_MAX];
+	memcpy(bad, buf, size);
+	bad[3] ^= 0x01;
+	uint16_t errors = decoder.errors;
+	assert(feed(&decoder, bad, size) == 0);
+	assert(decoder.errors == errors + 1);
+	assert(feed(&decoder, buf, size) == 1);
+
+	// A synchronisation byte followed by an invalid length
+	const uint8_t noise[] = { FRAME_SYNC, 0xff, 0x00, FRAME_SYNC, FRAME_SYNC };
+	assert(feed(&decoder, noise, sizeof(noise)) == 0);
+	assert(feed(&decoder, buf, size) == 1);
+	assert(decoder.frame.type == FRAME_BALANCE_GET);
+
+	// A truncated frame swallows the start of the next one, which is then recovered by the one after
+	assert(feed(&decoder, buf, size - 2) == 0);
+	feed(&decoder, buf, size);
+	assert(feed(&decoder, buf, size) == 1);
+}
+
+static void device_send(int fd, uint8_t type, uint8_t seq, const uint8_t *payload, uint8_t length) {
+	uint8_t buf[FRAME_SIZE_MAX];
+	uint8_t size;
+	encode(type, seq, (const char *) payload, length, buf, &size);
+	assert(write(fd, buf, size) == size);
+}
+
+/* A simulated controller: a line shell that switches to machine mode */
+static void device(int fd) {
+	char line[32];
+	size_t position = 0;
+	bool machine = false;
+	uint8_t event = 0;
+	int16_t base = 0;
+	uint8_t cents = 0;
+	frame_decoder_t decoder;
+	frame_decoder_init(&decoder);
+	for (;;) {
+		uint8_t data;
+		if (read(fd, &data, 1) != 1) {
+			break;
+		}
+		if (!machine) {
+			// Echo like the line editor, so the client has to skip text
+			assert(write(fd, &data, 1) == 1);
+			if (data == '\r') {
+				line[position] = '\0';
+				position = 0;
+				machine = strcmp(line, "machine") == 0;
+				const char *prompt = "\r\nMatemat> ";
+				assert(write(fd, prompt, strlen(prompt)) == (ssize_t) strlen(prompt));
+			} else if (position < sizeof(line) - 1) {
+				line[position++] = data;
+			}
+			continue;
+		}
+		if (!frame_decode(&decoder, data)) {
+			continue;
+		}
+		const frame_t *request = &decoder.frame;
+		uint8_t payload[FRAME_PAYLOAD_MAX];
+		switch (request->type) {
+			case FRAME_PING:
+				device_send(fd, FRAME_PING | FRAME_RESPONSE, request->seq, request->payload, request->length);
+				break;
+			case FRAME_BALANCE_SET:
+				if (request->length != 3) {
+					payload[0] = request->type;
+					payload[1] = FRAME_ERROR_LENGTH;
+					device_send(fd, FRAME_ERROR, request->seq, payload, 2);
+					break;
+				}
+				base = (int16_t) frame_get16(&request->payload[0]);
+				cents = request->payload[2];
+				// Fall through
+			case FRAME_BALANCE_GET:
+				frame_put16(&payload[0], base);
+				payload[2] = cents;
+				device_send(fd, request->type | FRAME_RESPONSE, request->seq, payload, 3);
+				if (request->type == FRAME_BALANCE_SET) {
+					payload[0] = EVENT_BALANCE;
+					frame_put32(&payload[1], 15625);
+					frame_put16(&payload[5], base);
+					frame_put16(&payload[7], cents);
+					device_send(fd, FRAME_EVENT, event++, payload, 9);
+				}
+				break;
+			case FRAME_EXIT:
+				device_send(fd, FRAME_EXIT | FRAME_RESPONSE, request->seq, NULL, 0);
+				return;
+			default:
+				payload[0] = request->type;
+				payload[1] = FRAME_ERROR_TYPE;
+				device_send(fd, FRAME_ERROR, request->seq, payload, 2);
+				break;
+		}
+	}
+}
+
+static void count_event(const frame_t *frame, void *arg) {
+	int *events = arg;
+	assert(frame->type == FRAME_EVENT);
+	assert(frame->length == 9);
+	assert(frame->payload[0] == EVENT_BALANCE);
+	assert(frame_get32(&frame->payload[1]) == 15625);
+	(*events)++;
+}
+
+static void test_loopback(void) {
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	assert(master >= 0);
+	assert(grantpt(master) == 0);
+	assert(unlockpt(master) == 0);
+	client_t client;
+	assert(client_open(&client, ptsname(master), B38400) == 0);
+
+	pid_t pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		client_close(&client);
+		device(master);
+		// Let the parent read the last response before the pty is torn down
+		sleep(1);
+		_exit(0);
+	}
+
+	int events = 0;
+	client_events(&client, count_event, &events);
+	assert(client_enter(&client, TIMEOUT) == 0);
+
+	// Pipeline a batch of requests before reading any response
+	uint8_t balance[3];
+	frame_put16(&balance[0], 12);
+	balance[2] = 50;
+	int seqs[6];
+	seqs[0] = client_send(&client, FRAME_PING, "abc", 3);
+	seqs[1] = client_send(&client, FRAME_BALANCE_SET, balance, 3);
+	seqs[2] = client_send(&client, FRAME_BALANCE_GET, NULL, 0);
+	seqs[3] = client_send(&client, 0x33, NULL, 0);
+	seqs[4] = client_send(&client, FRAME_BALANCE_SET, balance, 2);
+	seqs[5] = client_send(&client, FRAME_PING, "0123456789abcdef", FRAME_PAYLOAD_MAX);
+	int i;
+	for (i = 0; i < 6; i++) {
+		assert(seqs[i] >= 0);
+		assert(i == 0 || seqs[i] == (uint8_t) (seqs[i - 1] + 1));
+	}
+
+	frame_t response;
+	assert(client_receive(&client, &response, TIMEOUT) == 1);
+	assert(response.seq == seqs[0]);
+	assert(response.type == (FRAME_PING | FRAME_RESPONSE));
+	assert(response.length == 3 && memcmp(response.payload, "abc", 3) == 0);
+
+	assert(client_receive(&client, &response, TIMEOUT) == 1);
+	assert(response.seq == seqs[1]);
+	assert(response.type == (FRAME_BALANCE_SET | FRAME_RESPONSE));
+	assert(frame_get16(&response.payload[0]) == 12 && response.payload[2] == 50);
+
+	assert(client_receive(&client, &response, TIMEOUT) == 1);
+	assert(response.seq == seqs[2]);
+	assert(response.type == (FRAME_BALANCE_GET | FRAME_RESPONSE));
+	assert(frame_get16(&response.payload[0]) == 12 && response.payload[2] == 50);
+	// The event notification between the responses went to the callback
+	assert(events == 1);
+
+	assert(client_receive(&client, &response, TIMEOUT) == 1);
+	assert(response.seq == seqs[3]);
+	assert(response.type == FRAME_ERROR);
+	assert(response.payload[0] == 0x33 && response.payload[1] == FRAME_ERROR_TYPE);
+
+	assert(client_receive(&client, &response, TIMEOUT) == 1);
+	assert(response.seq == seqs[4]);
+	assert(response.type == FRAME_ERROR);
+	assert(response.payload[1] == FRAME_ERROR_LENGTH);
+
+	assert(client_receive(&client, &response, TIMEOUT) == 1);
+	assert(response.seq == seqs[5]);
+	assert(response.length == FRAME_PAYLOAD_MAX);
+	assert(memcmp(response.payload, "0123456789abcdef", FRAME_PAYLOAD_MAX) == 0);
+
+	// Nothing else is pending
+	assert(client_receive(&client, &response, 50) == 0);
+
+	assert(client_call(&client, FRAME_EXIT, NULL, 0, &response, TIMEOUT) == 1);
+	assert(response.type == (FRAME_EXIT | FRAME_RESPONSE));
+	assert(client.decoder.errors == 0);
+
+	client_close(&client);
+	int status;
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	close(master);
+}
+
+int main(int argc, char **argv) {
+	test_crc();
+	test_roundtrip();
+	test_resync();
+	test_loopback();
+	printf("All frame tests passed\n");
+	return 0;
+}
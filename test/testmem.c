@@ -0,0 +1,198 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <assert.h>
+#include <time.h>
+#include "memory.h"
+
+/* Chunk payload, tagged with the owner so double allocations are detected */
+typedef struct {
+	uint32_t owner;
+	uint32_t serial;
+} chunk_t;
+
+#define CHUNKS 8
+#define HELD 3
+#define INVOCATIONS 20000
+
+static uint8_t pool[MEMORY_POOL_SIZE(CHUNKS, sizeof(chunk_t))];
+static memory_t *manager;
+
+/* Chunks held across invocations by each simulated interrupt */
+static chunk_t *held[2][HELD];
+static uint32_t held_serial[2][HELD];
+static volatile sig_atomic_t interrupts[2];
+static volatile sig_atomic_t allocations[2];
+static volatile sig_atomic_t failures;
+
+static void check(chunk_t *chunk, uint32_t owner, uint32_t serial) {
+	if (chunk->owner != owner || chunk->serial != serial) {
+		failures++;
+	}
+}
+
+static void interrupt(int context) {
+	static uint32_t serials[2];
+	uint32_t owner = context + 2;
+	interrupts[context]++;
+	size_t i;
+	/* Release the chunks from the previous invocation and grab new ones */
+	for (i = 0; i < HELD; i++) {
+		chunk_t *chunk = held[context][i];
+		if (chunk) {
+			check(chunk, owner, held_serial[context][i]);
+			if (!memory_release(chunk)) {
+				failures++;
+			}
+			held[context][i] = NULL;
+		}
+	}
+	for (i = 0; i < HELD; i++) {
+		chunk_t *chunk = (chunk_t *) memory_allocate(manager);
+		if (chunk) {
+			allocations[context]++;
+			chunk->owner = owner;
+			chunk->serial = serials[context]++;
+			held[context][i] = chunk;
+			held_serial[context][i] = chunk->serial;
+		}
+	}
+}
+
+static void handler(int sig) {
+	interrupt(sig == SIGUSR1 ? 0 : 1);
+}
+
+static timer_t start_timer(int sig, long period) {
+	timer_t timer;
+	struct sigevent event;
+	memset(&event, 0, sizeof(event));
+	event.sigev_notify = SIGEV_SIGNAL;
+	event.sigev_signo = sig;
+	assert(timer_create(CLOCK_MONOTONIC, &event, &timer) == 0);
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = 0;
+	spec.it_interval.tv_nsec = period;
+	spec.it_value = spec.it_interval;
+	assert(timer_settime(timer, 0, &spec, NULL) == 0);
+	return timer;
+}
+
+static void test_basic(void) {
+	memory_t *basic = memory_init(pool, sizeof(pool), sizeof(chunk_t));
+	assert(basic != NULL);
+	assert(basic->count == CHUNKS);
+	void *chunks[CHUNKS];
+	size_t i;
+	for (i = 0; i < CHUNKS; i++) {
+		chunks[i] = memory_allocate(basic);
+		assert(chunks[i] != NULL);
+		memset(chunks[i], 0xaa, sizeof(chunk_t));
+	}
+	assert(memory_allocate(basic) == NULL);
+	memory_stats_t stats;
+	memory_stats(basic, &stats);
+	assert(stats.chunks == CHUNKS && stats.used == CHUNKS && stats.peak == CHUNKS);
+	assert(stats.allocations == CHUNKS && stats.failures == 1);
+	assert(memory_release(chunks[3]));
+	assert(!memory_release(chunks[3]));
+	assert(memory_allocate(basic) == chunks[3]);
+	for (i = 0; i < CHUNKS; i++) {
+		assert(memory_release(chunks[i]));
+	}
+	memory_stats(basic, &stats);
+	assert(stats.used == 0 && stats.peak == CHUNKS && stats.allocations == CHUNKS + 1);
+	assert(memory_init(pool, sizeof(memory_t), sizeof(chunk_t)) == NULL);
+	assert(memory_init(pool, MEMORY_POOL_SIZE(1, sizeof(chunk_t)) - 1, sizeof(chunk_t)) == NULL);
+	assert(memory_init(pool, MEMORY_POOL_SIZE(1, sizeof(chunk_t)), sizeof(chunk_t))->count == 1);
+}
+
+static void test_stress(void) {
+	manager = memory_init(pool, sizeof(pool), sizeof(chunk_t));
+	assert(manager != NULL);
+
+	/* Two timers with different periods simulate nested interrupt sources */
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handler;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGUSR1, &action, NULL);
+	sigaction(SIGUSR2, &action, NULL);
+	timer_t timer0 = start_timer(SIGUSR1, 50000);
+	timer_t timer1 = start_timer(SIGUSR2, 37000);
+
+	uint32_t serial = 0;
+	uint32_t main_allocations = 0;
+	size_t i;
+	while (interrupts[0] < INVOCATIONS || interrupts[1] < INVOCATIONS) {
+		chunk_t *a = (chunk_t *) memory_allocate(manager);
+		chunk_t *b = (chunk_t *) memory_allocate(manager);
+		uint32_t sa = serial++;
+		uint32_t sb = serial++;
+		if (a) {
+			main_allocations++;
+			a->owner = 1;
+			a->serial = sa;
+		}
+		if (b) {
+			main_allocations++;
+			b->owner = 1;
+			b->serial = sb;
+		}
+		if (a) {
+			check(a, 1, sa);
+			if (!memory_release(a)) {
+				failures++;
+			}
+		}
+		if (b) {
+			check(b, 1, sb);
+			if (!memory_release(b)) {
+				failures++;
+			}
+		}
+	}
+
+	timer_delete(timer0);
+	timer_delete(timer1);
+	signal(SIGUSR1, SIG_IGN);
+	signal(SIGUSR2, SIG_IGN);
+
+	/* Drain the chunks still held by the interrupt handlers */
+	size_t c;
+	for (c = 0; c < 2; c++) {
+		for (i = 0; i < HELD; i++) {
+			if (held[c][i]) {
+				assert(memory_release(held[c][i]));
+			}
+		}
+	}
+	/* All chunks must be free again */
+	void *chunks[CHUNKS];
+	for (i = 0; i < CHUNKS; i++) {
+		chunks[i] = memory_allocate(manager);
+		assert(chunks[i] != NULL);
+	}
+	assert(memory_allocate(manager) == NULL);
+
+	/* Counters must not lose updates either */
+	memory_stats_t stats;
+	memory_stats(manager, &stats);
+	assert(stats.used == CHUNKS);
+	assert(stats.allocations == main_allocations + allocations[0] + allocations[1] + CHUNKS);
+
+	printf("main: %u allocations\n", main_allocations);
+	printf("interrupt 0: %d invocations, %d allocations\n", interrupts[0], allocations[0]);
+	printf("interrupt 1: %d invocations, %d allocations\n", interrupts[1], allocations[1]);
+	printf("failures: %d\n", failures);
+	assert(failures == 0);
+	assert(interrupts[0] > 0 && interrupts[1] > 0);
+}
+
+int main(int argc, char **argv) {
+	test_basic();
+	test_stress();
+	return 0;
+}
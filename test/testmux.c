@@ -0,0 +1,248 @@
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "frame.h"
+#include "client.h"
+#include "mux.h"
+
+/* Response timeout of the clients (milliseconds) */
+#define TIMEOUT 2000
+/* Response timeout of the multiplexer (milliseconds) */
+#define MUX_TIMEOUT 200
+/* Event id sent by the simulated device after a balance change */
+#define EVENT_BALANCE 6
+/* Request type the simulated device never answers */
+#define SILENT 0x3e
+
+static void device_send(int fd, uint8_t type, uint8_t seq, const uint8_t *payload, uint8_t length) {
+	frame_t frame;
+	frame.type = type;
+	frame.seq = seq;
+	frame.length = length;
+	if (length > 0) {
+		memcpy(frame.payload, payload, length);
+	}
+	uint8_t buf[FRAME_SIZE_MAX];
+	uint8_t size = frame_encode(&frame, buf);
+	assert(write(fd, buf, size) == size);
+}
+
+/* A simulated controller: a line shell that switches to machine mode */
+static void device(int fd) {
+	char line[32];
+	size_t position = 0;
+	bool machine = false;
+	uint8_t event = 0;
+	int16_t base = 0;
+	uint8_t cents = 0;
+	frame_decoder_t decoder;
+	frame_decoder_init(&decoder);
+	for (;;) {
+		uint8_t data;
+		if (read(fd, &data, 1) != 1) {
+			break;
+		}
+		if (!machine) {
+			assert(write(fd, &data, 1) == 1);
+			if (data == '\r') {
+				line[position] = '\0';
+				position = 0;
+				machine = strcmp(line, "machine") == 0;
+				const char *prompt = "\r\nMatemat> ";
+				assert(write(fd, prompt, strlen(prompt)) == (ssize_t) strlen(prompt));
+			} else if (position < sizeof(line) - 1) {
+				line[position++] = data;
+			}
+			continue;
+		}
+		if (!frame_decode(&decoder, data)) {
+			continue;
+		}
+		const frame_t *request = &decoder.frame;
+		uint8_t payload[FRAME_PAYLOAD_MAX];
+		switch (request->type) {
+			case FRAME_PING:
+				device_send(fd, FRAME_PING | FRAME_RESPONSE, request->seq, request->payload, request->length);
+				break;
+			case FRAME_BALANCE_SET:
+				base = (int16_t) frame_get16(&request->payload[0]);
+				cents = request->payload[2];
+				// Fall through
+			case FRAME_BALANCE_GET:
+				frame_put16(&payload[0], base);
+				payload[2] = cents;
+				device_send(fd, request->type | FRAME_RESPONSE, request->seq, payload, 3);
+				if (request->type == FRAME_BALANCE_SET) {
+					payload[0] = EVENT_BALANCE;
+					frame_put32(&payload[1], 15625);
+					frame_put16(&payload[5], base);
+					frame_put16(&payload[7], cents);
+					device_send(fd, FRAME_EVENT, event++, payload, 9);
+				}
+				break;
+			case FRAME_EXIT:
+				// The multiplexer must never forward this
+				assert(false);
+				break;
+			case SILENT:
+				break;
+			default:
+				payload[0] = request->type;
+				payload[1] = FRAME_ERROR_TYPE;
+				device_send(fd, FRAME_ERROR, request->seq, payload, 2);
+				break;
+		}
+	}
+}
+
+static void count_event(const frame_t *frame, void *arg) {
+	int *events = arg;
+	assert(frame->type == FRAME_EVENT);
+	assert(frame->length == 9);
+	assert(frame->payload[0] == EVENT_BALANCE);
+	(*events)++;
+}
+
+static void connect_client(client_t *client, const char *path) {
+	// The multiplexer creates the socket once the console is in machine mode
+	int tries;
+	for (tries = 0; client_connect(client, path) < 0; tries++) {
+		assert(tries < 200);
+		usleep(10000);
+	}
+}
+
+static void expect(client_t *client, int seq, uint8_t type) {
+	frame_t response;
+	assert(client_receive(client, &response, TIMEOUT) == 1);
+	assert(response.seq == seq);
+	assert(response.type == type);
+}
+
+static void expect_timeout(client_t *client, int seq, uint8_t type) {
+	frame_t response;
+	assert(client_receive(client, &response, TIMEOUT) == 1);
+	assert(response.seq == seq);
+	assert(response.type == FRAME_ERROR);
+	assert(response.length == 2);
+	assert(response.payload[0] == type && response.payload[1] == FRAME_ERROR_TIMEOUT);
+}
+
+static void test_mux(void) {
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	assert(master >= 0);
+	assert(grantpt(master) == 0);
+	assert(unlockpt(master) == 0);
+	// Keep the slave open, so the device never sees a hangup
+	int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	assert(slave >= 0);
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/testmux.%d.sock", (int) getpid());
+
+	pid_t simulator = fork();
+	assert(simulator >= 0);
+	if (simulator == 0) {
+		device(master);
+		_exit(0);
+	}
+	pid_t daemon = fork();
+	assert(daemon >= 0);
+	if (daemon == 0) {
+		static mux_t mux;
+		assert(mux_open(&mux, ptsname(master), B38400, path, MUX_TIMEOUT) == 0);
+		while (mux_poll(&mux, 1000) == 0);
+		_exit(1);
+	}
+
+	client_t a, b;
+	connect_client(&a, path);
+	connect_client(&b, path);
+	int events_a = 0, events_b = 0;
+	client_events(&a, count_event, &events_a);
+	client_events(&b, count_event, &events_b);
+
+	// Both clients pipeline requests, each with its own sequence numbers
+	uint8_t balance[3];
+	frame_put16(&balance[0], 12);
+	balance[2] = 50;
+	assert(client_send(&a, FRAME_PING, "a", 1) == 0);
+	assert(client_send(&b, FRAME_PING, "b", 1) == 0);
+	assert(client_send(&a, FRAME_BALANCE_SET, balance, 3) == 1);
+	assert(client_send(&b, 0x33, NULL, 0) == 1);
+	assert(client_send(&a, FRAME_BALANCE_GET, NULL, 0) == 2);
+	assert(client_send(&b, FRAME_BALANCE_GET, NULL, 0) == 2);
+
+	frame_t response;
+	assert(client_receive(&a, &response, TIMEOUT) == 1);
+	assert(response.seq == 0 && response.type == (FRAME_PING | FRAME_RESPONSE));
+	assert(response.length == 1 && response.payload[0] == 'a');
+	expect(&a, 1, FRAME_BALANCE_SET | FRAME_RESPONSE);
+	assert(client_receive(&a, &response, TIMEOUT) == 1);
+	assert(response.seq == 2 && response.type == (FRAME_BALANCE_GET | FRAME_RESPONSE));
+	assert(frame_get16(&response.payload[0]) == 12 && response.payload[2] == 50);
+
+	assert(client_receive(&b, &response, TIMEOUT) == 1);
+	assert(response.seq == 0 && response.type == (FRAME_PING | FRAME_RESPONSE));
+	assert(response.length == 1 && response.payload[0] == 'b');
+	assert(client_receive(&b, &response, TIMEOUT) == 1);
+	assert(response.seq == 1 && response.type == FRAME_ERROR);
+	assert(response.payload[0] == 0x33 && response.payload[1] == FRAME_ERROR_TYPE);
+	expect(&b, 2, FRAME_BALANCE_GET | FRAME_RESPONSE);
+
+	// The balance event went to both clients, and nothing else is pending
+	assert(client_receive(&a, &response, 50) == 0);
+	assert(client_receive(&b, &response, 50) == 0);
+	assert(events_a == 1 && events_b == 1);
+
+	// Exit is answered locally, the console stays in machine mode for the others
+	assert(client_call(&a, FRAME_EXIT, NULL, 0, &response, TIMEOUT) == 1);
+	assert(response.seq == 3 && response.type == (FRAME_EXIT | FRAME_RESPONSE));
+	assert(client_call(&b, FRAME_PING, NULL, 0, &response, TIMEOUT) == 1);
+	assert(response.seq == 3 && response.type == (FRAME_PING | FRAME_RESPONSE));
+
+	// An unanswered request times out
+	assert(client_send(&b, SILENT, NULL, 0) == 4);
+	expect_timeout(&b, 4, SILENT);
+
+	// A lost response is detected by the response to the next request
+	assert(client_send(&a, SILENT, NULL, 0) == 4);
+	assert(client_send(&a, FRAME_PING, NULL, 0) == 5);
+	expect_timeout(&a, 4, SILENT);
+	expect(&a, 5, FRAME_PING | FRAME_RESPONSE);
+
+	// A client that goes away does not disturb the others
+	assert(client_send(&a, FRAME_BALANCE_GET, NULL, 0) == 6);
+	client_close(&a);
+	assert(client_call(&b, FRAME_BALANCE_GET, NULL, 0, &response, TIMEOUT) == 1);
+	assert(response.seq == 5 && response.type == (FRAME_BALANCE_GET | FRAME_RESPONSE));
+	assert(b.decoder.errors == 0);
+	client_close(&b);
+
+	int status;
+	kill(daemon, SIGKILL);
+	assert(waitpid(daemon, &status, 0) == daemon);
+	assert(WIFSIGNALED(status));
+	kill(simulator, SIGKILL);
+	assert(waitpid(simulator, &status, 0) == simulator);
+	// An assertion in the device would have aborted it
+	assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+	unlink(path);
+	close(slave);
+	close(master);
+}
+
+int main(int argc, char **argv) {
+	test_mux();
+	printf("All multiplexer tests passed\n");
+	return 0;
+}
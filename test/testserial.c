@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <avr/io.h>
+#include "serial.h"
+#include "fmt.h"
+
+/* Simulated I/O registers, see include/avr/io.h */
+volatile uint8_t PINA;
+volatile uint8_t PINB, PORTB, DDRB;
+volatile uint8_t PINC, PORTC, DDRC;
+volatile uint8_t ETIFR, ETIMSK;
+volatile uint16_t TCNT3, OCR3B;
+volatile uint8_t PINE, PORTE, DDRE;
+volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+volatile uint8_t SREG;
+
+/* The interrupts of serial.c */
+void USART0_UDRE_vect(void);
+void USART0_TX_vect(void);
+
+/* Number of lines written by the callout, far more than the transmit ring holds */
+#define LINES 40
+
+/* Characters written to the data register */
+static char output[4096];
+static size_t length;
+static char expected[4096];
+
+static uint32_t now;
+/* Ticks that pass with every reading of the time */
+static uint32_t step;
+static struct wheel_mgr manager;
+static struct wheel_timer report;
+/* Characters that were sent while the callout was still running */
+static size_t polled;
+
+volatile uint8_t *udr0(void) {
+	assert(length < sizeof(output) - 1);
+	return (volatile uint8_t *) &output[length++];
+}
+
+static uint32_t get_time(void) {
+	now += step;
+	return now;
+}
+
+static void rx(char character) {
+}
+
+/* Formatted output with interrupts disabled, with long strings from program memory */
+static void callback(struct wheel_mgr *cm, struct wheel_timer *tim, void *arg) {
+	// The transmit interrupt cannot make room
+	assert(!(SREG & _BV(SREG_I)));
+	uint8_t i;
+	for (i = 0; i < LINES; i++) {
+		fmt_P(PSTR("Line "));
+		fmt_uint(i, 3);
+		fmt_P(PSTR(": a rather long constant text, "));
+		fmt_hex(0xbeef0000 + i, 8);
+		fmt_eol();
+	}
+	polled = length;
+}
+
+/* Run the transmit interrupt until everything was sent */
+static void drain(void) {
+	SREG = _BV(SREG_I);
+	while (UCSR0B & _BV(UDRIE0)) {
+		USART0_UDRE_vect();
+	}
+	USART0_TX_vect();
+}
+
+static void test_callout(void) {
+	size_t size = 0;
+	uint8_t i;
+	for (i = 0; i < LINES; i++) {
+		size += snprintf(&expected[size], sizeof(expected) - size, "Line %3u: a rather long constant text, beef%04x\r\n", i, i);
+	}
+
+	wheel_mgr_init(&manager, get_time);
+	serial_init(&manager, rx);
+	UCSR0A = _BV(UDRE0);
+	wheel_init(&report, callback, NULL, 0);
+	wheel_schedule(&manager, &report, 1);
+	SREG = 0;
+	now++;
+	wheel_manage(&manager);
+	drain();
+
+	output[length] = '\0';
+	if (strcmp(output, expected) != 0) {
+		printf("expected %u characters, got %u:\n%s\n", (unsigned) size, (unsigned) length, output);
+		assert(false);
+	}
+	// The queue could not hold it all, so the data register was polled during the callout
+	assert(polled > 0);
+	printf("serial: %u characters, %u sent by polling\n", (unsigned) size, (unsigned) polled);
+}
+
+static void test_paused(void) {
+	// With CTS inactive and interrupts disabled, output is dropped instead of waiting forever
+	length = 0;
+	serial_set_flow(true);
+	PINE = _BV(PE3);
+	SREG = 0;
+	uint16_t i;
+	for (i = 0; i < 1000; i++) {
+		fmt_char('x');
+	}
+	serial_stats_t stats;
+	serial_stats(&stats);
+	assert(stats.stalls == 1);
+	assert(length <= 1);
+	// Everything that did not fit the ring buffer is counted
+	assert(stats.drops == 1000 - length - (128 - serial_tx_free()));
+
+	// With interrupts enabled, the wait for CTS ends after the timeout
+	uint16_t drops = stats.drops;
+	SREG = _BV(SREG_I);
+	step = 1000;
+	fmt_char('y');
+	serial_stats(&stats);
+	assert(stats.drops == drops + 1);
+	assert(stats.stalls == 1);
+	step = 0;
+	serial_shutdown();
+}
+
+int main(int argc, char **argv) {
+	test_callout();
+	test_paused();
+	printf("serial: ok\n");
+	return 0;
+}
@@ -0,0 +1,264 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "top.h"
+#include "serial.h"
+#include "bank.h"
+#include "bill.h"
+#include "coin.h"
+#include "main.h"
+#include "clock.h"
+#include "slab.h"
+#include "sched.h"
+
+#define ROWS 24
+#define COLUMNS 80
+
+/* Simulated system state, read by the dashboard through the stubs below */
+static uint32_t now;
+static time_t uptime;
+static currency_t balance;
+static bill_state_t bill;
+static bool alarm;
+static uint8_t pins;
+static memory_stats_t pools[SLAB_CLASS_MAX];
+static main_idle_t idle;
+static sched_stats_t sched;
+static uint8_t tx_free = 128;
+
+/* Output of the last step, and the terminal it is played on */
+static char output[2048];
+static size_t length;
+static char screen[ROWS][COLUMNS + 1];
+static int row, column;
+
+uint32_t main_time(void) {
+	return now;
+}
+
+time_t time(time_t *timer) {
+	return uptime;
+}
+
+bank_t *main_get_bank(void) {
+	return NULL;
+}
+
+currency_t bank_get_balance(bank_t *bank) {
+	return balance;
+}
+
+bill_state_t bill_state(void) {
+	return bill;
+}
+
+PGM_P bill_state_name(bill_state_t state) {
+	static const char *names[] = { "uninitialized", "self-test", "idle", "validating", "scanned", "accepting", "rejecting", "error", "ended" };
+	return names[state];
+}
+
+bool coin_alarm(void) {
+	return alarm;
+}
+
+uint8_t coin_pins(void) {
+	return pins;
+}
+
+memory_t *slab_class(slab_class_e sclass) {
+	return (memory_t *) &pools[sclass];
+}
+
+void memory_stats(memory_t *manager, memory_stats_t *stats) {
+	*stats = *(memory_stats_t *) manager;
+}
+
+void main_get_idle(main_idle_t *stats) {
+	*stats = idle;
+}
+
+const sched_stats_t *sched_stats(void) {
+	return &sched;
+}
+
+uint8_t serial_tx_free(void) {
+	return tx_free;
+}
+
+void serial_send(char character) {
+	assert(length < sizeof(output) - 1);
+	output[length++] = character;
+	output[length] = '\0';
+}
+
+void serial_send_P(PGM_P data, uint16_t size) {
+	while (size-- > 0) {
+		serial_send(*data++);
+	}
+}
+
+/* A minimal VT100: printable characters, CR, LF, cursor position and forward, clear screen */
+static void play(void) {
+	size_t i = 0;
+	while (i < length) {
+		char character = output[i++];
+		if (character == '\033') {
+			assert(output[i++] == '[');
+			bool private = output[i] == '?';
+			if (private) {
+				i++;
+			}
+			int params[2] = { 0, 0 };
+			int count = 0;
+			while (output[i] >= '0' && output[i] <= '9') {
+				params[count] = params[count] * 10 + output[i++] - '0';
+				if (output[i] == ';') {
+					i++;
+					count++;
+					assert(count < 2);
+				}
+			}
+			char command = output[i++];
+			if (private) {
+				assert(command == 'l' || command == 'h');
+			} else if (command == 'H') {
+				row = params[0] ? params[0] - 1 : 0;
+				column = params[1] ? params[1] - 1 : 0;
+			} else if (command == 'C') {
+				column += params[0] ? params[0] : 1;
+			} else if (command == 'J') {
+				assert(params[0] == 2);
+				memset(screen, ' ', sizeof(screen));
+			} else {
+				assert(false);
+			}
+		} else if (character == '\r') {
+			column = 0;
+		} else if (character == '\n') {
+			row++;
+		} else {
+			assert(character >= ' ' && row < ROWS && column < COLUMNS);
+			screen[row][column++] = character;
+		}
+	}
+	length = 0;
+	output[0] = '\0';
+}
+
+static void expect(int line, const char *expected) {
+	char text[COLUMNS + 1];
+	memcpy(text, screen[line - 1], COLUMNS);
+	int end = COLUMNS;
+	while (end > 0 && text[end - 1] == ' ') {
+		end--;
+	}
+	text[end] = '\0';
+	if (strcmp(text, expected) != 0) {
+		printf("row %d: expected \"%s\", got \"%s\"\n", line, expected, text);
+		assert(false);
+	}
+}
+
+/* Simulate one second of constant activity */
+static void second(void) {
+	uptime++;
+	idle.wakeups += 31;
+	idle.dispatches += 12;
+}
+
+/* Advance the time and run the due events, returns the number of characters sent */
+static size_t step(struct wheel_mgr *manager, uint32_t ticks) {
+	now += ticks;
+	wheel_manage(manager);
+	size_t sent = length;
+	play();
+	return sent;
+}
+
+static void test_top(void) {
+	struct wheel_mgr manager;
+	wheel_mgr_init(&manager, main_time);
+	memset(screen, '#', sizeof(screen));
+	uptime = 3604;
+	balance.base = 12;
+	balance.cents = 50;
+	bill = BILL_STATE_IDLE;
+	pins = 0x1f;
+	pools[0].chunks = 12;
+	pools[0].used = 2;
+	pools[0].peak = 5;
+	pools[1].chunks = 8;
+	pools[1].peak = 1;
+	sched.late.ticks = 2;
+	sched.slow.ticks = 40;
+
+	top_init(&manager);
+	top_start();
+	assert(top_active());
+	play();
+	step(&manager, 0);
+	expect(1, "Matemat status                                          Uptime       3604 s");
+	expect(2, "");
+	expect(3, "Balance     12.50   Bill idle            Coin ready   Pins 0x1f");
+	expect(5, "Pool      Used  Chunks   Peak  Fails");
+	expect(6, "small        2      12      5      0");
+	expect(7, "large        0       8      1      0");
+	expect(9, "Wakeups/s             0   Latest dispatch      2 ticks");
+	expect(10, "Dispatches/s          0   Slowest callback    40 ticks");
+	expect(12, "Press any key to exit");
+
+	// Nothing is sent before the period is over, and then only the fields that changed
+	assert(step(&manager, 15624) == 0);
+	second();
+	step(&manager, 1);
+	expect(1, "Matemat status                                          Uptime       3605 s");
+	expect(9, "Wakeups/s            31   Latest dispatch      2 ticks");
+	expect(10, "Dispatches/s         12   Slowest callback    40 ticks");
+
+	// A steady state costs one cursor movement and one field per second
+	second();
+	now += 15625;
+	wheel_manage(&manager);
+	assert(strcmp(output, "\033[1;64H      3606") == 0);
+	play();
+
+	// Fields on the same row are reached with a relative movement
+	pools[0].used = 3;
+	pools[0].peak = 6;
+	idle.wakeups += 31;
+	idle.dispatches += 12;
+	now += 15625;
+	wheel_manage(&manager);
+	assert(strcmp(output, "\033[6;10H    3\033[10C    6") == 0);
+	play();
+	expect(6, "small        3      12      6      0");
+
+	// With a full transmit buffer, the fields follow once there is room again
+	tx_free = 0;
+	balance.base = -1;
+	balance.cents = 50;
+	bill = BILL_STATE_VALIDATION;
+	alarm = true;
+	second();
+	assert(step(&manager, 15625) == 0);
+	tx_free = 128;
+	assert(step(&manager, 16) > 0);
+	expect(3, "Balance     -1.50   Bill validating      Coin alarm   Pins 0x1f");
+	expect(1, "Matemat status                                          Uptime       3607 s");
+	expect(9, "Wakeups/s            31   Latest dispatch      2 ticks");
+
+	// Closing places the cursor below the dashboard
+	top_stop();
+	assert(!top_active());
+	play();
+	assert(row == TOP_ROWS && column == 0);
+	assert(step(&manager, 15625) == 0);
+}
+
+int main(int argc, char **argv) {
+	test_top();
+	printf("top: ok\n");
+	return 0;
+}
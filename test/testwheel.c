@@ -0,0 +1,229 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "wheel.h"
+
+#define TIMERS 64
+#define ROUNDS 200000
+
+static uint32_t now;
+static struct wheel_mgr manager;
+static struct wheel_timer timers[TIMERS];
+/* Reference state: expected expiry and whether the timer is pending */
+static uint32_t expire[TIMERS];
+static bool pending[TIMERS];
+static uint32_t fired;
+/* Priority of the last timer that ran in the current dispatch */
+static int last_priority;
+
+static uint32_t get_time(void) {
+	return now;
+}
+
+static void callback(struct wheel_mgr *cm, struct wheel_timer *tim, void *arg) {
+	size_t i = (size_t) arg;
+	assert(pending[i]);
+	/* Must not run early, and must run at the first dispatch after expiry */
+	assert((int32_t) (now - expire[i]) >= 0);
+	assert(tim->priority <= last_priority);
+	last_priority = tim->priority;
+	pending[i] = false;
+	fired++;
+}
+
+static void test_order(void) {
+	now = 1000;
+	wheel_mgr_init(&manager, get_time);
+	size_t i;
+	for (i = 0; i < TIMERS; i++) {
+		wheel_init(&timers[i], callback, (void *) i, i % 3);
+		expire[i] = now + 5;
+		pending[i] = true;
+		wheel_schedule(&manager, &timers[i], 5);
+	}
+	uint32_t next;
+	assert(wheel_next(&manager, &next) && next == now + 5);
+	now += 4;
+	fired = 0;
+	wheel_manage(&manager);
+	assert(fired == 0);
+	now += 1;
+	last_priority = 255;
+	wheel_manage(&manager);
+	assert(fired == TIMERS);
+	assert(!wheel_next(&manager, &next));
+}
+
+static void test_random(void) {
+	now = 0xfffffff0;
+	wheel_mgr_init(&manager, get_time);
+	size_t i;
+	for (i = 0; i < TIMERS; i++) {
+		wheel_init(&timers[i], callback, (void *) i, 1);
+		pending[i] = false;
+	}
+	fired = 0;
+	uint32_t round;
+	for (round = 0; round < ROUNDS; round++) {
+		i = rand() % TIMERS;
+		switch (rand() % 4) {
+			case 0:
+			case 1: {
+				/* Mostly short timers, some long ones, a few beyond the wheel span */
+				uint32_t ticks;
+				switch (rand() % 16) {
+					case 0:
+						ticks = rand() % 0x1000000;
+						break;
+					case 1:
+					case 2:
+						ticks = rand() % 0x10000;
+						break;
+					default:
+						ticks = rand() % 300;
+						break;
+				}
+				expire[i] = now + ticks;
+				pending[i] = true;
+				wheel_schedule(&manager, &timers[i], ticks);
+				break;
+			}
+			case 2:
+				pending[i] = false;
+				wheel_stop(&manager, &timers[i]);
+				break;
+			case 3: {
+				/* The next deadline must never be later than the earliest pending timer */
+				uint32_t next;
+				bool any = wheel_next(&manager, &next);
+				size_t j;
+				for (j = 0; j < TIMERS; j++) {
+					if (pending[j]) {
+						assert(any);
+						assert((int32_t) (next - expire[j]) <= 0);
+					}
+				}
+				/* Advance in small or large steps, then all due timers must have run */
+				switch (rand() % 64) {
+					case 0:
+						now += rand() % 0x200000;
+						break;
+					case 1:
+					case 2:
+					case 3:
+						now += rand() % 0x4000;
+						break;
+					default:
+						now += rand() % 20;
+						break;
+				}
+				last_priority = 255;
+				wheel_manage(&manager);
+				for (j = 0; j < TIMERS; j++) {
+					assert(!pending[j] || (int32_t) (now - expire[j]) < 0);
+				}
+				break;
+			}
+		}
+	}
+	/* Drain */
+	now += 0x1000000;
+	last_priority = 255;
+	wheel_manage(&manager);
+	for (i = 0; i < TIMERS; i++) {
+		assert(!pending[i]);
+	}
+	printf("wheel: %u timers fired\n", fired);
+	assert(fired > 0);
+}
+
+/*
+ * Timers in the top level (65536 ticks and more) must cascade down and fire
+ * on time when the wheel advances tick by tick, from every slot position
+ * (including those where the occupancy bitmap is not rotated at all).
+ * The delays and masks exceed 16 bits, like an AVR int.
+ */
+static void test_long(void) {
+	static const uint32_t delays[] = { 0x10000, 0x10011, 0x30005, 1000000 };
+	size_t i;
+	uint32_t start;
+	for (start = 0; start < 16; start++) {
+		now = 0xfffe0000 + start * 0x1111;
+		wheel_mgr_init(&manager, get_time);
+		for (i = 0; i < sizeof(delays) / sizeof(delays[0]); i++) {
+			wheel_init(&timers[i], callback, (void *) i, 1);
+			expire[i] = now + delays[i];
+			pending[i] = true;
+			wheel_schedule(&manager, &timers[i], delays[i]);
+		}
+		fired = 0;
+		while (fired < sizeof(delays) / sizeof(delays[0])) {
+			uint32_t next;
+			assert(wheel_next(&manager, &next));
+			assert((int32_t) (next - now) <= (int32_t) 1000000);
+			now++;
+			last_priority = 255;
+			wheel_manage(&manager);
+			for (i = 0; i < sizeof(delays) / sizeof(delays[0]); i++) {
+				// Exactly on time: nothing pending once due
+				assert(!pending[i] || (int32_t) (now - expire[i]) < 0);
+			}
+		}
+		uint32_t next;
+		assert(!wheel_next(&manager, &next));
+	}
+}
+
+/* Callbacks run through the dispatch hook */
+static uint32_t hooked;
+
+static void hook(struct wheel_mgr *cm, struct wheel_timer *tim) {
+	hooked++;
+	tim->f(cm, tim, tim->arg);
+}
+
+/* Schedules the next timer, which becomes due during the same dispatch */
+static void chain(struct wheel_mgr *cm, struct wheel_timer *tim, void *arg) {
+	size_t i = (size_t) arg;
+	fired++;
+	if (i + 1 < TIMERS) {
+		wheel_schedule(cm, &timers[i + 1], 0);
+	}
+}
+
+/*
+ * The hook sees every callback, also those of timers that become due while
+ * the manager dispatches.
+ */
+static void test_hook(void) {
+	now = 500;
+	wheel_mgr_init(&manager, get_time);
+	wheel_set_hook(&manager, hook);
+	size_t i;
+	for (i = 0; i < TIMERS; i++) {
+		wheel_init(&timers[i], chain, (void *) i, 1);
+	}
+	wheel_schedule(&manager, &timers[0], 1);
+	now++;
+	fired = 0;
+	hooked = 0;
+	wheel_manage(&manager);
+	assert(fired == TIMERS);
+	assert(hooked == TIMERS);
+}
+
+/* The bit and mask helpers must not depend on int, which is 16 bits on AVR */
+static_assert(sizeof(WHEEL_BIT(0)) == sizeof(uint16_t), "WHEEL_BIT must be 16 bits wide");
+static_assert(WHEEL_BIT(WHEEL_SLOTS - 1) == 0x8000, "WHEEL_BIT must reach the top slot");
+static_assert(sizeof(WHEEL_LOW(0)) == sizeof(uint32_t), "WHEEL_LOW must be 32 bits wide");
+static_assert(WHEEL_LOW((WHEEL_LEVELS - 1) * WHEEL_BITS) == 0xffff, "WHEEL_LOW must cover the top level");
+
+int main(int argc, char **argv) {
+	test_order();
+	test_random();
+	test_long();
+	test_hook();
+	return 0;
+}
@@ -0,0 +1,257 @@
+/**
+ * @file client.c
+ * @brief Host protocol reference client implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "client.h"
+
+/** Command line that switches the shell to machine mode, preceded by returns that open a session */
+static const char ENTER[] = "\r\rmachine\r";
+
+/**
+ * Write a buffer completely.
+ * @param fd the file descriptor
+ * @param buf the data
+ * @param size the number of bytes
+ * @return 0 on success, -1 on error
+ */
+static int client_write(int fd, const void *buf, size_t size);
+
+/**
+ * Get the monotonic time.
+ * @return the time (milliseconds)
+ */
+static int64_t client_now(void);
+
+int client_write(int fd, const void *buf, size_t size) {
+	const uint8_t *data = buf;
+	while (size > 0) {
+		ssize_t ret = write(fd, data, size);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += ret;
+		size -= ret;
+	}
+	return 0;
+}
+
+int64_t client_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int client_open(client_t *client, const char *device, speed_t speed) {
+	int fd = open(device, O_RDWR | O_NOCTTY);
+	if (fd < 0) {
+		return -1;
+	}
+	struct termios tio;
+	if (tcgetattr(fd, &tio) < 0) {
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+		close(fd);
+		return -1;
+	}
+	client_attach(client, fd);
+	client->owned = 1;
+	return 0;
+}
+
+int client_connect(client_t *client, const char *path) {
+	struct sockaddr_un address;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+		close(fd);
+		return -1;
+	}
+	client_attach(client, fd);
+	client->owned = 1;
+	return 0;
+}
+
+speed_t client_speed(long baud) {
+	switch (baud) {
+		case 9600:
+			return B9600;
+		case 19200:
+			return B19200;
+		case 38400:
+			return B38400;
+		case 57600:
+			return B57600;
+		case 115200:
+			return B115200;
+#ifdef B230400
+		case 230400:
+			return B230400;
+#endif
+		default:
+			return B0;
+	}
+}
+
+void client_attach(client_t *client, int fd) {
+	client->fd = fd;
+	client->owned = 0;
+	client->seq = 0;
+	client->event = NULL;
+	client->arg = NULL;
+	client->head = 0;
+	client->tail = 0;
+	frame_decoder_init(&client->decoder);
+}
+
+void client_close(client_t *client) {
+	if (client->owned) {
+		close(client->fd);
+	}
+	client->fd = -1;
+}
+
+void client_events(client_t *client, client_event_cb *event, void *arg) {
+	client->event = event;
+	client->arg = arg;
+}
+
+int client_enter(client_t *client, int timeout) {
+	if (client_write(client->fd, ENTER, sizeof(ENTER) - 1) < 0) {
+		return -1;
+	}
+	// The shell output is skipped by the decoder, the ping confirms machine mode
+	frame_t response;
+	if (client_call(client, FRAME_PING, NULL, 0, &response, timeout) != 1) {
+		return -1;
+	}
+	return response.type == (FRAME_PING | FRAME_RESPONSE) ? 0 : -1;
+}
+
+int client_send(client_t *client, uint8_t type, const void *payload, uint8_t length) {
+	if (length > FRAME_PAYLOAD_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	frame_t frame;
+	uint8_t buf[FRAME_SIZE_MAX];
+	frame.type = type;
+	frame.seq = client->seq;
+	frame.length = length;
+	if (length > 0) {
+		memcpy(frame.payload, payload, length);
+	}
+	uint8_t size = frame_encode(&frame, buf);
+	if (client_write(client->fd, buf, size) < 0) {
+		return -1;
+	}
+	return client->seq++;
+}
+
+int client_receive(client_t *client, frame_t *response, int timeout) {
+	int64_t deadline = client_now() + timeout;
+	for (;;) {
+		// Decode buffered bytes first, a read may contain several frames
+		while (client->head < client->tail) {
+			if (frame_decode(&client->decoder, client->buf[client->head++])) {
+				const frame_t *frame = &client->decoder.frame;
+				if (frame->type != FRAME_EVENT) {
+					*response = *frame;
+					return 1;
+				}
+				if (client->event) {
+					client->event(frame, client->arg);
+				}
+			}
+		}
+		int64_t remaining = deadline - client_now();
+		if (remaining < 0) {
+			return 0;
+		}
+		struct pollfd pfd = { .fd = client->fd, .events = POLLIN };
+		int ret = poll(&pfd, 1, (int) remaining);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (ret == 0) {
+			return 0;
+		}
+		ssize_t size = read(client->fd, client->buf, sizeof(client->buf));
+		if (size < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			return -1;
+		}
+		if (size == 0) {
+			errno = EPIPE;
+			return -1;
+		}
+		client->head = 0;
+		client->tail = size;
+	}
+}
+
+int client_call(client_t *client, uint8_t type, const void *payload, uint8_t length, frame_t *response, int timeout) {
+	int seq = client_send(client, type, payload, length);
+	if (seq < 0) {
+		return -1;
+	}
+	int64_t deadline = client_now() + timeout;
+	for (;;) {
+		int64_t remaining = deadline - client_now();
+		int ret = client_receive(client, response, remaining > 0 ? (int) remaining : 0);
+		if (ret != 1 || response->seq == seq) {
+			return ret;
+		}
+	}
+}
@@ -0,0 +1,161 @@
+/**
+ * @file client.h
+ * @brief Host protocol reference client
+ * 
+ * A minimal host-side implementation of the framed console protocol
+ * (see src/frame.h and src/remote.h) for POSIX systems.
+ * 
+ * Requests can be pipelined: client_send() returns immediately with the
+ * sequence number of the request, and client_receive() returns the
+ * responses in the order they arrive. Event notifications are passed to
+ * the event callback and never returned by client_receive(). Text output
+ * of the console (e.g. the shell echo while entering machine mode) is
+ * skipped by the frame decoder.
+ * 
+ * The controller handles bytes from its receive buffer only when there is
+ * room for a response, so a client should not have more request bytes in
+ * flight than fit into the console receive buffer (128 bytes by default).
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CLIENT_H
+#define _CLIENT_H
+
+#include <stdint.h>
+#include <termios.h>
+#include "frame.h"
+
+/**
+ * Event notification callback prototype
+ * @param frame the FRAME_EVENT frame
+ * @param arg the user argument
+ */
+typedef void (client_event_cb)(const frame_t *frame, void *arg);
+
+/**
+ * Client state object
+ */
+typedef struct {
+	/** Serial port file descriptor */
+	int fd;
+	/** Set if the file descriptor is closed by client_close() */
+	int owned;
+	/** Sequence number of the next request */
+	uint8_t seq;
+	/** Response decoder */
+	frame_decoder_t decoder;
+	/** Event notification callback, or NULL */
+	client_event_cb *event;
+	/** User argument for the event callback */
+	void *arg;
+	/** Receive buffer */
+	uint8_t buf[64];
+	/** Index of the next byte to decode */
+	uint8_t head;
+	/** Number of bytes in the receive buffer */
+	uint8_t tail;
+} client_t;
+
+/**
+ * Open a serial port and configure it for raw 8N1 communication.
+ * @param client the client
+ * @param device the serial device path
+ * @param speed the baud rate constant (e.g. B38400)
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int client_open(client_t *client, const char *device, speed_t speed);
+
+/**
+ * Connect to a host multiplexer (see mux.h) on a Unix socket.
+ * The multiplexer keeps the controller in machine mode, client_enter() is
+ * not needed but does no harm.
+ * @param client the client
+ * @param path the socket path
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int client_connect(client_t *client, const char *path);
+
+/**
+ * Convert a baud rate to a termios speed constant.
+ * @param baud the baud rate
+ * @return the speed constant, or B0 if unsupported
+ */
+speed_t client_speed(long baud);
+
+/**
+ * Attach the client to an already configured file descriptor.
+ * @param client the client
+ * @param fd the file descriptor, not closed by client_close()
+ */
+void client_attach(client_t *client, int fd);
+
+/**
+ * Close the client.
+ * @param client the client
+ */
+void client_close(client_t *client);
+
+/**
+ * Set the event notification callback.
+ * @param client the client
+ * @param event the callback, or NULL to discard events
+ * @param arg the user argument
+ */
+void client_events(client_t *client, client_event_cb *event, void *arg);
+
+/**
+ * Switch the console from the shell to machine mode and check that the
+ * controller answers.
+ * @param client the client
+ * @param timeout the response timeout (milliseconds)
+ * @return 0 on success, -1 on error or timeout
+ */
+int client_enter(client_t *client, int timeout);
+
+/**
+ * Send a request without waiting for the response.
+ * @param client the client
+ * @param type the message type
+ * @param payload the payload
+ * @param length the payload length (at most FRAME_PAYLOAD_MAX)
+ * @return the sequence number of the request, or -1 on error
+ */
+int client_send(client_t *client, uint8_t type, const void *payload, uint8_t length);
+
+/**
+ * Wait for the next response.
+ * @param client the client
+ * @param response storage for the response
+ * @param timeout the timeout (milliseconds)
+ * @return 1 if a response was received, 0 on timeout, -1 on error
+ */
+int client_receive(client_t *client, frame_t *response, int timeout);
+
+/**
+ * Send a request and wait for its response. Responses to other requests are discarded.
+ * @param client the client
+ * @param type the message type
+ * @param payload the payload
+ * @param length the payload length
+ * @param response storage for the response
+ * @param timeout the timeout (milliseconds)
+ * @return 1 if the response was received, 0 on timeout, -1 on error
+ */
+int client_call(client_t *client, uint8_t type, const void *payload, uint8_t length, frame_t *response, int timeout);
+
+#endif /*_CLIENT_H*/
@@ -0,0 +1,236 @@
+/**
+ * @file matemat.c
+ * @brief Host protocol command line client
+ * 
+ * Usage: matemat [-d device] [-b baud] [-s socket] [-t timeout] command [arguments]
+ * 
+ * With -s, the controller is reached through the host multiplexer (muxd)
+ * instead of the serial device, so several clients can run at the same time.
+ * 
+ * Command                | Description
+ * -----------------------|-----------------------------------------------
+ * ping                   | Check that the controller answers
+ * balance [base.cents]   | Display or set the balance
+ * bill                   | Display the banknote scanner state
+ * coin                   | Display the coin acceptor state
+ * gpio port [pin action] | Display a GPIO port, or configure a pin (in, off, on, out)
+ * events                 | Print event notifications until interrupted
+ * telemetry              | Print the telemetry stream (on the telemetry UART) until interrupted
+ * exit                   | Switch the console back to the shell
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "client.h"
+
+/** Ticks per second of the controller system time */
+#define TICKS_PER_SECOND 15625UL
+
+static const char *const GPIO_ACTIONS[] = { "in", "off", "on", "out" };
+
+/**
+ * Print the usage and exit.
+ * @param name the program name
+ */
+static void usage(const char *name);
+
+/**
+ * Print an event notification, and the number of lost notifications before it.
+ * @param frame the event frame
+ * @param arg the sequence number of the previous notification (int, -1 if none)
+ */
+static void print_event(const frame_t *frame, void *arg);
+
+/**
+ * Send a request, wait for the response and check its type.
+ * @param client the client
+ * @param type the request type
+ * @param payload the payload
+ * @param length the payload length
+ * @param response storage for the response
+ * @param timeout the timeout (milliseconds)
+ * @return 0 on success, 1 on error
+ */
+static int call(client_t *client, uint8_t type, const void *payload, uint8_t length, frame_t *response, int timeout);
+
+void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-d device] [-b baud] [-s socket] [-t timeout] command [arguments]\n", name);
+	fprintf(stderr, "Commands: ping, balance [base.cents], bill, coin, gpio port [pin in|off|on|out], events, telemetry, exit\n");
+	exit(2);
+}
+
+void print_event(const frame_t *frame, void *arg) {
+	if (frame->length < 9) {
+		return;
+	}
+	int *last = arg;
+	if (*last >= 0 && frame->seq != (uint8_t) (*last + 1)) {
+		printf("(%u events lost)\n", (uint8_t) (frame->seq - *last - 1));
+	}
+	*last = frame->seq;
+	uint32_t time = frame_get32(&frame->payload[1]);
+	printf("[%lu.%03lu] event %u: %u %u (#%u)\n", (unsigned long) (time / TICKS_PER_SECOND), (unsigned long) (time % TICKS_PER_SECOND * 1000 / TICKS_PER_SECOND), frame->payload[0], frame_get16(&frame->payload[5]), frame_get16(&frame->payload[7]), frame->seq);
+	fflush(stdout);
+}
+
+int call(client_t *client, uint8_t type, const void *payload, uint8_t length, frame_t *response, int timeout) {
+	int ret = client_call(client, type, payload, length, response, timeout);
+	if (ret < 0) {
+		perror("request");
+		return 1;
+	}
+	if (ret == 0) {
+		fprintf(stderr, "Timeout\n");
+		return 1;
+	}
+	if (response->type == FRAME_ERROR && response->length >= 2) {
+		fprintf(stderr, "Request 0x%02x failed with error %u\n", response->payload[0], response->payload[1]);
+		return 1;
+	}
+	if (response->type != (type | FRAME_RESPONSE)) {
+		fprintf(stderr, "Unexpected response 0x%02x\n", response->type);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *device = "/dev/ttyUSB0";
+	const char *path = NULL;
+	long baud = 38400;
+	int timeout = 1000;
+	int opt;
+	while ((opt = getopt(argc, argv, "d:b:s:t:")) != -1) {
+		switch (opt) {
+			case 'd':
+				device = optarg;
+				break;
+			case 'b':
+				baud = strtol(optarg, NULL, 10);
+				break;
+			case 's':
+				path = optarg;
+				break;
+			case 't':
+				timeout = (int) strtol(optarg, NULL, 10);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind >= argc || client_speed(baud) == B0) {
+		usage(argv[0]);
+	}
+	const char *command = argv[optind];
+	char **args = &argv[optind + 1];
+	int nargs = argc - optind - 1;
+
+	client_t client;
+	if (path) {
+		device = path;
+		if (client_connect(&client, path) < 0) {
+			perror(path);
+			return 1;
+		}
+	} else if (client_open(&client, device, client_speed(baud)) < 0) {
+		perror(device);
+		return 1;
+	}
+	int last = -1;
+	client_events(&client, print_event, &last);
+	// The telemetry stream is sent unsolicited, there is no shell to switch
+	bool telemetry = strcmp(command, "telemetry") == 0;
+	if (!telemetry && client_enter(&client, timeout) < 0) {
+		fprintf(stderr, "No response from %s\n", device);
+		client_close(&client);
+		return 1;
+	}
+
+	frame_t response;
+	uint8_t payload[FRAME_PAYLOAD_MAX];
+	int ret = 0;
+	if (strcmp(command, "ping") == 0) {
+		ret = call(&client, FRAME_PING, "matemat", 7, &response, timeout);
+		if (!ret) {
+			printf("pong\n");
+		}
+	} else if (strcmp(command, "balance") == 0) {
+		uint8_t type = FRAME_BALANCE_GET;
+		uint8_t length = 0;
+		if (nargs >= 1) {
+			double value = strtod(args[0], NULL);
+			long hundredths = (long) (value * 100 + (value < 0 ? -0.5 : 0.5));
+			frame_put16(&payload[0], (uint16_t) (int16_t) (hundredths / 100));
+			payload[2] = (uint8_t) labs(hundredths % 100);
+			type = FRAME_BALANCE_SET;
+			length = 3;
+		}
+		ret = call(&client, type, payload, length, &response, timeout);
+		if (!ret) {
+			printf("%d.%02u\n", (int16_t) frame_get16(&response.payload[0]), response.payload[2]);
+		}
+	} else if (strcmp(command, "bill") == 0) {
+		ret = call(&client, FRAME_BILL_GET, NULL, 0, &response, timeout);
+		if (!ret) {
+			printf("state %u\n", response.payload[0]);
+		}
+	} else if (strcmp(command, "coin") == 0) {
+		ret = call(&client, FRAME_COIN_GET, NULL, 0, &response, timeout);
+		if (!ret) {
+			printf("%s, pins=0x%02x\n", response.payload[0] ? "alarm" : "ready", response.payload[1]);
+		}
+	} else if (strcmp(command, "gpio") == 0 && (nargs == 1 || nargs == 3)) {
+		uint8_t type = FRAME_GPIO_GET;
+		uint8_t length = 1;
+		payload[0] = args[0][0] & ~0x20;
+		if (nargs == 3) {
+			uint8_t action;
+			for (action = 0; action < 4 && strcmp(args[2], GPIO_ACTIONS[action]) != 0; action++);
+			payload[1] = (uint8_t) strtoul(args[1], NULL, 10);
+			payload[2] = action;
+			type = FRAME_GPIO_SET;
+			length = 3;
+		}
+		ret = call(&client, type, payload, length, &response, timeout);
+		if (!ret) {
+			printf("%c: 0x%02x\n", response.payload[0], response.payload[1]);
+		}
+	} else if (strcmp(command, "events") == 0 || telemetry) {
+		// Responses are not expected, events are printed by the callback
+		for (;;) {
+			if (client_receive(&client, &response, 60000) < 0) {
+				perror("receive");
+				ret = 1;
+				break;
+			}
+		}
+	} else if (strcmp(command, "exit") == 0) {
+		ret = call(&client, FRAME_EXIT, NULL, 0, &response, timeout);
+	} else {
+		client_close(&client);
+		usage(argv[0]);
+	}
+	client_close(&client);
+	return ret;
+}
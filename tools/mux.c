@@ -0,0 +1,430 @@
+/**
+ * @file mux.c
+ * @brief Host protocol multiplexer implementation
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "mux.h"
+
+/**
+ * Get the monotonic time.
+ * @return the time (milliseconds)
+ */
+static int64_t mux_now(void);
+
+/**
+ * Accept a client connection, or reject it if all slots are taken.
+ * @param mux the multiplexer
+ */
+static void mux_accept(mux_t *mux);
+
+/**
+ * Close a client connection. Its forwarded requests are answered to nobody.
+ * @param mux the multiplexer
+ * @param index the client index
+ */
+static void mux_drop(mux_t *mux, uint8_t index);
+
+/**
+ * Read from a client and decode its requests.
+ * @param mux the multiplexer
+ * @param index the client index
+ */
+static void mux_read(mux_t *mux, uint8_t index);
+
+/**
+ * Decode received bytes of a client until its backlog is full.
+ * @param client the client
+ */
+static void mux_decode(mux_client_t *client);
+
+/**
+ * Send buffered output to a client.
+ * @param mux the multiplexer
+ * @param index the client index
+ */
+static void mux_flush(mux_t *mux, uint8_t index);
+
+/**
+ * Append a frame to the output buffer of a client.
+ * @param client the client
+ * @param frame the frame
+ * @return false, if there is no room
+ */
+static bool mux_queue(mux_client_t *client, const frame_t *frame);
+
+/**
+ * Forward waiting requests to the controller, one per client and round.
+ * @param mux the multiplexer
+ * @return 0 on success, -1 if the serial link failed
+ */
+static int mux_forward(mux_t *mux);
+
+/**
+ * Read from the serial link and dispatch the received frames.
+ * @param mux the multiplexer
+ * @return 0 on success, -1 if the serial link failed
+ */
+static int mux_receive(mux_t *mux);
+
+/**
+ * Return a response to the client of the matching request.
+ * @param mux the multiplexer
+ * @param frame the response
+ */
+static void mux_response(mux_t *mux, const frame_t *frame);
+
+/**
+ * Pass an event notification to all clients that have room for it.
+ * @param mux the multiplexer
+ * @param frame the event
+ */
+static void mux_event(mux_t *mux, const frame_t *frame);
+
+/**
+ * Remove the oldest forwarded request and answer it with FRAME_ERROR_TIMEOUT.
+ * @param mux the multiplexer
+ */
+static void mux_fail(mux_t *mux);
+
+int64_t mux_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int mux_open(mux_t *mux, const char *device, speed_t speed, const char *path, int timeout) {
+	uint8_t index;
+	for (index = 0; index < MUX_CLIENTS; index++) {
+		mux->clients[index].fd = -1;
+	}
+	mux->listener = -1;
+	mux->path = NULL;
+	mux->timeout = timeout;
+	mux->next = 0;
+	mux->head = 0;
+	mux->count = 0;
+	mux->unexpected = 0;
+
+	struct sockaddr_un address;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	if (client_open(&mux->device, device, speed) < 0) {
+		return -1;
+	}
+	if (client_enter(&mux->device, timeout) < 0) {
+		client_close(&mux->device);
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		client_close(&mux->device);
+		return -1;
+	}
+	// Replace the socket of a previous instance
+	unlink(path);
+	if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(fd, MUX_CLIENTS) < 0) {
+		int error = errno;
+		close(fd);
+		client_close(&mux->device);
+		errno = error;
+		return -1;
+	}
+	mux->listener = fd;
+	mux->path = path;
+	return 0;
+}
+
+void mux_close(mux_t *mux) {
+	uint8_t index;
+	for (index = 0; index < MUX_CLIENTS; index++) {
+		if (mux->clients[index].fd >= 0) {
+			mux_drop(mux, index);
+		}
+	}
+	if (mux->listener >= 0) {
+		close(mux->listener);
+		unlink(mux->path);
+		mux->listener = -1;
+	}
+	client_close(&mux->device);
+}
+
+int mux_poll(mux_t *mux, int timeout) {
+	struct pollfd fds[MUX_CLIENTS + 2];
+	fds[0].fd = mux->device.fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = mux->listener;
+	fds[1].events = POLLIN;
+	uint8_t index;
+	for (index = 0; index < MUX_CLIENTS; index++) {
+		const mux_client_t *client = &mux->clients[index];
+		fds[index + 2].fd = client->fd;
+		// Undecoded bytes are left only while the backlog is full
+		fds[index + 2].events = (client->in_head == client->in_tail ? POLLIN : 0) | (client->length > 0 ? POLLOUT : 0);
+	}
+	if (mux->count > 0) {
+		// Wake up when the oldest request times out
+		int64_t remaining = mux->flight[mux->head].sent + mux->timeout - mux_now();
+		if (remaining < timeout) {
+			timeout = remaining > 0 ? (int) remaining : 0;
+		}
+	}
+	int ret = poll(fds, MUX_CLIENTS + 2, timeout);
+	if (ret < 0) {
+		return errno == EINTR ? 0 : -1;
+	}
+	if (fds[0].revents && mux_receive(mux) < 0) {
+		return -1;
+	}
+	for (index = 0; index < MUX_CLIENTS; index++) {
+		short revents = fds[index + 2].revents;
+		if (revents & POLLOUT) {
+			mux_flush(mux, index);
+		}
+		if ((revents & (POLLIN | POLLHUP | POLLERR)) && mux->clients[index].fd >= 0) {
+			mux_read(mux, index);
+		}
+	}
+	// Accepted last, the new client has no poll result yet
+	if (fds[1].revents & POLLIN) {
+		mux_accept(mux);
+	}
+	int64_t now = mux_now();
+	while (mux->count > 0 && now - mux->flight[mux->head].sent >= mux->timeout) {
+		mux_fail(mux);
+	}
+	return mux_forward(mux);
+}
+
+void mux_accept(mux_t *mux) {
+	int fd = accept(mux->listener, NULL, NULL);
+	if (fd < 0) {
+		return;
+	}
+	uint8_t index;
+	for (index = 0; index < MUX_CLIENTS && mux->clients[index].fd >= 0; index++);
+	if (index == MUX_CLIENTS) {
+		close(fd);
+		return;
+	}
+	mux_client_t *client = &mux->clients[index];
+	client->fd = fd;
+	frame_decoder_init(&client->decoder);
+	client->head = 0;
+	client->waiting = 0;
+	client->pending = 0;
+	client->dropped = 0;
+	client->in_head = 0;
+	client->in_tail = 0;
+	client->length = 0;
+}
+
+void mux_drop(mux_t *mux, uint8_t index) {
+	close(mux->clients[index].fd);
+	mux->clients[index].fd = -1;
+	uint8_t i;
+	for (i = 0; i < mux->count; i++) {
+		mux_request_t *request = &mux->flight[(mux->head + i) % MUX_WINDOW];
+		if (request->client == index) {
+			request->client = MUX_CLIENTS;
+		}
+	}
+}
+
+void mux_read(mux_t *mux, uint8_t index) {
+	mux_client_t *client = &mux->clients[index];
+	ssize_t size = recv(client->fd, client->in, sizeof(client->in), MSG_DONTWAIT);
+	if (size < 0 && (errno == EINTR || errno == EAGAIN)) {
+		return;
+	}
+	if (size <= 0) {
+		mux_drop(mux, index);
+		return;
+	}
+	client->in_head = 0;
+	client->in_tail = size;
+	mux_decode(client);
+}
+
+void mux_decode(mux_client_t *client) {
+	while (client->in_head < client->in_tail && client->waiting < MUX_BACKLOG) {
+		if (frame_decode(&client->decoder, client->in[client->in_head++])) {
+			client->backlog[(client->head + client->waiting) % MUX_BACKLOG] = client->decoder.frame;
+			client->waiting++;
+		}
+	}
+}
+
+void mux_flush(mux_t *mux, uint8_t index) {
+	mux_client_t *client = &mux->clients[index];
+	ssize_t size = send(client->fd, client->out, client->length, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (size < 0) {
+		if (errno != EINTR && errno != EAGAIN) {
+			mux_drop(mux, index);
+		}
+		return;
+	}
+	client->length -= size;
+	memmove(client->out, client->out + size, client->length);
+}
+
+bool mux_queue(mux_client_t *client, const frame_t *frame) {
+	if (client->length + FRAME_SIZE_MAX > sizeof(client->out)) {
+		return false;
+	}
+	client->length += frame_encode(frame, client->out + client->length);
+	return true;
+}
+
+int mux_forward(mux_t *mux) {
+	bool progress = true;
+	while (progress && mux->count < MUX_WINDOW) {
+		progress = false;
+		uint8_t n;
+		for (n = 0; n < MUX_CLIENTS && mux->count < MUX_WINDOW; n++) {
+			uint8_t index = mux->next;
+			mux->next = (index + 1) % MUX_CLIENTS;
+			mux_client_t *client = &mux->clients[index];
+			if (client->fd < 0 || client->waiting == 0) {
+				continue;
+			}
+			const frame_t *frame = &client->backlog[client->head];
+			if (frame->type == FRAME_EXIT) {
+				if (client->pending > 0) {
+					// Answered after the responses to the earlier requests
+					continue;
+				}
+				// The console stays in machine mode for the other clients
+				frame_t response = { FRAME_EXIT | FRAME_RESPONSE, frame->seq, 0 };
+				mux_queue(client, &response);
+			} else {
+				int link = client_send(&mux->device, frame->type, frame->payload, frame->length);
+				if (link < 0) {
+					return -1;
+				}
+				mux_request_t *request = &mux->flight[(mux->head + mux->count) % MUX_WINDOW];
+				request->client = index;
+				request->seq = frame->seq;
+				request->type = frame->type;
+				request->link = link;
+				request->sent = mux_now();
+				mux->count++;
+				client->pending++;
+			}
+			client->head = (client->head + 1) % MUX_BACKLOG;
+			client->waiting--;
+			// Make room for the requests that were held back
+			mux_decode(client);
+			progress = true;
+		}
+	}
+	return 0;
+}
+
+int mux_receive(mux_t *mux) {
+	client_t *device = &mux->device;
+	ssize_t size = read(device->fd, device->buf, sizeof(device->buf));
+	if (size < 0) {
+		return errno == EINTR || errno == EAGAIN ? 0 : -1;
+	}
+	if (size == 0) {
+		errno = EPIPE;
+		return -1;
+	}
+	ssize_t i;
+	for (i = 0; i < size; i++) {
+		if (frame_decode(&device->decoder, device->buf[i])) {
+			if (device->decoder.frame.type == FRAME_EVENT) {
+				mux_event(mux, &device->decoder.frame);
+			} else {
+				mux_response(mux, &device->decoder.frame);
+			}
+		}
+	}
+	return 0;
+}
+
+void mux_response(mux_t *mux, const frame_t *frame) {
+	uint8_t i;
+	for (i = 0; i < mux->count && mux->flight[(mux->head + i) % MUX_WINDOW].link != frame->seq; i++);
+	if (i == mux->count) {
+		// Late response to a request that already timed out
+		mux->unexpected++;
+		return;
+	}
+	// Responses arrive in order, the requests before the matching one were lost
+	while (i-- > 0) {
+		mux_fail(mux);
+	}
+	const mux_request_t *request = &mux->flight[mux->head];
+	mux->head = (mux->head + 1) % MUX_WINDOW;
+	mux->count--;
+	if (request->client < MUX_CLIENTS) {
+		mux_client_t *client = &mux->clients[request->client];
+		client->pending--;
+		frame_t response = *frame;
+		response.seq = request->seq;
+		mux_queue(client, &response);
+	}
+}
+
+void mux_event(mux_t *mux, const frame_t *frame) {
+	uint8_t index;
+	for (index = 0; index < MUX_CLIENTS; index++) {
+		mux_client_t *client = &mux->clients[index];
+		if (client->fd < 0) {
+			continue;
+		}
+		// Keep room for the responses to all outstanding requests of the client
+		size_t reserved = (size_t) (client->pending + client->waiting + 1) * FRAME_SIZE_MAX;
+		if (client->length + reserved > sizeof(client->out) || !mux_queue(client, frame)) {
+			client->dropped++;
+		}
+	}
+}
+
+void mux_fail(mux_t *mux) {
+	const mux_request_t *request = &mux->flight[mux->head];
+	mux->head = (mux->head + 1) % MUX_WINDOW;
+	mux->count--;
+	if (request->client < MUX_CLIENTS) {
+		mux_client_t *client = &mux->clients[request->client];
+		client->pending--;
+		frame_t response = { FRAME_ERROR, request->seq, 2, { request->type, FRAME_ERROR_TIMEOUT } };
+		mux_queue(client, &response);
+	}
+}
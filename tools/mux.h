@@ -0,0 +1,159 @@
+/**
+ * @file mux.h
+ * @brief Host protocol multiplexer
+ * 
+ * Shares the console of one controller between several host programs. The
+ * multiplexer owns the serial device, keeps the console in machine mode and
+ * accepts clients on a Unix socket. Clients speak the framed host protocol
+ * (see src/frame.h) on the socket as if they were connected to the serial
+ * port directly, so client.h works unchanged (see client_connect()).
+ * 
+ * - Requests of all clients are forwarded to the controller with
+ *   sequence numbers of the multiplexer, up to MUX_WINDOW at a time. The
+ *   controller answers in order, and each response is returned to the
+ *   client that sent the request, with the sequence number of that client.
+ * - Clients are served round-robin, each with up to MUX_BACKLOG requests
+ *   waiting. A client with a full backlog is not read until one of its
+ *   requests was forwarded.
+ * - Event notifications are sent to all clients, with the sequence numbers
+ *   of the controller. When a client does not read fast enough, events are
+ *   dropped for that client only, which it sees as a gap in the sequence
+ *   numbers. Responses are never dropped.
+ * - A request that is not answered within the timeout, or whose response
+ *   was lost, is answered with FRAME_ERROR_TIMEOUT.
+ * - FRAME_EXIT is answered by the multiplexer and not forwarded, so one
+ *   client cannot switch the console back to the shell for the others.
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MUX_H
+#define _MUX_H
+
+#include <stdint.h>
+#include <termios.h>
+#include "frame.h"
+#include "client.h"
+
+/** Maximum number of clients */
+#define MUX_CLIENTS 8
+/** Requests in flight on the serial link (MUX_WINDOW * FRAME_SIZE_MAX must fit into the console receive buffer) */
+#define MUX_WINDOW 5
+/** Requests waiting per client */
+#define MUX_BACKLOG 4
+/** Output buffer size per client (bytes) */
+#define MUX_OUTPUT 1024
+
+/**
+ * Client connection
+ */
+typedef struct {
+	/** Socket, -1 if the slot is free */
+	int fd;
+	/** Request decoder */
+	frame_decoder_t decoder;
+	/** Waiting requests, with the sequence numbers of the client */
+	frame_t backlog[MUX_BACKLOG];
+	/** Index of the oldest waiting request */
+	uint8_t head;
+	/** Number of waiting requests */
+	uint8_t waiting;
+	/** Number of forwarded requests without a response */
+	uint8_t pending;
+	/** Number of events dropped because the client did not read them */
+	unsigned long dropped;
+	/** Received bytes that have not been decoded yet */
+	uint8_t in[64];
+	/** Index of the next byte to decode */
+	uint8_t in_head;
+	/** Number of bytes in the receive buffer */
+	uint8_t in_tail;
+	/** Number of bytes waiting to be sent */
+	size_t length;
+	/** Output buffer */
+	uint8_t out[MUX_OUTPUT];
+} mux_client_t;
+
+/**
+ * Forwarded request
+ */
+typedef struct {
+	/** Client index, or MUX_CLIENTS if the client has gone */
+	uint8_t client;
+	/** Sequence number of the client */
+	uint8_t seq;
+	/** Message type */
+	uint8_t type;
+	/** Sequence number on the serial link */
+	uint8_t link;
+	/** Time at which the request was sent (milliseconds) */
+	int64_t sent;
+} mux_request_t;
+
+/**
+ * Multiplexer state object
+ */
+typedef struct {
+	/** Serial link to the controller */
+	client_t device;
+	/** Listening socket */
+	int listener;
+	/** Socket path, removed by mux_close() */
+	const char *path;
+	/** Response timeout (milliseconds) */
+	int timeout;
+	/** Client that is served first by the next round */
+	uint8_t next;
+	/** Forwarded requests, in the order of the serial link */
+	mux_request_t flight[MUX_WINDOW];
+	/** Index of the oldest forwarded request */
+	uint8_t head;
+	/** Number of forwarded requests */
+	uint8_t count;
+	/** Number of responses that did not match a forwarded request */
+	unsigned long unexpected;
+	/** Clients */
+	mux_client_t clients[MUX_CLIENTS];
+} mux_t;
+
+/**
+ * Open the serial device, switch the console to machine mode and listen
+ * for clients.
+ * @param mux the multiplexer
+ * @param device the serial device path
+ * @param speed the baud rate constant (e.g. B38400)
+ * @param path the socket path, an existing socket is replaced
+ * @param timeout the response timeout (milliseconds)
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int mux_open(mux_t *mux, const char *device, speed_t speed, const char *path, int timeout);
+
+/**
+ * Close all connections and remove the socket.
+ * @param mux the multiplexer
+ */
+void mux_close(mux_t *mux);
+
+/**
+ * Wait for and handle activity on the serial link and the clients.
+ * @param mux the multiplexer
+ * @param timeout the maximum time to wait (milliseconds)
+ * @return 0 on success or when interrupted by a signal, -1 if the serial link failed
+ */
+int mux_poll(mux_t *mux, int timeout);
+
+#endif /*_MUX_H*/
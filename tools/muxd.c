@@ -0,0 +1,110 @@
+/**
+ * @file muxd.c
+ * @brief Host protocol multiplexer daemon
+ * 
+ * Usage: muxd [-d device] [-b baud] [-s socket] [-t timeout]
+ * 
+ * Owns the controller console and shares it between several clients on a
+ * Unix socket (see mux.h). The socket (default /tmp/matemat.sock) is used
+ * with `matemat -s socket` or client_connect(). Runs in the foreground
+ * until it is interrupted or the serial link fails.
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "mux.h"
+
+/** Set by the signal handler to end the main loop */
+static volatile sig_atomic_t terminated;
+
+/**
+ * Print the usage and exit.
+ * @param name the program name
+ */
+static void usage(const char *name);
+
+/**
+ * Termination signal handler.
+ * @param signal the signal number
+ */
+static void terminate(int signal);
+
+void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-d device] [-b baud] [-s socket] [-t timeout]\n", name);
+	exit(2);
+}
+
+void terminate(int signal) {
+	terminated = 1;
+}
+
+int main(int argc, char **argv) {
+	const char *device = "/dev/ttyUSB0";
+	const char *path = "/tmp/matemat.sock";
+	long baud = 38400;
+	int timeout = 1000;
+	int opt;
+	while ((opt = getopt(argc, argv, "d:b:s:t:")) != -1) {
+		switch (opt) {
+			case 'd':
+				device = optarg;
+				break;
+			case 'b':
+				baud = strtol(optarg, NULL, 10);
+				break;
+			case 's':
+				path = optarg;
+				break;
+			case 't':
+				timeout = (int) strtol(optarg, NULL, 10);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind != argc || client_speed(baud) == B0) {
+		usage(argv[0]);
+	}
+
+	// Without SA_RESTART, so a signal interrupts the poll
+	struct sigaction action = { .sa_handler = terminate };
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	static mux_t mux;
+	if (mux_open(&mux, device, client_speed(baud), path, timeout) < 0) {
+		perror(device);
+		return 1;
+	}
+	int ret = 0;
+	while (!terminated) {
+		if (mux_poll(&mux, 1000) < 0) {
+			perror(device);
+			ret = 1;
+			break;
+		}
+	}
+	mux_close(&mux);
+	return ret;
+}
@@ -0,0 +1,284 @@
+/**
+ * @file vcd.c
+ * @brief Convert a gpio watch capture to a value change dump
+ * 
+ * Usage: vcd [log]
+ * 
+ * Reads a console log containing the output of the gpio watch command (from
+ * the file, or standard input) and writes the first capture in it as a VCD
+ * file to standard output, for viewing with GTKWave or similar tools. Other
+ * console output around the capture, such as the command echo and the
+ * prompt, is skipped.
+ * 
+ * Each port appears as an 8 bit vector (PORTA) and as single pins (PA0..PA7).
+ * The timescale is 1ns, the sample numbers are converted with the actual
+ * sample rate reported in the capture header.
+ * 
+ * @copyright Matemat controller firmware
+ * Copyright © 2015 Chaostreff Basel
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/** Maximum number of ports in a capture (ports A..G) */
+#define PORTS_MAX 7
+
+/**
+ * Capture being converted
+ */
+typedef struct {
+	/** Port letters */
+	char ports[PORTS_MAX + 1];
+	/** Number of ports */
+	int count;
+	/** Sample rate (Hz) */
+	unsigned long rate;
+	/** Set after the first record */
+	bool started;
+	/** Sample number of the last record */
+	uint64_t sample;
+	/** Pin states of the last record */
+	uint8_t pins[PORTS_MAX];
+} capture_t;
+
+/**
+ * Print the usage and exit.
+ * @param name the program name
+ */
+static void usage(const char *name);
+
+/**
+ * Remove trailing line endings and whitespace.
+ * @param line the line
+ */
+static void trim(char *line);
+
+/**
+ * Parse a capture header line ("capture <ports> <rate> Hz").
+ * @param line the line
+ * @param capture the capture to set up
+ * @return false, if the line is not a capture header
+ */
+static bool parse_header(const char *line, capture_t *capture);
+
+/**
+ * Parse a record line ("<sample> <pins>", in hex).
+ * @param line the line
+ * @param count the number of ports
+ * @param time storage for the 16 bit sample number
+ * @param pins storage for the pin states
+ * @return false, if the line is not a record
+ */
+static bool parse_record(const char *line, int count, uint16_t *time, uint8_t *pins);
+
+/**
+ * Write the VCD header and variable definitions.
+ * @param capture the capture
+ */
+static void write_header(const capture_t *capture);
+
+/**
+ * Write the changes of a record.
+ * @param capture the capture, updated with the record
+ * @param sample the full sample number
+ * @param pins the pin states
+ */
+static void write_record(capture_t *capture, uint64_t sample, const uint8_t *pins);
+
+/**
+ * Convert a sample number to nanoseconds.
+ * @param capture the capture
+ * @param sample the sample number
+ * @return the time (ns)
+ */
+static uint64_t nanoseconds(const capture_t *capture, uint64_t sample);
+
+void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [log]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+void trim(char *line) {
+	size_t length = strlen(line);
+	while (length > 0 && isspace((unsigned char) line[length - 1])) {
+		line[--length] = '\0';
+	}
+}
+
+bool parse_header(const char *line, capture_t *capture) {
+	char ports[16];
+	unsigned long rate;
+	char unit[4];
+	if (sscanf(line, "capture %15s %lu %3s", ports, &rate, unit) != 3 || strcmp(unit, "Hz") != 0 || rate == 0) {
+		return false;
+	}
+	size_t count = strlen(ports);
+	if (count == 0 || count > PORTS_MAX) {
+		return false;
+	}
+	size_t i;
+	for (i = 0; i < count; i++) {
+		if (ports[i] < 'A' || ports[i] > 'G') {
+			return false;
+		}
+	}
+	memcpy(capture->ports, ports, count + 1);
+	capture->count = count;
+	capture->rate = rate;
+	capture->started = false;
+	return true;
+}
+
+bool parse_record(const char *line, int count, uint16_t *time, uint8_t *pins) {
+	if (strlen(line) != (size_t) (5 + 2 * count) || line[4] != ' ') {
+		return false;
+	}
+	int i;
+	for (i = 0; line[i]; i++) {
+		if (i != 4 && !isxdigit((unsigned char) line[i])) {
+			return false;
+		}
+	}
+	*time = strtoul(line, NULL, 16);
+	for (i = 0; i < count; i++) {
+		char byte[3] = { line[5 + 2 * i], line[6 + 2 * i], '\0' };
+		pins[i] = strtoul(byte, NULL, 16);
+	}
+	return true;
+}
+
+uint64_t nanoseconds(const capture_t *capture, uint64_t sample) {
+	return sample * 1000000000ULL / capture->rate;
+}
+
+void write_header(const capture_t *capture) {
+	printf("$version matemat gpio watch $end\n");
+	printf("$comment %lu Hz sample rate $end\n", capture->rate);
+	printf("$timescale 1 ns $end\n");
+	printf("$scope module matemat $end\n");
+	int i;
+	for (i = 0; i < capture->count; i++) {
+		// Identifiers: one per port vector, then one per pin, from '!' on
+		printf("$var wire 8 %c PORT%c $end\n", '!' + i * 9, capture->ports[i]);
+		int pin;
+		for (pin = 0; pin < 8; pin++) {
+			printf("$var wire 1 %c P%c%d $end\n", '!' + i * 9 + 1 + pin, capture->ports[i], pin);
+		}
+	}
+	printf("$upscope $end\n");
+	printf("$enddefinitions $end\n");
+}
+
+void write_record(capture_t *capture, uint64_t sample, const uint8_t *pins) {
+	bool first = !capture->started;
+	capture->started = true;
+	capture->sample = sample;
+	// Records at a wrap of the sample number may not contain a change
+	if (!first && memcmp(pins, capture->pins, capture->count) == 0) {
+		return;
+	}
+	printf("#%llu\n", (unsigned long long) nanoseconds(capture, sample));
+	if (first) {
+		printf("$dumpvars\n");
+	}
+	int i;
+	for (i = 0; i < capture->count; i++) {
+		uint8_t changed = first ? 0xff : pins[i] ^ capture->pins[i];
+		if (changed == 0) {
+			continue;
+		}
+		char id = '!' + i * 9;
+		printf("b");
+		int pin;
+		for (pin = 7; pin >= 0; pin--) {
+			printf("%d", (pins[i] >> pin) & 1);
+		}
+		printf(" %c\n", id);
+		for (pin = 0; pin < 8; pin++) {
+			if (changed & (1 << pin)) {
+				printf("%d%c\n", (pins[i] >> pin) & 1, id + 1 + pin);
+			}
+		}
+		capture->pins[i] = pins[i];
+	}
+	if (first) {
+		printf("$end\n");
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc > 2) {
+		usage(argv[0]);
+	}
+	FILE *input = stdin;
+	if (argc == 2) {
+		input = fopen(argv[1], "r");
+		if (!input) {
+			perror(argv[1]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	capture_t capture;
+	bool header = false;
+	bool end = false;
+	char line[256];
+	while (!end && fgets(line, sizeof(line), input)) {
+		trim(line);
+		// The header may follow the echoed command on the same line
+		const char *start = strstr(line, "capture ");
+		if (!header) {
+			if (start && parse_header(start, &capture)) {
+				write_header(&capture);
+				header = true;
+			}
+			continue;
+		}
+		uint16_t time;
+		uint8_t pins[PORTS_MAX];
+		unsigned long long samples;
+		if (parse_record(line, capture.count, &time, pins)) {
+			// A timestamp that does not increase means the 16 bit sample number wrapped
+			uint64_t sample = capture.started ? (capture.sample & ~0xffffULL) | time : time;
+			if (capture.started && sample <= capture.sample) {
+				sample += 0x10000;
+			}
+			write_record(&capture, sample, pins);
+		} else if (sscanf(line, "end %llu samples", &samples) == 1) {
+			if (strstr(line, "truncated")) {
+				fprintf(stderr, "Capture truncated after %llu samples, the controller could not stream the changes fast enough\n", samples);
+			}
+			printf("#%llu\n", (unsigned long long) nanoseconds(&capture, samples));
+			end = true;
+		}
+	}
+	if (input != stdin) {
+		fclose(input);
+	}
+	if (!header) {
+		fprintf(stderr, "No capture found\n");
+		return EXIT_FAILURE;
+	}
+	if (!end) {
+		fprintf(stderr, "Capture incomplete, the end line is missing\n");
+	}
+	return EXIT_SUCCESS;
+}